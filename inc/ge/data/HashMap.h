@@ -167,7 +167,7 @@ HashMap<K, V, H>::HashMap(size_t initialSize) :
     m_tableSize(initialSize),
     m_size(0)
 {
-    m_table = new TableVal*[initialSize];
+    m_table = new TableVal*[initialSize]();
 }
 
 template <typename K,
@@ -313,6 +313,9 @@ template <typename K,
           typename H>
 typename HashMap<K, V, H>::Iterator HashMap<K, V, H>::iterator()
 {
+    if (m_table == NULL)
+        return Iterator(this, 0, NULL);
+
     return Iterator(this, 0, m_table[0]);
 }
 
@@ -321,6 +324,9 @@ template <typename K,
           typename H>
 typename HashMap<K, V, H>::ConstIterator HashMap<K, V, H>::iterator() const
 {
+    if (m_table == NULL)
+        return ConstIterator(this, 0, NULL);
+
     return ConstIterator(this, 0, m_table[0]);
 }
 
@@ -367,6 +373,9 @@ template <typename K,
           typename H>
 typename HashMap<K, V, H>::Iterator HashMap<K, V, H>::get(const K& key)
 {
+    if (m_table == NULL)
+        return Iterator(this, m_tableSize, NULL);
+
     uint32 hashVal = m_hasher(key);
     size_t index = hashVal % m_tableSize;
 
@@ -379,6 +388,8 @@ typename HashMap<K, V, H>::Iterator HashMap<K, V, H>::get(const K& key)
         {
             return Iterator(this, index, tableVal);
         }
+
+        tableVal = tableVal->next;
     }
 
     return Iterator(this, m_tableSize, NULL);
@@ -389,6 +400,9 @@ template <typename K,
           typename H>
 typename HashMap<K, V, H>::ConstIterator HashMap<K, V, H>::get(const K& key) const
 {
+    if (m_table == NULL)
+        return ConstIterator(this, m_tableSize, NULL);
+
     uint32 hashVal = m_hasher(key);
     size_t index = hashVal % m_tableSize;
 
@@ -401,6 +415,8 @@ typename HashMap<K, V, H>::ConstIterator HashMap<K, V, H>::get(const K& key) con
         {
             return ConstIterator(this, index, tableVal);
         }
+
+        tableVal = tableVal->next;
     }
 
     return ConstIterator(this, m_tableSize, NULL);
@@ -428,6 +444,7 @@ void HashMap<K, V, H>::erase(Iterator& iter)
 
     // Delete and invalidate the iterator
     delete iter._tableVal;
+    m_size--;
 
     iter._tableIndex = 0;
     iter._tableVal = NULL;
@@ -480,6 +497,8 @@ void HashMap<K, V, H>::resize(size_t newTableSize)
         }
     }
 
+    delete[] m_table;
+
     m_table = newTable;
     m_tableSize = newTableSize;
 }
@@ -594,7 +613,7 @@ void HashMap<K, V, H>::ConstIterator::scrollToValid()
 
     // Start searching the table
     while (_tableVal == NULL &&
-           _tableIndex < _owner->m_tableSize)
+           _tableIndex + 1 < _owner->m_tableSize)
     {
         _tableIndex++;
         _tableVal = _owner->m_table[_tableIndex];
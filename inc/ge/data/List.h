@@ -80,6 +80,7 @@ public:
     void clear();
 
     T* data();
+    const T* data() const;
 
     T& get(size_t index);
     const T& get(size_t index) const;
@@ -240,7 +241,7 @@ List<T>& List<T>::operator=(List<T>&& other)
 template<typename T>
 void List<T>::clear()
 {
-    CppUtil::destroy(_start, _iter);
+    cleanupBuffer(_start, _iter);
     _start = NULL;
     _end = NULL;
     _iter = NULL;
@@ -252,6 +253,12 @@ T* List<T>::data()
     return _start;
 }
 
+template<typename T>
+const T* List<T>::data() const
+{
+    return _start;
+}
+
 template<typename T>
 T& List<T>::get(size_t index)
 {
@@ -326,6 +333,7 @@ template<typename T>
 void List<T>::remove(size_t index)
 {
     std::rotate(_start + index, _start + index + 1, _iter);
+    _iter--;
     CppUtil::destroy(_iter);
 }
 
@@ -465,10 +473,11 @@ void List<T>::resize(size_t newSize, T fillValue)
         }
 
         T* cleanIter = _iter;
+        T* newIter = _start + newSize;
 
         try
         {
-            while (cleanIter != _end)
+            while (cleanIter != newIter)
             {
                 CppUtil::copyConstruct(cleanIter, fillValue);
                 cleanIter++;
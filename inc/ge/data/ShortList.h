@@ -84,7 +84,7 @@ ShortList<T, ShortCount>::ShortList(const ShortList& other) : List<T>()
 
     try
     {
-        std::uninitialized_copy(other._start, other._end, List<T>::_start);
+        std::uninitialized_copy(other._start, other._iter, List<T>::_start);
     }
     catch (...)
     {
@@ -92,7 +92,7 @@ ShortList<T, ShortCount>::ShortList(const ShortList& other) : List<T>()
         throw;
     }
 
-    List<T>::_iter = List<T>::_start;
+    List<T>::_iter = List<T>::_start + other.size();
 }
 
 template<typename T, int ShortCount>
@@ -112,7 +112,9 @@ ShortList<T, ShortCount>::ShortList(const List<T>& other) : List<T>()
 
     try
     {
-        std::uninitialized_copy(other._start, other._end, List<T>::_start);
+        std::uninitialized_copy(other.data(),
+                                other.data() + other.size(),
+                                List<T>::_start);
     }
     catch (...)
     {
@@ -120,7 +122,7 @@ ShortList<T, ShortCount>::ShortList(const List<T>& other) : List<T>()
         throw;
     }
 
-    List<T>::_iter = List<T>::_start;
+    List<T>::_iter = List<T>::_start + other.size();
 }
 
 template<typename T, int ShortCount>
@@ -130,6 +132,7 @@ ShortList<T, ShortCount>::~ShortList()
 
     // Defend against base class cleanup
     List<T>::_start = NULL;
+    List<T>::_iter = NULL;
     List<T>::_end = NULL;
 }
 
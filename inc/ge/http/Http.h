@@ -3,6 +3,9 @@
 #ifndef HTTP_H
 #define HTTP_H
 
+#include <ge/common.h>
+#include <ge/aio/AioFile.h>
+
 // HTTP version enum
 enum HttpProt_enum
 {
@@ -21,6 +24,40 @@ enum HttpMethod_enum
     HTTP_TRACE
 };
 
+// Request headers resolved when a request is parsed. HttpSession gives
+// constant time access to these.
+enum HttpHeader_enum
+{
+    HTTP_HEADER_HOST,
+    HTTP_HEADER_CONNECTION,
+    HTTP_HEADER_CONTENT_LENGTH,
+    HTTP_HEADER_TRANSFER_ENCODING,
+    HTTP_HEADER_ACCEPT_ENCODING,
+    HTTP_HEADER_RANGE,
+    HTTP_HEADER_IF_NONE_MATCH,
+    HTTP_HEADER_IF_MODIFIED_SINCE,
+    HTTP_HEADER_IF_RANGE,
+    HTTP_HEADER_EXPECT,
+    HTTP_HEADER_COUNT,
+    HTTP_HEADER_UNKNOWN = HTTP_HEADER_COUNT
+};
+
+// Where a request handler is run
+enum HttpDispatch_enum
+{
+    HTTP_DISPATCH_POOL,     // On the server's ThreadPool, if it has one
+    HTTP_DISPATCH_INLINE    // On the IO thread that read the request. Only
+                            // for handlers that never block.
+};
+
+// Result of parsing a Range header against a file
+enum HttpRange_enum
+{
+    HTTP_RANGE_IGNORED,         // Send the whole file
+    HTTP_RANGE_SATISFIABLE,     // Send the parsed range
+    HTTP_RANGE_UNSATISFIABLE    // Respond 416
+};
+
 // TODO: Move below to private header
 
 // Maximum line length, including URL line. This affects session size.
@@ -29,26 +66,185 @@ enum HttpMethod_enum
 // Maximum number of request header lines. Sanity check.
 #define HTTP_MAX_REQUEST_HEADERS 256
 
+// Maximum total size of the header lines of a request
+#define HTTP_MAX_HEADER_BYTES (1024*64)
+
+// Header bytes and headers stored in a session before it allocates
+#define HTTP_SHORT_HEADER_BYTES 1024
+#define HTTP_SHORT_HEADERS 16
+
+// Bytes of headers added to a response stored in a session before it
+// allocates
+#define HTTP_SHORT_RESPONSE_HEADER_BYTES 512
+
+// Content up to this length is copied in after the response head, so the
+// whole response is written from a single block
+#define HTTP_INLINE_CONTENT_LEN 1024
+
+// Maximum size of a request body sent with chunked encoding. The body is
+// collected in memory as it arrives.
+#define HTTP_MAX_CHUNKED_BODY (1024*1024*16)
+
+// Size of the buffer a streamed request body is read into. The handler
+// receives the body in blocks of at most this size.
+#define HTTP_BODY_CHUNK_LEN (1024*64)
+
+// Freed sessions and write entries a connection keeps for its later
+// requests. Any more are kept by the freeing thread without locking, which
+// exchanges them with the server shard HTTP_THREAD_SPARE_BATCH at a time.
+// The shard keeps up to the HTTP_SERVER_SPARE limits.
+#define HTTP_CONNECTION_SPARE_SESSIONS 2
+#define HTTP_CONNECTION_SPARE_ENTRIES 16
+#define HTTP_THREAD_SPARE_BATCH 32
+#define HTTP_SERVER_SPARE_SESSIONS 1024
+#define HTTP_SERVER_SPARE_ENTRIES 4096
+
+// Line buffers of idle connections kept by each server shard for the
+// connections that next receive data. Threads hold up to two batches of
+// HTTP_THREAD_SPARE_BATCH more each.
+#define HTTP_SERVER_SPARE_BUFFERS 1024
+
+// Maximum number of parameters captured by a route pattern
+#define HTTP_MAX_ROUTE_PARAMS 8
+
+// Fields and bytes of escaped text an HttpForm holds before allocating
+#define HTTP_SHORT_FORM_FIELDS 16
+#define HTTP_SHORT_FORM_BYTES 256
+
+// Maximum number of pipelined requests awaiting a response per connection.
+// Reading from the connection pauses once reached.
+#define HTTP_MAX_PIPELINE 32
+
+// Maximum number of queued write entries handed to the socket in a single
+// gathering write.
+#define HTTP_MAX_WRITE_BUFFERS 32
+
+// Maximum length of file content sent by a single write entry
+#define HTTP_MAX_SENDFILE_LEN (1024*1024*1024)
+
 // Session state enum
 enum SessionState_enum
 {
     READING_FIRST_LINE,
     READING_HEADERS,
     READING_BODY,
+    READING_CHUNK_SIZE,
+    READING_CHUNK_DATA,
+    READING_CHUNK_END,
+    READING_TRAILERS,
     RESPONDING,
 };
 
+// State of a request body streamed to the handler
+enum BodyState_enum
+{
+    BODY_WAITING,      // Handler holds a block or hasn't asked for the body
+    BODY_READING,      // Reading the next block
+    BODY_DELIVERING,   // Body callback is running
+    BODY_RELEASED,     // Block released while the body callback was running
+    BODY_DONE          // Body read to the end or abandoned
+};
+
 /*
- * Entry allocated for pending write data
+ * Entry allocated for pending write data. If file is set, dataLen bytes of
+ * the file starting at fileOffset are sent instead of data.
  */
 class WriteEntry
 {
 public:
+    WriteEntry() :
+        next(NULL),
+        data(NULL),
+        dataLen(0),
+        freeData(false),
+        file(NULL),
+        fileOffset(0),
+        freeFile(false)
+    {
+    }
+
+    ~WriteEntry()
+    {
+        if (freeData)
+            delete[] data;
+
+        if (freeFile)
+            delete file;
+    }
+
     WriteEntry* next;
 
     char*   data;
     size_t  dataLen;
     bool    freeData;
+
+    AioFile* file;
+    uint64   fileOffset;
+    bool     freeFile;
+};
+
+/*
+ * Free list of the memory of freed sessions or write entries, kept to be
+ * reused for new ones.
+ */
+class SpareList
+{
+public:
+    SpareList() :
+        head(NULL),
+        count(0)
+    {
+    }
+
+    ~SpareList()
+    {
+        while (head != NULL)
+            ::operator delete(take());
+    }
+
+    void* take()
+    {
+        Block* block = head;
+
+        if (block != NULL)
+        {
+            head = block->next;
+            count--;
+        }
+
+        return block;
+    }
+
+    void add(void* memory)
+    {
+        Block* block = (Block*)memory;
+
+        block->next = head;
+        head = block;
+        count++;
+    }
+
+    class Block
+    {
+    public:
+        Block* next;
+    };
+
+    Block* head;
+    uint32 count;
+};
+
+/*
+ * A request header. The name and value are offsets into the header bytes
+ * of the session, as those may move while the request is being read.
+ */
+class HttpHeader
+{
+public:
+    uint32 nameStart;
+    uint32 nameLen;
+    uint32 valueStart;
+    uint32 valueLen;
 };
 
 #endif // HTTP_H
@@ -0,0 +1,118 @@
+// HttpConnection.h
+
+#ifndef HTTP_CONNECTION_H
+#define HTTP_CONNECTION_H
+
+#include <ge/aio/AioSocket.h>
+#include <ge/aio/SocketService.h>
+#include <ge/http/Http.h>
+#include <ge/thread/Mutex.h>
+
+class HttpConnection;
+class HttpServer;
+class HttpSession;
+
+/*
+ * Part of a HttpServer running on one SocketService. A shard accepts its
+ * own connections and keeps the spares they pass back when idle, so
+ * connections never touch another shard's state. Shards of one server
+ * listen on the same port with SO_REUSEPORT, leaving the kernel to spread
+ * connections between them.
+ */
+class HttpShard
+{
+    friend class HttpServer;
+    friend class HttpConnection;
+
+private:
+    HttpShard(HttpServer* httpServer,
+              SocketService* socketService);
+    ~HttpShard();
+
+    HttpShard(const HttpShard& other) DELETED;
+    HttpShard& operator=(const HttpShard& other) DELETED;
+
+    HttpServer* _httpServer;
+    SocketService* _socketService;
+    AioSocket _acceptSockIpv4;
+    AioSocket _acceptSockIpv6;
+    HttpConnection* _pendingConnectionIpv4;
+    HttpConnection* _pendingConnectionIpv6;
+
+    // Spares passed on by connections, and by threads in batches. Guarded
+    // by _spareLock.
+    Mutex _spareLock;
+    SpareList _spareSessions;
+    SpareList _spareEntries;
+    SpareList _spareBuffers;
+};
+
+/*
+ * A client connection to a HttpServer. Requests are parsed from the
+ * connection one after the other and each is given its own HttpSession.
+ *
+ * Requests are parsed and dispatched while the handlers of earlier ones are
+ * still running, so a client may pipeline requests. The sessions awaiting a
+ * response are kept in request order. Only data of the session at the head
+ * of that queue is written, later sessions buffer their response until all
+ * earlier ones have been completed.
+ */
+class HttpConnection
+{
+    friend class HttpServer;
+    friend class HttpSession;
+    friend class HttpShard;
+
+private:
+    HttpConnection(HttpShard* shard);
+    ~HttpConnection();
+
+    HttpConnection(const HttpConnection& other) DELETED;
+    HttpConnection& operator=(const HttpConnection& other) DELETED;
+
+    HttpShard* _shard;
+    SocketService* _socketService;
+    HttpServer* _httpServer;
+    AioSocket _socket;
+
+    // Request being parsed and line reading state. Only touched by the
+    // thread reading the connection.
+    HttpSession* reading;
+
+    // HTTP_MAX_LINE bytes taken from the server once data arrives. NULL
+    // while the connection waits for its next request.
+    char*  lineBuffer;
+    size_t lineBufferIndex;
+    size_t lineBufferFilled;
+    size_t lineColon;        // First ':' in the line, HTTP_MAX_LINE if none
+
+    bool readIntoBody;       // Pending read targets the request body
+
+    // Guards all of the variables beneath here as they get touched by
+    // multiple threads.
+    Mutex lock;
+
+    bool readActive;         // Reading or parsing requests
+    bool readPaused;         // Too many requests awaiting a response
+    bool writeActive;
+    bool closeAfterWrites;   // A response ended the connection
+    bool isClosing;          // Socket is finished, free once idle
+
+    WriteEntry* writeListHead;  // Data handed to the socket, in order
+    WriteEntry* writeListTail;
+
+    // Buffers of the write in progress, the first writeBufferCount entries
+    // of the write list
+    SocketService::WriteBuffer writeBuffers[HTTP_MAX_WRITE_BUFFERS];
+    uint32 writeBufferCount;
+
+    HttpSession* responseHead;  // Dispatched requests, in request order
+    HttpSession* responseTail;
+    uint32       responseCount;
+
+    // Memory of freed sessions and write entries, reused by later requests
+    SpareList spareSessions;
+    SpareList spareEntries;
+};
+
+#endif // HTTP_CONNECTION_H
@@ -0,0 +1,82 @@
+// HttpForm.h
+
+#ifndef HTTP_FORM_H
+#define HTTP_FORM_H
+
+#include <ge/data/ShortList.h>
+#include <ge/http/Http.h>
+#include <ge/text/StringRef.h>
+
+/*
+ * Fields of URL encoded text, as sent in a query string or an
+ * application/x-www-form-urlencoded request body ("a=1&b=x+y").
+ *
+ * The names and values are spans of the parsed text rather than copies.
+ * A vectorized scan finds the fields holding a '%' or '+', and only those
+ * are unescaped, in place. A field without a '=' has an empty value.
+ */
+class HttpForm
+{
+public:
+    HttpForm();
+
+    /*! \brief Parses URL encoded text. The fields refer to the text, so
+     *         it must outlive them, unless it holds escapes. Then it's
+     *         copied into the form once to be unescaped.
+     *
+     * \param  data     Text to parse
+     * \return False if the text holds an invalid escape
+     */
+    bool parse(const StringRef& data);
+
+    /*! \brief Parses URL encoded text, unescaping it in place. The fields
+     *         refer to the text, so it must outlive them.
+     *
+     * \param  data     Text to parse, overwritten by the unescaped fields
+     * \param  dataLen  Length of data
+     * \return False if the text holds an invalid escape
+     */
+    bool parseInPlace(char* data,
+                      size_t dataLen);
+
+    /* Removes all fields */
+    void clear();
+
+    /* Returns the number of fields */
+    size_t size() const;
+
+    /* Returns the name of the field at index */
+    StringRef getName(size_t index) const;
+
+    /* Returns the value of the field at index */
+    StringRef getValue(size_t index) const;
+
+    /* Returns the value of the first field with the passed name, or an
+       empty string if there is none */
+    StringRef get(const StringRef& name) const;
+
+    /* Returns if a field has the passed name */
+    bool has(const StringRef& name) const;
+
+private:
+    HttpForm(const HttpForm& other) DELETED;
+    HttpForm& operator=(const HttpForm& other) DELETED;
+
+    bool parseFields(char* data,
+                     char* end,
+                     const char* nextEscape);
+
+    class Field
+    {
+    public:
+        StringRef name;
+        StringRef value;
+    };
+
+    ShortList<Field, HTTP_SHORT_FORM_FIELDS> _fields;
+
+    // Copy of escaped text passed to parse()
+    ShortList<char, HTTP_SHORT_FORM_BYTES> _buffer;
+};
+
+#endif // HTTP_FORM_H
@@ -0,0 +1,96 @@
+// HttpRouter.h
+
+#ifndef HTTP_ROUTER_H
+#define HTTP_ROUTER_H
+
+#include <ge/data/List.h>
+#include <ge/http/Http.h>
+#include <ge/text/String.h>
+#include <ge/text/StringRef.h>
+
+class HttpServer;
+class HttpSession;
+
+/*
+ * Finds the handler of a request path among a set of route patterns.
+ *
+ * A pattern is a path made of the following segments:
+ *
+ * /users         Static text, matched exactly
+ * /:id           Parameter, matching one non-empty path segment
+ * *path          Wildcard, following a '/' and matching the rest of the
+ *                path, including any further '/'. Must end the pattern.
+ *
+ * The patterns are compiled into a radix tree with the static text shared
+ * by patterns stored once. Static text is preferred over a parameter, and
+ * a parameter over a wildcard, backing off to the next choice if the rest
+ * of the path doesn't match. Matching walks the path in place and captures
+ * parameters as spans of it, so it never allocates.
+ */
+class HttpRouter
+{
+public:
+    // Same as HttpServer::httpHandler_func
+    typedef void (*httpHandler_func)(HttpServer&  server,
+                                     HttpSession& session);
+
+    /*
+     * Handler registered for a pattern.
+     */
+    class Route
+    {
+    public:
+        httpHandler_func handler;
+        HttpDispatch_enum dispatch;
+        List<String> paramNames;    // Parameters in the order captured
+    };
+
+    HttpRouter();
+    ~HttpRouter();
+
+    /*! \brief Adds a route. Throws a SystemException if the pattern is
+     *         invalid, has more than HTTP_MAX_ROUTE_PARAMS parameters or
+     *         was already added.
+     *
+     * \param pattern         Path pattern ("/users/:id")
+     * \param handler         Handler function for the requests
+     * \param dispatch        Where the handler is run
+     */
+    void addRoute(const StringRef& pattern,
+                  httpHandler_func handler,
+                  HttpDispatch_enum dispatch);
+
+    /*! \brief Finds the route matching a path.
+     *
+     * \param path            Request path, without the query string
+     * \param paramValues     Receives the captured parameters, in the order
+     *                        of the route's paramNames. Must hold
+     *                        HTTP_MAX_ROUTE_PARAMS entries.
+     * \return The matching route, or NULL if there is none
+     */
+    const Route* findRoute(const StringRef& path,
+                           StringRef* paramValues) const;
+
+private:
+    HttpRouter(const HttpRouter& other) DELETED;
+    HttpRouter& operator=(const HttpRouter& other) DELETED;
+
+    class Node;
+
+    static
+    Node* addStatic(Node* node,
+                    StringRef text);
+
+    static
+    const Route* matchNode(const Node* node,
+                           const char* path,
+                           size_t pos,
+                           size_t pathLen,
+                           StringRef* paramValues,
+                           uint32 paramCount);
+
+    Node* _root;
+    List<Route*> _routes;
+};
+
+#endif // HTTP_ROUTER_H
@@ -0,0 +1,50 @@
+// HttpScan.h
+
+#ifndef HTTP_SCAN_H
+#define HTTP_SCAN_H
+
+#include <ge/common.h>
+
+/*
+ * Tokenizing of HTTP request lines and URL encoded text. Uses SSE2 or AVX2 to look at 16 or 32
+ * bytes at a time where the CPU supports it.
+ */
+namespace HttpScan
+{
+    /*! \brief Scans for the end of a line and the first colon on it.
+     *
+     * A line ends at a '\n'. Control characters other than '\r' and '\t'
+     * are invalid in a request line, as are bytes outside of ASCII.
+     *
+     * \param  str     Start of the data to scan
+     * \param  end     End of the data to scan
+     * \param  colon   Receives the first ':' before the returned position,
+     *                 or NULL if there is none
+     * \return Pointer to the '\n' or invalid byte, or end if neither found
+     */
+    const char* scanLine(const char* str,
+                         const char* end,
+                         const char** colon);
+
+    /*! \brief Scans for the start of an escape in URL encoded text, a
+     *         '%' or a '+'.
+     *
+     * \param  str     Start of the data to scan
+     * \param  end     End of the data to scan
+     * \return Pointer to the '%' or '+', or end if neither found
+     */
+    const char* scanEscape(const char* str,
+                           const char* end);
+
+    /*! \brief Returns if the passed byte ends a scan by scanLine().
+     */
+    static inline
+    bool isLineStop(char c)
+    {
+        return (signed char)c < 0x20 &&
+               c != '\r' &&
+               c != '\t';
+    }
+};
+
+#endif // HTTP_SCAN_H
@@ -3,13 +3,20 @@
 #ifndef HTTP_SERVER_H
 #define HTTP_SERVER_H
 
+#include <ge/Error.h>
 #include <ge/aio/AioSocket.h>
 #include <ge/aio/SocketService.h>
 #include <ge/data/List.h>
 #include <ge/http/Http.h>
+#include <ge/http/HttpConnection.h>
+#include <ge/http/HttpRouter.h>
 #include <ge/http/HttpSession.h>
+#include <ge/text/String.h>
 #include <ge/text/StringRef.h>
+#include <ge/thread/Mutex.h>
+#include <ge/thread/ThreadPool.h>
 
+class HttpConnection;
 class HttpSession;
 
 /*
@@ -20,12 +27,15 @@ class HttpSession;
  * GET/POST/PUT
  * Basic header parsing
  * Automatic 100 Continue responses
- *
- * Does not support:
- *
+ * Persistent connections
+ * Pipelined requests
  * Chunked requests
  * Chunked responses
- * Persistant connection
+ * Static files with range and conditional requests
+ * Request bodies streamed to the handler as they arrive
+ * Handlers run on a ThreadPool, or inline on the IO thread, per route
+ * Routes with path parameters and wildcards
+ * Sharding over several SocketServices with SO_REUSEPORT
  */
 class HttpServer
 {
@@ -52,6 +62,25 @@ public:
                       uint32 port,
                       httpHandler_func handler);
 
+    /*! \brief Starts serving HTTP requests on several SocketServices.
+     *         Each service gets its own listening sockets, bound to the
+     *         port with SO_REUSEPORT, and the kernel spreads new
+     *         connections between them. A connection stays on the service
+     *         that accepted it, and services share no locks or memory
+     *         pools. Scales best with one service per processor, each
+     *         running one thread bound to its processor. Not supported on
+     *         Windows.
+     *
+     * \param socketServices  SocketServices to run on
+     * \param serviceCount    Number of socketServices
+     * \param port            Port to accept traffic on
+     * \param handler         Handler function for HTTP requests
+     */
+    void startServing(SocketService** socketServices,
+                      uint32 serviceCount,
+                      uint32 port,
+                      httpHandler_func handler);
+
     /*! \brief Shuts down an existing HTTP daemon. This will close the
      *         socket being used to accept connections and cause any thread
      *         blocking on bnetHttpd_BeginAccepting to unblock. The server
@@ -59,13 +88,59 @@ public:
      */
     void shutdown();
 
+    /*! \brief Sets if request bodies are passed to the handler as they
+     *         arrive, rather than collected in memory first. With streaming
+     *         enabled, the handler is called once the headers are read and
+     *         reads the body with HttpSession::readBody(). Disabled by
+     *         default.
+     *
+     * \param enabled         If request bodies are streamed
+     */
+    void setBodyStreaming(bool enabled);
+
+    /*! \brief Sets the ThreadPool that runs handlers dispatched with
+     *         HTTP_DISPATCH_POOL. Without one, all handlers run on the IO
+     *         thread that read the request. Must be set before serving,
+     *         and outlive the server.
+     *
+     * \param threadPool      ThreadPool to run handlers on
+     */
+    void setThreadPool(ThreadPool* threadPool);
+
+    /*! \brief Adds a handler for the URLs whose path matches a pattern.
+     *         The handler passed to startServing() handles the URLs no
+     *         route matches. Routes must be added before serving.
+     *
+     * Patterns are described by HttpRouter: "/users/:id" matches
+     * "/users/12", and "/static/" followed by the wildcard "*file" matches
+     * every path under "/static/". The handler gets the captured parameters with
+     * HttpSession::getParam(). Paths are matched as sent, before
+     * unescaping, and without the query string.
+     *
+     * \param pattern         Path pattern of the handled URLs
+     * \param handler         Handler function for the requests
+     * \param dispatch        Where the handler is run
+     */
+    void addRoute(const StringRef& pattern,
+                  httpHandler_func handler,
+                  HttpDispatch_enum dispatch);
+
 private:
     HttpServer(const HttpServer& other) DELETED;
     HttpServer& operator=(const HttpServer& other) DELETED;
 
-    static 
-    StringRef headerMatchExtract(const StringRef headerLine,
-                                 const StringRef expectedKey);
+    static
+    void trimHeader(const char* headerData,
+                    HttpHeader* header);
+
+    static
+    bool addHeaderLine(HttpSession*    session,
+                       const StringRef line,
+                       size_t          colon);
+
+    static
+    bool headerHasToken(const StringRef value,
+                        const StringRef token);
 
     static
     void parseFirstRequestLine(const StringRef line,
@@ -81,30 +156,130 @@ private:
                       char*           data,
                       size_t          dataLen,
                       bool            freeData,
+                      bool            lastData,
+                      bool            flush);
+
+    static
+    void addWriteFile(HttpSession*    session,
+                      AioFile*        file,
+                      uint64          pos,
+                      uint64          len,
                       bool            lastData);
 
     static
-    StringRef tryReadLine(HttpSession* session,
-                          size_t       bytesRead,
-                          bool*        lineCompleted,
-                          bool*        invalid);
+    void addWriteEntry(HttpSession*    session,
+                       WriteEntry*     entry,
+                       bool            lastData,
+                       bool            flush);
+
+    static
+    HttpSession* newSession(HttpConnection* connection);
+
+    static
+    void freeSession(HttpConnection* connection,
+                     HttpSession*    session);
+
+    static
+    WriteEntry* newWriteEntry(HttpConnection* connection);
+
+    static
+    void freeWriteEntry(HttpConnection* connection,
+                        WriteEntry*     entry);
+
+    static
+    void attachLineBuffer(HttpConnection* connection);
+
+    static
+    void releaseLineBuffer(HttpConnection* connection);
+
+    static
+    void releaseSpares(HttpConnection* connection);
 
     static
-    void flushLine(HttpSession* session);
+    void queueWrite(HttpConnection* connection,
+                    WriteEntry*     entry);
+
+    static
+    void startWrite(HttpConnection* connection);
+
+    static
+    bool advanceResponses(HttpConnection* connection,
+                          bool*           resumeRead);
+
+    static
+    StringRef tryReadLine(HttpConnection* connection,
+                          size_t          bytesRead,
+                          bool*           lineCompleted,
+                          bool*           invalid);
+
+    static
+    void flushLine(HttpConnection* connection);
 
     static
     void responseHeadersToBuffer(HttpSession* session,
                                  char*        dest);
 
     static
-    void sendRequestFailure(HttpSession* session,
-                            StringRef    message);
+    void sendRequestFailure(HttpConnection* connection,
+                            HttpSession*    session,
+                            StringRef       message);
+
+    static
+    bool readHandler(HttpConnection* connection,
+                     HttpSession*    session,
+                     const char**    failure);
+
+    static
+    bool readChunkLine(HttpConnection* connection,
+                       HttpSession*    session,
+                       const char**    failure);
+
+    static
+    void readBodyData(HttpConnection* connection,
+                      HttpSession*    session,
+                      bool*           bodyEnd,
+                      const char**    failure);
+
+    static
+    bool streamBody(HttpConnection* connection,
+                    HttpSession*    session);
+
+    static
+    void endStreamedBody(HttpConnection* connection,
+                         HttpSession*    session);
+
+    static
+    void abandonBody(HttpConnection* connection,
+                     HttpSession*    session,
+                     const Error&    error,
+                     bool            closeNow);
 
     static
-    bool readHandler(HttpSession* session,
-                     AioSocket* aioSocket,
-                     uint32 bytesTransfered);
-    
+    void sendContinue(HttpConnection* connection,
+                      HttpSession*    session);
+
+    static
+    void processInput(HttpConnection* connection);
+
+    static
+    void dispatchRequest(HttpServer*  httpServer,
+                         HttpSession* session);
+
+    static
+    void startRead(HttpConnection* connection);
+
+    static
+    void closeConnection(HttpConnection* connection);
+
+    static
+    void markClosing(HttpConnection* connection);
+
+    static
+    bool canDestroyConnection(HttpConnection* connection);
+
+    static
+    void destroyConnection(HttpConnection* connection);
+
     static
     void acceptCallback(AioSocket* aioSocket,
                         AioSocket* acceptedSocket,
@@ -117,6 +292,12 @@ private:
                       uint32 bytesTransfered,
                       const Error& error);
 
+    static
+    void readyCallback(AioSocket* aioSocket,
+                       void* userData,
+                       uint32 bytesTransfered,
+                       const Error& error);
+
     static
     void writeCallback(AioSocket* aioSocket,
                        void* userData,
@@ -124,12 +305,11 @@ private:
                        const Error& error);
 
 
-    SocketService* _socketService;
-    httpHandler_func _handler;
-    AioSocket _acceptSockIpv4;
-    AioSocket _acceptSockIpv6;
-    HttpSession* _pendingSessionIpv4;
-    HttpSession* _pendingSessionIpv6;
+    ThreadPool* _threadPool;
+    HttpRouter::Route _defaultRoute;
+    HttpRouter _router;
+    List<HttpShard*> _shards;
+    bool _streamBodies;
 };
 
 #endif // HTTP_SERVER_H
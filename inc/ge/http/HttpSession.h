@@ -3,29 +3,52 @@
 #ifndef HTTP_SERVER_REQUEST_H
 #define HTTP_SERVER_REQUEST_H
 
+#include <ge/Error.h>
+#include <ge/aio/AioFile.h>
 #include <ge/aio/AioSocket.h>
+#include <ge/aio/FileService.h>
 #include <ge/aio/SocketService.h>
 #include <ge/data/List.h>
+#include <ge/data/ShortList.h>
 #include <ge/http/Http.h>
+#include <ge/http/HttpConnection.h>
+#include <ge/http/HttpForm.h>
 #include <ge/http/HttpServer.h>
 #include <ge/text/StringRef.h>
-#include <ge/thread/Mutex.h>
 
 class HttpServer;
 
 /*
  * Logical representation of a request sent to a HttpServer. A handler
- * function can use this to examine and respond to a request.
+ * function can use this to examine and respond to a request. The session
+ * must not be used once the response has been completed, and may be
+ * responded to from any thread.
  */
 class HttpSession
 {
     friend class HttpServer;
+    friend class HttpConnection;
 
 private:
-    HttpSession();
+    HttpSession(HttpConnection* connection);
 public:
     ~HttpSession();
 
+    // Function receiving the blocks of a streamed request body. The end of
+    // the body is indicated by a call with dataLen of 0. If error is set,
+    // the body couldn't be read to the end.
+    typedef void (*bodyCallback_func)(HttpSession& session,
+                                      void* userData,
+                                      const char* data,
+                                      size_t dataLen,
+                                      const Error& error);
+
+    // Function called once spoolBody() has written the body to a file
+    typedef void (*spoolCallback_func)(HttpSession& session,
+                                       void* userData,
+                                       uint64 bytesWritten,
+                                       const Error& error);
+
     HttpSession(HttpSession&& other);
     HttpSession& operator=(HttpSession&& other);
 
@@ -37,19 +60,107 @@ public:
     /* Returns the request URL */
     const StringRef getUrl();
 
-    /* Returns the raw header lines of the request */
-    const List<String>& getHeaderLines();
+    /* Returns the path of the request URL, up to any query string */
+    StringRef getPath();
+
+    /* Returns the query string of the request URL, without the '?', or an
+       empty string if it has none */
+    StringRef getQueryString();
+
+    /* Parses the query string into form. Returns false if it holds an
+       invalid escape. */
+    bool parseQuery(HttpForm& form);
+
+    /* Returns the value of a header resolved when the request was parsed,
+       or an empty string if the client didn't send it */
+    StringRef getHeader(HttpHeader_enum header);
+
+    /* Returns the value of the first header with the passed name, or an
+       empty string if the client didn't send it. Names are matched
+       case-insensitively. */
+    StringRef getHeader(const StringRef& name);
+
+    /* Returns the number of headers of the request */
+    size_t getHeaderCount();
+
+    /* Returns the name of the header at index */
+    StringRef getHeaderName(size_t index);
+
+    /* Returns the value of the header at index */
+    StringRef getHeaderValue(size_t index);
+
+    /* Returns the value of the parameter of the matching route with the
+       passed name, or an empty string if it has none */
+    StringRef getParam(const StringRef& name);
+
+    /* Returns the number of parameters captured by the matching route */
+    size_t getParamCount();
+
+    /* Returns the name of the route parameter at index */
+    StringRef getParamName(size_t index);
+
+    /* Returns the value of the route parameter at index */
+    StringRef getParamValue(size_t index);
 
-    /* Returns the request body */
+    /* Returns the request body. Empty if the body is streamed. */
     const char* getBody();
 
-    /* Returns the request body length */
+    /* Returns the request body length. For a streamed body, the
+       Content-Length, or 0 with chunked encoding. */
     size_t getBodyLength();
 
+    /* Returns if the body must be read with readBody() or spoolBody() */
+    bool isBodyStreamed();
+
+    /* Parses an application/x-www-form-urlencoded body into form. The body
+       is unescaped in place, so getBody() holds the form's fields
+       afterwards. Returns false if the body is streamed or holds an
+       invalid escape. */
+    bool parseBody(HttpForm& form);
+
+    // Streamed body functions
+
+    /*! \brief Starts reading a streamed request body. The callback receives
+     *         each block as it's read. No more of the body is read until
+     *         the block is released with releaseBody(), which may be done
+     *         from any thread and from within the callback.
+     *
+     * Should be called before responding, as a 100 Continue can't be sent
+     * once the response has started. If the response is completed before
+     * the whole body has been read, the rest of the body is skipped and the
+     * connection closes after the response.
+     *
+     * \param  callback        Function receiving the body
+     * \param  userData        Passed to the callback
+     */
+    void readBody(bodyCallback_func callback,
+                  void* userData);
+
+    /*! \brief Releases the last block passed to the body callback, and
+     *         lets the next one be read.
+     */
+    void releaseBody();
+
+    /*! \brief Writes a streamed request body to a file as it's read,
+     *         without ever holding more than one block of it in memory.
+     *
+     * \param  fileService     FileService to write the file with
+     * \param  file            File to write to
+     * \param  pos             Offset in the file to write the body at
+     * \param  callback        Called once the body is written or fails
+     * \param  userData        Passed to the callback
+     */
+    void spoolBody(FileService* fileService,
+                   AioFile* file,
+                   uint64 pos,
+                   spoolCallback_func callback,
+                   void* userData);
+
     // Response functions
 
     /*! \brief Should be used by http_handler_func callbacks to respond to HTTP
-    *          requests with a full and complete response.
+    *          requests with a full and complete response. The response must
+    *          be framed with a Content-Length if the connection persists.
     *
     * \param  data            Buffer containing a complete HTTP response
     * \param  dataLen         Length of data (the full length, not just content)
@@ -61,13 +172,19 @@ public:
                     size_t      dataLen,
                     bool        freeData);
 
-    /*! \brief Should be used by http_handler_func callbacks to set values in 
-     *         the header of a response. If this is never called, you will get
-     *         default values.
+    /*! \brief Should be used by http_handler_func callbacks to set values in
+     *         the header of a response. Must be called before respond() or
+     *         beginResponse(), which send the headers set so far.
      *
-     * The following fields should not be set as they will be set automatically:
+     * The following fields are set automatically, and are ignored if set
+     * here:
      * Date
      * Content-Length
+     * Transfer-Encoding
+     * Connection - except that "close" ends the connection after the
+     *              response
+     *
+     * Headers whose name or value hold a CR or LF are ignored.
      *
      * \param  headerKey       Name of the header value ("Content-Type")
      * \param  headerValue     Value for the header field
@@ -76,7 +193,11 @@ public:
                            const StringRef& headerValue);
 
     /*! \brief Should be used by http_handler_func callbacks to respond to HTTP
-     *         requests. Currently, a full and complete response is required.
+     *         requests. Date, Content-Length and Connection headers are
+     *         added automatically, ahead of those set with
+     *         setResponseHeader(). Short content is copied in after the
+     *         head, so the response goes out as one block.
+     *         Currently, a full and complete response is required.
      *         Eventually, we will probably move toward having a separate
      *         response object eventually so that chunked or compressed
      *         responses can be supported transparently.
@@ -92,41 +213,140 @@ public:
                  size_t           dataLen,
                  bool             freeData);
 
+    /*! \brief Starts a response whose content is streamed with
+     *         writeChunk(). Used instead of respond() when the content
+     *         isn't known up front. HTTP/1.1 clients receive the content
+     *         with chunked encoding, for HTTP/1.0 clients the connection is
+     *         closed to end it.
+     *
+     * \param  header          Header text ("200 OK", "404 Not Found", etc)
+     */
+    void beginResponse(const StringRef& header);
+
+    /*! \brief Sends the next block of a response started with
+     *         beginResponse(). Empty blocks are ignored.
+     *
+     * \param  data            Buffer containing response content
+     * \param  dataLen         Length of data
+     * \param  freeData        Set if data should be freed after it's no
+     *                         longer needed
+     */
+    void writeChunk(const char* data,
+                    size_t      dataLen,
+                    bool        freeData);
+
+    /*! \brief Completes a response started with beginResponse(). The
+     *         session must not be used afterwards.
+     */
+    void endResponse();
+
+    /*! \brief Responds with the content of a file. The content is sent
+     *         with sendfile() where supported, so it's never copied into
+     *         memory. Answers conditional requests with "304 Not Modified",
+     *         and single byte ranges with "206 Partial Content". Responds
+     *         with "404 Not Found" if the file can't be opened.
+     *
+     * \param  fileName        Path of the file to send
+     */
+    void respondFile(const StringRef& fileName);
+
+    /*! \brief Responds with the file the request URL names under a root
+     *         directory, as with respondFile(). URLs ending in '/' are
+     *         given the directory's index.html. URLs that would escape the
+     *         root directory get "404 Not Found".
+     *
+     * \param  rootDir         Directory files are served from
+     */
+    void respondStatic(const StringRef& rootDir);
+
 private:
     HttpSession(const HttpSession& other) DELETED;
     HttpSession& operator=(const HttpSession& other) DELETED;
 
-    void reset();
+    void addResponseHeader(const StringRef& name,
+                           const StringRef& value);
+    char* buildHead(const StringRef& header,
+                    bool hasLength,
+                    uint64 contentLen,
+                    size_t reserveLen,
+                    size_t* headLen);
+
+    static
+    void spoolBodyCallback(HttpSession& session,
+                           void* userData,
+                           const char* data,
+                           size_t dataLen,
+                           const Error& error);
 
-    SocketService* _socketService;
+    static
+    void spoolWriteCallback(AioFile* aioFile,
+                            void* userData,
+                            uint32 bytesTransfered,
+                            const Error& error);
+
+    HttpConnection* _connection;
     HttpServer* _httpServer;
-    AioSocket _socket;
 
     SessionState_enum state;
 
     HttpProt_enum httpProt;
     HttpMethod_enum method;
+    bool keepAlive;          // Connection persists after the response
+    bool expectContinue;     // Client sent "Expect: 100-continue"
     String url;
-    List<String> headerLines;
+
+    // Header lines are copied one after the other into headerData. Until
+    // the headers are parsed, a header's value runs to the end of its line.
+    ShortList<char, HTTP_SHORT_HEADER_BYTES> headerData;
+    ShortList<HttpHeader, HTTP_SHORT_HEADERS> headers;
+    StringRef knownHeaders[HTTP_HEADER_COUNT];
+
+    // Route handling the request, and the parameters it captured from url
+    const HttpRouter::Route* route;
+    StringRef routeParams[HTTP_MAX_ROUTE_PARAMS];
 
     char*  content;
     uint32 contentLen;
     uint32 contentIndex;
 
-    // Line reading state
-    char   lineBuffer[HTTP_MAX_LINE];
-    size_t lineBufferIndex;
-    size_t lineBufferFilled;
+    // Chunked request body state. content holds contentReserved bytes and
+    // grows as chunks arrive.
+    bool   chunkedRequest;
+    uint32 chunkRemaining;
+    uint32 contentReserved;
 
-    // Guards all of the variables beneath here as they get touched by
-    // multiple threads.
-    Mutex lock;
+    // Streamed body state. content is a buffer of contentReserved bytes
+    // holding the block passed to the handler, contentIndex bytes long.
+    // bodyState is guarded by the connection lock.
+    bool   streamBody;
+    BodyState_enum bodyState;
+    uint64 bodyDelivered;    // Bytes passed to the handler so far
+    bodyCallback_func bodyCallback;
+    void*  bodyUserData;
 
-    bool writeActive;
+    // spoolBody() state
+    FileService* spoolService;
+    AioFile*     spoolFile;
+    uint64       spoolPos;
+    uint64       spoolWritten;
+    const char*  spoolData;
+    uint32       spoolDataLen;
+    uint32       spoolDataIndex;
+    spoolCallback_func spoolCallback;
+    void*        spoolUserData;
 
+    bool chunkedResponse;    // Response content is sent in chunks
+
+    // "Name: value\r\n" lines to send after the automatic headers
+    ShortList<char, HTTP_SHORT_RESPONSE_HEADER_BYTES> responseHeaders;
+
+    // Guarded by the connection lock. Response data is kept here until
+    // the responses to all earlier requests have been completed.
     WriteEntry* writeListHead;
     WriteEntry* writeListTail;
     bool        writesComplete; // If all writes have been submitted
+
+    HttpSession* next;       // Next request on the connection
 };
 
 #endif // HTTP_SERVER_SESSION_H
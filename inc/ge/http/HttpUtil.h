@@ -3,6 +3,7 @@
 #ifndef HTTP_UTIL_H
 #define HTTP_UTIL_H
 
+#include <ge/http/Http.h>
 #include <ge/text/String.h>
 #include <ge/text/StringRef.h>
 #include <ge/util/Date.h>
@@ -34,7 +35,9 @@ namespace HttpUtil
 
     /*! \brief Unescapes a URL string in place. A string can only get
      * shorter. Returns true on success. Returns false on failure, but
-     * guarentees nothing about the state of the passed string.
+     * guarentees nothing about the state of the passed string. The string
+     * needn't be null terminated, and isn't terminated afterwards. Text
+     * without escapes is found with a vectorized scan and left in place.
      *
      * \param str    String to unescape
      * \param size   Input and output of string before and after unescaping.
@@ -52,7 +55,7 @@ namespace HttpUtil
      * Sun Nov  6 08:49:37 1994       ; ANSI C's asctime() format
      *
      * This function will always output the first, as it has a four digit
-     * year.
+     * year. The time is given in GMT.
      *
      * \param time The time to convert to text
      * \return Timestamp String
@@ -76,6 +79,66 @@ namespace HttpUtil
      */
     void formatTimestamp(Date date,
                          char* dest);
+
+    /*! \brief Writes the current time as formatTimestamp() does. The text
+     *         is formatted at most once a second and shared by all
+     *         threads without locking.
+     *
+     * \param dest    Buffer of at least 30 bytes to receive the timestamp
+     */
+    void formatCurrentTimestamp(char* dest);
+
+    /*! \brief Gives the pre-rendered status line of a standard response.
+     *
+     * \param httpProt   Protocol version of the response
+     * \param status     Status code and reason ("200 OK")
+     * \return The line ("HTTP/1.1 200 OK\r\n"), or an empty string if the
+     *         status isn't a standard one
+     */
+    StringRef getStatusLine(HttpProt_enum httpProt,
+                            const StringRef& status);
+
+    /*! \brief Finds which of the headers resolved by HttpSession the
+     *         passed header name is. Names are matched case-insensitively.
+     *
+     * \param name   Header name ("Content-Length")
+     * \return The matching header, or HTTP_HEADER_UNKNOWN
+     */
+    HttpHeader_enum lookupHeader(const StringRef& name);
+
+    /*! \brief Gives the Content-Type of a file from its extension.
+     *
+     * \param  fileName   Name or path of the file
+     * \return The content type, "application/octet-stream" if unknown
+     */
+    StringRef getMimeType(const StringRef& fileName);
+
+    /*! \brief Parses the hex size at the start of a chunk size line of a
+     *         chunked body. Chunk extensions following the size are
+     *         ignored.
+     *
+     * \param line       The line, without its CRLF
+     * \param chunkLen   Set to the chunk size, 0 for the last chunk
+     * \return False if the line doesn't start with a valid size
+     */
+    bool parseChunkSize(const StringRef& line,
+                        uint32*          chunkLen);
+
+    /*! \brief Parses a Range header against a file. Only a single byte
+     *         range is supported. Headers with multiple ranges or other
+     *         units are ignored, so the whole file is sent.
+     *
+     * \param value     Value of the Range header ("bytes=0-499")
+     * \param fileLen   Length of the file
+     * \param start     Set to the first byte of the range
+     * \param end       Set to the last byte of the range, clamped to the
+     *                  end of the file
+     * \return Whether the range can be served, or is to be ignored
+     */
+    HttpRange_enum parseRange(const StringRef& value,
+                              uint64           fileLen,
+                              uint64*          start,
+                              uint64*          end);
 };
 
 #endif // HTTP_UTIL_H
@@ -16,4 +16,8 @@ enum OpenMode_Enum
 #define IO_WRITE_ACCESS 2
 #define IO_RW_ACCESS 3
 
+// Bypass the OS file cache where supported. Buffers, offsets and lengths
+// must then be aligned to the device block size.
+#define IO_DIRECT_ACCESS 4
+
 #endif // IO_H
@@ -16,6 +16,7 @@ public:
     String(const StringRef&& strRef);
     String(const char* cstr);
     String(const char* data, size_t dataLen);
+    ~String();
 
     String& operator=(const String& str);
     String& operator=(String&& str);
@@ -79,6 +80,9 @@ public:
 private:
     void append_raw(const char* data, size_t dataLen);
     void append_cstr(const char* cstr, size_t cstrLen);
+    void init(const char* data, size_t dataLen);
+    void assign(const char* data, size_t dataLen);
+    void steal(String& str);
 
 	size_t reserved;
     size_t len;
@@ -15,6 +15,12 @@ namespace CurrentThread
      */
     void setName(const StringRef name);
 
+    /*
+     * Binds the current thread to run only on the given processor, counted
+     * from 0. Ignored where unsupported or if there is no such processor.
+     */
+    void setProcessor(uint32 processor);
+
     /*
      * Yields the CPU to some other thread.
      */
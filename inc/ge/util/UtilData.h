@@ -17,6 +17,9 @@ namespace UtilData
     // The one's digit of numbers from 0-99
     extern char g_digitOnes[100];
 
+    // Digit characters for radixes up to 16
+    extern char g_digitChars[16];
+
     // The numeric value of the given byte, or -1 if not a numeric type.
     extern int8 g_charValue[256];
 
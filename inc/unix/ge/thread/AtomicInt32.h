@@ -21,6 +21,20 @@ public:
         _value(val)
     {}
 
+    // Loads made before get() complete before the value is read, and
+    // stores made before a set() are seen by loads made after the get()
+    // that reads the value.
+    int32 get()
+    {
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        return __atomic_load_n(&_value, __ATOMIC_ACQUIRE);
+    }
+
+    void set(int32 val)
+    {
+        __atomic_store_n(&_value, val, __ATOMIC_RELEASE);
+    }
+
     int32 inc()
     {
         return __sync_add_and_fetch(&_value, 1);
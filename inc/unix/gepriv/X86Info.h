@@ -41,6 +41,9 @@
 #if defined(__AVX__)
 #define SUPPORTS_AVX
 #endif
+#if defined(__AVX2__)
+#define SUPPORTS_AVX2
+#endif
 #if defined(__AES__)
 #define SUPPORTS_AES
 #endif
@@ -162,6 +165,16 @@ namespace X86Info
 #endif
     }
 
+    static inline
+    bool hasAVX2()
+    {
+#if defined(__AVX2__)
+        return true;
+#else
+        return false;
+#endif
+    }
+
     static inline
     bool hasAES()
     {
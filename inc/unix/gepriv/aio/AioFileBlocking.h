@@ -9,9 +9,13 @@
 #include <ge/Error.h>
 #include <ge/io/IO.h>
 #include <ge/text/StringRef.h>
+#include <ge/util/Date.h>
 #include <gepriv/aio/FileServiceBlocking.h>
 
+struct stat;
+
 class FileService;
+class SocketService;
 
 /*
  * Represents a file opened for asynchronous IO.
@@ -19,6 +23,7 @@ class FileService;
 class AioFile
 {
     friend class FileService;
+    friend class SocketService;
 
 public:
     AioFile();
@@ -27,10 +32,16 @@ public:
     void open(StringRef fileName, OpenMode_Enum mode, int permissions);
     void close();
 
+    uint64 getFileLength();
+    Date getLastModified();
+    bool isDirectory();
+
 private:
     AioFile(const AioFile& other) DELETED;
     AioFile& operator=(const AioFile& other) DELETED;
 
+    void statFile(struct stat* fileStat, const char* context);
+
     int _fd;
     FileService* _owner;
 };
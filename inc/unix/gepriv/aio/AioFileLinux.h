@@ -10,8 +10,14 @@
 #include <ge/aio/FileService.h>
 #include <ge/io/IO.h>
 #include <ge/text/StringRef.h>
+#include <ge/util/Date.h>
+
+struct stat;
 
 class FileService;
+class FileServiceUring;
+class SocketService;
+class SocketServiceUring;
 
 /*
  * Represents a file opened for asynchronous IO.
@@ -19,6 +25,9 @@ class FileService;
 class AioFile
 {
     friend class FileService;
+    friend class FileServiceUring;
+    friend class SocketService;
+    friend class SocketServiceUring;
 
 public:
     AioFile();
@@ -27,10 +36,16 @@ public:
     void open(StringRef fileName, OpenMode_Enum mode, int permissions);
     void close();
 
+    uint64 getFileLength();
+    Date getLastModified();
+    bool isDirectory();
+
 private:
     AioFile(const AioFile& other) DELETED;
     AioFile& operator=(const AioFile& other) DELETED;
 
+    void statFile(struct stat* fileStat, const char* context);
+
     int _fd;
     FileService* _owner;
 };
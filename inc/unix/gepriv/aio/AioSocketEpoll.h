@@ -11,12 +11,14 @@
 #include <gepriv/aio/SocketServiceEpoll.h>
 
 class SocketService;
+class SocketServiceUring;
 
 // TODO: Need access to source and dest address
 
 class AioSocket
 {
     friend class SocketService;
+    friend class SocketServiceUring;
 
 public:
     AioSocket();
@@ -28,12 +30,17 @@ public:
 
     void init(INetProt_Enum family);
     void close();
+    void shutdown();
 
     void listen();
     void listen(int32 backlog);
 
     void bind(const INetAddress& address, int32 port);
 
+    // Lets other sockets bind the same port, with the kernel spreading
+    // new connections between them. Must be called before bind().
+    void setReusePort();
+
 private:
     AioSocket(const AioSocket& other) DELETED;
     AioSocket& operator=(const AioSocket& other) DELETED;
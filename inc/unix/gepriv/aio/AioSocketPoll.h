@@ -28,12 +28,17 @@ public:
 
     void init(INetProt_Enum family);
     void close();
+    void shutdown();
 
     void listen();
     void listen(int32 backlog);
 
     void bind(const INetAddress& address, int32 port);
 
+    // Lets other sockets bind the same port, with the kernel spreading
+    // new connections between them. Must be called before bind().
+    void setReusePort();
+
 private:
     AioSocket(const AioSocket& other) DELETED;
     AioSocket& operator=(const AioSocket& other) DELETED;
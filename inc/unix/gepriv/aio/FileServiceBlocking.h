@@ -30,6 +30,8 @@ public:
     FileService();
     ~FileService();
 
+    void registerBuffer(char* buffer, uint32 bufferLen);
+
     void startServing(uint32 desiredThreads);
     void shutdown();
 
@@ -47,6 +49,13 @@ public:
                    const char* buffer,
                    uint32 bufferLen);
 
+    void fileWriteSync(AioFile* aioFile,
+                       FileService::fileCallback callback,
+                       void* userData,
+                       uint64 pos,
+                       const char* buffer,
+                       uint32 bufferLen);
+
 private:
     FileService(const FileService&) DELETED;
     FileService& operator=(const FileService&) DELETED;
@@ -69,6 +78,7 @@ private:
     public:
         AioFile* aioFile;
         bool isRead;
+        bool isSync;
         FileService::fileCallback callback;
         void* userData;
         uint64 pos;
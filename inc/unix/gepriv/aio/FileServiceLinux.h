@@ -5,43 +5,158 @@
 
 #ifdef __linux__
 
-#include <ge/aio/AioServer.h>
-#include <gepriv/aio/FileService.h>
+#include <ge/Error.h>
+#include <ge/data/List.h>
+#include <ge/thread/Condition.h>
+#include <ge/thread/Thread.h>
+#include <gepriv/aio/AioFileLinux.h>
+
+#include <linux/aio_abi.h>
+#include <sys/uio.h>
+
+class AioFile;
+class FileServiceUring;
 
 /*
- * FileService implementation that uses Linux file aio.
+ * FileService implementation for Linux. Uses io_uring (FileServiceUring)
+ * when the kernel supports it, otherwise Linux native aio (io_submit).
+ *
+ * With native aio, operations submitted while another thread is in
+ * io_submit are collected and passed to the kernel together in one call.
+ * Completions are signaled through an eventfd, reaped in batches with
+ * io_getevents by a dedicated thread, and the callbacks run on the worker
+ * threads. The kernel only performs IO asynchronously for files opened
+ * with IO_DIRECT_ACCESS. Buffered files are still handled correctly, but
+ * io_submit may block the submitting thread.
+ *
+ * fileWriteSync() completes once the written data is on stable storage, as
+ * if the write was followed by fdatasync(). Buffers passed to
+ * registerBuffer() before startServing() are pinned by the kernel once
+ * rather than per operation when io_uring is in use.
  */
-class FileServiceLinuxAio : public FileService
+class FileService
 {
 public:
-    FileServiceLinuxAio(AioServer aioServer);
-    ~FileServiceLinuxAio();
+    friend class AioFile;
+    friend class AioWorker;
+    friend class ReapWorker;
+    friend class FileServiceUring;
+
+    typedef void (*fileCallback)(AioFile* aioFile,
+                                 void* userData,
+                                 uint32 bytesTransfered,
+                                 const Error& error);
+
+    FileService();
+    ~FileService();
+
+    void registerBuffer(char* buffer, uint32 bufferLen);
+
+    void startServing(uint32 desiredThreads);
+    void shutdown();
+
+    void fileRead(AioFile* aioFile,
+                  FileService::fileCallback callback,
+                  void* userData,
+                  uint64 pos,
+                  char* buffer,
+                  uint32 bufferLen);
+
+    void fileWrite(AioFile* aioFile,
+                   FileService::fileCallback callback,
+                   void* userData,
+                   uint64 pos,
+                   const char* buffer,
+                   uint32 bufferLen);
+
+    void fileWriteSync(AioFile* aioFile,
+                       FileService::fileCallback callback,
+                       void* userData,
+                       uint64 pos,
+                       const char* buffer,
+                       uint32 bufferLen);
 
-    void process() OVERRIDE;
+private:
+    FileService(const FileService&) DELETED;
+    FileService& operator=(const FileService&) DELETED;
+
+    class AioWorker : public Thread
+    {
+    public:
+        AioWorker(FileService* fileService);
+        void run() OVERRIDE;
+
+    private:
+        FileService* _fileService;
+    };
+
+    class ReapWorker : public Thread
+    {
+    public:
+        ReapWorker(FileService* fileService);
+        void run() OVERRIDE;
+
+    private:
+        FileService* _fileService;
+    };
 
-    void shutdown() OVERRIDE;
+    /*
+     * An operation given to the kernel. Kept on the intrusive in flight list
+     * so dropFile() can find the operations of a closed file, then on the
+     * completed queue until a worker runs its callback.
+     */
+    class OperData
+    {
+    public:
+        iocb cb;
+        AioFile* aioFile;
+        FileService::fileCallback callback;
+        void* userData;
+        bool isRead;
+        bool isSync;
+        int64 result;
 
-    void submitRead(AioFile* aioFile,
-                    AioServer::fileCallback callback,
-                    void* userData,
-                    uint64 pos,
-                    char* buffer,
-                    uint32 bufferLen) OVERRIDE;
+        OperData* next;
+        OperData* prev;
+    };
 
     void submitWrite(AioFile* aioFile,
-                     AioServer::fileCallback callback,
+                     FileService::fileCallback callback,
                      void* userData,
                      uint64 pos,
                      const char* buffer,
-                     uint32 bufferLen) OVERRIDE;
+                     uint32 bufferLen,
+                     bool isSync);
 
-private:
-    FileServiceLinuxAio(const FileServiceLinuxAio&) DELETED;
-    FileServiceLinuxAio& operator=(const FileServiceLinuxAio&) DELETED;
+    void submitOper(OperData* operData);
+    void submitPending();
+    void completeOper(OperData* operData, int64 result);
+
+    void linkOper(OperData* operData);
+    void unlinkOper(OperData* operData);
+
+    void dropFile(AioFile* aioFile);
+
+    bool process();
+    bool reap();
 
-    AioServer _aioServer;
+    FileServiceUring* _uring;      // io_uring engine, NULL if unsupported
+    List<iovec> _buffers;          // Buffers passed to registerBuffer()
+    aio_context_t _aioContext;     // Kernel aio context
+    int _eventFd;                  // Signaled by the kernel on completion
+    Condition _cond;               // Condition guarding data
+    bool _isStarted;               // Indicates if started
+    bool _isShutdown;              // Indicates if shutdown
+    bool _isSubmitting;            // Set while a thread is in io_submit
+    bool _submitBlocked;           // Kernel queue was full on last submit
+    List<AioWorker*> _threads;     // List of threads created
+    ReapWorker _reapWorker;        // Thread calling io_getevents
+    List<OperData*> _pending;      // Operations waiting for io_submit
+    OperData* _inFlightHead;       // Operations the kernel owns
+    OperData* _completedHead;      // Operations awaiting callbacks
+    OperData* _completedTail;
 };
 
-#endif // #ifdef __linux__
+#endif // __linux__
 
 #endif // FILE_SERVICE_LINUX_H
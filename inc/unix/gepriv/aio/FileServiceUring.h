@@ -0,0 +1,155 @@
+// FileServiceUring.h
+
+#ifndef FILE_SERVICE_URING_H
+#define FILE_SERVICE_URING_H
+
+#ifdef __linux__
+
+#include <ge/Error.h>
+#include <ge/data/HashMap.h>
+#include <ge/data/List.h>
+#include <ge/thread/Condition.h>
+#include <ge/thread/Thread.h>
+#include <gepriv/aio/FileServiceLinux.h>
+#include <gepriv/aio/IoUring.h>
+
+#include <sys/uio.h>
+
+class AioFile;
+
+/*
+ * FileService engine that uses io_uring. Selected at runtime by the Linux
+ * FileService when the kernel supports it, otherwise native aio is used.
+ *
+ * Submission entries are filled in by the calling thread. Entries added
+ * while another thread is in io_uring_enter are passed to the kernel by
+ * that thread when it returns, so concurrent operations share one call.
+ *
+ * Files are added to the ring's fixed file table on first use and buffers
+ * passed to FileService::registerBuffer() are registered with the kernel,
+ * which saves a file lookup and a page pinning per operation. Callbacks
+ * are run on the ring thread as completions are reaped.
+ */
+class FileServiceUring
+{
+public:
+    friend class RingWorker;
+
+    FileServiceUring(FileService* owner);
+    ~FileServiceUring();
+
+    static bool isSupported();
+
+    void startServing(const List<iovec>& buffers);
+    void shutdown();
+
+    void fileRead(AioFile* aioFile,
+                  FileService::fileCallback callback,
+                  void* userData,
+                  uint64 pos,
+                  char* buffer,
+                  uint32 bufferLen);
+
+    void fileWrite(AioFile* aioFile,
+                   FileService::fileCallback callback,
+                   void* userData,
+                   uint64 pos,
+                   const char* buffer,
+                   uint32 bufferLen,
+                   bool isSync);
+
+    void dropFile(AioFile* aioFile);
+
+private:
+    FileServiceUring(const FileServiceUring&) DELETED;
+    FileServiceUring& operator=(const FileServiceUring&) DELETED;
+
+    class RingWorker : public Thread
+    {
+    public:
+        RingWorker(FileServiceUring* fileService);
+        void run() OVERRIDE;
+
+    private:
+        FileServiceUring* _fileService;
+    };
+
+    /*
+     * A file known to the ring. Outlives the AioFile until every operation
+     * referencing it has completed, so its fixed file slot (or duplicated
+     * fd when fixed files are unavailable) can't be reused while the kernel
+     * may still resolve it.
+     */
+    class FileData
+    {
+    public:
+        int fd;
+        int32 slot;
+        uint32 refCount;
+        bool isDropped;
+    };
+
+    class OperData
+    {
+    public:
+        AioFile* aioFile;
+        FileData* fileData;
+        FileService::fileCallback callback;
+        void* userData;
+        bool isRead;
+        bool isSync;
+        uint64 pos;
+        char* buffer;
+        uint32 bufferLen;
+
+        // Completions still expected from the kernel. A synced write is a
+        // write linked to an fdatasync and produces two.
+        uint32 cqeCount;
+        int32 result;
+        int32 syncResult;
+
+        OperData* next;
+        OperData* prev;
+    };
+
+    void submitOper(OperData* operData);
+    bool prepOper(OperData* operData);
+    void prepPending();
+    void submitPending();
+
+    FileData* getFileData(AioFile* aioFile);
+    void releaseFile(FileData* fileData);
+    int32 findBuffer(const char* buffer, uint32 bufferLen);
+
+    void handleCqe(const io_uring_cqe* cqe);
+    void runCallback(OperData* operData, AioFile* aioFile);
+
+    void linkOper(OperData* operData);
+    void unlinkOper(OperData* operData);
+
+    bool process();
+
+    FileService* _owner;
+
+    IoUring _ring;
+    bool _fixedFiles;
+    List<int32> _freeSlots;
+    List<iovec> _buffers;
+
+    Condition _cond;
+
+    RingWorker _ringWorker;
+
+    bool _isStarted;
+    bool _isShutdown;
+    bool _isSubmitting;
+    bool _submitBlocked;
+    HashMap<int, FileData*> _fileMap;
+    List<OperData*> _pending;
+    OperData* _inFlightHead;
+    List<OperData*> _completions;
+};
+
+#endif // __linux__
+
+#endif // FILE_SERVICE_URING_H
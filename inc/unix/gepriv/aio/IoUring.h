@@ -0,0 +1,81 @@
+// IoUring.h
+
+#ifndef IO_URING_H
+#define IO_URING_H
+
+#ifdef __linux__
+
+#include <ge/common.h>
+
+#include <linux/io_uring.h>
+#include <sys/uio.h>
+
+/*
+ * Thin wrapper around the io_uring system calls and the shared submission
+ * and completion rings.
+ *
+ * Not thread safe. The owner is expected to serialize access to the
+ * submission side and the completion side. enter() is the exception, it
+ * may be called concurrently with getSqe() and with other enter() calls.
+ */
+class IoUring
+{
+public:
+    IoUring();
+    ~IoUring();
+
+    static bool isSupported(const uint8* requiredOps, uint32 opCount);
+
+    void init(uint32 entries);
+    void close();
+
+    bool isOpen() const;
+
+    io_uring_sqe* getSqe();
+    uint32 sqSpace() const;
+    uint32 unsubmitted() const;
+
+    int submit(uint32 waitCount);
+    void flushSq();
+    int enter(uint32 waitCount);
+
+    io_uring_cqe* peekCqe();
+    void cqeSeen();
+
+    int registerFiles(const int* fds, uint32 count);
+    int updateFiles(uint32 offset, const int* fds, uint32 count);
+    int registerBuffers(const iovec* iovecs, uint32 count);
+
+private:
+    IoUring(const IoUring&) DELETED;
+    IoUring& operator=(const IoUring&) DELETED;
+
+    int _ringFd;
+
+    // Submission ring
+    void* _sqRing;
+    size_t _sqRingSize;
+    uint32* _sqHead;
+    uint32* _sqTail;
+    uint32* _sqMask;
+    uint32* _sqEntries;
+    uint32* _sqArray;
+    io_uring_sqe* _sqes;
+    size_t _sqesSize;
+
+    // Tail including entries handed out by getSqe() but not yet published
+    uint32 _sqeTail;
+
+    // Completion ring. Shares the submission mapping when the kernel
+    // supports IORING_FEAT_SINGLE_MMAP.
+    void* _cqRing;
+    size_t _cqRingSize;
+    uint32* _cqHead;
+    uint32* _cqTail;
+    uint32* _cqMask;
+    io_uring_cqe* _cqes;
+};
+
+#endif // __linux__
+
+#endif // IO_URING_H
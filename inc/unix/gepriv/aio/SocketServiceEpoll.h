@@ -1,78 +1,306 @@
 // SocketServiceEpoll.h
 
-#ifdef __linux__
-
 #ifndef SOCKET_SERVICE_EPOLL_H
 #define SOCKET_SERVICE_EPOLL_H
 
-#include <ge/aio/AioServer.h>
-#include <gepriv/aio/SocketServiceEpoll.h>
+#ifdef __linux__
+
+#include <ge/Error.h>
+#include <ge/data/HashMap.h>
+#include <ge/data/List.h>
+#include <ge/inet/INetAddress.h>
+#include <ge/thread/AtomicInt32.h>
+#include <ge/thread/Condition.h>
+#include <ge/thread/Mutex.h>
+#include <ge/thread/Thread.h>
+#include <gepriv/aio/AioSocketEpoll.h>
 
+class AioFile;
+class AioSocket;
+class SocketServiceUring;
 
 /*
- * SocketService implementation that uses the epoll() system calls.
+ * SocketService implementation that uses the Linux epoll() system calls.
+ *
+ * If the kernel supports io_uring, startServing() hands all operations to a
+ * SocketServiceUring instead and the epoll threads are never started. Its
+ * ring thread passes completions to desiredThreads workers, so callbacks
+ * run on the same kind of threads either way. io_uring always uses a
+ * single ring, whatever the reactor count.
+ *
+ * A socket is registered edge-triggered for both input and output the first
+ * time an operation is submitted on it, and stays registered until it is
+ * closed. The poll thread only records readiness and queues the sockets that
+ * have a pending operation, so the cost of a wakeup scales with the number of
+ * ready sockets rather than the number of open ones.
+ *
+ * socketWriteV() gathers several buffers into each sendmsg() call. The
+ * array of buffers must stay valid until the callback runs, unless it
+ * holds a single buffer.
+ *
+ * socketWaitReadable() completes with no bytes once data or the end of the
+ * stream can be read, so a caller may wait on many idle sockets without
+ * holding a buffer for each.
+ *
+ * With epoll, the sockets can be split between several reactors, each an
+ * epoll instance and poll thread with its own lock and worker threads. A
+ * socket is given to a reactor by its fd on its first operation and stays
+ * with it until closed, so operations on sockets of different reactors
+ * share no lock. With inline completion, the poll thread is the only one.
  */
-class SocketServiceEpoll : public SocketService
+class SocketService
 {
 public:
-    SocketServiceEpoll(AioServer* aioServer);
-    ~SocketServiceEpoll();
+    friend class AioSocket;
+    friend class AioWorker;
+    friend class Reactor;
+
+    typedef void (*socketCallback)(AioSocket* aioSocket,
+                                   void* userData,
+                                   uint32 bytesTransfered,
+                                   const Error& error);
+    typedef void (*acceptCallback)(AioSocket* aioSocket,
+                                   AioSocket* acceptedSocket,
+                                   void* userData,
+                                   const Error& error);
+    typedef void (*connectCallback)(AioSocket* aioSocket,
+                                    void* userData,
+                                    const Error& error);
 
     /*
-     * Calls read(), write() on ready sockets and triggers callbacks.
+     * A block of data for socketWriteV().
      */
-    void process() OVERRIDE;
+    class WriteBuffer
+    {
+    public:
+        const char* data;
+        uint32 dataLen;
+    };
 
-    void shutdown() OVERRIDE;
+    SocketService();
+    ~SocketService();
 
-    void submitClose(AioSocket* aioSocket,
-                     AioServer::connectCallback callback,
-                     void* userData) OVERRIDE;
+    void startServing(uint32 desiredThreads);
 
-    void submitAccept(AioSocket* listenSocket,
-                      AioSocket* acceptSocket,
-                      AioServer::acceptCallback callback,
-                      void* userData) OVERRIDE;
+    // Starts serving with every thread of the service bound to one
+    // processor, so a service per processor never migrates between them
+    void startServing(uint32 desiredThreads,
+                      uint32 processor);
 
-    void submitConnect(AioSocket* aioSocket,
-                       AioServer::connectCallback callback,
-                       void* userData,
-                       const INetAddress& address,
-                       int32 port) OVERRIDE;
+    // Sets the number of threads waiting on socket events, 1 by default.
+    // Must be called before startServing().
+    void setReactorCount(uint32 reactorCount);
+
+    // Performs operations and runs their callbacks on the poll threads
+    // instead of handing them to workers, saving a thread switch per
+    // operation. With io_uring, callbacks run on the ring thread. Callbacks
+    // must not block, and desiredThreads is unused. Must be called before
+    // startServing().
+    void setInlineCompletion(bool inlineCompletion);
+    void shutdown();
 
-    void submitConnect(AioSocket* aioSocket,
-                       AioServer::connectCallback callback,
+    void socketAccept(AioSocket* listenSocket,
+                      AioSocket* acceptSocket,
+                      SocketService::acceptCallback callback,
+                      void* userData);
+
+    void socketConnect(AioSocket* aioSocket,
+                       SocketService::connectCallback callback,
                        void* userData,
                        const INetAddress& address,
-                       int32 port,
-                       int32 timeout) OVERRIDE;
+                       int32 port);
 
     void socketRead(AioSocket* aioSocket,
-                    AioServer::socketCallback callback,
+                    SocketService::socketCallback callback,
                     void* userData,
                     char* buffer,
-                    uint32 bufferLen) OVERRIDE;
+                    uint32 bufferLen);
+
+    void socketWaitReadable(AioSocket* aioSocket,
+                            SocketService::socketCallback callback,
+                            void* userData);
 
     void socketWrite(AioSocket* aioSocket,
-                     AioServer::socketCallback callback,
+                     SocketService::socketCallback callback,
                      void* userData,
                      const char* buffer,
-                     uint32 bufferLen) OVERRIDE;
+                     uint32 bufferLen);
+
+    void socketWriteV(AioSocket* aioSocket,
+                      SocketService::socketCallback callback,
+                      void* userData,
+                      const WriteBuffer* buffers,
+                      uint32 bufferCount);
 
     void socketSendFile(AioSocket* aioSocket,
-                        AioServer::socketCallback callback,
+                        SocketService::socketCallback callback,
                         void* userData,
                         AioFile* aioFile,
                         uint64 pos,
-                        uint32 writeLen) OVERRIDE;
+                        uint32 writeLen);
 
 private:
-    SocketServiceEpoll(const SocketServiceEpoll&) DELETED;
-    SocketServiceEpoll& operator=(const SocketServiceEpoll&) DELETED;
+    SocketService(const SocketService&) DELETED;
+    SocketService& operator=(const SocketService&) DELETED;
+
+    class Reactor;
+    class SockData;
+
+    class AioWorker : public Thread
+    {
+    public:
+        AioWorker(Reactor* reactor);
+        void run() OVERRIDE;
+
+        Reactor* reactor;
+    };
+
+    class QueueEntry
+    {
+    public:
+        bool isRead;
+        bool isQueued;
+        SockData* data;
+        QueueEntry* next;
+        QueueEntry* prev;
+    };
+
+    class SockData
+    {
+    public:
+        QueueEntry readQueueEntry;
+        QueueEntry writeQueueEntry;
+
+        AioSocket* aioSocket;
+        int fd;
+        Reactor* reactor;
+
+        // Set when epoll reports an edge, cleared when a worker takes the
+        // side to perform a system call. As the fd is edge-triggered, an
+        // operation may only wait on epoll after a call reported EAGAIN.
+        bool readReady;
+        bool writeReady;
+
+        // Set while a worker is performing a system call on the given side
+        bool readActive;
+        bool writeActive;
+
+        // Set once the socket is closed. The data is freed by the poll
+        // thread of its reactor once no worker or pending epoll event can
+        // reference it.
+        bool isDropped;
+
+        // Read data
+        uint32 readOper;
+        AioSocket* acceptSocket;
+        void* readCallback;
+        void* readUserData;
+        char* readBuffer;
+        uint32 readBufferPos;
+        uint32 readBufferLen;
+
+        // Write data
+        uint32 writeOper;
+        void* writeCallback;
+        void* writeUserData;
+        const WriteBuffer* writeBuffers;
+        uint32 writeBufferCount;
+        uint32 writeBufferIndex;   // Buffer being sent
+        uint32 writeBufferOffset;  // Bytes of that buffer already sent
+        uint32 writeBufferPos;     // Total bytes sent
+        uint32 writeBufferLen;     // Total bytes to send
+        WriteBuffer writeSingle;   // Holds the buffer of a single write
 
-    AioServer* _aioServer;
+        INetAddress connectAddress;
+        int32 connectPort;
+        bool connectStarted;
+
+        int sendFileFd;
+        uint64 sendFileOffset;
+        uint64 sendFileEnd;
+
+        SockData();
+    };
+
+    /*
+     * Epoll instance and poll thread serving a share of the sockets, with
+     * the workers that perform their operations.
+     */
+    class Reactor : public Thread
+    {
+    public:
+        Reactor(SocketService* socketService);
+        ~Reactor();
+
+        void run() OVERRIDE;
+
+        SocketService* socketService;
+        int epollFd;
+        int wakeupFd;
+
+        List<AioWorker*> workers;
+
+        // Guards the data of the reactor's sockets and the variables
+        // beneath here
+        Condition cond;
+        bool isShutdown;
+
+        // Set with inline completion while the poll thread may block in
+        // epoll_wait(). A thread queuing an entry that clears it writes to
+        // the wakeup fd.
+        bool isPolling;
+
+        HashMap<int, SockData*> dataMap;
+        List<SockData*> droppedList;
+        QueueEntry* readyQueueHead;
+        QueueEntry* readyQueueTail;
+    };
+
+    void emptyWakeFd(Reactor* reactor);
+    void wakeup(Reactor* reactor);
+
+    Reactor* getReactor(AioSocket* aioSocket);
+    SockData* getSockData(Reactor* reactor,
+                          AioSocket* aioSocket,
+                          const char* context);
+    void dropSocket(AioSocket* aioSocket);
+    void freeDropped(Reactor* reactor);
+
+    void setWriteBuffers(SockData* sockData,
+                         const WriteBuffer* buffers,
+                         uint32 bufferCount);
+
+    bool process(AioWorker* worker);
+    void performOper(QueueEntry* queueEntry);
+    void runQueued(Reactor* reactor);
+    bool poll(Reactor* reactor);
+
+    void enqueData(QueueEntry* queueEntry);
+    void dequeData(QueueEntry* queueEntry);
+
+    bool doAccept(SockData* sockData, Error* error);
+    bool doConnect(SockData* sockData, Error* error);
+    bool doRecv(SockData* sockData, Error* error);
+    bool doWaitRead(SockData* sockData, Error* error);
+    bool doSend(SockData* sockData, Error* error);
+    bool doSendfile(SockData* sockData, Error* error);
+
+
+    SocketServiceUring* _uring;
+
+    // Guards the started and shutdown states
+    Mutex _lock;
+
+    List<Reactor*> _reactors;
+    uint32 _reactorCount;
+
+    int32 _processor;        // Processor the threads run on, -1 if any
+    bool _inlineCompletion;
+    bool _isStarted;
+    bool _isShutdown;
+    AtomicInt32 _isServing;  // Read by submitters without taking _lock
 };
 
-#endif // SOCKET_SERVICE_EPOLL_H
+#endif // __linux__
 
-#endif // #ifdef __linux__
+#endif // SOCKET_SERVICE_EPOLL_H
@@ -3,29 +3,61 @@
 #ifndef SOCKET_SERVICE_POLL_H
 #define SOCKET_SERVICE_POLL_H
 
+#ifndef __linux__
+
 #include <ge/Error.h>
-#include <ge/data/HashMap.h>
 #include <ge/data/List.h>
 #include <ge/inet/INetAddress.h>
+#include <ge/thread/AtomicInt32.h>
 #include <ge/thread/Condition.h>
+#include <ge/thread/Mutex.h>
 #include <ge/thread/Thread.h>
 #include <gepriv/aio/AioFileBlocking.h>
 #include <gepriv/aio/AioSocketPoll.h>
 
 #include <poll.h>
 
+// Sockets per chunk of the socket table, as a power of 2
+#define SOCKET_TABLE_CHUNK_BITS 10
+#define SOCKET_TABLE_CHUNK_LEN (1 << SOCKET_TABLE_CHUNK_BITS)
+
+// Chunks of the socket table, limiting the fds it can hold
+#define SOCKET_TABLE_MAX_CHUNKS 1024
+
 class AioFile;
 class AioSocket;
 
 /*
  * SocketService implementation that uses the poll() system call.
+ *
+ * socketWriteV() gathers several buffers into each sendmsg() call. The
+ * array of buffers must stay valid until the callback runs, unless it
+ * holds a single buffer.
+ *
+ * socketWaitReadable() completes with no bytes once data or the end of the
+ * stream can be read, without taking any of it.
+ *
+ * Sockets are kept in a table indexed by fd with a lock per entry. Ready
+ * operations are handed to the workers through lock-free queues, one per
+ * worker, so operations on different sockets share no lock. An idle worker
+ * parks on its own condition, which a producer only takes to wake it.
+ *
+ * The array passed to poll() is kept from call to call. Only the sockets
+ * whose operations changed since the last call are updated, so waking the
+ * poll thread doesn't cost a pass over every open socket.
+ *
+ * The sockets can be split between several reactors, each a poll thread
+ * with its own worker threads. A socket is given to a
+ * reactor in turn on its first operation and stays with it, so its events
+ * and callbacks are handled by the same few threads. With inline
+ * completion, the poll thread is the only one.
  */
 class SocketService
 {
 public:
     friend class AioSocket;
     friend class AioWorker;
-    friend class PollWorker;
+    friend class Reactor;
 
     typedef void (*socketCallback)(AioSocket* aioSocket,
                                    void* userData,
@@ -39,10 +71,35 @@ public:
                                     void* userData,
                                     const Error& error);
 
+    /*
+     * A block of data for socketWriteV().
+     */
+    class WriteBuffer
+    {
+    public:
+        const char* data;
+        uint32 dataLen;
+    };
+
     SocketService();
     ~SocketService();
 
     void startServing(uint32 desiredThreads);
+
+    // Starts serving with every thread of the service bound to one
+    // processor, so a service per processor never migrates between them
+    void startServing(uint32 desiredThreads,
+                      uint32 processor);
+
+    // Sets the number of threads waiting on socket events, 1 by default.
+    // Must be called before startServing().
+    void setReactorCount(uint32 reactorCount);
+
+    // Performs operations and runs their callbacks on the poll threads
+    // instead of handing them to workers, saving a thread switch per
+    // operation. Callbacks must not block, and desiredThreads is unused.
+    // Must be called before startServing().
+    void setInlineCompletion(bool inlineCompletion);
     void shutdown();
 
     void socketAccept(AioSocket* listenSocket,
@@ -62,12 +119,22 @@ public:
                     char* buffer,
                     uint32 bufferLen);
 
+    void socketWaitReadable(AioSocket* aioSocket,
+                            SocketService::socketCallback callback,
+                            void* userData);
+
     void socketWrite(AioSocket* aioSocket,
                      SocketService::socketCallback callback,
                      void* userData,
                      const char* buffer,
                      uint32 bufferLen);
 
+    void socketWriteV(AioSocket* aioSocket,
+                      SocketService::socketCallback callback,
+                      void* userData,
+                      const WriteBuffer* buffers,
+                      uint32 bufferCount);
+
     void socketSendFile(AioSocket* aioSocket,
                         SocketService::socketCallback callback,
                         void* userData,
@@ -79,35 +146,64 @@ private:
     SocketService(const SocketService&) DELETED;
     SocketService& operator=(const SocketService&) DELETED;
 
-    class AioWorker : public Thread
+    class Reactor;
+    class SockData;
+
+    class QueueEntry
     {
     public:
-        AioWorker(SocketService* socketService);
-        void run() OVERRIDE;
+        bool isRead;
 
-    private:
-        SocketService* _socketService;
+        // Set by the thread queuing the entry with the data's slot locked,
+        // cleared by the thread taking it from the queue. Accessed
+        // atomically.
+        bool isQueued;
+        SockData* data;
+        QueueEntry* next;
     };
 
-    class PollWorker : public Thread
+    /*
+     * Lock-free queue of entries that any thread may add to and only one
+     * thread takes from. Adding costs an atomic exchange. Taking may miss
+     * an entry that's still being added, in which case the adding thread
+     * is relied on to wake the taker afterwards.
+     */
+    class ReadyQueue
     {
     public:
-        PollWorker(SocketService* socketService);
-        void run() OVERRIDE;
+        ReadyQueue();
+
+        void push(QueueEntry* queueEntry);
+
+        // Only called by the taking thread
+        QueueEntry* pop();
+        bool isEmpty() const;
 
     private:
-        SocketService* _socketService;
-    };
+        ReadyQueue(const ReadyQueue&) DELETED;
+        ReadyQueue& operator=(const ReadyQueue&) DELETED;
 
-    class SockData;
+        QueueEntry* _head;  // Last entry added
+        QueueEntry* _tail;  // Next entry to take
+        QueueEntry _stub;   // Holds the place of an empty queue
+    };
 
-    class QueueEntry
+    class AioWorker : public Thread
     {
     public:
-        bool isRead;
-        SockData* data;
-        QueueEntry* next;
-        QueueEntry* prev;
+        AioWorker(Reactor* reactor);
+        void run() OVERRIDE;
+
+        Reactor* reactor;
+        ReadyQueue readyQueue;
+
+        // Set while the worker may be about to park. A thread queuing an
+        // entry that clears it wakes the worker. Accessed atomically.
+        int32 isIdle;
+
+        // Guards wakePending, which is set to wake a parked worker
+        Condition parkCond;
+        bool wakePending;
     };
 
     class SockData
@@ -117,6 +213,33 @@ private:
         QueueEntry writeQueueEntry;
 
         AioSocket* aioSocket;
+        int fd;
+        Reactor* reactor;
+
+        // Held once by the socket table and once by each queued or running
+        // side. The last holder frees the data.
+        AtomicInt32 refCount;
+
+        // Set when a system call may be tried without waiting on poll,
+        // cleared when a worker takes the side. A side waits on poll once
+        // a call reported EAGAIN.
+        bool readReady;
+        bool writeReady;
+
+        // Set while a worker is performing a system call on the given side
+        bool readActive;
+        bool writeActive;
+
+        // Set once the socket is closed. Workers still holding the data
+        // abandon its operations.
+        bool isDropped;
+
+        // Set while the socket is on the poll thread's dirty list
+        bool isPollDirty;
+
+        // Entry of the socket in its reactor's poll list, -1 if it has
+        // none. Only used by the reactor's poll thread.
+        int32 pollIndex;
 
         // Read data
         uint32 readOper;
@@ -126,21 +249,22 @@ private:
         char* readBuffer;
         uint32 readBufferPos;
         uint32 readBufferLen;
-        bool readComplete;
-        Error readError;
 
         // Write data
         uint32 writeOper;
         void* writeCallback;
         void* writeUserData;
-        char* writeBuffer;
-        uint32 writeBufferPos;
-        uint32 writeBufferLen;
-        bool writeComplete;
-        Error writeError;
+        const WriteBuffer* writeBuffers;
+        uint32 writeBufferCount;
+        uint32 writeBufferIndex;   // Buffer being sent
+        uint32 writeBufferOffset;  // Bytes of that buffer already sent
+        uint32 writeBufferPos;     // Total bytes sent
+        uint32 writeBufferLen;     // Total bytes to send
+        WriteBuffer writeSingle;   // Holds the buffer of a single write
 
         INetAddress connectAddress;
         int32 connectPort;
+        bool connectStarted;
 
         int sendFileFd;
         char* sendFileBuf;
@@ -153,38 +277,121 @@ private:
         ~SockData();
     };
 
-    void emptyWakePipe();
-    void wakeup();
+    /*
+     * Entry of the socket table for one fd. Its lock guards the SockData
+     * it holds, so operations on different sockets never contend.
+     */
+    class SocketSlot
+    {
+    public:
+        SocketSlot();
+
+        Mutex lock;
+        SockData* data;
+    };
+
+    /*
+     * Poll thread serving a share of the sockets, with the workers that
+     * perform their operations.
+     */
+    class Reactor : public Thread
+    {
+    public:
+        Reactor(SocketService* socketService);
+        ~Reactor();
+
+        void run() OVERRIDE;
 
+        SocketService* socketService;
+        int wakeupPipe[2];
+
+        List<AioWorker*> workers;
+        AtomicInt32 nextWorker;  // Worker tried first for the next entry
+
+        // Operations run by the poll thread itself with inline completion
+        ReadyQueue inlineQueue;
+
+        // Set with inline completion while the poll thread may block in
+        // poll(). A thread queuing an entry that clears it writes to the
+        // wakeup pipe. Accessed atomically.
+        int32 isPolling;
+
+        // Kept by the poll thread across calls to poll(). Entry i of
+        // pollFdList is for the socket at entry i of pollDataList, and has
+        // a negative fd while the socket waits on nothing. The first entry
+        // is the wakeup pipe.
+        List<pollfd> pollFdList;
+        List<SockData*> pollDataList;
+
+        // Sockets whose poll events may have changed. The poll thread
+        // moves them to pollChangeList and applies them before each call
+        // to poll().
+        Mutex pollLock;
+        List<SockData*> pollDirtyList;
+        List<SockData*> pollChangeList;
+    };
+
+    void emptyWakePipe(Reactor* reactor);
+    void wakeup(Reactor* reactor);
+
+    SocketSlot* getSlot(int fd);
+    SockData* getSockData(SocketSlot* slot,
+                          AioSocket* aioSocket,
+                          const char* context);
+    void releaseData(SockData* sockData);
     void dropSocket(AioSocket* aioSocket);
-    bool process();
-    bool poll();
 
-    void enqueData(QueueEntry* queueEntry);
+    static
+    short pollEvents(const SockData* sockData);
 
-    void doAccept(SockData* sockData);
-    void doConnect(SockData* sockData);
-    void doRecv(SockData* sockData);
-    void doSend(SockData* sockData);
-    void doSendfile(SockData* sockData);
+    void markPollDirty(SockData* sockData);
+    void applyPollChanges(Reactor* reactor);
+    void setPollEvents(SockData* sockData);
+    void removePollEntry(Reactor* reactor,
+                         size_t index);
 
+    void setWriteBuffers(SockData* sockData,
+                         const WriteBuffer* buffers,
+                         uint32 bufferCount);
 
-    int _wakeupPipe[2];
+    bool process(AioWorker* worker);
+    void performOper(SockData* sockData,
+                     bool isRead);
+    void runQueued(Reactor* reactor);
+    bool poll(Reactor* reactor);
 
-    Condition _pauseCond;
-    bool _doPause;
-    bool _isPaused;
+    void enqueData(QueueEntry* queueEntry);
+    void drainQueue(ReadyQueue* readyQueue);
 
-    Condition _cond;
+    bool doAccept(SockData* sockData, Error* error);
+    bool doConnect(SockData* sockData, Error* error);
+    bool doRecv(SockData* sockData, Error* error);
+    bool doWaitRead(SockData* sockData, Error* error);
+    bool doSend(SockData* sockData, Error* error);
+    bool doSendfile(SockData* sockData, Error* error);
 
-    List<AioWorker*> _threads;
-    PollWorker _pollWorker;
 
+    // Guards the started and shutdown states
+    Mutex _lock;
+
+    List<Reactor*> _reactors;
+    uint32 _reactorCount;
+    AtomicInt32 _nextReactor;  // Reactor given the next new socket
+
+    int32 _processor;        // Processor the threads run on, -1 if any
+    bool _inlineCompletion;
+    bool _isStarted;
     bool _isShutdown;
-    List<pollfd> _pollFdList;
-    HashMap<int, SockData> _dataMap;
-    QueueEntry* _readyQueueHead;
-    QueueEntry* _readyQueueTail;
+    AtomicInt32 _isServing;  // Read by submitters without taking _lock
+
+    // Socket table indexed by fd. It's split into chunks that are added as
+    // higher fds show up and never moved, so slots are found without a
+    // lock. _tableLock only serializes adding chunks.
+    SocketSlot* _slotChunks[SOCKET_TABLE_MAX_CHUNKS];
+    AtomicInt32 _chunkCount;
+    Mutex _tableLock;
 };
 
+#endif // !__linux__
+
 #endif // SOCKET_SERVICE_POLL_H
@@ -0,0 +1,261 @@
+// SocketServiceUring.h
+
+#ifndef SOCKET_SERVICE_URING_H
+#define SOCKET_SERVICE_URING_H
+
+#ifdef __linux__
+
+#include <ge/Error.h>
+#include <ge/data/HashMap.h>
+#include <ge/data/List.h>
+#include <ge/inet/INetAddress.h>
+#include <ge/thread/Condition.h>
+#include <ge/thread/Thread.h>
+#include <gepriv/aio/IoUring.h>
+#include <gepriv/aio/SocketServiceEpoll.h>
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+class AioFile;
+class AioSocket;
+
+// Maximum number of buffers gathered into a single IORING_OP_SENDMSG
+#define MAX_SEND_IOVECS 16
+
+// Connections a multishot accept may hold for a listening socket with no
+// socketAccept pending. Once reached, the accept is cancelled until the
+// backlog is taken, leaving further connections in the kernel's listen
+// queue. The backlog only exceeds this by the completions reaped before
+// the cancel lands.
+#define MAX_ACCEPT_BACKLOG 64
+
+/*
+ * SocketService engine that uses io_uring. Selected at runtime by the Linux
+ * SocketService when the kernel supports it, otherwise epoll is used.
+ *
+ * Operations are recorded under a lock and turned into submission entries
+ * by the ring thread, so every operation started during one loop iteration
+ * goes to the kernel in a single io_uring_enter call. The ring thread hands
+ * reaped completions to worker threads, which run the callbacks, or runs
+ * the callbacks itself with inline completion.
+ */
+class SocketServiceUring
+{
+public:
+    friend class RingWorker;
+
+    SocketServiceUring(SocketService* owner);
+    ~SocketServiceUring();
+
+    static bool isSupported();
+
+    // Starts the ring thread and workerCount workers, at least one, or no
+    // workers with inline completion. The threads are bound to processor
+    // unless it's -1.
+    void startServing(uint32 workerCount,
+                      int32 processor,
+                      bool inlineCompletion);
+    void shutdown();
+
+    void socketAccept(AioSocket* listenSocket,
+                      AioSocket* acceptSocket,
+                      SocketService::acceptCallback callback,
+                      void* userData);
+
+    void socketConnect(AioSocket* aioSocket,
+                       SocketService::connectCallback callback,
+                       void* userData,
+                       const INetAddress& address,
+                       int32 port);
+
+    void socketRead(AioSocket* aioSocket,
+                    SocketService::socketCallback callback,
+                    void* userData,
+                    char* buffer,
+                    uint32 bufferLen);
+
+    void socketWaitReadable(AioSocket* aioSocket,
+                            SocketService::socketCallback callback,
+                            void* userData);
+
+    void socketWrite(AioSocket* aioSocket,
+                     SocketService::socketCallback callback,
+                     void* userData,
+                     const char* buffer,
+                     uint32 bufferLen);
+
+    void socketWriteV(AioSocket* aioSocket,
+                      SocketService::socketCallback callback,
+                      void* userData,
+                      const SocketService::WriteBuffer* buffers,
+                      uint32 bufferCount);
+
+    void socketSendFile(AioSocket* aioSocket,
+                        SocketService::socketCallback callback,
+                        void* userData,
+                        AioFile* aioFile,
+                        uint64 pos,
+                        uint32 writeLen);
+
+    void dropSocket(AioSocket* aioSocket);
+
+private:
+    SocketServiceUring(const SocketServiceUring&) DELETED;
+    SocketServiceUring& operator=(const SocketServiceUring&) DELETED;
+
+    class RingWorker : public Thread
+    {
+    public:
+        RingWorker(SocketServiceUring* socketService);
+        void run() OVERRIDE;
+
+    private:
+        SocketServiceUring* _socketService;
+    };
+
+    class AioWorker : public Thread
+    {
+    public:
+        AioWorker(SocketServiceUring* socketService);
+        void run() OVERRIDE;
+
+    private:
+        SocketServiceUring* _socketService;
+    };
+
+    class SockData
+    {
+    public:
+        AioSocket* aioSocket;
+        int fd;
+
+        // Number of submission entries the kernel may still complete, and
+        // number of entries in the submit list. The data is freed once a
+        // dropped socket has neither.
+        uint32 inFlight;
+        uint32 queuedCount;
+        bool isDropped;
+
+        // Read data
+        uint32 readOper;
+        bool readQueued;
+        bool readSubmitted;
+        bool readPolling;
+        AioSocket* acceptSocket;
+        void* readCallback;
+        void* readUserData;
+        char* readBuffer;
+        uint32 readBufferLen;
+
+        // Set while an accept is armed in the kernel. Connections accepted
+        // by a multishot accept with no socketAccept pending are kept in
+        // the backlog, see MAX_ACCEPT_BACKLOG.
+        bool acceptArmed;
+        bool acceptCancelling;
+        List<int> acceptBacklog;
+
+        // Write data
+        uint32 writeOper;
+        bool writeQueued;
+        bool writeSubmitted;
+        bool writePolling;
+        void* writeCallback;
+        void* writeUserData;
+        const SocketService::WriteBuffer* writeBuffers;
+        uint32 writeBufferCount;
+        uint32 writeBufferIndex;   // Buffer being sent
+        uint32 writeBufferOffset;  // Bytes of that buffer already sent
+        uint32 writeBufferPos;     // Total bytes sent
+        uint32 writeBufferLen;     // Total bytes to send
+        SocketService::WriteBuffer writeSingle;
+
+        // Message handed to the kernel when gathering several buffers
+        msghdr writeMsg;
+        iovec writeIov[MAX_SEND_IOVECS];
+
+        sockaddr_storage connectAddress;
+        socklen_t connectAddressLen;
+
+        int sendFileFd;
+        uint64 sendFileOffset;
+        uint64 sendFileEnd;
+
+        SockData();
+    };
+
+    class Completion
+    {
+    public:
+        uint32 oper;
+        void* callback;
+        void* userData;
+        AioSocket* aioSocket;
+        AioSocket* acceptSocket;
+        uint32 bytesTransfered;
+        Error error;
+    };
+
+    SockData* getSockData(AioSocket* aioSocket, const char* context);
+    void checkRunning();
+
+    void queueOper(SockData* sockData, uint32 tag);
+    bool prepOper(uint64 token);
+    void handleCqe(const io_uring_cqe* cqe);
+    void freeDropped();
+    void armWakeup();
+
+    void completeAccept(SockData* sockData, int32 res);
+    void completeRead(SockData* sockData, int32 res);
+    void completeWrite(SockData* sockData, int32 res);
+    void acceptConnection(SockData* sockData, int acceptFd, int32 res);
+    void addCompletion(SockData* sockData,
+                       bool isRead,
+                       uint32 bytesTransfered,
+                       int err,
+                       const char* systemCall);
+
+    bool doSendfile(SockData* sockData, int* err);
+    void prepSend(SockData* sockData, io_uring_sqe* sqe);
+    void advanceWrite(SockData* sockData, uint32 sent);
+
+    bool process();
+    void runCompletion(const Completion& completion);
+    bool work();
+
+    SocketService* _owner;
+
+    IoUring _ring;
+    int _wakeupFd;
+    uint64 _wakeupValue;
+    bool _isWaiting;
+    bool _wakeArmed;
+    bool _wakePending;
+    bool _multishotAccept;
+
+    Condition _cond;
+
+    RingWorker _ringWorker;
+    int32 _processor;
+    bool _inlineCompletion;  // Callbacks run on the ring thread
+
+    bool _isStarted;
+    bool _isShutdown;
+    HashMap<int, SockData*> _dataMap;
+    List<SockData*> _droppedList;
+    List<uint64> _submitList;
+    List<Completion> _completions;
+
+    // Completions handed to the workers, taken from _workHead on. Guarded
+    // by _workCond rather than _cond, so workers don't contend with
+    // submitters.
+    Condition _workCond;
+    List<AioWorker*> _workers;
+    List<Completion> _workList;
+    size_t _workHead;
+    bool _isWorkShutdown;
+};
+
+#endif // __linux__
+
+#endif // SOCKET_SERVICE_URING_H
@@ -7,6 +7,7 @@
 #include <ge/Error.h>
 #include <ge/io/IO.h>
 #include <ge/text/StringRef.h>
+#include <ge/util/Date.h>
 
 #define _WINSOCKAPI_
 #include <Windows.h>
@@ -26,6 +27,10 @@ public:
     void open(const StringRef fileName, OpenMode_Enum mode, int permissions);
     void close();
 
+    uint64 getFileLength();
+    Date getLastModified();
+    bool isDirectory();
+
 private:
     AioFile(const AioFile& other) DELETED;
     AioFile& operator=(const AioFile& other) DELETED;
@@ -24,6 +24,11 @@ class AioSocket;
  *
  * Note that on some systems the sendfile functionality may be emulated using
  * blocking io.
+ *
+ * socketWriteV() passes several buffers to a single WSASend() call.
+ *
+ * socketWaitReadable() completes with no bytes once data can be read, so
+ * idle sockets need not hold a receive buffer.
  */
 class SocketService
 {
@@ -44,10 +49,34 @@ public:
                                     void* userData,
                                     const Error& error);
 
+    /*
+     * A block of data for socketWriteV().
+     */
+    class WriteBuffer
+    {
+    public:
+        const char* data;
+        uint32 dataLen;
+    };
+
     SocketService();
     ~SocketService();
 
     void startServing(uint32 desiredThreads);
+
+    // Starts serving with every thread of the service bound to one
+    // processor, so a service per processor never migrates between them
+    void startServing(uint32 desiredThreads,
+                      uint32 processor);
+
+    // Sets the number of threads waiting on socket events, 1 by default.
+    // Must be called before startServing().
+    void setReactorCount(uint32 reactorCount);
+
+    // Performs operations and runs their callbacks on the threads waiting
+    // on socket events instead of handing them to workers. Callbacks must
+    // not block. Must be called before startServing().
+    void setInlineCompletion(bool inlineCompletion);
     void shutdown();
 
     void socketAccept(AioSocket* listenSocket,
@@ -67,12 +96,22 @@ public:
                     char* buffer,
                     uint32 bufferLen);
 
+    void socketWaitReadable(AioSocket* aioSocket,
+                            SocketService::socketCallback callback,
+                            void* userData);
+
     void socketWrite(AioSocket* aioSocket,
                      SocketService::socketCallback callback,
                      void* userData,
                      const char* buffer,
                      uint32 bufferLen);
 
+    void socketWriteV(AioSocket* aioSocket,
+                      SocketService::socketCallback callback,
+                      void* userData,
+                      const WriteBuffer* buffers,
+                      uint32 bufferCount);
+
     void socketSendFile(AioSocket* aioSocket,
                         SocketService::socketCallback callback,
                         void* userData,
@@ -107,6 +146,7 @@ private:
 
     LONG volatile _state;        // Current server state (1 = started, 2 = shutdown)
     LONG volatile _pending;      // Number of pending IO requests
+    int32 _processor;            // Processor the threads run on, -1 if any
 
     Mutex _lock;                 // Lock for set of files and sockets
     List<AioSocket*> _sockets;   // Set of sockets
@@ -21,6 +21,19 @@ public:
         _value(val)
     {}
 
+    // Loads made before get() complete before the value is read, and
+    // stores made before a set() are seen by loads made after the get()
+    // that reads the value.
+    int32 get()
+    {
+        return ::InterlockedCompareExchange(&_value, 0, 0);
+    }
+
+    void set(int32 val)
+    {
+        ::InterlockedExchange(&_value, val);
+    }
+
     int32 inc()
     {
         return ::InterlockedIncrement(&_value);
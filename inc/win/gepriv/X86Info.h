@@ -23,6 +23,11 @@
 #define SUPPORTS_AES
 #endif
 
+// AVX2 requires Visual Studio 2012 or later
+#if (_MSC_VER >= 1700)
+#define SUPPORTS_AVX2
+#endif
+
 /*
  * Class that wraps the information extractable by the X86 CPUID instruction.
  * Where the compiler has a macro indicating the capability, the macro will
@@ -44,6 +49,7 @@ namespace X86Info
     extern bool x86info_hasSSE4_2;
     extern bool x86info_hasSSE4a;
     extern bool x86info_hasAVX;
+    extern bool x86info_hasAVX2;
     extern bool x86info_hasAES;
 
     /*
@@ -128,6 +134,12 @@ namespace X86Info
         return x86info_hasAVX;
     }
 
+    static inline
+    bool hasAVX2()
+    {
+        return x86info_hasAVX2;
+    }
+
     static inline
     bool hasAES()
     {
@@ -0,0 +1,70 @@
+// HttpConnection.cpp
+
+#include "ge/http/HttpConnection.h"
+
+#include "ge/http/HttpSession.h"
+
+HttpShard::HttpShard(HttpServer* httpServer,
+                     SocketService* socketService) :
+    _httpServer(httpServer),
+    _socketService(socketService),
+    _pendingConnectionIpv4(NULL),
+    _pendingConnectionIpv6(NULL)
+{
+}
+
+HttpShard::~HttpShard()
+{
+    // No accept may complete into a connection once it's freed
+    _acceptSockIpv4.close();
+    _acceptSockIpv6.close();
+
+    delete _pendingConnectionIpv4;
+    delete _pendingConnectionIpv6;
+}
+
+HttpConnection::HttpConnection(HttpShard* shard) :
+    _shard(shard),
+    _socketService(shard->_socketService),
+    _httpServer(shard->_httpServer),
+    reading(NULL),
+    lineBuffer(NULL),
+    lineBufferIndex(0),
+    lineBufferFilled(0),
+    lineColon(HTTP_MAX_LINE),
+    readIntoBody(false),
+    readActive(false),
+    readPaused(false),
+    writeActive(false),
+    closeAfterWrites(false),
+    isClosing(false),
+    writeListHead(NULL),
+    writeListTail(NULL),
+    writeBufferCount(0),
+    responseHead(NULL),
+    responseTail(NULL),
+    responseCount(0)
+{
+}
+
+HttpConnection::~HttpConnection()
+{
+    delete reading;
+
+    while (responseHead != NULL)
+    {
+        HttpSession* session = responseHead;
+        responseHead = session->next;
+        delete session;
+    }
+
+    while (writeListHead != NULL)
+    {
+        WriteEntry* entry = writeListHead;
+        writeListHead = entry->next;
+
+        delete entry;
+    }
+
+    ::operator delete(lineBuffer);
+}
@@ -0,0 +1,144 @@
+// HttpForm.cpp
+
+#include "ge/http/HttpForm.h"
+
+#include "ge/http/HttpScan.h"
+#include "ge/http/HttpUtil.h"
+
+#include <cstring>
+
+HttpForm::HttpForm()
+{
+}
+
+bool HttpForm::parse(const StringRef& data)
+{
+    // Text without escapes is never written to, so it's used as it is
+    char* start = (char*)data.data();
+    char* end = start + data.length();
+    const char* nextEscape = HttpScan::scanEscape(start, end);
+
+    if (nextEscape != end)
+    {
+        _buffer.clear();
+        _buffer.addBlockBack(data.data(), data.length());
+
+        start = _buffer.data();
+        end = start + data.length();
+        nextEscape = start + (nextEscape - data.data());
+    }
+
+    return parseFields(start, end, nextEscape);
+}
+
+bool HttpForm::parseInPlace(char* data,
+                            size_t dataLen)
+{
+    char* end = data + dataLen;
+
+    return parseFields(data, end, HttpScan::scanEscape(data, end));
+}
+
+void HttpForm::clear()
+{
+    _fields.clear();
+    _buffer.clear();
+}
+
+size_t HttpForm::size() const
+{
+    return _fields.size();
+}
+
+StringRef HttpForm::getName(size_t index) const
+{
+    return _fields.get(index).name;
+}
+
+StringRef HttpForm::getValue(size_t index) const
+{
+    return _fields.get(index).value;
+}
+
+StringRef HttpForm::get(const StringRef& name) const
+{
+    size_t fieldCount = _fields.size();
+
+    for (size_t i = 0; i < fieldCount; i++)
+    {
+        const Field& field = _fields.get(i);
+
+        if (field.name == name)
+            return field.value;
+    }
+
+    return StringRef();
+}
+
+bool HttpForm::has(const StringRef& name) const
+{
+    size_t fieldCount = _fields.size();
+
+    for (size_t i = 0; i < fieldCount; i++)
+    {
+        if (_fields.get(i).name == name)
+            return true;
+    }
+
+    return false;
+}
+
+/*
+ * Splits text into fields. nextEscape is the first '%' or '+' at or after
+ * the field being parsed, so fields ahead of it are taken as they are.
+ */
+bool HttpForm::parseFields(char* data,
+                           char* end,
+                           const char* nextEscape)
+{
+    char* fieldStart = data;
+
+    _fields.clear();
+
+    while (fieldStart < end)
+    {
+        char* fieldEnd = (char*)::memchr(fieldStart, '&', end - fieldStart);
+
+        if (fieldEnd == NULL)
+            fieldEnd = end;
+
+        // Empty fields ("a=1&&b=2") are skipped
+        if (fieldEnd != fieldStart)
+        {
+            char* equals = (char*)::memchr(fieldStart, '=', fieldEnd - fieldStart);
+            char* valueStart = (equals != NULL) ? equals + 1 : fieldEnd;
+            size_t nameLen = ((equals != NULL) ? equals : fieldEnd) - fieldStart;
+            size_t valueLen = fieldEnd - valueStart;
+
+            if (nextEscape < fieldEnd)
+            {
+                if (!HttpUtil::unescapeUrlInPlace(fieldStart, &nameLen) ||
+                    !HttpUtil::unescapeUrlInPlace(valueStart, &valueLen))
+                {
+                    _fields.clear();
+                    return false;
+                }
+
+                nextEscape = HttpScan::scanEscape(fieldEnd, end);
+            }
+
+            Field field;
+            field.name = StringRef(fieldStart, nameLen);
+            field.value = StringRef(valueStart, valueLen);
+
+            _fields.addBack(field);
+        }
+
+        if (fieldEnd == end)
+            break;
+
+        fieldStart = fieldEnd + 1;
+    }
+
+    return true;
+}
@@ -0,0 +1,298 @@
+// HttpRouter.cpp
+
+#include "ge/http/HttpRouter.h"
+
+#include "ge/SystemException.h"
+
+#include <cstring>
+
+/*
+ * Node of the radix tree. A static node is entered by matching its label,
+ * a parameter node by capturing a path segment.
+ */
+class HttpRouter::Node
+{
+public:
+    Node() :
+        paramChild(NULL),
+        route(NULL),
+        wildcardRoute(NULL)
+    {}
+
+    ~Node()
+    {
+        for (size_t i = 0; i < children.size(); i++)
+            delete children.get(i);
+
+        delete paramChild;
+    }
+
+    String label;
+    String indices;          // First byte of the label of each child
+    List<Node*> children;    // Static children
+    Node* paramChild;
+    const Route* route;      // Route of a path ending here
+    const Route* wildcardRoute;  // Route capturing the rest of the path
+};
+
+/*
+ * Finds the child whose label starts with c from the indices of a node.
+ * Returns -1 if there is none.
+ */
+static inline
+ssize_t findChild(const String& indices,
+                  char c)
+{
+    if (indices.length() == 0)
+        return -1;
+
+    const char* index = (const char*)::memchr(indices.data(), c, indices.length());
+
+    return (index != NULL) ? index - indices.data() : -1;
+}
+
+HttpRouter::HttpRouter() :
+    _root(new Node())
+{
+}
+
+HttpRouter::~HttpRouter()
+{
+    delete _root;
+
+    for (size_t i = 0; i < _routes.size(); i++)
+        delete _routes.get(i);
+}
+
+void HttpRouter::addRoute(const StringRef& pattern,
+                          httpHandler_func handler,
+                          HttpDispatch_enum dispatch)
+{
+    size_t patternLen = pattern.length();
+
+    if (patternLen == 0 ||
+        pattern.charAt(0) != '/')
+    {
+        throw SystemException("Route pattern must start with '/'");
+    }
+
+    Route* route = new Route();
+    route->handler = handler;
+    route->dispatch = dispatch;
+
+    Node* node = _root;
+    size_t pos = 0;
+
+    try
+    {
+        while (pos < patternLen)
+        {
+            char c = pattern.charAt(pos);
+
+            // Parameters and wildcards take up a whole segment
+            if ((c == ':' || c == '*') &&
+                pattern.charAt(pos - 1) == '/')
+            {
+                size_t end = pos + 1;
+
+                while (end < patternLen &&
+                       pattern.charAt(end) != '/')
+                {
+                    end++;
+                }
+
+                if (route->paramNames.size() == HTTP_MAX_ROUTE_PARAMS)
+                    throw SystemException("Route pattern has too many parameters");
+
+                StringRef name = pattern.substring(pos + 1, end);
+                route->paramNames.addBack(String(name));
+
+                if (c == '*')
+                {
+                    if (end != patternLen)
+                        throw SystemException("Route wildcard must end the pattern");
+
+                    if (node->wildcardRoute != NULL)
+                        throw SystemException("Route pattern already added");
+
+                    node->wildcardRoute = route;
+                    _routes.addBack(route);
+                    return;
+                }
+
+                if (end == pos + 1)
+                    throw SystemException("Route parameter must have a name");
+
+                if (node->paramChild == NULL)
+                    node->paramChild = new Node();
+
+                node = node->paramChild;
+                pos = end;
+                continue;
+            }
+
+            // Static text runs up to the next parameter or wildcard
+            size_t end = pos + 1;
+
+            while (end < patternLen &&
+                   !((pattern.charAt(end) == ':' || pattern.charAt(end) == '*') &&
+                     pattern.charAt(end - 1) == '/'))
+            {
+                end++;
+            }
+
+            node = addStatic(node, pattern.substring(pos, end));
+            pos = end;
+        }
+
+        if (node->route != NULL)
+            throw SystemException("Route pattern already added");
+    }
+    catch (...)
+    {
+        delete route;
+        throw;
+    }
+
+    node->route = route;
+    _routes.addBack(route);
+}
+
+const HttpRouter::Route* HttpRouter::findRoute(const StringRef& path,
+                                               StringRef* paramValues) const
+{
+    return matchNode(_root,
+                     path.data(),
+                     0,
+                     path.length(),
+                     paramValues,
+                     0);
+}
+
+/*
+ * Finds or adds the static node reached by matching text from a node,
+ * splitting the label of a child that only shares part of the text.
+ */
+HttpRouter::Node* HttpRouter::addStatic(Node* node,
+                                        StringRef text)
+{
+    while (text.length() != 0)
+    {
+        ssize_t childIndex = findChild(node->indices, text.charAt(0));
+
+        if (childIndex == -1)
+        {
+            Node* child = new Node();
+            child->label = text;
+
+            node->indices.appendChar(text.charAt(0));
+            node->children.addBack(child);
+            return child;
+        }
+
+        Node* child = node->children.get(childIndex);
+
+        size_t common = 1;
+        size_t maxCommon = (text.length() < child->label.length()) ?
+                           text.length() : child->label.length();
+
+        while (common < maxCommon &&
+               text.charAt(common) == child->label.charAt(common))
+        {
+            common++;
+        }
+
+        if (common < child->label.length())
+        {
+            // The new node takes the shared part of the label
+            Node* split = new Node();
+            split->label = child->label.substring(0, common);
+
+            StringRef restRef = child->label.substring(common);
+            String rest(restRef);
+            child->label = rest;
+
+            split->indices.appendChar(rest.charAt(0));
+            split->children.addBack(child);
+            node->children.set(childIndex, split);
+
+            child = split;
+        }
+
+        node = child;
+        text = text.substring(common);
+    }
+
+    return node;
+}
+
+/*
+ * Matches the rest of a path from a node, trying static children, then the
+ * parameter child, then the wildcard.
+ */
+const HttpRouter::Route* HttpRouter::matchNode(const Node* node,
+                                               const char* path,
+                                               size_t pos,
+                                               size_t pathLen,
+                                               StringRef* paramValues,
+                                               uint32 paramCount)
+{
+    if (pos == pathLen)
+    {
+        if (node->route != NULL)
+            return node->route;
+    }
+    else
+    {
+        ssize_t childIndex = findChild(node->indices, path[pos]);
+
+        if (childIndex != -1)
+        {
+            const Node* child = node->children.get(childIndex);
+            size_t labelLen = child->label.length();
+
+            if (labelLen <= pathLen - pos &&
+                ::memcmp(path + pos, child->label.data(), labelLen) == 0)
+            {
+                const Route* route = matchNode(child,
+                                               path,
+                                               pos + labelLen,
+                                               pathLen,
+                                               paramValues,
+                                               paramCount);
+
+                if (route != NULL)
+                    return route;
+            }
+        }
+
+        if (node->paramChild != NULL &&
+            path[pos] != '/')
+        {
+            const char* slash = (const char*)::memchr(path + pos,
+                                                      '/',
+                                                      pathLen - pos);
+            size_t end = (slash != NULL) ? slash - path : pathLen;
+
+            paramValues[paramCount] = StringRef(path + pos, end - pos);
+
+            const Route* route = matchNode(node->paramChild,
+                                           path,
+                                           end,
+                                           pathLen,
+                                           paramValues,
+                                           paramCount + 1);
+
+            if (route != NULL)
+                return route;
+        }
+    }
+
+    if (node->wildcardRoute != NULL)
+    {
+        paramValues[paramCount] = StringRef(path + pos, pathLen - pos);
+        return node->wildcardRoute;
+    }
+
+    return NULL;
+}
@@ -0,0 +1,96 @@
+// HttpScan.cpp
+
+#include <ge/http/HttpScan.h>
+
+#if defined(CHIPSET_X86)
+
+#include <gepriv/X86Info.h>
+
+#if defined(SUPPORTS_SSE2)
+const char* scanLine_partial_sse2(const char* iter,
+                                  const char* end,
+                                  const char** colon);
+const char* scanEscape_partial_sse2(const char* iter,
+                                    const char* end);
+#endif
+
+#if defined(SUPPORTS_AVX2)
+const char* scanLine_partial_avx2(const char* iter,
+                                  const char* end,
+                                  const char** colon);
+const char* scanEscape_partial_avx2(const char* iter,
+                                    const char* end);
+#endif
+
+#endif // CHIPSET_X86
+
+namespace HttpScan
+{
+
+/*
+ * The vectorized versions stop at the end of the line, or at the tail too
+ * short for a full block. SSE2 picks up after AVX2 to narrow the tail, and
+ * the rest is done here.
+ */
+const char* scanLine(const char* str,
+                     const char* end,
+                     const char** colon)
+{
+    const char* iter = str;
+
+    (*colon) = NULL;
+
+#if defined(SUPPORTS_AVX2)
+    if (X86Info::hasAVX2())
+    {
+        iter = scanLine_partial_avx2(iter, end, colon);
+    }
+#endif
+#if defined(SUPPORTS_SSE2)
+    if (X86Info::hasSSE2())
+    {
+        iter = scanLine_partial_sse2(iter, end, colon);
+    }
+#endif // Fall through if no vectorized version
+
+    while (iter < end &&
+           !isLineStop(*iter))
+    {
+        if ((*iter) == ':' && (*colon) == NULL)
+            (*colon) = iter;
+
+        iter++;
+    }
+
+    return iter;
+}
+
+const char* scanEscape(const char* str,
+                       const char* end)
+{
+    const char* iter = str;
+
+#if defined(SUPPORTS_AVX2)
+    if (X86Info::hasAVX2())
+    {
+        iter = scanEscape_partial_avx2(iter, end);
+    }
+#endif
+#if defined(SUPPORTS_SSE2)
+    if (X86Info::hasSSE2())
+    {
+        iter = scanEscape_partial_sse2(iter, end);
+    }
+#endif // Fall through if no vectorized version
+
+    while (iter < end &&
+           (*iter) != '%' &&
+           (*iter) != '+')
+    {
+        iter++;
+    }
+
+    return iter;
+}
+
+} // End namespace HttpScan
@@ -0,0 +1,116 @@
+// HttpScan_avx2.cpp
+
+/*
+ * This file needs to be compliled with support for Intel AVX2 intrinsics.
+ */
+
+#include <ge/common.h>
+
+#if defined(CHIPSET_X86)
+
+#include <gepriv/X86Info.h>
+
+#if defined(SUPPORTS_AVX2)
+
+#include <immintrin.h>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+static inline
+uint32 lowestBit(uint32 mask)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return index;
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+
+/*
+ * AVX2 version of HttpScan::scanLine. Returns a pointer to the byte ending
+ * the line, or to the remainder shorter than 32 bytes if none was found.
+ */
+const char* scanLine_partial_avx2(const char* iter,
+                                  const char* end,
+                                  const char** colon)
+{
+    const __m256i ctlBound = _mm256_set1_epi8(0x20);
+    const __m256i crChars = _mm256_set1_epi8('\r');
+    const __m256i tabChars = _mm256_set1_epi8('\t');
+    const __m256i colonChars = _mm256_set1_epi8(':');
+
+    while (end - iter >= 32)
+    {
+        // VMOVDQU as the line can start anywhere in the buffer
+        __m256i test = _mm256_loadu_si256((const __m256i*)iter);
+
+        // VPCMPGTB is a signed compare, so bytes above 0x7F count as
+        // control characters along with those below 0x20
+        __m256i ctl = _mm256_cmpgt_epi8(ctlBound, test);
+        __m256i allowed = _mm256_or_si256(_mm256_cmpeq_epi8(test, crChars),
+                                          _mm256_cmpeq_epi8(test, tabChars));
+
+        // VPMOVMSKB to get a bit per byte
+        uint32 stopMask = (uint32)_mm256_movemask_epi8(_mm256_andnot_si256(allowed, ctl));
+        uint32 colonMask = 0;
+
+        if ((*colon) == NULL)
+            colonMask = (uint32)_mm256_movemask_epi8(_mm256_cmpeq_epi8(test, colonChars));
+
+        if (stopMask != 0)
+        {
+            uint32 stopIndex = lowestBit(stopMask);
+
+            // Only a colon ahead of the end of the line counts. The shift
+            // is safe, stopIndex is at most 31.
+            colonMask &= (1u << stopIndex) - 1;
+
+            if (colonMask != 0)
+                (*colon) = iter + lowestBit(colonMask);
+
+            return iter + stopIndex;
+        }
+
+        if (colonMask != 0)
+            (*colon) = iter + lowestBit(colonMask);
+
+        iter += 32;
+    }
+
+    return iter;
+}
+
+/*
+ * AVX2 version of HttpScan::scanEscape. Returns a pointer to the first '%'
+ * or '+', or to the remainder shorter than 32 bytes if none was found.
+ */
+const char* scanEscape_partial_avx2(const char* iter,
+                                    const char* end)
+{
+    const __m256i percentChars = _mm256_set1_epi8('%');
+    const __m256i plusChars = _mm256_set1_epi8('+');
+
+    while (end - iter >= 32)
+    {
+        __m256i test = _mm256_loadu_si256((const __m256i*)iter);
+        __m256i escapes = _mm256_or_si256(_mm256_cmpeq_epi8(test, percentChars),
+                                          _mm256_cmpeq_epi8(test, plusChars));
+
+        uint32 escapeMask = (uint32)_mm256_movemask_epi8(escapes);
+
+        if (escapeMask != 0)
+            return iter + lowestBit(escapeMask);
+
+        iter += 32;
+    }
+
+    return iter;
+}
+
+#endif // SUPPORTS_AVX2
+
+#endif // CHIPSET_X86
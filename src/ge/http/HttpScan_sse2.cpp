@@ -0,0 +1,115 @@
+// HttpScan_sse2.cpp
+
+/*
+ * This file needs to be compliled with support for SSE2 intrinsics.
+ */
+
+#include <ge/common.h>
+
+#if defined(CHIPSET_X86)
+
+#include <gepriv/X86Info.h>
+
+#if defined(SUPPORTS_SSE2)
+
+#include <emmintrin.h>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+static inline
+uint32 lowestBit(uint32 mask)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return index;
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+
+/*
+ * SSE2 version of HttpScan::scanLine. Returns a pointer to the byte ending
+ * the line, or to the remainder shorter than 16 bytes if none was found.
+ */
+const char* scanLine_partial_sse2(const char* iter,
+                                  const char* end,
+                                  const char** colon)
+{
+    const __m128i ctlBound = _mm_set1_epi8(0x20);
+    const __m128i crChars = _mm_set1_epi8('\r');
+    const __m128i tabChars = _mm_set1_epi8('\t');
+    const __m128i colonChars = _mm_set1_epi8(':');
+
+    while (end - iter >= 16)
+    {
+        // MOVDQU as the line can start anywhere in the buffer
+        __m128i test = _mm_loadu_si128((const __m128i*)iter);
+
+        // PCMPGTB is a signed compare, so bytes above 0x7F count as
+        // control characters along with those below 0x20
+        __m128i ctl = _mm_cmplt_epi8(test, ctlBound);
+        __m128i allowed = _mm_or_si128(_mm_cmpeq_epi8(test, crChars),
+                                       _mm_cmpeq_epi8(test, tabChars));
+
+        // PMOVMSKB to get a bit per byte
+        uint32 stopMask = _mm_movemask_epi8(_mm_andnot_si128(allowed, ctl));
+        uint32 colonMask = 0;
+
+        if ((*colon) == NULL)
+            colonMask = _mm_movemask_epi8(_mm_cmpeq_epi8(test, colonChars));
+
+        if (stopMask != 0)
+        {
+            uint32 stopIndex = lowestBit(stopMask);
+
+            // Only a colon ahead of the end of the line counts
+            colonMask &= (1u << stopIndex) - 1;
+
+            if (colonMask != 0)
+                (*colon) = iter + lowestBit(colonMask);
+
+            return iter + stopIndex;
+        }
+
+        if (colonMask != 0)
+            (*colon) = iter + lowestBit(colonMask);
+
+        iter += 16;
+    }
+
+    return iter;
+}
+
+/*
+ * SSE2 version of HttpScan::scanEscape. Returns a pointer to the first '%'
+ * or '+', or to the remainder shorter than 16 bytes if none was found.
+ */
+const char* scanEscape_partial_sse2(const char* iter,
+                                    const char* end)
+{
+    const __m128i percentChars = _mm_set1_epi8('%');
+    const __m128i plusChars = _mm_set1_epi8('+');
+
+    while (end - iter >= 16)
+    {
+        __m128i test = _mm_loadu_si128((const __m128i*)iter);
+        __m128i escapes = _mm_or_si128(_mm_cmpeq_epi8(test, percentChars),
+                                       _mm_cmpeq_epi8(test, plusChars));
+
+        uint32 escapeMask = _mm_movemask_epi8(escapes);
+
+        if (escapeMask != 0)
+            return iter + lowestBit(escapeMask);
+
+        iter += 16;
+    }
+
+    return iter;
+}
+
+#endif // SUPPORTS_SSE2
+
+#endif // CHIPSET_X86
@@ -2,11 +2,16 @@
 
 #include "ge/http/HttpServer.h"
 
+#include "ge/SystemException.h"
+#include "ge/http/HttpScan.h"
+#include "ge/http/HttpUtil.h"
 #include "ge/io/Console.h"
 #include "ge/thread/Mutex.h"
 #include "ge/util/UInt32.h"
 
+#include <cctype>
 #include <cstring>
+#include <new>
 
 static const char* badReqMsg =
     "HTTP/1.0 400 Bad Request\r\n"
@@ -38,6 +43,61 @@ static const char* lengthReqMsg =
     "</HTML>\r\n"
     "\r\n";
 
+static const char* tooLargeMsg =
+    "HTTP/1.0 413 Request Entity Too Large\r\n"
+    "Content-Type: text/html\r\n"
+    "Content-Length: 144\r\n"
+    "\r\n"
+    "<HTML>\r\n"
+    "  <HEAD>\r\n"
+    "    <TITLE>Request Entity Too Large</TITLE>\r\n"
+    "  </HEAD>\r\n"
+    "  <BODY>\r\n"
+    "    <P>HTTP request body is too large.\r\n"
+    "  </BODY>\r\n"
+    "</HTML>\r\n"
+    "\r\n";
+
+static const char* unavailableMsg =
+    "HTTP/1.0 503 Service Unavailable\r\n"
+    "Content-Type: text/html\r\n"
+    "Content-Length: 142\r\n"
+    "\r\n"
+    "<HTML>\r\n"
+    "  <HEAD>\r\n"
+    "    <TITLE>Service Unavailable</TITLE>\r\n"
+    "  </HEAD>\r\n"
+    "  <BODY>\r\n"
+    "    <P>HTTP request could not be handled.\r\n"
+    "  </BODY>\r\n"
+    "</HTML>\r\n"
+    "\r\n";
+
+/*
+ * Runs a request handler on the server's ThreadPool
+ */
+class HttpHandlerTask : public Runnable
+{
+public:
+    HttpHandlerTask(HttpServer* httpServer,
+                    HttpServer::httpHandler_func handler,
+                    HttpSession* session) :
+        _httpServer(httpServer),
+        _handler(handler),
+        _session(session)
+    {}
+
+    void run()
+    {
+        _handler(*_httpServer, *_session);
+    }
+
+private:
+    HttpServer* _httpServer;
+    HttpServer::httpHandler_func _handler;
+    HttpSession* _session;
+};
+
 static const char* notImplMsg = 
     "HTTP/1.0 501 Method Not Implemented\r\n"
     "Content-Type: text/html\r\n"
@@ -53,55 +113,130 @@ static const char* notImplMsg =
     "</HTML>\r\n"
     "\r\n";
 
-/*! \brief  Given a header line, this checks for a matching key. If the key
- *          does match, it returns a StringRef containing the value portion
- *          of the string. If it doesn't match, returns empty string.
+/*! \brief  Drops the whitespace around the value of a header. The name
+ *          has none, as addHeaderLine() rejects it.
  *
- * Example: headerMatchExtract("Content-Length: 400", "content-length");
- *          Should return a StringRef containing the substring "400"
+ * Example: "Content-Length: 400 " gives "Content-Length" and "400"
+ *
+ * \param headerData    Header bytes of the session
+ * \param header        Header to trim
+ */
+void HttpServer::trimHeader(const char* headerData,
+                            HttpHeader* header)
+{
+    const char* value = headerData + header->valueStart;
+    uint32 valueSkip = 0;
+
+    while (valueSkip < header->valueLen &&
+           (value[valueSkip] == ' ' || value[valueSkip] == '\t'))
+    {
+        valueSkip++;
+    }
+
+    header->valueStart += valueSkip;
+    header->valueLen -= valueSkip;
+    value += valueSkip;
+
+    while (header->valueLen > 0 &&
+           (value[header->valueLen-1] == ' ' || value[header->valueLen-1] == '\t'))
+    {
+        header->valueLen--;
+    }
+}
+
+/*! \brief  Copies a header line into the header bytes of a session. A line
+ *          starting with whitespace continues the value of the previous
+ *          header.
  *
- * \param headerLine    The full header line from the client
- * \param expectedKey   Name we are expecting to match
- * \param Extracted value or empty string on error
+ * \param session       Session being read
+ * \param line          The full header line from the client
+ * \param colon         Offset of the first ':' in the line
+ * \return False if the line is invalid or there are too many headers
  */
-StringRef HttpServer::headerMatchExtract(const StringRef headerLine,
-                                         const StringRef expectedKey)
+bool HttpServer::addHeaderLine(HttpSession*    session,
+                               const StringRef line,
+                               size_t          colon)
 {
-    size_t        i;
+    size_t dataLen = session->headerData.size();
 
-    size_t headerLen = headerLine.length();
-    size_t expectedLen = expectedKey.length();
+    if (dataLen + line.length() > HTTP_MAX_HEADER_BYTES)
+        return false;
 
-    for (i = 0;
-         i < expectedLen &&
-         i < headerLen &&
-         headerLine.charAt(i) != ':' &&
-         !isspace(headerLine.charAt(i));
-         i++)
+    if (line.charAt(0) == ' ' ||
+        line.charAt(0) == '\t')
     {
-        char a = tolower(expectedKey.charAt(i));
-        char b = tolower(headerLine.charAt(i));
+        // Of course it makes no sense if it's the first header line
+        if (session->headers.isEmpty())
+            return false;
+
+        // The previous header's line is the last in headerData
+        session->headerData.addBlockBack(line.data(), line.length());
+        session->headers.back().valueLen += (uint32)line.length();
+        return true;
+    }
+
+    // If they exceeded the maximum number of headers, reject the request
+    if (session->headers.size() >= HTTP_MAX_REQUEST_HEADERS)
+        return false;
 
-        if (a != b)
-            return "";
+    // Every header line has a name followed by a colon. Whitespace
+    // between them isn't allowed, as proxies differ on what the name is.
+    if (colon >= line.length() ||
+        colon == 0 ||
+        line.charAt(colon - 1) == ' ' ||
+        line.charAt(colon - 1) == '\t')
+    {
+        return false;
     }
 
-    while (isspace(headerLine.charAt(i)))
-        i++;
+    HttpHeader header;
+
+    header.nameStart = (uint32)dataLen;
+    header.nameLen = (uint32)colon;
+    header.valueStart = (uint32)(dataLen + colon + 1);
+    header.valueLen = (uint32)(line.length() - colon - 1);
+
+    session->headerData.addBlockBack(line.data(), line.length());
+    session->headers.addBack(header);
+    return true;
+}
+
+/*! \brief  Checks if a comma separated header value, such as that of the
+ *          Connection header, contains the passed token. Case insensitive.
+ *
+ * \param value   Header value
+ * \param token   Token to look for
+ * \return True if the token is present
+ */
+bool HttpServer::headerHasToken(const StringRef value,
+                                const StringRef token)
+{
+    size_t valueLen = value.length();
+    size_t pos = 0;
 
-    if (i < expectedLen &&
-        headerLine.charAt(i) == ':')
+    while (pos < valueLen)
     {
-        size_t resStart = i + 1;
+        // Skip separators
+        while (pos < valueLen &&
+               (value.charAt(pos) == ',' || isspace(value.charAt(pos))))
+        {
+            pos++;
+        }
 
-        while (isspace(headerLine.charAt(resStart)))
-            resStart++;
+        size_t tokenStart = pos;
+
+        while (pos < valueLen &&
+               value.charAt(pos) != ',' &&
+               !isspace(value.charAt(pos)))
+        {
+            pos++;
+        }
 
-        return StringRef(headerLine.data() + resStart,
-                         headerLine.length() - resStart);
+        if (value.substring(tokenStart, pos).engEqualsIgnoreCase(token))
+            return true;
     }
 
-    return "";
+    return false;
 }
 
 /*! \brief  Parses the first line of the request, extracting the request
@@ -215,9 +350,9 @@ void HttpServer::parseFirstRequestLine(StringRef    line,
     }
 }
 
-/*! \brief Extracts any needed data from the passed HTTP header line.
+/*! \brief Splits the header lines of a request into names and values,
+ *         resolves the well-known headers and extracts any needed data.
  *
- * \param  line         The line to parse
  * \param  session      Session to update with parsed data
  * \param  invalid      Set to true if the header line is invalid
  */
@@ -226,547 +361,1959 @@ void HttpServer::parseHeaders(HttpSession*     session,
 {
     (*invalid) = false;
 
-    // TODO: Should do general check for a :
-    
-    size_t headerCount = session->headerLines.size();
-    
-    for (size_t i = 0; i< headerCount; i++)
+    // Connections persist by default from HTTP/1.1 on
+    bool closeRequested = false;
+    bool keepAliveRequested = false;
+
+    const char* headerData = session->headerData.data();
+    size_t headerCount = session->headers.size();
+
+    // Resolve the well-known headers into their slots. Only the first of a
+    // repeated header is kept, except for Connection, whose tokens combine.
+    // Differing Content-Length values would leave the body length up to
+    // whoever reads the request, so they are rejected.
+    for (size_t i = 0; i < headerCount; i++)
+    {
+        HttpHeader& header = session->headers.get(i);
+
+        trimHeader(headerData, &header);
+
+        StringRef name(headerData + header.nameStart, header.nameLen);
+        StringRef str(headerData + header.valueStart, header.valueLen);
+
+        HttpHeader_enum known = HttpUtil::lookupHeader(name);
+
+        if (known == HTTP_HEADER_UNKNOWN)
+            continue;
+
+        if (known == HTTP_HEADER_CONNECTION)
+        {
+            if (headerHasToken(str, "close"))
+                closeRequested = true;
+            else if (headerHasToken(str, "keep-alive"))
+                keepAliveRequested = true;
+        }
+
+        if (session->knownHeaders[known].data() == NULL)
+        {
+            session->knownHeaders[known] = str;
+        }
+        else if (known == HTTP_HEADER_CONTENT_LENGTH &&
+                 session->knownHeaders[known] != str)
+        {
+            (*invalid) = true;
+            return;
+        }
+    }
+
+    StringRef str = session->knownHeaders[HTTP_HEADER_CONTENT_LENGTH];
+
+    if (str.data() != NULL)
     {
-        String& line = session->headerLines.get(i);
+        bool validSize;
 
-        StringRef str = headerMatchExtract(line, "Content-Length");
+        session->contentLen = UInt32::parseUInt32(str, &validSize);
 
-        if (str.length() != 0)
+        if (!validSize)
         {
-            bool validSize;
+            (*invalid) = true;
+            return;
+        }
+    }
 
-            session->contentLen = UInt32::parseUInt32(str, &validSize);
+    str = session->knownHeaders[HTTP_HEADER_TRANSFER_ENCODING];
 
-            if (!validSize)
-            {
-                (*invalid) = true;
-                return;
-            }
+    if (str.data() != NULL)
+    {
+        // Only chunked is supported, and it must be the final coding.
+        // HTTP/1.0 has no transfer codings, and a request framed both by
+        // chunks and a Content-Length could be split differently by a
+        // proxy in front of the server, so both are rejected.
+        if (!str.engEqualsIgnoreCase("chunked") ||
+            session->httpProt == HTTP_PROT_10 ||
+            session->knownHeaders[HTTP_HEADER_CONTENT_LENGTH].data() != NULL)
+        {
+            (*invalid) = true;
+            return;
         }
+
+        session->chunkedRequest = true;
     }
+
+    session->expectContinue =
+        session->knownHeaders[HTTP_HEADER_EXPECT].engEqualsIgnoreCase("100-continue");
+
+    if (session->httpProt == HTTP_PROT_11)
+        session->keepAlive = !closeRequested;
+    else
+        session->keepAlive = keepAliveRequested;
 }
 
 /*! \brief Adds a block of data to be written to the session as part of the
- *         response. Will be written after all already added data.
- *
- * TODO: May may more sense to require the response lock to be locked and
- * pass a _writeEntry in.
+ *         response. Will be written after all already added data. Data of
+ *         a session is held back until the responses to all earlier
+ *         requests on the connection have been completed.
  *
  * \param  session     Session to have response data added
  * \param  data        Data to add to response
  * \param  dataLen     Length of data
  * \param  freeData    If data should be freed once written
  * \param  lastData    If this is the last part of the response data
+ * \param  flush       If queued data should be written now. Otherwise it
+ *                     is held so it goes out with the data added next.
+ *                     The last data is always flushed.
  */
 void HttpServer::addWriteData(HttpSession* session,
                               char*        data,
                               size_t       dataLen,
                               bool         freeData,
-                              bool         lastData)
+                              bool         lastData,
+                              bool         flush)
 {
-    WriteEntry* newEntry = new WriteEntry();
-
-    newEntry->data = data;
-    newEntry->dataLen = dataLen;
-    newEntry->freeData = freeData;
+    WriteEntry* newEntry = NULL;
 
-    session->lock.lock();
-
-    // Flag as the writes being complete if this is the last write data
-    session->writesComplete = lastData;
-
-    // TODO: Only queue if busy writing?
-    // Add entry to linked list of data to write
-    if (session->writeListTail == NULL)
+    // Empty data only marks the end of the response
+    if (dataLen != 0)
     {
-        session->writeListHead = newEntry;
-        session->writeListTail = newEntry;
+        newEntry = newWriteEntry(session->_connection);
+
+        newEntry->data = data;
+        newEntry->dataLen = dataLen;
+        newEntry->freeData = freeData;
     }
-    else
+    else if (freeData)
     {
-        session->writeListTail->next = newEntry;
-        session->writeListTail = newEntry;
+        delete[] data;
     }
 
-    // If there is no current write active, fire one off
-    if (!session->writeActive)
+    addWriteEntry(session, newEntry, lastData, flush);
+}
+
+/*! \brief Adds part of a file to be written to the session as part of
+ *         the response. The file is sent with the socket's sendfile
+ *         support, without being read into memory.
+ *
+ * \param  session     Session to have response data added
+ * \param  file        Open file to send from. Deleted once written.
+ * \param  pos         Offset of the first byte to send
+ * \param  len         Number of bytes to send
+ * \param  lastData    If this is the last part of the response data
+ */
+void HttpServer::addWriteFile(HttpSession* session,
+                              AioFile*     file,
+                              uint64       pos,
+                              uint64       len,
+                              bool         lastData)
+{
+    // A single socket operation can only send so much, longer ranges are
+    // split over several entries. Only the last one owns the file.
+    while (len > HTTP_MAX_SENDFILE_LEN)
     {
-        session->writeActive = true;
+        WriteEntry* newEntry = newWriteEntry(session->_connection);
+
+        newEntry->dataLen = HTTP_MAX_SENDFILE_LEN;
+        newEntry->file = file;
+        newEntry->fileOffset = pos;
 
-        SocketService* socketService = session->_socketService;
+        addWriteEntry(session, newEntry, false, false);
 
-        socketService->socketWrite(&session->_socket,
-                                   writeCallback,
-                                   session,
-                                   session->writeListHead->data,
-                                   session->writeListHead->dataLen);
+        pos += HTTP_MAX_SENDFILE_LEN;
+        len -= HTTP_MAX_SENDFILE_LEN;
     }
 
-    session->lock.unlock();
-}
+    WriteEntry* newEntry = newWriteEntry(session->_connection);
 
-void HttpServer::sendRequestFailure(HttpSession* session,
-                                    StringRef    message)
-{
-    addWriteData(session,
-                 (char*)message.data(),
-                 message.length(),
-                 false,
-                 true);
+    newEntry->dataLen = (size_t)len;
+    newEntry->file = file;
+    newEntry->fileOffset = pos;
+    newEntry->freeFile = true;
+
+    addWriteEntry(session, newEntry, lastData, true);
 }
 
-/*! \brief Attempts to read a line into the session's line buffer.
+/*! \brief Adds an entry to the response of the session. The entry is
+ *         freed once written.
  *
- *  \param  session   Session to read into
- *  \param  invalid   Indicates if the line is somehow invalid
+ * \param  session     Session to have response data added
+ * \param  entry       Entry to add, or NULL to add nothing
+ * \param  lastData    If this is the last part of the response data
+ * \param  flush       If queued data should be written now
  */
-StringRef HttpServer::tryReadLine(HttpSession* session,
-                                  size_t       bytesRead,
-                                  bool*        lineCompleted,
-                                  bool*        invalid)
+void HttpServer::addWriteEntry(HttpSession* session,
+                               WriteEntry*  entry,
+                               bool         lastData,
+                               bool         flush)
 {
-    (*lineCompleted) = false;
-    (*invalid) = false;
+    HttpConnection* connection = session->_connection;
+    bool resumeRead = false;
+    bool close = false;
+    bool destroy = false;
+
+    connection->lock.lock();
+
+    // A response completed ahead of its streamed body skips the rest of the
+    // body, so nothing more can be read from the connection. If the body
+    // is being read, the reading side stops once it sees the response.
+    if (lastData &&
+        session->streamBody &&
+        session->bodyState != BODY_DONE)
+    {
+        session->keepAlive = false;
+
+        if (session->bodyState == BODY_WAITING)
+            endStreamedBody(connection, session);
+    }
 
-    // Scan for illegal bytes and the newline at the same time. It's
-    // particularly important to reject null characters to avoid security
-    // issues when passing strings to OS functions.
-    size_t i;
-    for (i = session->lineBufferIndex;
-         i < session->lineBufferFilled;
-         i++)
+    // The connection failed. Keep accepting data from the handler until the
+    // response is complete, then free the session.
+    if (connection->isClosing)
     {
-        char c = session->lineBuffer[i];
+        if (entry != NULL)
+            freeWriteEntry(connection, entry);
 
-        if (c == '\n')
+        if (lastData)
         {
-            size_t lineEnd = i;
+            session->writesComplete = true;
+            advanceResponses(connection, &resumeRead);
+        }
 
-            if (i != 0 &&
-                session->lineBuffer[i-1] == '\r')
-            {
-                lineEnd--;
-            }
+        destroy = canDestroyConnection(connection);
+
+        connection->lock.unlock();
+
+        if (destroy)
+            destroyConnection(connection);
+
+        return;
+    }
 
-            session->lineBufferIndex = i+1;
-            (*lineCompleted) = true;
-            return StringRef(session->lineBuffer, lineEnd);
+    if (entry != NULL)
+    {
+        if (session == connection->responseHead)
+        {
+            queueWrite(connection, entry);
         }
-        else if (c < 30 &&
-                 c != '\r' &&
-                 c != '\t')
+        else if (session->writeListTail == NULL)
         {
-            (*invalid) = true;
-            return StringRef();
+            session->writeListHead = entry;
+            session->writeListTail = entry;
+        }
+        else
+        {
+            session->writeListTail->next = entry;
+            session->writeListTail = entry;
         }
     }
 
-    // If haven't yet found end of line and hit end of buffer, mark as
-    // invalid. The line is too long.
-    if (i == sizeof(session->lineBuffer))
+    if ((flush || lastData) && session == connection->responseHead)
+        startWrite(connection);
+
+    // Flag as the writes being complete if this is the last write data
+    if (lastData)
     {
-        (*invalid) = true;
+        session->writesComplete = true;
+        close = advanceResponses(connection, &resumeRead);
     }
 
-    session->lineBufferIndex = i;
-    return StringRef();
+    connection->lock.unlock();
+
+    if (close)
+    {
+        closeConnection(connection);
+    }
+    else if (resumeRead)
+    {
+        processInput(connection);
+    }
 }
 
-/*! \brief Flushes any line in session->lineBuffer and moves bytes past the
- *         end of line to the start of the buffer.
- *
- *  \param  session    The session to flush the line from
+/*
+ * Spares kept by each thread for the connections it serves, used without
+ * locking. They are exchanged with the shard HTTP_THREAD_SPARE_BATCH at a
+ * time, and freed when the thread exits.
  */
-void HttpServer::flushLine(HttpSession* session)
+class ThreadSpares
 {
-    // Move data past end of line to start of buffer
-    ::memmove(session->lineBuffer,
-              session->lineBuffer + session->lineBufferIndex,
-              session->lineBufferFilled - session->lineBufferIndex);
+public:
+    SpareList sessions;
+    SpareList entries;
+    SpareList buffers;
+};
 
-    // Adjust indicies
-    session->lineBufferFilled -= session->lineBufferIndex;
-    session->lineBufferIndex = 0;
-}
+static thread_local ThreadSpares threadSpares;
 
-HttpServer::HttpServer()
+/*
+ * Takes a spare from a thread's list. An empty list is refilled from the
+ * shard's with a single lock. Returns NULL if neither has any.
+ */
+static void* takeSpare(SpareList& local,
+                       SpareList& shared,
+                       Mutex&     sharedLock)
 {
-}
+    void* memory = local.take();
 
-HttpServer::~HttpServer()
-{
+    if (memory != NULL)
+        return memory;
 
-}
+    sharedLock.lock();
 
-HttpServer::HttpServer(HttpServer&& other)
-{
-    // TODO
+    while (local.count < HTTP_THREAD_SPARE_BATCH &&
+           shared.count != 0)
+    {
+        local.add(shared.take());
+    }
+
+    sharedLock.unlock();
+
+    return local.take();
 }
 
-HttpServer& HttpServer::operator=(HttpServer&& other)
+/*
+ * Adds a spare to a thread's list. Once the list holds two batches, one is
+ * passed to the shard with a single lock. Any the shard can't keep below
+ * sharedLimit are freed.
+ */
+static void addSpare(SpareList& local,
+                     SpareList& shared,
+                     Mutex&     sharedLock,
+                     uint32     sharedLimit,
+                     void*      memory)
 {
-    // TODO
-    return *this;
+    local.add(memory);
+
+    if (local.count < HTTP_THREAD_SPARE_BATCH * 2)
+        return;
+
+    // Freed once the shard is unlocked
+    SpareList excess;
+
+    sharedLock.lock();
+
+    while (local.count > HTTP_THREAD_SPARE_BATCH)
+    {
+        if (shared.count < sharedLimit)
+            shared.add(local.take());
+        else
+            excess.add(local.take());
+    }
+
+    sharedLock.unlock();
 }
 
-void HttpServer::startServing(SocketService* socketService,
-                              uint32 port,
-                              httpHandler_func handler)
+/*! \brief Creates a session for the next request on a connection, reusing
+ *         the memory of a freed one if there is any.
+ */
+HttpSession* HttpServer::newSession(HttpConnection* connection)
 {
-    _socketService = socketService;
-    _handler = handler;
+    connection->lock.lock();
+    void* memory = connection->spareSessions.take();
+    connection->lock.unlock();
+
+    if (memory == NULL)
+    {
+        HttpShard* shard = connection->_shard;
 
-    // Create some session objects (with sockets) for new connections
-    _pendingSessionIpv4 = new HttpSession();
-    _pendingSessionIpv4->_httpServer = this;
-    _pendingSessionIpv4->_socketService = socketService;
+        memory = takeSpare(threadSpares.sessions,
+                           shard->_spareSessions,
+                           shard->_spareLock);
 
-    _pendingSessionIpv6 = new HttpSession();
-    _pendingSessionIpv6->_httpServer = this;
-    _pendingSessionIpv6->_socketService = socketService;
+        if (memory == NULL)
+            memory = ::operator new(sizeof(HttpSession));
+    }
 
-    // Bind the accept sockets to the designated port
-    // This is the most likely thing to fail
-    _acceptSockIpv4.init(INET_PROT_IPV4);
-    _acceptSockIpv6.init(INET_PROT_IPV6);
+    return new (memory) HttpSession(connection);
+}
 
-    _acceptSockIpv4.bind(INetAddress::getAddrAny(INET_PROT_IPV4), port);
-    _acceptSockIpv6.bind(INetAddress::getAddrAny(INET_PROT_IPV6), port);
+/*! \brief Frees a session, keeping its memory for later requests. Must be
+ *         called with the connection locked.
+ */
+void HttpServer::freeSession(HttpConnection* connection,
+                             HttpSession*    session)
+{
+    session->~HttpSession();
 
-    _acceptSockIpv4.listen();
-    _acceptSockIpv6.listen();
+    if (connection->spareSessions.count < HTTP_CONNECTION_SPARE_SESSIONS)
+    {
+        connection->spareSessions.add(session);
+        return;
+    }
 
-    // Start accepting
-    _socketService->socketAccept(&_acceptSockIpv4,
-                                 &_pendingSessionIpv4->_socket,
-                                 acceptCallback,
-                                 _pendingSessionIpv4);
+    HttpShard* shard = connection->_shard;
 
-    _socketService->socketAccept(&_acceptSockIpv6,
-                                 &_pendingSessionIpv6->_socket,
-                                 acceptCallback,
-                                 _pendingSessionIpv6);
+    addSpare(threadSpares.sessions,
+             shard->_spareSessions,
+             shard->_spareLock,
+             HTTP_SERVER_SPARE_SESSIONS,
+             session);
 }
 
-void HttpServer::shutdown()
+/*! \brief Creates a write entry for a connection, reusing the memory of a
+ *         freed one if there is any.
+ */
+WriteEntry* HttpServer::newWriteEntry(HttpConnection* connection)
 {
-    // We do not shutdown the passed SocketService as we don't own it
-    // But we do depend on it being shut down first
-    // TODO: Add check
+    connection->lock.lock();
+    void* memory = connection->spareEntries.take();
+    connection->lock.unlock();
 
-    // Close accepting sockets
-    if (_pendingSessionIpv4 != NULL)
+    if (memory == NULL)
     {
-        _pendingSessionIpv4->_socket.close();
-        delete _pendingSessionIpv4;
+        HttpShard* shard = connection->_shard;
+
+        memory = takeSpare(threadSpares.entries,
+                           shard->_spareEntries,
+                           shard->_spareLock);
+
+        if (memory == NULL)
+            memory = ::operator new(sizeof(WriteEntry));
     }
 
-    if (_pendingSessionIpv6 != NULL)
+    return new (memory) WriteEntry();
+}
+
+/*! \brief Frees a write entry, keeping its memory for later writes. Must
+ *         be called with the connection locked.
+ */
+void HttpServer::freeWriteEntry(HttpConnection* connection,
+                                WriteEntry*     entry)
+{
+    entry->~WriteEntry();
+
+    if (connection->spareEntries.count < HTTP_CONNECTION_SPARE_ENTRIES)
     {
-        _pendingSessionIpv6->_socket.close();
-        delete _pendingSessionIpv6;
+        connection->spareEntries.add(entry);
+        return;
     }
+
+    HttpShard* shard = connection->_shard;
+
+    addSpare(threadSpares.entries,
+             shard->_spareEntries,
+             shard->_spareLock,
+             HTTP_SERVER_SPARE_ENTRIES,
+             entry);
 }
 
-void HttpServer::acceptCallback(AioSocket* aioSocket,
-                                AioSocket* acceptedSocket,
-                                void* userData,
-                                const Error& error)
+/*! \brief Gives a connection a line buffer to read into if it has none,
+ *         reusing one released by an idle connection if there is any.
+ */
+void HttpServer::attachLineBuffer(HttpConnection* connection)
 {
-    HttpSession* session = (HttpSession*)userData;
+    if (connection->lineBuffer != NULL)
+        return;
 
+    HttpShard* shard = connection->_shard;
 
-    Console::outln("acceptCallback");
+    void* memory = takeSpare(threadSpares.buffers,
+                             shard->_spareBuffers,
+                             shard->_spareLock);
 
-    if (error.isSet())
-    {
-        Console::outln(String("acceptCallback: ") + error.toString());
+    if (memory == NULL)
+        memory = ::operator new(HTTP_MAX_LINE);
+
+    connection->lineBuffer = (char*)memory;
+}
+
+/*! \brief Passes the line buffer of a connection on for the connections
+ *         that next receive data. Must be called with the connection
+ *         locked, once nothing in the buffer remains to be parsed.
+ */
+void HttpServer::releaseLineBuffer(HttpConnection* connection)
+{
+    if (connection->lineBuffer == NULL)
         return;
-    }
 
-    HttpServer* httpServer = session->_httpServer;
-    SocketService* socketService = httpServer->_socketService;
+    HttpShard* shard = connection->_shard;
 
-    // Start reading
+    addSpare(threadSpares.buffers,
+             shard->_spareBuffers,
+             shard->_spareLock,
+             HTTP_SERVER_SPARE_BUFFERS,
+             connection->lineBuffer);
 
-    socketService->socketRead(acceptedSocket,
-                              readCallback,
-                              session,
-                              session->lineBuffer,
-                              sizeof(session->lineBuffer));
+    connection->lineBuffer = NULL;
+}
 
-    HttpSession* newSession = new HttpSession();
-    newSession->_httpServer = httpServer;
-    newSession->_socketService = socketService;
+/*! \brief Passes the spare sessions and write entries of a connection, and
+ *         its line buffer, on for other connections. Must be called with
+ *         the connection locked, once it is being destroyed.
+ */
+void HttpServer::releaseSpares(HttpConnection* connection)
+{
+    HttpShard* shard = connection->_shard;
 
-    // Create new requests objects and accept again
-    if (aioSocket == &httpServer->_acceptSockIpv4)
-    {
-        httpServer->_pendingSessionIpv4 = newSession;
+    releaseLineBuffer(connection);
 
-        socketService->socketAccept(&httpServer->_acceptSockIpv4,
-                                    &httpServer->_pendingSessionIpv4->_socket,
-                                    acceptCallback,
-                                    httpServer->_pendingSessionIpv4);
-    }
-    else
+    while (connection->spareSessions.count != 0)
     {
-        httpServer->_pendingSessionIpv6 = newSession;
+        addSpare(threadSpares.sessions,
+                 shard->_spareSessions,
+                 shard->_spareLock,
+                 HTTP_SERVER_SPARE_SESSIONS,
+                 connection->spareSessions.take());
+    }
 
-        socketService->socketAccept(&httpServer->_acceptSockIpv6,
-                                    &httpServer->_pendingSessionIpv6->_socket,
-                                    acceptCallback,
-                                    httpServer->_pendingSessionIpv6);
+    while (connection->spareEntries.count != 0)
+    {
+        addSpare(threadSpares.entries,
+                 shard->_spareEntries,
+                 shard->_spareLock,
+                 HTTP_SERVER_SPARE_ENTRIES,
+                 connection->spareEntries.take());
     }
 }
 
-void HttpServer::readCallback(AioSocket* aioSocket,
-                              void* userData,
-                              uint32 bytesTransfered,
-                              const Error& error)
+/*! \brief Adds an entry to the data written to the connection. Nothing
+ *         is written until startWrite() is called. Must be called with the
+ *         connection locked.
+ */
+void HttpServer::queueWrite(HttpConnection* connection,
+                            WriteEntry*     entry)
 {
-    HttpSession* session = (HttpSession*)userData;
-
-    Console::outln("readCallback");
-
-    if (error.isSet())
+    if (connection->writeListTail == NULL)
     {
-        Console::outln(String("readCallback: ") + error.toString());
-        aioSocket->close();
-        return;
+        connection->writeListHead = entry;
+        connection->writeListTail = entry;
+    }
+    else
+    {
+        connection->writeListTail->next = entry;
+        connection->writeListTail = entry;
     }
+}
 
-    // If read 0 bytes, peer closed connection
-    if (bytesTransfered == 0)
+/*! \brief Writes the queued entries of the connection, if there is no
+ *         write active already. Up to HTTP_MAX_WRITE_BUFFERS entries are
+ *         gathered into a single socket write, stopping at an entry that
+ *         sends from a file. Must be called with the connection locked.
+ */
+void HttpServer::startWrite(HttpConnection* connection)
+{
+    if (connection->writeActive ||
+        connection->writeListHead == NULL)
     {
-        // TODO: Need to reference count
-        //aioSocket->close();
         return;
     }
 
-    // Call readHandler to parse the data
-    bool keepSock = readHandler(session,
-                                aioSocket,
-                                bytesTransfered);
+    WriteEntry* head = connection->writeListHead;
 
-    // Close socket if indicated
-    if (!keepSock)
+    // File content is sent on its own
+    if (head->file != NULL)
     {
-        aioSocket->close();
+        connection->writeBufferCount = 1;
+        connection->writeActive = true;
+
+        connection->_socketService->socketSendFile(&connection->_socket,
+                                                   writeCallback,
+                                                   connection,
+                                                   head->file,
+                                                   head->fileOffset,
+                                                   (uint32)head->dataLen);
         return;
     }
 
-    // Trigger new read
-    if (session->state == READING_BODY)
-    {
-        session->_socketService->socketRead(&session->_socket,
-                                            readCallback,
-                                            session,
-                                            session->content + session->contentIndex,
-                                            session->contentLen - session->contentIndex);
-    }
-    else if (session->state != RESPONDING)
+    uint32 count = 0;
+
+    for (WriteEntry* entry = head;
+         entry != NULL && entry->file == NULL && count < HTTP_MAX_WRITE_BUFFERS;
+         entry = entry->next)
     {
-        session->_socketService->socketRead(&session->_socket,
-                                            readCallback,
-                                            session,
-                                            session->lineBuffer + session->lineBufferFilled,
-                                            sizeof(session->lineBuffer) - session->lineBufferFilled);
+        connection->writeBuffers[count].data = entry->data;
+        connection->writeBuffers[count].dataLen = (uint32)entry->dataLen;
+        count++;
     }
+
+    connection->writeBufferCount = count;
+    connection->writeActive = true;
+
+    connection->_socketService->socketWriteV(&connection->_socket,
+                                             writeCallback,
+                                             connection,
+                                             connection->writeBuffers,
+                                             count);
 }
 
-bool HttpServer::readHandler(HttpSession* session,
-                             AioSocket* aioSocket,
-                             uint32 bytesTransfered)
+/*! \brief Frees the completed sessions at the head of the response queue
+ *         and passes the data buffered by the next session to the socket.
+ *         Must be called with the connection locked.
+ *
+ *  \param  connection   Connection to advance
+ *  \param  resumeRead   Set if reading was paused and should now resume
+ *  \return True if the connection should be closed now
+ */
+bool HttpServer::advanceResponses(HttpConnection* connection,
+                                  bool*           resumeRead)
 {
-    bool lineCompleted;
-    bool invalid;
-    
-    // If in state of reading first line of request
-    if (session->state == READING_FIRST_LINE)
+    (*resumeRead) = false;
+
+    // A session streaming its body is still used by the reading side
+    while (connection->responseHead != NULL &&
+           connection->responseHead->writesComplete &&
+           (!connection->responseHead->streamBody ||
+            connection->responseHead->bodyState == BODY_DONE))
     {
-        session->lineBufferFilled += bytesTransfered;
+        HttpSession* session = connection->responseHead;
 
-        StringRef line = tryReadLine(session,
-                                     bytesTransfered,
+        connection->responseHead = session->next;
+        connection->responseCount--;
+
+        if (connection->responseHead == NULL)
+            connection->responseTail = NULL;
+
+        if (!session->keepAlive)
+            connection->closeAfterWrites = true;
+
+        freeSession(connection, session);
+
+        // Send whatever the new head has already buffered
+        HttpSession* nextSession = connection->responseHead;
+
+        if (nextSession == NULL)
+            break;
+
+        while (nextSession->writeListHead != NULL)
+        {
+            WriteEntry* entry = nextSession->writeListHead;
+            nextSession->writeListHead = entry->next;
+            entry->next = NULL;
+
+            if (connection->isClosing)
+            {
+                freeWriteEntry(connection, entry);
+            }
+            else
+            {
+                queueWrite(connection, entry);
+            }
+        }
+
+        nextSession->writeListTail = NULL;
+    }
+
+    if (connection->isClosing)
+        return false;
+
+    startWrite(connection);
+
+    if (connection->readPaused &&
+        connection->responseCount < HTTP_MAX_PIPELINE)
+    {
+        connection->readPaused = false;
+        connection->readActive = true;
+        (*resumeRead) = true;
+    }
+
+    return (connection->closeAfterWrites &&
+            !connection->writeActive);
+}
+
+/*! \brief Responds to a request that couldn't be parsed with a canned
+ *         error response. The connection is closed once it has been
+ *         written.
+ */
+void HttpServer::sendRequestFailure(HttpConnection* connection,
+                                    HttpSession*    session,
+                                    StringRef       message)
+{
+    session->state = RESPONDING;
+    session->keepAlive = false;
+
+    connection->lock.lock();
+
+    if (connection->responseTail == NULL)
+        connection->responseHead = session;
+    else
+        connection->responseTail->next = session;
+
+    connection->responseTail = session;
+    connection->responseCount++;
+
+    // No further requests are read
+    connection->readActive = false;
+
+    connection->lock.unlock();
+
+    addWriteData(session,
+                 (char*)message.data(),
+                 message.length(),
+                 false,
+                 true,
+                 true);
+}
+
+/*! \brief Attempts to read a line into the connection's line buffer.
+ *
+ *  \param  connection   Connection to read from
+ *  \param  invalid      Indicates if the line is somehow invalid
+ */
+StringRef HttpServer::tryReadLine(HttpConnection* connection,
+                                  size_t          bytesRead,
+                                  bool*           lineCompleted,
+                                  bool*           invalid)
+{
+    (*lineCompleted) = false;
+    (*invalid) = false;
+
+    // Scan for illegal bytes, the newline and the colon of a header at
+    // the same time. It's particularly important to reject null characters
+    // to avoid security issues when passing strings to OS functions.
+    const char* colon;
+    const char* stop = HttpScan::scanLine(connection->lineBuffer + connection->lineBufferIndex,
+                                          connection->lineBuffer + connection->lineBufferFilled,
+                                          &colon);
+
+    if (colon != NULL &&
+        connection->lineColon == HTTP_MAX_LINE)
+    {
+        connection->lineColon = colon - connection->lineBuffer;
+    }
+
+    size_t i = stop - connection->lineBuffer;
+
+    if (i < connection->lineBufferFilled)
+    {
+        if ((*stop) != '\n')
+        {
+            (*invalid) = true;
+            return StringRef();
+        }
+
+        size_t lineEnd = i;
+
+        if (i != 0 &&
+            connection->lineBuffer[i-1] == '\r')
+        {
+            lineEnd--;
+        }
+
+        connection->lineBufferIndex = i+1;
+        (*lineCompleted) = true;
+        return StringRef(connection->lineBuffer, lineEnd);
+    }
+
+    // If haven't yet found end of line and hit end of buffer, mark as
+    // invalid. The line is too long.
+    if (i == HTTP_MAX_LINE)
+    {
+        (*invalid) = true;
+    }
+
+    connection->lineBufferIndex = i;
+    return StringRef();
+}
+
+/*! \brief Flushes any line in connection->lineBuffer and moves bytes past
+ *         the end of line to the start of the buffer.
+ *
+ *  \param  connection    The connection to flush the line from
+ */
+void HttpServer::flushLine(HttpConnection* connection)
+{
+    // Move data past end of line to start of buffer
+    ::memmove(connection->lineBuffer,
+              connection->lineBuffer + connection->lineBufferIndex,
+              connection->lineBufferFilled - connection->lineBufferIndex);
+
+    // Adjust indicies
+    connection->lineBufferFilled -= connection->lineBufferIndex;
+    connection->lineBufferIndex = 0;
+    connection->lineColon = HTTP_MAX_LINE;
+}
+
+HttpServer::HttpServer() :
+    _threadPool(NULL),
+    _streamBodies(false)
+{
+}
+
+HttpServer::~HttpServer()
+{
+    for (size_t i = 0; i < _shards.size(); i++)
+        delete _shards.get(i);
+}
+
+HttpServer::HttpServer(HttpServer&& other)
+{
+    // TODO
+}
+
+HttpServer& HttpServer::operator=(HttpServer&& other)
+{
+    // TODO
+    return *this;
+}
+
+void HttpServer::startServing(SocketService* socketService,
+                              uint32 port,
+                              httpHandler_func handler)
+{
+    startServing(&socketService, 1, port, handler);
+}
+
+void HttpServer::startServing(SocketService** socketServices,
+                              uint32 serviceCount,
+                              uint32 port,
+                              httpHandler_func handler)
+{
+    if (serviceCount == 0)
+        throw SystemException("HttpServer needs a SocketService to run on");
+
+    _defaultRoute.handler = handler;
+    _defaultRoute.dispatch = HTTP_DISPATCH_POOL;
+
+    // A single service keeps the port to itself
+    bool reusePort = (serviceCount > 1);
+
+    // Bind the accept sockets of every shard to the designated port before
+    // accepting on any. This is the most likely thing to fail.
+    for (uint32 i = 0; i < serviceCount; i++)
+    {
+        HttpShard* shard = new HttpShard(this, socketServices[i]);
+        _shards.addBack(shard);
+
+        shard->_acceptSockIpv4.init(INET_PROT_IPV4);
+        shard->_acceptSockIpv6.init(INET_PROT_IPV6);
+
+        if (reusePort)
+        {
+            shard->_acceptSockIpv4.setReusePort();
+            shard->_acceptSockIpv6.setReusePort();
+        }
+
+        shard->_acceptSockIpv4.bind(INetAddress::getAddrAny(INET_PROT_IPV4), port);
+        shard->_acceptSockIpv6.bind(INetAddress::getAddrAny(INET_PROT_IPV6), port);
+
+        shard->_acceptSockIpv4.listen();
+        shard->_acceptSockIpv6.listen();
+    }
+
+    for (uint32 i = 0; i < serviceCount; i++)
+    {
+        HttpShard* shard = _shards.get(i);
+        SocketService* socketService = shard->_socketService;
+
+        // Create some connection objects (with sockets) for new connections
+        shard->_pendingConnectionIpv4 = new HttpConnection(shard);
+        shard->_pendingConnectionIpv6 = new HttpConnection(shard);
+
+        // Start accepting
+        socketService->socketAccept(&shard->_acceptSockIpv4,
+                                    &shard->_pendingConnectionIpv4->_socket,
+                                    acceptCallback,
+                                    shard->_pendingConnectionIpv4);
+
+        socketService->socketAccept(&shard->_acceptSockIpv6,
+                                    &shard->_pendingConnectionIpv6->_socket,
+                                    acceptCallback,
+                                    shard->_pendingConnectionIpv6);
+    }
+}
+
+void HttpServer::shutdown()
+{
+    // We do not shutdown the passed SocketService as we don't own it
+    // But we do depend on it being shut down first
+    // TODO: Add check
+
+    for (size_t i = 0; i < _shards.size(); i++)
+    {
+        HttpShard* shard = _shards.get(i);
+
+        // Close accepting sockets before freeing the connections their
+        // accepts would complete into
+        shard->_acceptSockIpv4.close();
+        shard->_acceptSockIpv6.close();
+
+        if (shard->_pendingConnectionIpv4 != NULL)
+        {
+            shard->_pendingConnectionIpv4->_socket.close();
+            delete shard->_pendingConnectionIpv4;
+            shard->_pendingConnectionIpv4 = NULL;
+        }
+
+        if (shard->_pendingConnectionIpv6 != NULL)
+        {
+            shard->_pendingConnectionIpv6->_socket.close();
+            delete shard->_pendingConnectionIpv6;
+            shard->_pendingConnectionIpv6 = NULL;
+        }
+    }
+}
+
+void HttpServer::setBodyStreaming(bool enabled)
+{
+    _streamBodies = enabled;
+}
+
+void HttpServer::setThreadPool(ThreadPool* threadPool)
+{
+    _threadPool = threadPool;
+}
+
+void HttpServer::addRoute(const StringRef& pattern,
+                          httpHandler_func handler,
+                          HttpDispatch_enum dispatch)
+{
+    _router.addRoute(pattern, handler, dispatch);
+}
+
+void HttpServer::acceptCallback(AioSocket* aioSocket,
+                                AioSocket* acceptedSocket,
+                                void* userData,
+                                const Error& error)
+{
+    HttpConnection* connection = (HttpConnection*)userData;
+
+    if (error.isSet())
+    {
+        Console::outln(String("acceptCallback: ") + error.toString());
+        return;
+    }
+
+    HttpShard* shard = connection->_shard;
+    SocketService* socketService = shard->_socketService;
+
+    // Start reading
+    connection->readActive = true;
+    startRead(connection);
+
+    HttpConnection* newConnection = new HttpConnection(shard);
+
+    // Create new connection objects and accept again
+    if (aioSocket == &shard->_acceptSockIpv4)
+    {
+        shard->_pendingConnectionIpv4 = newConnection;
+
+        socketService->socketAccept(&shard->_acceptSockIpv4,
+                                    &newConnection->_socket,
+                                    acceptCallback,
+                                    newConnection);
+    }
+    else
+    {
+        shard->_pendingConnectionIpv6 = newConnection;
+
+        socketService->socketAccept(&shard->_acceptSockIpv6,
+                                    &newConnection->_socket,
+                                    acceptCallback,
+                                    newConnection);
+    }
+}
+
+void HttpServer::readCallback(AioSocket* aioSocket,
+                              void* userData,
+                              uint32 bytesTransfered,
+                              const Error& error)
+{
+    HttpConnection* connection = (HttpConnection*)userData;
+
+    if (error.isSet() ||
+        bytesTransfered == 0)
+    {
+        if (error.isSet())
+            Console::outln(String("readCallback: ") + error.toString());
+
+        HttpSession* session = connection->reading;
+
+        // Let the handler know its body won't arrive
+        if (session != NULL && session->streamBody)
+        {
+            Error bodyError = error;
+
+            if (!error.isSet())
+                bodyError = Error(err_connection_shutdown, "HttpServer::readCallback");
+
+            abandonBody(connection, session, bodyError, true);
+            return;
+        }
+
+        // If read 0 bytes, peer closed connection
+        connection->lock.lock();
+        connection->readActive = false;
+        connection->lock.unlock();
+
+        closeConnection(connection);
+        return;
+    }
+
+    HttpSession* session = connection->reading;
+
+    if (!connection->readIntoBody)
+    {
+        connection->lineBufferFilled += bytesTransfered;
+    }
+    else if (session->state == READING_BODY)
+    {
+        session->contentIndex += bytesTransfered;
+    }
+    else if (session->streamBody)
+    {
+        session->contentIndex += bytesTransfered;
+        session->chunkRemaining -= bytesTransfered;
+    }
+    else
+    {
+        session->contentLen += bytesTransfered;
+        session->chunkRemaining -= bytesTransfered;
+    }
+
+    processInput(connection);
+}
+
+/*! \brief Parses whatever has been read so far. Every complete request is
+ *         dispatched to the handler without waiting on the responses to
+ *         earlier ones, then another read is issued.
+ *
+ *  \param  connection    The connection to process
+ */
+void HttpServer::processInput(HttpConnection* connection)
+{
+    HttpServer* httpServer = connection->_httpServer;
+
+    while (true)
+    {
+        // The next request starts with the next bytes read
+        if (connection->reading == NULL)
+        {
+            if (connection->lineBufferFilled == 0)
+            {
+                startRead(connection);
+                return;
+            }
+
+            connection->reading = newSession(connection);
+        }
+
+        HttpSession* session = connection->reading;
+        const char* failure = NULL;
+
+        // The handler already has a request whose body is being read
+        if (session->streamBody)
+        {
+            if (!streamBody(connection, session))
+                return;
+
+            continue;
+        }
+
+        bool requestReady = readHandler(connection, session, &failure);
+
+        if (failure != NULL)
+        {
+            connection->reading = NULL;
+            sendRequestFailure(connection, session, failure);
+            return;
+        }
+
+        if (!requestReady)
+        {
+            startRead(connection);
+            return;
+        }
+
+        // A streamed body is read after the request is dispatched, and
+        // remains the one being read
+        bool streaming = session->streamBody;
+
+        if (!streaming)
+        {
+            connection->reading = NULL;
+            session->state = RESPONDING;
+        }
+
+        bool keepReading = session->keepAlive;
+        bool destroy = false;
+
+        connection->lock.lock();
+
+        if (connection->isClosing)
+        {
+            // Nobody would receive the response
+            connection->reading = NULL;
+            connection->readActive = false;
+            freeSession(connection, session);
+            destroy = canDestroyConnection(connection);
+            connection->lock.unlock();
+
+            if (destroy)
+                destroyConnection(connection);
+
+            return;
+        }
+
+        if (connection->responseTail == NULL)
+            connection->responseHead = session;
+        else
+            connection->responseTail->next = session;
+
+        connection->responseTail = session;
+        connection->responseCount++;
+
+        // Nothing is read past the request that ends the connection. Once
+        // too many responses are outstanding, reading resumes as they are
+        // completed. With a streamed body, this is decided once the body
+        // has been read.
+        if (!streaming)
+        {
+            if (!keepReading)
+            {
+                connection->readActive = false;
+            }
+            else if (connection->responseCount >= HTTP_MAX_PIPELINE)
+            {
+                connection->readActive = false;
+                connection->readPaused = true;
+                keepReading = false;
+            }
+        }
+
+        connection->lock.unlock();
+
+        // The session may be freed once the handler completes the response,
+        // so it must not be touched after this. Nor the connection if this
+        // was the last request read from it.
+        dispatchRequest(httpServer, session);
+
+        if (!keepReading || streaming)
+            return;
+    }
+}
+
+/*! \brief Runs the handler of a request, on the IO thread or queued to
+ *         the ThreadPool as its route asks. If the ThreadPool won't take
+ *         the request, it's answered with a 503 and the connection closes.
+ */
+void HttpServer::dispatchRequest(HttpServer*  httpServer,
+                                 HttpSession* session)
+{
+    // The query string plays no part in routing
+    const HttpRouter::Route* route = httpServer->_router.findRoute(session->getPath(),
+                                                                   session->routeParams);
+
+    if (route == NULL)
+        route = &httpServer->_defaultRoute;
+
+    session->route = route;
+
+    if (route->dispatch == HTTP_DISPATCH_INLINE ||
+        httpServer->_threadPool == NULL)
+    {
+        route->handler(*httpServer, *session);
+        return;
+    }
+
+    HttpHandlerTask* task = new HttpHandlerTask(httpServer,
+                                                route->handler,
+                                                session);
+
+    if (!httpServer->_threadPool->execute(task, true))
+    {
+        delete task;
+
+        session->keepAlive = false;
+
+        addWriteData(session,
+                     (char*)unavailableMsg,
+                     ::strlen(unavailableMsg),
+                     false,
+                     true,
+                     true);
+    }
+}
+
+/*! \brief Consumes buffered request data.
+ *
+ *  \param  connection The connection to parse data from
+ *  \param  session    The request being read
+ *  \param  failure    Set to the response to send if the request is invalid
+ *  \return True once a complete request has been read
+ */
+bool HttpServer::readHandler(HttpConnection* connection,
+                             HttpSession*    session,
+                             const char**    failure)
+{
+    bool lineCompleted;
+    bool invalid;
+
+    (*failure) = NULL;
+
+    // If in state of reading first line of request
+    while (session->state == READING_FIRST_LINE)
+    {
+        StringRef line = tryReadLine(connection,
+                                     0,
                                      &lineCompleted,
                                      &invalid);
-        bytesTransfered = 0;
 
-        if (invalid)
+        if (invalid)
+        {
+            (*failure) = badReqMsg;
+            return false;
+        }
+
+        // Just return if didn't read the full line
+        if (!lineCompleted)
+            return false;
+
+        // Empty lines ahead of a request are ignored. Clients may send one
+        // after a request body.
+        if (line.length() == 0)
+        {
+            flushLine(connection);
+            continue;
+        }
+
+        // Parse the first line
+        parseFirstRequestLine(line, session, &invalid);
+
+        if (invalid)
+        {
+            (*failure) = notImplMsg;
+            return false;
+        }
+
+        // Flush the line read
+        flushLine(connection);
+
+        // Change state to reading header lines
+        session->state = READING_HEADERS;
+    }
+    
+    // If in state of reading headers
+    while (session->state == READING_HEADERS)
+    {
+        // Try to read the line
+        StringRef line = tryReadLine(connection,
+                                     0,
+                                     &lineCompleted,
+                                     &invalid);
+
+        if (invalid)
+        {
+            (*failure) = badReqMsg;
+            return false;
+        }
+
+        // Just return if didn't read the full line
+        if (!lineCompleted)
+            return false;
+
+        // If the line length is 0 it marks the end of headers
+        if (line.length() == 0)
+        {
+            flushLine(connection);
+
+            // Parse the headers for data we need (content-length)
+            parseHeaders(session, &invalid);
+
+            if (invalid)
+            {
+                (*failure) = badReqMsg;
+                return false;
+            }
+
+            if (session->contentLen == 0 &&
+                !session->chunkedRequest &&
+                (session->method == HTTP_PUT ||
+                 session->method == HTTP_POST))
+            {
+                (*failure) = lengthReqMsg;
+                return false;
+            }
+
+            // The handler is called straight away and asks for the body.
+            // The client is told to send it only then.
+            if (connection->_httpServer->_streamBodies &&
+                (session->chunkedRequest || session->contentLen != 0))
+            {
+                uint32 reserved = HTTP_BODY_CHUNK_LEN;
+
+                if (!session->chunkedRequest &&
+                    session->contentLen < reserved)
+                {
+                    reserved = session->contentLen;
+                }
+
+                session->streamBody = true;
+                session->content = new char[reserved];
+                session->contentReserved = reserved;
+
+                if (session->chunkedRequest)
+                    session->state = READING_CHUNK_SIZE;
+                else
+                    session->state = READING_BODY;
+
+                return true;
+            }
+
+            if (session->chunkedRequest)
+            {
+                session->state = READING_CHUNK_SIZE;
+            }
+            else
+            {
+                // Allocate space for the content
+                if (session->contentLen != 0)
+                {
+                    session->content = new char[session->contentLen];
+
+                    // Copy as much as we can from the line buffer. Anything
+                    // past the body belongs to the next request.
+                    size_t copyable = connection->lineBufferFilled;
+
+                    if (copyable > session->contentLen)
+                        copyable = session->contentLen;
+
+                    ::memcpy(session->content,
+                             connection->lineBuffer,
+                             copyable);
+                    session->contentIndex = copyable;
+
+                    connection->lineBufferIndex = copyable;
+                    flushLine(connection);
+                }
+
+                session->state = READING_BODY;
+            }
+
+            // Let the client know to send the body
+            if (session->expectContinue &&
+                session->httpProt == HTTP_PROT_11 &&
+                (session->chunkedRequest ||
+                 session->contentIndex < session->contentLen))
+            {
+                sendContinue(connection, session);
+            }
+
+            break;
+        }
+        else if (!addHeaderLine(session, line, connection->lineColon))
+        {
+            (*failure) = badReqMsg;
+            return false;
+        }
+
+        // Flush the line read
+        flushLine(connection);
+    }
+
+    // Decode as much of a chunked body as has been read. The chunk data is
+    // collected in content.
+    while (session->state != READING_BODY)
+    {
+        if (session->state == READING_CHUNK_DATA)
+        {
+            size_t copyable = connection->lineBufferFilled;
+
+            if (copyable > session->chunkRemaining)
+                copyable = session->chunkRemaining;
+
+            ::memcpy(session->content + session->contentLen,
+                     connection->lineBuffer,
+                     copyable);
+            session->contentLen += copyable;
+            session->chunkRemaining -= copyable;
+
+            connection->lineBufferIndex = copyable;
+            flushLine(connection);
+
+            if (session->chunkRemaining != 0)
+                return false;
+
+            session->state = READING_CHUNK_END;
+            continue;
+        }
+
+        if (!readChunkLine(connection, session, failure))
+            return false;
+
+        if (session->state == READING_BODY)
+        {
+            session->contentIndex = session->contentLen;
+        }
+        else if (session->state == READING_CHUNK_DATA)
+        {
+            if (session->chunkRemaining > HTTP_MAX_CHUNKED_BODY - session->contentLen)
+            {
+                (*failure) = tooLargeMsg;
+                return false;
+            }
+
+            // Grow the body to fit the chunk
+            uint32 needed = session->contentLen + session->chunkRemaining;
+
+            if (needed > session->contentReserved)
+            {
+                uint32 newReserved = session->contentReserved * 2;
+
+                if (newReserved < needed)
+                    newReserved = needed;
+
+                if (newReserved > HTTP_MAX_CHUNKED_BODY)
+                    newReserved = HTTP_MAX_CHUNKED_BODY;
+
+                char* newContent = new char[newReserved];
+
+                ::memcpy(newContent, session->content, session->contentLen);
+                delete[] session->content;
+
+                session->content = newContent;
+                session->contentReserved = newReserved;
+            }
+        }
+    }
+
+    return (session->contentIndex == session->contentLen);
+}
+
+/*! \brief Consumes a line of a chunked body: a chunk size, the CRLF
+ *         following chunk data, or a trailer line. Once a chunk size has
+ *         been read, the state is READING_CHUNK_DATA with chunkRemaining
+ *         set. Once the trailer has been read, the state is READING_BODY.
+ *
+ *  \param  connection The connection to parse data from
+ *  \param  session    The request being read
+ *  \param  failure    Set to the response to send if the line is invalid
+ *  \return True if a line was consumed
+ */
+bool HttpServer::readChunkLine(HttpConnection* connection,
+                               HttpSession*    session,
+                               const char**    failure)
+{
+    bool lineCompleted;
+    bool invalid;
+
+    StringRef line = tryReadLine(connection,
+                                 0,
+                                 &lineCompleted,
+                                 &invalid);
+
+    if (invalid)
+    {
+        (*failure) = badReqMsg;
+        return false;
+    }
+
+    if (!lineCompleted)
+        return false;
+
+    if (session->state == READING_CHUNK_SIZE)
+    {
+        uint32 chunkLen;
+        bool validSize = HttpUtil::parseChunkSize(line, &chunkLen);
+
+        flushLine(connection);
+
+        if (!validSize)
         {
-            sendRequestFailure(session, badReqMsg);
-            return true;
+            (*failure) = badReqMsg;
+            return false;
         }
 
-        // Just return if didn't read the full line
-        if (!lineCompleted)
+        // The last chunk is empty and followed by the trailer
+        if (chunkLen == 0)
         {
-            // Issue another read?
-            return true;
+            session->state = READING_TRAILERS;
+        }
+        else
+        {
+            session->chunkRemaining = chunkLen;
+            session->state = READING_CHUNK_DATA;
+        }
+    }
+    else if (session->state == READING_CHUNK_END)
+    {
+        // Chunk data is followed by a CRLF
+        if (line.length() != 0)
+        {
+            (*failure) = badReqMsg;
+            return false;
         }
 
-        Console::outln(String("Request: ") + line);
+        flushLine(connection);
+        session->state = READING_CHUNK_SIZE;
+    }
+    else
+    {
+        // Trailer fields are ignored, an empty line ends the request
+        bool trailerEnd = (line.length() == 0);
 
-        // Parse the first line
-        parseFirstRequestLine(line, session, &invalid);
+        flushLine(connection);
 
-        if (invalid)
+        if (trailerEnd)
+            session->state = READING_BODY;
+    }
+
+    return true;
+}
+
+/*! \brief Moves buffered body data of a streamed request into the block
+ *         passed to the handler, decoding chunked encoding.
+ *
+ *  \param  connection The connection to parse data from
+ *  \param  session    The request being read
+ *  \param  bodyEnd    Set if the whole body has been read
+ *  \param  failure    Set to the response to send if the body is invalid
+ */
+void HttpServer::readBodyData(HttpConnection* connection,
+                              HttpSession*    session,
+                              bool*           bodyEnd,
+                              const char**    failure)
+{
+    (*bodyEnd) = false;
+    (*failure) = NULL;
+
+    if (!session->chunkedRequest)
+    {
+        // Anything past the body belongs to the next request
+        uint64 bodyLeft = session->contentLen -
+                          session->bodyDelivered -
+                          session->contentIndex;
+        size_t copyable = connection->lineBufferFilled;
+
+        if (copyable > bodyLeft)
+            copyable = (size_t)bodyLeft;
+
+        if (copyable > session->contentReserved - session->contentIndex)
+            copyable = session->contentReserved - session->contentIndex;
+
+        ::memcpy(session->content + session->contentIndex,
+                 connection->lineBuffer,
+                 copyable);
+        session->contentIndex += copyable;
+
+        connection->lineBufferIndex = copyable;
+        flushLine(connection);
+
+        (*bodyEnd) = (bodyLeft == copyable);
+        return;
+    }
+
+    while (session->contentIndex < session->contentReserved)
+    {
+        if (session->state == READING_BODY)
         {
-            sendRequestFailure(session, notImplMsg);
-            return true;
+            (*bodyEnd) = true;
+            return;
         }
 
-        // Flush the line read
-        flushLine(session);
-
-        // If we read a HTTP1.1 header, add a continue response
-        if (session->httpProt == HTTP_PROT_11)
+        if (session->state == READING_CHUNK_DATA)
         {
-            addWriteData(session,
-                         (char*)"HTTP/1.1 100 Continue\r\n\r\n",
-                         25,
-                         false,
-                         false);
+            // The chunk may have been read straight into the block
+            if (session->chunkRemaining == 0)
+            {
+                session->state = READING_CHUNK_END;
+                continue;
+            }
+
+            if (connection->lineBufferFilled == 0)
+                return;
+
+            size_t copyable = connection->lineBufferFilled;
+
+            if (copyable > session->chunkRemaining)
+                copyable = session->chunkRemaining;
+
+            if (copyable > session->contentReserved - session->contentIndex)
+                copyable = session->contentReserved - session->contentIndex;
+
+            ::memcpy(session->content + session->contentIndex,
+                     connection->lineBuffer,
+                     copyable);
+            session->contentIndex += copyable;
+            session->chunkRemaining -= copyable;
+
+            connection->lineBufferIndex = copyable;
+            flushLine(connection);
+
+            continue;
         }
 
-        // Change state to reading header lines
-        session->state = READING_HEADERS;
+        if (!readChunkLine(connection, session, failure))
+            return;
     }
-    
-    // If in state of reading headers
-    if (session->state == READING_HEADERS)
+}
+
+/*! \brief Passes the body of a streamed request to the handler, one block
+ *         at a time. Stops whenever the handler holds a block or more data
+ *         has to be read.
+ *
+ *  \param  connection The connection the body is read from
+ *  \param  session    The request being read
+ *  \return True once the body has been read and reading should continue
+ *          with the next request
+ */
+bool HttpServer::streamBody(HttpConnection* connection,
+                            HttpSession*    session)
+{
+    while (true)
     {
-        session->lineBufferFilled += bytesTransfered;
+        connection->lock.lock();
+        bool responded = session->writesComplete;
+        connection->lock.unlock();
 
-        do
+        // The rest of the body is skipped
+        if (responded)
         {
-            // Try to read the line
-            StringRef line = tryReadLine(session,
-                                         bytesTransfered,
-                                         &lineCompleted,
-                                         &invalid);
-            bytesTransfered = 0;
+            abandonBody(connection, session, Error(), false);
+            return false;
+        }
 
-            if (invalid)
-            {
-                sendRequestFailure(session, badReqMsg);
-                return true;
-            }
+        bool bodyEnd;
+        const char* failure;
 
-            // Just return if didn't read the full line
-            if (!lineCompleted)
-            {
-                // TODO: Issue another read?
-                return true;
-            }
+        readBodyData(connection, session, &bodyEnd, &failure);
 
-            // If the line length is 0 it marks the end of headers
-            if (line.length() == 0)
-            {
-                // Parse the headers for data we need (content-length)
-                parseHeaders(session, &invalid);
+        if (failure != NULL)
+        {
+            // The handler has the request, so it makes the response. The
+            // connection closes after it.
+            abandonBody(connection,
+                        session,
+                        Error(err_protocol_error, "HttpServer::streamBody"),
+                        false);
+            return false;
+        }
 
-                if (invalid)
-                {
-                    sendRequestFailure(session, badReqMsg);
-                    return true;
-                }
+        if (session->contentIndex != 0)
+        {
+            connection->lock.lock();
+            session->bodyState = BODY_DELIVERING;
+            connection->lock.unlock();
 
-                if (session->contentLen == 0 &&
-                    (session->method == HTTP_PUT ||
-                     session->method == HTTP_POST))
-                {
-                    sendRequestFailure(session, lengthReqMsg);
-                    return true;
-                }
+            session->bodyDelivered += session->contentIndex;
 
-                // Allocate space for the content
-                if (session->contentLen != 0)
-                {
-                    session->content = new char[session->contentLen];
+            session->bodyCallback(*session,
+                                  session->bodyUserData,
+                                  session->content,
+                                  session->contentIndex,
+                                  Error());
 
-                    // Copy as much as we can from the line buffer
-                    if (session->lineBufferFilled > 0)
-                    {
-                        size_t copyable = session->lineBufferFilled;
+            // The block itself is left alone until the handler releases it
+            session->contentIndex = 0;
 
-                        if (copyable > session->contentLen)
-                            copyable = session->contentLen;
+            connection->lock.lock();
 
-                        ::memcpy(session->content,
-                                 session->lineBuffer,
-                                 copyable);
-                        session->contentIndex += copyable;
+            bool released = (session->bodyState == BODY_RELEASED);
 
-                        // TODO: Adjust line buffer vars here if reusing session
-                        session->lineBufferFilled = 0;
-                    }
-                }
+            if (released)
+                session->bodyState = BODY_READING;
+            else
+                session->bodyState = BODY_WAITING;
 
-                session->state = READING_BODY;
-            }
-            else if (session->lineBuffer[0] == ' ' ||
-                     session->lineBuffer[0] == '\t')
-            {
-                size_t headerCount = session->headerLines.size();
+            connection->lock.unlock();
 
-                // A space or tab at start of line indicates a header continues on the next line
-                // Of course it makes no sense if it's the first header line
-                if (headerCount == 0)
-                {
-                    sendRequestFailure(session, badReqMsg);
-                    return true;
-                }
+            if (!released)
+                return false;
 
-                // Build a header of the two values appended
-                String& headerLine = session->headerLines.get(headerCount-1);
-                headerLine.append(line);
-            }
-            else
-            {
-                size_t headerCount = session->headerLines.size();
+            continue;
+        }
 
-                // If they exceeded the maximum number of headers, reject the request
-                if (headerCount > HTTP_MAX_REQUEST_HEADERS)
-                {
-                    sendRequestFailure(session, badReqMsg);
-                    return true;
-                }
+        if (!bodyEnd)
+        {
+            startRead(connection);
+            return false;
+        }
 
-                // Make a copy of the header line
-                session->headerLines.addBack(line);
-            }
+        // The body has been read, continue as with any other request
+        bool keepReading = session->keepAlive;
+        bool notify;
+        bool close = false;
+        bool destroy = false;
+        bool resumeRead;
+
+        connection->lock.lock();
+
+        notify = !session->writesComplete;
+        session->bodyState = BODY_DONE;
+        connection->reading = NULL;
 
-            // Flush the line read
-            flushLine(session);
+        if (!keepReading)
+        {
+            connection->readActive = false;
+        }
+        else if (connection->responseCount >= HTTP_MAX_PIPELINE)
+        {
+            connection->readActive = false;
+            connection->readPaused = true;
+            keepReading = false;
+        }
+
+        if (!notify)
+        {
+            close = advanceResponses(connection, &resumeRead);
+            destroy = canDestroyConnection(connection);
+        }
+
+        connection->lock.unlock();
+
+        if (destroy)
+        {
+            destroyConnection(connection);
+            return false;
+        }
+
+        if (close)
+        {
+            closeConnection(connection);
+            return false;
+        }
+
+        // The session may be freed once the handler completes the
+        // response, so it must not be touched after this
+        if (notify)
+        {
+            session->bodyCallback(*session,
+                                  session->bodyUserData,
+                                  NULL,
+                                  0,
+                                  Error());
+        }
 
-        } while (session->state == READING_HEADERS);
+        return keepReading;
     }
+}
+
+/*! \brief Stops reading a streamed request body. The connection is closed
+ *         after the response. Must be called with the connection locked.
+ */
+void HttpServer::endStreamedBody(HttpConnection* connection,
+                                 HttpSession*    session)
+{
+    session->keepAlive = false;
+    session->bodyState = BODY_DONE;
+    connection->reading = NULL;
+    connection->readActive = false;
+}
+
+/*! \brief Stops reading a streamed request body that can't be read to the
+ *         end, and tells the handler unless it has already responded.
+ *
+ *  \param  connection The connection the body is read from
+ *  \param  session    The request being read
+ *  \param  error      Passed to the body callback
+ *  \param  closeNow   If the connection should be closed straight away,
+ *                     rather than after the response
+ */
+void HttpServer::abandonBody(HttpConnection* connection,
+                             HttpSession*    session,
+                             const Error&    error,
+                             bool            closeNow)
+{
+    bool notify;
+    bool close = closeNow;
+    bool destroy = false;
+    bool resumeRead;
+
+    connection->lock.lock();
+
+    notify = !session->writesComplete;
+    endStreamedBody(connection, session);
 
-    if (session->state == READING_BODY)
+    if (!notify)
     {
-        session->contentIndex += bytesTransfered;
+        if (advanceResponses(connection, &resumeRead))
+            close = true;
+
+        destroy = canDestroyConnection(connection);
+    }
+
+    connection->lock.unlock();
 
-        // If we read everything, toss the data into a _httpdWorkerData and
-        // have the thread pool do the callback
-        if (session->contentIndex == session->contentLen)
+    if (destroy)
+    {
+        destroyConnection(connection);
+    }
+    else if (close)
+    {
+        closeConnection(connection);
+    }
+
+    // The session is kept until the handler responds
+    if (notify)
+    {
+        session->bodyCallback(*session,
+                              session->bodyUserData,
+                              NULL,
+                              0,
+                              error);
+    }
+}
+
+/*! \brief Asks the client to send the request body. Skipped while earlier
+ *         responses are outstanding, as it would be sent ahead of them.
+ *         The client sends the body regardless after a short wait.
+ *
+ *  \param  connection    The connection to send on
+ *  \param  session       The request whose body is wanted
+ */
+void HttpServer::sendContinue(HttpConnection* connection,
+                              HttpSession*    session)
+{
+    connection->lock.lock();
+
+    if ((connection->responseHead == NULL ||
+         connection->responseHead == session) &&
+        !connection->isClosing)
+    {
+        WriteEntry* entry = newWriteEntry(connection);
+
+        entry->data = (char*)"HTTP/1.1 100 Continue\r\n\r\n";
+        entry->dataLen = 25;
+
+        queueWrite(connection, entry);
+        startWrite(connection);
+    }
+
+    connection->lock.unlock();
+}
+
+/*! \brief Issues a read for the data the connection is waiting on.
+ *
+ *  \param  connection    The connection to read from
+ */
+void HttpServer::startRead(HttpConnection* connection)
+{
+    HttpSession* session = connection->reading;
+
+    connection->lock.lock();
+
+    // A streamed body is still read, so that the failed read reports the
+    // closed connection to the handler
+    if (connection->isClosing &&
+        !(session != NULL && session->streamBody))
+    {
+        connection->readActive = false;
+        bool destroy = canDestroyConnection(connection);
+        connection->lock.unlock();
+
+        if (destroy)
+            destroyConnection(connection);
+
+        return;
+    }
+
+    // Between requests the connection keeps no session or buffer. They are
+    // taken back once the next request starts to arrive.
+    if (connection->lineBufferFilled == 0 &&
+        (session == NULL || session->state == READING_FIRST_LINE))
+    {
+        if (session != NULL)
         {
-            session->state = RESPONDING;
+            connection->reading = NULL;
+            freeSession(connection, session);
+        }
 
-            session->_httpServer->_handler(*session->_httpServer,
-                                           *session);
+        releaseLineBuffer(connection);
+        connection->lock.unlock();
 
-            return true;
+        connection->_socketService->socketWaitReadable(&connection->_socket,
+                                                       readyCallback,
+                                                       connection);
+        return;
+    }
+
+    connection->lock.unlock();
+
+    // Body data is read straight into place when nothing is buffered
+    connection->readIntoBody = false;
+
+    if (session != NULL && session->streamBody)
+    {
+        // Streamed data is read into the block passed to the handler
+        uint32 readLen = session->contentReserved - session->contentIndex;
+
+        if (session->state == READING_BODY)
+        {
+            uint64 bodyLeft = session->contentLen -
+                              session->bodyDelivered -
+                              session->contentIndex;
+
+            if (readLen > bodyLeft)
+                readLen = (uint32)bodyLeft;
+
+            connection->readIntoBody = true;
+        }
+        else if (session->state == READING_CHUNK_DATA &&
+                 connection->lineBufferFilled == 0)
+        {
+            if (readLen > session->chunkRemaining)
+                readLen = session->chunkRemaining;
+
+            connection->readIntoBody = true;
         }
+
+        if (connection->readIntoBody)
+        {
+            connection->_socketService->socketRead(&connection->_socket,
+                                                   readCallback,
+                                                   connection,
+                                                   session->content + session->contentIndex,
+                                                   readLen);
+        }
+        else
+        {
+            connection->_socketService->socketRead(&connection->_socket,
+                                                   readCallback,
+                                                   connection,
+                                                   connection->lineBuffer + connection->lineBufferFilled,
+                                                   HTTP_MAX_LINE - connection->lineBufferFilled);
+        }
+    }
+    else if (session != NULL && session->state == READING_BODY)
+    {
+        connection->readIntoBody = true;
+        connection->_socketService->socketRead(&connection->_socket,
+                                               readCallback,
+                                               connection,
+                                               session->content + session->contentIndex,
+                                               session->contentLen - session->contentIndex);
+    }
+    else if (session != NULL &&
+             session->state == READING_CHUNK_DATA &&
+             connection->lineBufferFilled == 0)
+    {
+        connection->readIntoBody = true;
+        connection->_socketService->socketRead(&connection->_socket,
+                                               readCallback,
+                                               connection,
+                                               session->content + session->contentLen,
+                                               session->chunkRemaining);
+    }
+    else
+    {
+        connection->_socketService->socketRead(&connection->_socket,
+                                               readCallback,
+                                               connection,
+                                               connection->lineBuffer + connection->lineBufferFilled,
+                                               HTTP_MAX_LINE - connection->lineBufferFilled);
     }
+}
 
-    return false;
+/*! \brief Called once an idle connection has data to read, or has been
+ *         closed. Attaches a line buffer and reads into it.
+ */
+void HttpServer::readyCallback(AioSocket* aioSocket,
+                               void* userData,
+                               uint32 bytesTransfered,
+                               const Error& error)
+{
+    HttpConnection* connection = (HttpConnection*)userData;
+
+    if (error.isSet())
+    {
+        readCallback(aioSocket, userData, 0, error);
+        return;
+    }
+
+    attachLineBuffer(connection);
+
+    connection->readIntoBody = false;
+    connection->_socketService->socketRead(&connection->_socket,
+                                           readCallback,
+                                           connection,
+                                           connection->lineBuffer,
+                                           HTTP_MAX_LINE);
 }
 
 void HttpServer::writeCallback(AioSocket* aioSocket,
@@ -774,58 +2321,167 @@ void HttpServer::writeCallback(AioSocket* aioSocket,
                                uint32 bytesTransfered,
                                const Error& error)
 {
-    HttpSession* session = (HttpSession*)userData;
+    HttpConnection* connection = (HttpConnection*)userData;
+
+    WriteEntry* written = NULL;
+    bool close = false;
+    bool destroy = false;
+
+    connection->lock.lock();
 
-    Console::outln("writeCallback");
+    // Detach the entries that made up the completed write
+    written = connection->writeListHead;
+    WriteEntry* lastWritten = written;
+
+    for (uint32 i = 1; i < connection->writeBufferCount; i++)
+        lastWritten = lastWritten->next;
+
+    connection->writeListHead = lastWritten->next;
+    lastWritten->next = NULL;
+    connection->writeBufferCount = 0;
+
+    if (connection->writeListHead == NULL)
+        connection->writeListTail = NULL;
 
     if (error.isSet())
     {
         Console::outln(String("writeCallback: ") + error.toString());
-        aioSocket->close();
-        return;
+        markClosing(connection);
     }
 
-    WriteEntry* prevHead = NULL;
-    bool sessionComplete = false;
+    if (connection->isClosing)
+    {
+        // Remaining data is freed with the connection
+        connection->writeActive = false;
+        destroy = canDestroyConnection(connection);
+
+        // Wake a pending read so it can finish
+        if (!destroy && connection->readActive)
+            connection->_socket.shutdown();
+    }
+    else if (connection->writeListHead != NULL)
+    {
+        // Trigger new write if we have more data to write at the moment
+        connection->writeActive = false;
+        startWrite(connection);
+    }
+    else
+    {
+        // Note if no longer writing
+        connection->writeActive = false;
 
-    session->lock.lock();
+        // Close once the response that ended the connection is written
+        close = connection->closeAfterWrites;
+    }
+
+    // Free the written entries
+    while (written != NULL)
+    {
+        WriteEntry* entry = written;
+        written = entry->next;
 
-    // Remove current head
-    prevHead = session->writeListHead;
-    session->writeListHead = session->writeListHead->next;
+        freeWriteEntry(connection, entry);
+    }
 
-    if (session->writeListHead == NULL)
-        session->writeListTail = NULL;
+    connection->lock.unlock();
 
-    // Trigger new write if we have more data to write at the moment
-    if (session->writeListHead != NULL)
+    if (destroy)
     {
-        session->_socketService->socketWrite(&session->_socket,
-                                             writeCallback,
-                                             session,
-                                             session->writeListHead->data,
-                                             session->writeListHead->dataLen);
+        destroyConnection(connection);
     }
-    else
+    else if (close)
     {
-        // Note if no longer writing
-        session->writeActive = false;
+        closeConnection(connection);
+    }
+}
+
+/*! \brief Marks the connection as finished. It's freed once no operation
+ *         or handler references it.
+ *
+ *  \param  connection    The connection to close
+ */
+void HttpServer::closeConnection(HttpConnection* connection)
+{
+    connection->lock.lock();
+
+    markClosing(connection);
 
-        // Note if we need to end the session
-        sessionComplete = session->writesComplete;
+    bool destroy = canDestroyConnection(connection);
+
+    // Make pending operations complete rather than wait on the peer
+    if (!destroy &&
+        (connection->readActive || connection->writeActive))
+    {
+        connection->_socket.shutdown();
     }
 
-    session->lock.unlock();
+    connection->lock.unlock();
 
-    // Free the removed WriteEntry
-    if (prevHead->freeData)
-        delete[] prevHead->data;
+    if (destroy)
+        destroyConnection(connection);
+}
+
+/*! \brief Flags the connection as closing and frees the sessions whose
+ *         responses will no longer be sent. Sessions still held by a
+ *         handler are freed as it completes the response. Must be called
+ *         with the connection locked.
+ */
+void HttpServer::markClosing(HttpConnection* connection)
+{
+    if (connection->isClosing)
+        return;
+
+    connection->isClosing = true;
+    connection->readPaused = false;
 
-    delete prevHead;
+    HttpSession* prev = NULL;
+    HttpSession* session = connection->responseHead;
 
-    // Close the session if everything has been written
-    if (sessionComplete)
+    while (session != NULL)
     {
-        aioSocket->close();
+        HttpSession* next = session->next;
+
+        if (session->writesComplete &&
+            (!session->streamBody || session->bodyState == BODY_DONE))
+        {
+            if (prev == NULL)
+                connection->responseHead = next;
+            else
+                prev->next = next;
+
+            connection->responseCount--;
+            freeSession(connection, session);
+        }
+        else
+        {
+            prev = session;
+        }
+
+        session = next;
     }
+
+    connection->responseTail = prev;
+}
+
+/*! \brief Checks if a closing connection can be freed. Must be called with
+ *         the connection locked.
+ */
+bool HttpServer::canDestroyConnection(HttpConnection* connection)
+{
+    return (connection->isClosing &&
+            !connection->readActive &&
+            !connection->writeActive &&
+            connection->responseHead == NULL);
+}
+
+void HttpServer::destroyConnection(HttpConnection* connection)
+{
+    connection->_socket.close();
+
+    // Pass the spares on to newer connections
+    connection->lock.lock();
+    releaseSpares(connection);
+    connection->lock.unlock();
+
+    delete connection;
 }
@@ -2,16 +2,125 @@
 
 #include "ge/http/HttpSession.h"
 
+#include "ge/http/HttpUtil.h"
+#include "ge/io/IOException.h"
+#include "ge/util/UInt64.h"
+
 #include <cstring>
 
-HttpSession::HttpSession()
+static const char* notFoundMsg =
+    "<HTML>\r\n"
+    "<HEAD><TITLE>404 Not Found</TITLE></HEAD>\r\n"
+    "<BODY>\r\n"
+    "<H1>Not Found</H1>\r\n"
+    "The requested file was not found on this server.\r\n"
+    "</BODY>\r\n"
+    "</HTML>\r\n"
+    "\r\n";
+
+/*
+ * Copies bytes to dest, returning the end of the copy.
+ */
+static inline
+char* appendBytes(char* dest,
+                  const char* src,
+                  size_t len)
+{
+    ::memcpy(dest, src, len);
+    return dest + len;
+}
+
+/*
+ * Checks an If-None-Match list of entity tags for the passed one. Weak
+ * comparison is used, as the standard requires for If-None-Match.
+ */
+static
+bool etagListMatches(const StringRef value,
+                     const StringRef etag)
+{
+    size_t valueLen = value.length();
+    size_t pos = 0;
+
+    while (pos < valueLen)
+    {
+        // Skip separators
+        while (pos < valueLen &&
+               (value.charAt(pos) == ',' || value.charAt(pos) == ' ' ||
+                value.charAt(pos) == '\t'))
+        {
+            pos++;
+        }
+
+        size_t tagStart = pos;
+
+        while (pos < valueLen &&
+               value.charAt(pos) != ',' &&
+               value.charAt(pos) != ' ' &&
+               value.charAt(pos) != '\t')
+        {
+            pos++;
+        }
+
+        StringRef tag = value.substring(tagStart, pos);
+
+        if (tag.startsWith("W/"))
+            tag = tag.substring(2);
+
+        if (tag == "*" || tag == etag)
+            return true;
+    }
+
+    return false;
+}
+
+HttpSession::HttpSession(HttpConnection* connection) :
+    _connection(connection),
+    _httpServer(connection->_httpServer),
+    state(READING_FIRST_LINE),
+    httpProt(HTTP_PROT_10),
+    method(HTTP_GET),
+    keepAlive(false),
+    expectContinue(false),
+    route(NULL),
+    content(NULL),
+    contentLen(0),
+    contentIndex(0),
+    chunkedRequest(false),
+    chunkRemaining(0),
+    contentReserved(0),
+    streamBody(false),
+    bodyState(BODY_WAITING),
+    bodyDelivered(0),
+    bodyCallback(NULL),
+    bodyUserData(NULL),
+    spoolService(NULL),
+    spoolFile(NULL),
+    spoolPos(0),
+    spoolWritten(0),
+    spoolData(NULL),
+    spoolDataLen(0),
+    spoolDataIndex(0),
+    spoolCallback(NULL),
+    spoolUserData(NULL),
+    chunkedResponse(false),
+    writeListHead(NULL),
+    writeListTail(NULL),
+    writesComplete(false),
+    next(NULL)
 {
-    reset();
 }
 
 HttpSession::~HttpSession()
 {
+    delete[] content;
 
+    while (writeListHead != NULL)
+    {
+        WriteEntry* entry = writeListHead;
+        writeListHead = entry->next;
+
+        delete entry;
+    }
 }
 
 HttpSession::HttpSession(HttpSession&& other)
@@ -35,32 +144,239 @@ const StringRef HttpSession::getUrl()
     return url;
 }
 
-const List<String>& HttpSession::getHeaderLines()
+StringRef HttpSession::getPath()
+{
+    const char* query = (const char*)::memchr(url.data(), '?', url.length());
+
+    if (query == NULL)
+        return url;
+
+    return StringRef(url.data(), query - url.data());
+}
+
+StringRef HttpSession::getQueryString()
+{
+    const char* query = (const char*)::memchr(url.data(), '?', url.length());
+
+    if (query == NULL)
+        return StringRef();
+
+    query++;
+    return StringRef(query, url.data() + url.length() - query);
+}
+
+bool HttpSession::parseQuery(HttpForm& form)
+{
+    return form.parse(getQueryString());
+}
+
+StringRef HttpSession::getHeader(HttpHeader_enum header)
+{
+    return knownHeaders[header];
+}
+
+StringRef HttpSession::getHeader(const StringRef& name)
+{
+    HttpHeader_enum header = HttpUtil::lookupHeader(name);
+
+    if (header != HTTP_HEADER_UNKNOWN)
+        return knownHeaders[header];
+
+    size_t headerCount = headers.size();
+
+    for (size_t i = 0; i < headerCount; i++)
+    {
+        if (getHeaderName(i).engEqualsIgnoreCase(name))
+            return getHeaderValue(i);
+    }
+
+    return StringRef();
+}
+
+size_t HttpSession::getHeaderCount()
+{
+    return headers.size();
+}
+
+StringRef HttpSession::getHeaderName(size_t index)
+{
+    const HttpHeader& header = headers.get(index);
+
+    return StringRef(headerData.data() + header.nameStart,
+                     header.nameLen);
+}
+
+StringRef HttpSession::getHeaderValue(size_t index)
+{
+    const HttpHeader& header = headers.get(index);
+
+    return StringRef(headerData.data() + header.valueStart,
+                     header.valueLen);
+}
+
+StringRef HttpSession::getParam(const StringRef& name)
 {
-    return headerLines;
+    size_t paramCount = getParamCount();
+
+    for (size_t i = 0; i < paramCount; i++)
+    {
+        if (StringRef(route->paramNames.get(i)) == name)
+            return routeParams[i];
+    }
+
+    return StringRef();
+}
+
+size_t HttpSession::getParamCount()
+{
+    if (route == NULL)
+        return 0;
+
+    return route->paramNames.size();
+}
+
+StringRef HttpSession::getParamName(size_t index)
+{
+    return route->paramNames.get(index);
+}
+
+StringRef HttpSession::getParamValue(size_t index)
+{
+    return routeParams[index];
 }
 
 const char* HttpSession::getBody()
 {
+    if (streamBody)
+        return NULL;
+
     return content;
 }
 
 size_t HttpSession::getBodyLength()
 {
+    if (streamBody && chunkedRequest)
+        return 0;
+
     return contentLen;
 }
 
+bool HttpSession::isBodyStreamed()
+{
+    return streamBody;
+}
+
+bool HttpSession::parseBody(HttpForm& form)
+{
+    if (streamBody)
+    {
+        form.clear();
+        return false;
+    }
+
+    return form.parseInPlace(content, contentLen);
+}
+
+void HttpSession::readBody(bodyCallback_func callback,
+                           void* userData)
+{
+    bodyCallback = callback;
+    bodyUserData = userData;
+
+    // The client waits for this before sending the body
+    if (expectContinue &&
+        httpProt == HTTP_PROT_11)
+    {
+        HttpServer::sendContinue(_connection, this);
+    }
+
+    releaseBody();
+}
+
+void HttpSession::releaseBody()
+{
+    HttpConnection* connection = _connection;
+
+    connection->lock.lock();
+
+    // Reading continues once the callback returns
+    if (bodyState == BODY_DELIVERING)
+    {
+        bodyState = BODY_RELEASED;
+        connection->lock.unlock();
+        return;
+    }
+
+    if (bodyState != BODY_WAITING)
+    {
+        connection->lock.unlock();
+        return;
+    }
+
+    bodyState = BODY_READING;
+    connection->lock.unlock();
+
+    HttpServer::processInput(connection);
+}
+
+void HttpSession::spoolBody(FileService* fileService,
+                            AioFile* file,
+                            uint64 pos,
+                            spoolCallback_func callback,
+                            void* userData)
+{
+    spoolService = fileService;
+    spoolFile = file;
+    spoolPos = pos;
+    spoolWritten = 0;
+    spoolCallback = callback;
+    spoolUserData = userData;
+
+    readBody(spoolBodyCallback, NULL);
+}
+
 void HttpSession::respondRaw(const char* data,
                              size_t      dataLen,
                              bool        freeData)
 {
-    _httpServer->addWriteData(this, (char*)data, dataLen, freeData, true);
+    _httpServer->addWriteData(this, (char*)data, dataLen, freeData, true, true);
 }
 
 void HttpSession::setResponseHeader(const StringRef& headerKey,
                                     const StringRef& headerValue)
 {
+    // Line breaks would let the value smuggle in headers of its own
+    for (size_t i = 0; i < headerKey.length(); i++)
+    {
+        if (headerKey.charAt(i) == '\r' || headerKey.charAt(i) == '\n')
+            return;
+    }
 
+    for (size_t i = 0; i < headerValue.length(); i++)
+    {
+        if (headerValue.charAt(i) == '\r' || headerValue.charAt(i) == '\n')
+            return;
+    }
+
+    // Framing and persistence are decided by the session
+    HttpHeader_enum knownHeader = HttpUtil::lookupHeader(headerKey);
+
+    if (knownHeader == HTTP_HEADER_CONNECTION)
+    {
+        if (HttpServer::headerHasToken(headerValue, "close"))
+            keepAlive = false;
+
+        return;
+    }
+
+    if (knownHeader == HTTP_HEADER_CONTENT_LENGTH ||
+        knownHeader == HTTP_HEADER_TRANSFER_ENCODING ||
+        headerKey.engEqualsIgnoreCase("Date"))
+    {
+        return;
+    }
+
+    addResponseHeader(headerKey, headerValue);
 }
 
 void HttpSession::respond(const StringRef& header,
@@ -68,42 +384,504 @@ void HttpSession::respond(const StringRef& header,
                           size_t           dataLen,
                           bool             freeData)
 {
-    char* headerCopy = new char[header.length()];
-    ::memcpy(headerCopy, header.data(), header.length());
+    size_t headLen;
+
+    // A HEAD response describes the body without sending it
+    if (method == HTTP_HEAD || dataLen == 0)
+    {
+        char* head = buildHead(header, true, dataLen, 0, &headLen);
+        _httpServer->addWriteData(this, head, headLen, true, true, true);
 
+        if (freeData)
+            delete[] data;
+
+        return;
+    }
+
+    // Short content shares the block of the head
+    if (dataLen <= HTTP_INLINE_CONTENT_LEN)
+    {
+        char* head = buildHead(header, true, dataLen, dataLen, &headLen);
+        ::memcpy(head + headLen, data, dataLen);
+
+        if (freeData)
+            delete[] data;
+
+        _httpServer->addWriteData(this, head, headLen + dataLen, true, true, true);
+        return;
+    }
+
+    // Held back so the head and body go out in one write
+    char* head = buildHead(header, true, dataLen, 0, &headLen);
+    _httpServer->addWriteData(this, head, headLen, true, false, false);
+    _httpServer->addWriteData(this, (char*)data, dataLen, freeData, true, true);
+}
+
+void HttpSession::beginResponse(const StringRef& header)
+{
+    size_t headLen;
+
+    // HTTP/1.0 has no chunked encoding, the end of the content is marked
+    // by closing the connection instead.
     if (httpProt == HTTP_PROT_10)
+        keepAlive = false;
+    else
+        chunkedResponse = true;
+
+    char* head = buildHead(header, false, 0, 0, &headLen);
+    _httpServer->addWriteData(this, head, headLen, true, false, true);
+}
+
+void HttpSession::writeChunk(const char* data,
+                             size_t      dataLen,
+                             bool        freeData)
+{
+    // An empty chunk would end the content
+    if (method == HTTP_HEAD || dataLen == 0)
+    {
+        if (freeData)
+            delete[] data;
+
+        return;
+    }
+
+    if (chunkedResponse)
+    {
+        // Chunk size in hex followed by CRLF
+        char* sizeLine = new char[16];
+        uint32 sizeLen = UInt64::uint64ToBuffer(sizeLine, 14, dataLen, 16);
+        sizeLine[sizeLen] = '\r';
+        sizeLine[sizeLen+1] = '\n';
+
+        _httpServer->addWriteData(this, sizeLine, sizeLen+2, true, false, false);
+        _httpServer->addWriteData(this, (char*)data, dataLen, freeData, false, false);
+        _httpServer->addWriteData(this, (char*)"\r\n", 2, false, false, true);
+    }
+    else
+    {
+        _httpServer->addWriteData(this, (char*)data, dataLen, freeData, false, true);
+    }
+}
+
+void HttpSession::endResponse()
+{
+    if (chunkedResponse && method != HTTP_HEAD)
+    {
+        // Last chunk and an empty trailer
+        _httpServer->addWriteData(this, (char*)"0\r\n\r\n", 5, false, true, true);
+    }
+    else
+    {
+        _httpServer->addWriteData(this, NULL, 0, false, true, true);
+    }
+}
+
+/*
+ * Adds a header line to send after the automatic headers of the response.
+ */
+void HttpSession::addResponseHeader(const StringRef& name,
+                                    const StringRef& value)
+{
+    responseHeaders.addBlockBack(name.data(), name.length());
+    responseHeaders.addBlockBack(": ", 2);
+    responseHeaders.addBlockBack(value.data(), value.length());
+    responseHeaders.addBlockBack("\r\n", 2);
+}
+
+/*
+ * Writes the status line, the automatic headers and those added so far into
+ * a single block, which has reserveLen bytes free after the head for the
+ * content. The block is allocated with new[] and the length of the head is
+ * returned in headLen.
+ */
+char* HttpSession::buildHead(const StringRef& header,
+                             bool hasLength,
+                             uint64 contentLen,
+                             size_t reserveLen,
+                             size_t* headLen)
+{
+    char date[30];
+    HttpUtil::formatCurrentTimestamp(date);
+
+    // Standard statuses are copied whole
+    StringRef statusLine = HttpUtil::getStatusLine(httpProt, header);
+
+    char lengthText[24];
+    uint32 lengthLen = 0;
+
+    if (hasLength)
+        lengthLen = UInt64::uint64ToBuffer(lengthText, sizeof(lengthText), contentLen);
+
+    // Persistence is the default for HTTP/1.1 and an extension for 1.0
+    StringRef connectionLine;
+
+    if (!keepAlive && httpProt == HTTP_PROT_11)
+        connectionLine = "Connection: close\r\n";
+    else if (keepAlive && httpProt == HTTP_PROT_10)
+        connectionLine = "Connection: keep-alive\r\n";
+
+    size_t len = 6 + 29 + 2 +
+                 connectionLine.length() +
+                 responseHeaders.size() + 2;
+
+    if (statusLine.length() != 0)
+        len += statusLine.length();
+    else
+        len += 9 + header.length() + 2;
+
+    if (hasLength)
+        len += 16 + lengthLen + 2;
+
+    if (chunkedResponse)
+        len += 28;
+
+    char* head = new char[len + reserveLen];
+    char* pos = head;
+
+    if (statusLine.length() != 0)
     {
-        _httpServer->addWriteData(this, (char*)"HTTP/1.0 ", 8, false, false);
+        pos = appendBytes(pos, statusLine.data(), statusLine.length());
     }
     else
     {
-        _httpServer->addWriteData(this, (char*)"HTTP/1.1 ", 8, false, false);
+        if (httpProt == HTTP_PROT_10)
+            pos = appendBytes(pos, "HTTP/1.0 ", 9);
+        else
+            pos = appendBytes(pos, "HTTP/1.1 ", 9);
+
+        pos = appendBytes(pos, header.data(), header.length());
+        pos = appendBytes(pos, "\r\n", 2);
     }
 
-    _httpServer->addWriteData(this, headerCopy, header.length(), true, false);
+    pos = appendBytes(pos, "Date: ", 6);
+    pos = appendBytes(pos, date, 29);
+    pos = appendBytes(pos, "\r\n", 2);
+
+    if (connectionLine.length() != 0)
+        pos = appendBytes(pos, connectionLine.data(), connectionLine.length());
 
-    // TODO: Append headers here
+    if (hasLength)
+    {
+        pos = appendBytes(pos, "Content-Length: ", 16);
+        pos = appendBytes(pos, lengthText, lengthLen);
+        pos = appendBytes(pos, "\r\n", 2);
+    }
 
-    _httpServer->addWriteData(this, (char*)data, dataLen, freeData, true);
+    if (chunkedResponse)
+        pos = appendBytes(pos, "Transfer-Encoding: chunked\r\n", 28);
+
+    pos = appendBytes(pos, responseHeaders.data(), responseHeaders.size());
+    pos = appendBytes(pos, "\r\n", 2);
+
+    (*headLen) = len;
+    return head;
 }
 
-void HttpSession::reset()
+void HttpSession::respondFile(const StringRef& fileName)
 {
-    state = READING_FIRST_LINE;
-    httpProt = HTTP_PROT_10;
-    //url.clear();
-    headerLines.clear();
-        
-    content = NULL;
-    contentLen = 0;
-    contentIndex = 0;
+    AioFile* file = new AioFile();
+    uint64 fileLen;
+    Date modified;
+
+    try
+    {
+        file->open(fileName, OPEN_MODE_OPEN_ONLY, IO_READ_ACCESS);
+
+        if (file->isDirectory())
+        {
+            delete file;
+            respond("404 Not Found", notFoundMsg, ::strlen(notFoundMsg), false);
+            return;
+        }
+
+        fileLen = file->getFileLength();
+        modified = file->getLastModified();
+    }
+    catch (const IOException&)
+    {
+        delete file;
+        respond("404 Not Found", notFoundMsg, ::strlen(notFoundMsg), false);
+        return;
+    }
+
+    // Validators for conditional requests. The entity tag is made from
+    // the modification time and length of the file.
+    char lastModified[30];
+    HttpUtil::formatTimestamp(modified, lastModified);
+    StringRef lastModifiedRef(lastModified, 29);
+
+    char etag[40];
+    uint32 etagLen = 0;
+    etag[etagLen++] = '"';
+    etagLen += UInt64::uint64ToBuffer(etag + etagLen, 16, (uint64)modified.getTime_t(), 16);
+    etag[etagLen++] = '-';
+    etagLen += UInt64::uint64ToBuffer(etag + etagLen, 16, fileLen, 16);
+    etag[etagLen++] = '"';
+    StringRef etagRef(etag, etagLen);
+
+    char* head;
+    size_t headLen;
+
+    // If-Modified-Since is only considered without If-None-Match. Dates
+    // must match Last-Modified exactly rather than be parsed.
+    StringRef ifNoneMatch = knownHeaders[HTTP_HEADER_IF_NONE_MATCH];
+    StringRef ifModifiedSince = knownHeaders[HTTP_HEADER_IF_MODIFIED_SINCE];
+    bool notModified;
+
+    if (ifNoneMatch.data() != NULL)
+        notModified = etagListMatches(ifNoneMatch, etagRef);
+    else
+        notModified = (ifModifiedSince == lastModifiedRef);
+
+    if (notModified &&
+        (method == HTTP_GET || method == HTTP_HEAD))
+    {
+        delete file;
 
-    lineBufferIndex = 0;
-    lineBufferFilled = 0;
+        addResponseHeader("ETag", etagRef);
+        addResponseHeader("Last-Modified", lastModifiedRef);
 
-    writeActive = false;
+        head = buildHead("304 Not Modified", false, 0, 0, &headLen);
+        _httpServer->addWriteData(this, head, headLen, true, true, true);
+        return;
+    }
+
+    uint64 start = 0;
+    uint64 end = fileLen - 1;
+    HttpRange_enum rangeResult = HTTP_RANGE_IGNORED;
+
+    // If-Range makes the Range conditional on the file being unchanged
+    StringRef range = knownHeaders[HTTP_HEADER_RANGE];
+    StringRef ifRange = knownHeaders[HTTP_HEADER_IF_RANGE];
+
+    if (range.data() != NULL &&
+        method == HTTP_GET &&
+        (ifRange.data() == NULL ||
+         ifRange == etagRef ||
+         ifRange == lastModifiedRef))
+    {
+        rangeResult = HttpUtil::parseRange(range, fileLen, &start, &end);
+    }
+
+    if (rangeResult == HTTP_RANGE_UNSATISFIABLE)
+    {
+        delete file;
+
+        // "bytes */length"
+        char contentRange[32];
+        uint32 rangeLen = 8;
+        ::memcpy(contentRange, "bytes */", 8);
+        rangeLen += UInt64::uint64ToBuffer(contentRange + rangeLen, 24, fileLen);
+
+        addResponseHeader("Content-Range", StringRef(contentRange, rangeLen));
+
+        head = buildHead("416 Range Not Satisfiable", true, 0, 0, &headLen);
+        _httpServer->addWriteData(this, head, headLen, true, true, true);
+        return;
+    }
+
+    uint64 contentLen = (fileLen == 0) ? 0 : end - start + 1;
+
+    addResponseHeader("Content-Type", HttpUtil::getMimeType(fileName));
+
+    if (rangeResult == HTTP_RANGE_SATISFIABLE)
+    {
+        // "bytes start-end/length"
+        char contentRange[80];
+        uint32 rangeLen = 6;
+        ::memcpy(contentRange, "bytes ", 6);
+        rangeLen += UInt64::uint64ToBuffer(contentRange + rangeLen, 24, start);
+        contentRange[rangeLen++] = '-';
+        rangeLen += UInt64::uint64ToBuffer(contentRange + rangeLen, 24, end);
+        contentRange[rangeLen++] = '/';
+        rangeLen += UInt64::uint64ToBuffer(contentRange + rangeLen, 24, fileLen);
+
+        addResponseHeader("Content-Range", StringRef(contentRange, rangeLen));
+    }
+
+    addResponseHeader("Accept-Ranges", "bytes");
+    addResponseHeader("ETag", etagRef);
+    addResponseHeader("Last-Modified", lastModifiedRef);
+
+    if (rangeResult == HTTP_RANGE_SATISFIABLE)
+        head = buildHead("206 Partial Content", true, contentLen, 0, &headLen);
+    else
+        head = buildHead("200 OK", true, contentLen, 0, &headLen);
+
+    // A HEAD response describes the body without sending it
+    if (method == HTTP_HEAD || contentLen == 0)
+    {
+        delete file;
+        _httpServer->addWriteData(this, head, headLen, true, true, true);
+        return;
+    }
+
+    // Held back so the head goes out ahead of the file content
+    _httpServer->addWriteData(this, head, headLen, true, false, false);
+    _httpServer->addWriteFile(this, file, start, contentLen, true);
+}
+
+void HttpSession::respondStatic(const StringRef& rootDir)
+{
+    size_t urlLen = url.length();
+    size_t pathLen = 0;
+
+    // The query string plays no part in finding the file
+    while (pathLen < urlLen &&
+           url.charAt(pathLen) != '?' &&
+           url.charAt(pathLen) != '#')
+    {
+        pathLen++;
+    }
+
+    size_t rootLen = rootDir.length();
+
+    while (rootLen > 0 &&
+           rootDir.charAt(rootLen - 1) == '/')
+    {
+        rootLen--;
+    }
+
+    String fileName;
+    fileName.append(rootDir.substring(0, rootLen));
+
+    if (pathLen == 0 || url.charAt(0) != '/')
+    {
+        respond("404 Not Found", notFoundMsg, ::strlen(notFoundMsg), false);
+        return;
+    }
+
+    // Decode %XX escapes of the path. Unlike a query string, '+' is not a
+    // space in a path.
+    for (size_t i = 0; i < pathLen; i++)
+    {
+        char c = url.charAt(i);
+
+        if (c == '%')
+        {
+            bool valid = (i + 2 < pathLen);
+            uint64 value = 0;
+
+            if (valid)
+                value = UInt64::parseUInt64(url.substring(i + 1, i + 3), &valid, 16);
+
+            if (!valid || value == 0)
+            {
+                respond("404 Not Found", notFoundMsg, ::strlen(notFoundMsg), false);
+                return;
+            }
+
+            c = (char)value;
+            i += 2;
+        }
+
+        fileName.appendChar(c);
+    }
+
+    // Reject any ".." segment so the root can't be escaped. Backslashes
+    // would be separators on Windows.
+    StringRef path = fileName.substring(rootLen);
+    size_t segStart = 0;
+
+    for (size_t i = 0; i <= path.length(); i++)
+    {
+        if (i < path.length() &&
+            path.charAt(i) == '\\')
+        {
+            respond("404 Not Found", notFoundMsg, ::strlen(notFoundMsg), false);
+            return;
+        }
+
+        if (i == path.length() || path.charAt(i) == '/')
+        {
+            if (path.substring(segStart, i) == "..")
+            {
+                respond("404 Not Found", notFoundMsg, ::strlen(notFoundMsg), false);
+                return;
+            }
+
+            segStart = i + 1;
+        }
+    }
+
+    if (fileName.charAt(fileName.length() - 1) == '/')
+        fileName.append("index.html");
+
+    respondFile(fileName);
+}
+
+/*
+ * Body callback of spoolBody(). Each block is held until it has been
+ * written to the file.
+ */
+void HttpSession::spoolBodyCallback(HttpSession& session,
+                                    void* /* userData */,
+                                    const char* data,
+                                    size_t dataLen,
+                                    const Error& error)
+{
+    if (error.isSet() || dataLen == 0)
+    {
+        session.spoolCallback(session,
+                              session.spoolUserData,
+                              session.spoolWritten,
+                              error);
+        return;
+    }
+
+    session.spoolData = data;
+    session.spoolDataLen = (uint32)dataLen;
+    session.spoolDataIndex = 0;
+
+    session.spoolService->fileWrite(session.spoolFile,
+                                    spoolWriteCallback,
+                                    &session,
+                                    session.spoolPos,
+                                    data,
+                                    (uint32)dataLen);
+}
+
+void HttpSession::spoolWriteCallback(AioFile* /* aioFile */,
+                                     void* userData,
+                                     uint32 bytesTransfered,
+                                     const Error& error)
+{
+    HttpSession* session = (HttpSession*)userData;
+
+    // The handler is expected to respond, which skips the rest of the body
+    if (error.isSet())
+    {
+        session->spoolCallback(*session,
+                               session->spoolUserData,
+                               session->spoolWritten,
+                               error);
+        return;
+    }
+
+    if (bytesTransfered == 0)
+    {
+        session->spoolCallback(*session,
+                               session->spoolUserData,
+                               session->spoolWritten,
+                               Error(err_io_error, "HttpSession::spoolBody"));
+        return;
+    }
+
+    session->spoolWritten += bytesTransfered;
+    session->spoolPos += bytesTransfered;
+    session->spoolDataIndex += bytesTransfered;
+
+    // Finish a short write
+    if (session->spoolDataIndex < session->spoolDataLen)
+    {
+        session->spoolService->fileWrite(session->spoolFile,
+                                         spoolWriteCallback,
+                                         session,
+                                         session->spoolPos,
+                                         session->spoolData + session->spoolDataIndex,
+                                         session->spoolDataLen - session->spoolDataIndex);
+        return;
+    }
 
-    writeListHead = NULL;
-    writeListTail = NULL;
-    writesComplete = false;
+    session->releaseBody();
 }
@@ -3,6 +3,18 @@
 #include "ge/http/HttpUtil.h"
 
 #include "ge/data/ShortList.h"
+#include "ge/http/HttpScan.h"
+#include "ge/thread/AtomicInt32.h"
+#include "ge/util/UInt32.h"
+#include "ge/util/UInt64.h"
+
+#include <cctype>
+#include <cstring>
+#include <ctime>
+
+#ifdef _MSC_VER
+#	define gmtime_r(y, x) gmtime_s((x), (y))
+#endif
 
 /* Table of safe URL characters that do not need to be escaped
  * 0-9,a-z,A-Z
@@ -28,7 +40,7 @@ char safeUrlChars[256] =
 
 // Table of hex value of a single character or -1 if invalid hex character
 static
-char hexValue[256] =
+signed char hexValue[256] =
     {-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,  /* 00-0F */
      -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,  /* 10-1F */
      -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,  /* 20-2F */
@@ -48,8 +60,8 @@ char hexValue[256] =
 
 // RFC822 day of week strings
 static
-const char* shortDayOfWeek[] = {"Mon", "Tue", "Wed", "Thu",
-                                "Fri", "Sat", "Sun"};
+const char* shortDayOfWeek[] = {"Sun", "Mon", "Tue", "Wed",
+                                "Thu", "Fri", "Sat"};
 
 // RFC822 month strings
 static
@@ -57,6 +69,119 @@ const char* shortMonth[] = {"Jan", "Feb", "Mar", "Apr",
                             "May", "Jun", "Jul", "Aug",
                             "Sep", "Oct", "Nov", "Dec"};
 
+// Names of the HttpHeader_enum headers. Apart from Transfer-Encoding and
+// If-Modified-Since, each has a unique length, so the length alone picks
+// the only name a header can match.
+static
+const char* knownHeaderNames[HTTP_HEADER_COUNT] = {"Host",
+                                                   "Connection",
+                                                   "Content-Length",
+                                                   "Transfer-Encoding",
+                                                   "Accept-Encoding",
+                                                   "Range",
+                                                   "If-None-Match",
+                                                   "If-Modified-Since",
+                                                   "If-Range",
+                                                   "Expect"};
+
+// Content types by file extension
+static
+const char* mimeTypes[][2] = {{"html", "text/html"},
+                              {"htm",  "text/html"},
+                              {"css",  "text/css"},
+                              {"js",   "application/javascript"},
+                              {"json", "application/json"},
+                              {"txt",  "text/plain"},
+                              {"xml",  "application/xml"},
+                              {"png",  "image/png"},
+                              {"jpg",  "image/jpeg"},
+                              {"jpeg", "image/jpeg"},
+                              {"gif",  "image/gif"},
+                              {"svg",  "image/svg+xml"},
+                              {"ico",  "image/x-icon"},
+                              {"pdf",  "application/pdf"}};
+
+// Status lines of the standard responses, rendered for each protocol
+// version and sorted by status code
+#define STATUS_LINE(code, reason) \
+    {code, \
+     reason, \
+     {"HTTP/1.0 " #code " " reason "\r\n", "HTTP/1.1 " #code " " reason "\r\n"}, \
+     sizeof("HTTP/1.0 " #code " " reason "\r\n") - 1}
+
+static
+const struct
+{
+    uint32 code;
+    const char* reason;
+    const char* line[2];
+    uint32 lineLen;
+} statusLines[] = {STATUS_LINE(100, "Continue"),
+                   STATUS_LINE(101, "Switching Protocols"),
+                   STATUS_LINE(200, "OK"),
+                   STATUS_LINE(201, "Created"),
+                   STATUS_LINE(202, "Accepted"),
+                   STATUS_LINE(204, "No Content"),
+                   STATUS_LINE(206, "Partial Content"),
+                   STATUS_LINE(301, "Moved Permanently"),
+                   STATUS_LINE(302, "Found"),
+                   STATUS_LINE(303, "See Other"),
+                   STATUS_LINE(304, "Not Modified"),
+                   STATUS_LINE(307, "Temporary Redirect"),
+                   STATUS_LINE(308, "Permanent Redirect"),
+                   STATUS_LINE(400, "Bad Request"),
+                   STATUS_LINE(401, "Unauthorized"),
+                   STATUS_LINE(403, "Forbidden"),
+                   STATUS_LINE(404, "Not Found"),
+                   STATUS_LINE(405, "Method Not Allowed"),
+                   STATUS_LINE(408, "Request Timeout"),
+                   STATUS_LINE(409, "Conflict"),
+                   STATUS_LINE(410, "Gone"),
+                   STATUS_LINE(411, "Length Required"),
+                   STATUS_LINE(412, "Precondition Failed"),
+                   STATUS_LINE(413, "Payload Too Large"),
+                   STATUS_LINE(414, "URI Too Long"),
+                   STATUS_LINE(415, "Unsupported Media Type"),
+                   STATUS_LINE(416, "Range Not Satisfiable"),
+                   STATUS_LINE(417, "Expectation Failed"),
+                   STATUS_LINE(429, "Too Many Requests"),
+                   STATUS_LINE(431, "Request Header Fields Too Large"),
+                   STATUS_LINE(500, "Internal Server Error"),
+                   STATUS_LINE(501, "Not Implemented"),
+                   STATUS_LINE(502, "Bad Gateway"),
+                   STATUS_LINE(503, "Service Unavailable"),
+                   STATUS_LINE(504, "Gateway Timeout"),
+                   STATUS_LINE(505, "HTTP Version Not Supported")};
+
+#undef STATUS_LINE
+
+// Number of formatted timestamps kept by the date cache
+#define DATE_CACHE_SLOTS 4
+
+/*
+ * Current time formatted for HTTP headers, shared by all threads. The
+ * timestamp for each new second is written to the slot after the current
+ * one before the generation is advanced to publish it. A slot is only
+ * rewritten once DATE_CACHE_SLOTS - 1 newer ones have been published, so a
+ * reader's copy is good unless the generation moved that far meanwhile.
+ */
+class DateCache
+{
+public:
+    class Slot
+    {
+    public:
+        volatile time_t second;
+        char text[30];
+    };
+
+    AtomicInt32 generation;
+    AtomicInt32 updating;    // Set by the thread publishing a timestamp
+    Slot slots[DATE_CACHE_SLOTS];
+};
+
+static DateCache dateCache;
+
 namespace HttpUtil
 {
 
@@ -114,54 +239,46 @@ bool unescapeUrl(const StringRef& str, String& dest)
 
 bool unescapeUrlInPlace(char* str, size_t* size)
 {
-    char* readPos;
-    char* writePos;
-    uint32 numericValue;
-    uint32 hexHigh;
-    uint32 hexLow;
-
-    // This loop depends on writePos being <= readPos
-    readPos  = str;
-    writePos = str;
-
-    while (*readPos)
-    {
-        switch (*readPos)
-	    {
-	    case '%':
-            if (readPos[1] == '\0' ||
-                readPos[2] == '\0')
-            {
+    const char* end = str + (*size);
+
+    // Text ahead of the first escape stays where it is
+    const char* readPos = HttpScan::scanEscape(str, end);
+    char* writePos = (char*)readPos;
+
+    while (readPos < end)
+    {
+        if ((*readPos) == '+')
+        {
+            *writePos = ' ';
+            readPos++;
+        }
+        else
+        {
+            if (end - readPos < 3)
                 return false;
-            }
 
-            hexHigh = hexValue[(unsigned char)readPos[1]];
-            hexLow = hexValue[(unsigned char)readPos[2]];
+            int32 hexHigh = hexValue[(unsigned char)readPos[1]];
+            int32 hexLow = hexValue[(unsigned char)readPos[2]];
 
             if (hexHigh < 0 || hexLow < 0)
-            {
                 return false;
-            }
 
-	        numericValue = (hexHigh * 16) + hexLow;
-            *writePos = (char)numericValue;
+            *writePos = (char)((hexHigh * 16) + hexLow);
             readPos += 3;
-            break;
+        }
 
-        case '+':
-	        *writePos = ' ';
-            readPos++;
-	        break;
+        writePos++;
 
-	    default:
-	        *writePos = *readPos;
-            readPos++;
-	    }
+        // Move the text up to the next escape down in one block
+        const char* nextEscape = HttpScan::scanEscape(readPos, end);
+        size_t runLen = nextEscape - readPos;
 
-        writePos++;
+        ::memmove(writePos, readPos, runLen);
+        writePos += runLen;
+        readPos = nextEscape;
     }
 
-    *writePos = '\0'; // add 0-terminator
+    *size = writePos - str;
     return true;
 }
 
@@ -178,14 +295,19 @@ void formatTimestamp(Date date,
     const char* shortDay;
     const char* shortMon;
 
-    // TODO: Rework to be more efficient
-    uint32 year = date.getYear();
-    uint32 month = date.getMonth();
-    uint32 dayOfWeek = date.getDayOfWeek();
-    uint32 dayOfMonth = date.getDayOfMonth();
-    uint32 hour = date.getHour();
-    uint32 minute = date.getMinute();
-    uint32 second = date.getSecond();
+    // HTTP timestamps are always in GMT, where the Date getters give local
+    // time. Converting once also saves a conversion per getter.
+    time_t unixTime = date.getTime_t();
+    tm tmStruct;
+    gmtime_r(&unixTime, &tmStruct);
+
+    uint32 year = tmStruct.tm_year + 1900;
+    uint32 month = tmStruct.tm_mon;
+    uint32 dayOfWeek = tmStruct.tm_wday;
+    uint32 dayOfMonth = tmStruct.tm_mday;
+    uint32 hour = tmStruct.tm_hour;
+    uint32 minute = tmStruct.tm_min;
+    uint32 second = tmStruct.tm_sec;
 
     shortDay = shortDayOfWeek[dayOfWeek];
     shortMon = shortMonth[month];
@@ -223,4 +345,243 @@ void formatTimestamp(Date date,
     dest[29] = '\0';
 }
 
+void formatCurrentTimestamp(char* dest)
+{
+    time_t now = ::time(NULL);
+
+    uint32 generation = (uint32)dateCache.generation.get();
+    DateCache::Slot& slot = dateCache.slots[generation % DATE_CACHE_SLOTS];
+
+    if (slot.second == now)
+    {
+        ::memcpy(dest, slot.text, 30);
+
+        if ((uint32)dateCache.generation.get() - generation < DATE_CACHE_SLOTS - 1)
+            return;
+    }
+
+    formatTimestamp(Date(now), dest);
+
+    // Only one thread publishes, the others keep their own copy
+    if (!dateCache.updating.compareAndExchange(0, 1))
+        return;
+
+    generation = (uint32)dateCache.generation.get();
+
+    if (dateCache.slots[generation % DATE_CACHE_SLOTS].second < now)
+    {
+        DateCache::Slot& next = dateCache.slots[(generation + 1) % DATE_CACHE_SLOTS];
+
+        next.second = now;
+        ::memcpy(next.text, dest, 30);
+
+        dateCache.generation.set((int32)(generation + 1));
+    }
+
+    dateCache.updating.set(0);
+}
+
+StringRef getStatusLine(HttpProt_enum httpProt,
+                        const StringRef& status)
+{
+    // Three digits, a space and the reason
+    if (status.length() < 5 ||
+        status.charAt(3) != ' ')
+    {
+        return StringRef();
+    }
+
+    uint32 code = 0;
+
+    for (size_t i = 0; i < 3; i++)
+    {
+        char c = status.charAt(i);
+
+        if (c < '0' || c > '9')
+            return StringRef();
+
+        code = code * 10 + (c - '0');
+    }
+
+    size_t low = 0;
+    size_t high = sizeof(statusLines) / sizeof(statusLines[0]);
+
+    while (low < high)
+    {
+        size_t mid = (low + high) / 2;
+
+        if (statusLines[mid].code < code)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    if (low == sizeof(statusLines) / sizeof(statusLines[0]) ||
+        statusLines[low].code != code ||
+        status.substring(4) != statusLines[low].reason)
+    {
+        return StringRef();
+    }
+
+    return StringRef(statusLines[low].line[httpProt == HTTP_PROT_11],
+                     statusLines[low].lineLen);
+}
+
+HttpHeader_enum lookupHeader(const StringRef& name)
+{
+    HttpHeader_enum header;
+
+    switch (name.length())
+    {
+    case 4:
+        header = HTTP_HEADER_HOST;
+        break;
+    case 10:
+        header = HTTP_HEADER_CONNECTION;
+        break;
+    case 14:
+        header = HTTP_HEADER_CONTENT_LENGTH;
+        break;
+    case 17:
+        if (name.charAt(0) == 'T' || name.charAt(0) == 't')
+            header = HTTP_HEADER_TRANSFER_ENCODING;
+        else
+            header = HTTP_HEADER_IF_MODIFIED_SINCE;
+        break;
+    case 15:
+        header = HTTP_HEADER_ACCEPT_ENCODING;
+        break;
+    case 5:
+        header = HTTP_HEADER_RANGE;
+        break;
+    case 13:
+        header = HTTP_HEADER_IF_NONE_MATCH;
+        break;
+    case 8:
+        header = HTTP_HEADER_IF_RANGE;
+        break;
+    case 6:
+        header = HTTP_HEADER_EXPECT;
+        break;
+    default:
+        return HTTP_HEADER_UNKNOWN;
+    }
+
+    if (!name.engEqualsIgnoreCase(knownHeaderNames[header]))
+        return HTTP_HEADER_UNKNOWN;
+
+    return header;
+}
+
+StringRef getMimeType(const StringRef& fileName)
+{
+    size_t dot = fileName.length();
+
+    while (dot > 0 &&
+           fileName.charAt(dot-1) != '.' &&
+           fileName.charAt(dot-1) != '/')
+    {
+        dot--;
+    }
+
+    if (dot > 0 &&
+        fileName.charAt(dot-1) == '.')
+    {
+        StringRef extension = fileName.substring(dot);
+
+        for (size_t i = 0; i < sizeof(mimeTypes) / sizeof(mimeTypes[0]); i++)
+        {
+            if (extension.engEqualsIgnoreCase(mimeTypes[i][0]))
+                return mimeTypes[i][1];
+        }
+    }
+
+    return "application/octet-stream";
+}
+
+bool parseChunkSize(const StringRef& line,
+                    uint32*          chunkLen)
+{
+    size_t sizeEnd = 0;
+
+    while (sizeEnd < line.length() &&
+           line.charAt(sizeEnd) != ';' &&
+           !isspace(line.charAt(sizeEnd)))
+    {
+        sizeEnd++;
+    }
+
+    bool validSize;
+    (*chunkLen) = UInt32::parseUInt32(line.substring(0, sizeEnd),
+                                      &validSize,
+                                      16);
+
+    return validSize;
+}
+
+HttpRange_enum parseRange(const StringRef& value,
+                          uint64           fileLen,
+                          uint64*          start,
+                          uint64*          end)
+{
+    if (value.length() < 6 ||
+        !value.substring(0, 6).engEqualsIgnoreCase("bytes="))
+    {
+        return HTTP_RANGE_IGNORED;
+    }
+
+    StringRef spec = value.substring(6);
+
+    if (spec.indexOf(",") != -1)
+        return HTTP_RANGE_IGNORED;
+
+    ssize_t dash = spec.indexOf("-");
+
+    if (dash == -1)
+        return HTTP_RANGE_IGNORED;
+
+    bool valid;
+
+    // A suffix range gives the length at the end of the file to send
+    if (dash == 0)
+    {
+        uint64 suffixLen = UInt64::parseUInt64(spec.substring(1), &valid);
+
+        if (!valid)
+            return HTTP_RANGE_IGNORED;
+
+        if (suffixLen == 0 || fileLen == 0)
+            return HTTP_RANGE_UNSATISFIABLE;
+
+        (*start) = (suffixLen < fileLen) ? fileLen - suffixLen : 0;
+        (*end) = fileLen - 1;
+        return HTTP_RANGE_SATISFIABLE;
+    }
+
+    (*start) = UInt64::parseUInt64(spec.substring(0, dash), &valid);
+
+    if (!valid)
+        return HTTP_RANGE_IGNORED;
+
+    if ((size_t)dash + 1 == spec.length())
+    {
+        (*end) = fileLen - 1;
+    }
+    else
+    {
+        (*end) = UInt64::parseUInt64(spec.substring(dash + 1), &valid);
+
+        if (!valid || (*end) < (*start))
+            return HTTP_RANGE_IGNORED;
+
+        if ((*end) >= fileLen)
+            (*end) = fileLen - 1;
+    }
+
+    if ((*start) >= fileLen)
+        return HTTP_RANGE_UNSATISFIABLE;
+
+    return HTTP_RANGE_SATISFIABLE;
+}
+
 } // End namespace HttpUtil
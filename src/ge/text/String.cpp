@@ -15,134 +15,76 @@
 #include <cassert>
 #include <cstring>
 
-#define SMALL_STR_LEN (sizeof(size_t) * 2 + sizeof(char*))
+#define SMALL_STR_LEN (32 - (sizeof(size_t) * 2 + sizeof(char*)))
 #define SMALL_STR_MAX SMALL_STR_LEN-1
 
+/*
+ * strData always points at either shortStr or a heap allocation of
+ * reserved bytes. Strings shorter than SMALL_STR_MAX start out in
+ * shortStr, but a reserved buffer is kept even if the length is small.
+ */
+
 String::String() :
-    len(0),
     reserved(SMALL_STR_LEN),
+    len(0),
     strData(shortStr)
 {
+    shortStr[0] = '\0';
 }
 
-String::String(const String& str)
+String::String(const String& str) :
+    reserved(SMALL_STR_LEN),
+    len(0),
+    strData(shortStr)
 {
-    len = str.len;
-
-    if (str.len < SMALL_STR_MAX)
-    {
-        strData = shortStr;
-        reserved = SMALL_STR_LEN;
-        ::memcpy(shortStr, str.shortStr, str.len+1);
-    }
-    else
-    {
-        size_t newLen = str.len+1;
-        reserved = newLen;
-        strData = new char[newLen];
-        ::memcpy(strData, str.strData, newLen);
-    }
+    init(str.strData, str.len);
 }
 
-String::String(String&& str)
+String::String(String&& str) :
+    reserved(SMALL_STR_LEN),
+    len(0),
+    strData(shortStr)
 {
-    len = str.len;
-
-    if (str.len < SMALL_STR_MAX)
-    {
-        strData = shortStr;
-        reserved = SMALL_STR_LEN;
-        ::memcpy(shortStr, str.shortStr, str.len+1);
-    }
-    else
-    {
-        reserved = str.reserved;
-        strData = str.strData;
-        str.len = 0;
-    }
+    steal(str);
 }
 
-String::String(const StringRef strRef)
+String::String(const StringRef strRef) :
+    reserved(SMALL_STR_LEN),
+    len(0),
+    strData(shortStr)
 {
-    len = strRef.length();
-
-    if (len < SMALL_STR_MAX)
-    {
-        strData = shortStr;
-        reserved = SMALL_STR_LEN;
-        ::memcpy(shortStr, strRef.data(), len);
-        shortStr[len] = '\0';
-    }
-    else
-    {
-        size_t refLen = strRef.length();
-        size_t newLen = refLen+1;
-        reserved = newLen;
-        strData = new char[newLen];
-        ::memcpy(strData, strRef.data(), refLen);
-        strData[refLen] = '\0';
-    }
+    init(strRef.data(), strRef.length());
 }
 
-String::String(const StringRef&& strRef)
+String::String(const StringRef&& strRef) :
+    reserved(SMALL_STR_LEN),
+    len(0),
+    strData(shortStr)
 {
-    len = strRef.length();
-
-    if (len < SMALL_STR_MAX)
-    {
-        strData = shortStr;
-        reserved = SMALL_STR_LEN;
-        ::memcpy(shortStr, strRef.data(), len);
-        shortStr[len] = '\0';
-    }
-    else
-    {
-        size_t refLen = strRef.length();
-        size_t newLen = refLen+1;
-        reserved = newLen;
-        strData = new char[newLen];
-        ::memcpy(strData, strRef.data(), refLen);
-        strData[refLen] = '\0';
-    }
+    init(strRef.data(), strRef.length());
 }
 
-String::String(const char* cstr)
+String::String(const char* cstr) :
+    reserved(SMALL_STR_LEN),
+    len(0),
+    strData(shortStr)
 {
-    len = ::strlen(cstr);
-
-    if (len < SMALL_STR_MAX)
-    {
-        strData = shortStr;
-        reserved = SMALL_STR_LEN;
-        ::memcpy(shortStr, cstr, len+1);
-    }
-    else
-    {
-        size_t newLen = len+1;
-        reserved = newLen;
-        strData = new char[newLen];
-        ::memcpy(strData, cstr, newLen);
-    }
+    init(cstr, ::strlen(cstr));
 }
 
-String::String(const char* cstr, size_t dataLen)
+String::String(const char* cstr, size_t dataLen) :
+    reserved(SMALL_STR_LEN),
+    len(0),
+    strData(shortStr)
 {
-    len = dataLen;
+    init(cstr, dataLen);
+}
 
-    if (len < SMALL_STR_MAX)
-    {
-        strData = shortStr;
-        reserved = SMALL_STR_LEN;
-        ::memcpy(shortStr, cstr, dataLen);
-        shortStr[len] = '\0';
-    }
-    else
+String::~String()
+{
+    if (strData != shortStr)
     {
-        size_t newLen = dataLen+1;
-        reserved = newLen;
-        strData = new char[newLen];
-        ::memcpy(strData, cstr, dataLen);
-        strData[len] = '\0';
+        delete[] strData;
     }
 }
 
@@ -150,26 +92,7 @@ String& String::operator=(const String& str)
 {
     if (this != &str)
     {
-        if (len >= SMALL_STR_MAX)
-        {
-            delete[] strData;
-        }
-
-        len = str.len;
-
-        if (str.len < SMALL_STR_MAX)
-        {
-            strData = shortStr;
-            reserved = SMALL_STR_LEN;
-            ::memcpy(shortStr, str.shortStr, str.len+1);
-        }
-        else
-        {
-            size_t newLen = str.len+1;
-            reserved = newLen;
-            strData = new char[newLen];
-            ::memcpy(strData, str.strData, newLen);
-        }
+        assign(str.strData, str.len);
     }
 
     return *this;
@@ -179,25 +102,12 @@ String& String::operator=(String&& str)
 {
     if (this != &str)
     {
-        if (len >= SMALL_STR_MAX)
+        if (strData != shortStr)
         {
             delete[] strData;
         }
 
-        len = str.len;
-
-        if (str.len < SMALL_STR_MAX)
-        {
-            strData = shortStr;
-            reserved = SMALL_STR_LEN;
-            ::memcpy(shortStr, str.shortStr, str.len+1);
-        }
-        else
-        {
-            reserved = str.reserved;
-            strData = str.strData;
-            str.len = 0;
-        }
+        steal(str);
     }
 
     return *this;
@@ -205,62 +115,13 @@ String& String::operator=(String&& str)
 
 String& String::operator=(const StringRef& strRef)
 {
-    // Because it's possible to assign a StringRef that is a substring of
-    // this String, we have to use memmove instead of memcpy and defer
-    // deletion of the old data until the end.
-    const char* oldData = NULL;
-
-    if (len >= SMALL_STR_MAX)
-    {
-        oldData = strData;
-    }
-
-    len = strRef.length();
-
-    if (len < SMALL_STR_MAX)
-    {
-        strData = shortStr;
-        reserved = SMALL_STR_LEN;
-        ::memmove(shortStr, strRef.data(), len);
-        shortStr[len] = '\0';
-    }
-    else
-    {
-        size_t newLen = len+1;
-        reserved = newLen;
-        strData = new char[newLen];
-        ::memmove(strData, strRef.data(), len);
-        strData[len] = '\0';
-    }
-
-    delete[] oldData;
-
+    assign(strRef.data(), strRef.length());
     return *this;
 }
 
 String& String::operator=(const char* cstr)
 {
-    if (len >= SMALL_STR_MAX)
-    {
-        delete[] strData;
-    }
-
-    len = ::strlen(cstr);
-
-    if (len < SMALL_STR_MAX)
-    {
-        strData = shortStr;
-        reserved = SMALL_STR_LEN;
-        ::memcpy(shortStr, cstr, len+1);
-    }
-    else
-    {
-        size_t newLen = len+1;
-        reserved = newLen;
-        strData = new char[newLen];
-        ::memcpy(strData, cstr, newLen);
-    }
-
+    assign(cstr, ::strlen(cstr));
     return *this;
 }
 
@@ -358,7 +219,7 @@ void String::append_raw(const char* appendData, size_t dataLen)
 {
     if (len + dataLen < reserved)
     {
-        ::memcpy(strData+len, appendData, dataLen);
+        ::memmove(strData+len, appendData, dataLen);
         strData[len+dataLen] = '\0';
     }
     else
@@ -367,15 +228,14 @@ void String::append_raw(const char* appendData, size_t dataLen)
         size_t newReserved = newLen * 2;
         char* newData = new char[newReserved];
         ::memcpy(newData, strData, len);
+        ::memcpy(newData + len, appendData, dataLen);
+        newData[len + dataLen] = '\0';
 
         if (strData != shortStr)
         {
             delete[] strData;
         }
 
-        ::memcpy(newData + len, appendData, dataLen);
-        newData[len + dataLen] = '\0';
-
         reserved = newReserved;
         strData = newData;
     }
@@ -385,33 +245,68 @@ void String::append_raw(const char* appendData, size_t dataLen)
 
 void String::append_cstr(const char* cstr, size_t cstrLen)
 {
-    if (len + cstrLen < SMALL_STR_MAX)
+    append_raw(cstr, cstrLen);
+}
+
+void String::init(const char* initData, size_t dataLen)
+{
+    if (dataLen >= SMALL_STR_MAX)
     {
-        ::memcpy(shortStr+len, cstr, cstrLen+1);
+        reserved = dataLen+1;
+        strData = new char[reserved];
     }
-    else
+
+    ::memcpy(strData, initData, dataLen);
+    strData[dataLen] = '\0';
+    len = dataLen;
+}
+
+void String::assign(const char* assignData, size_t dataLen)
+{
+    // The data may be a substring of this String, so the old buffer is
+    // only freed once copied from.
+    if (dataLen < reserved)
     {
-        size_t newLen = len + cstrLen + 1;
-        size_t newReserved = newLen * 2;
-        char* newData = new char[newReserved];
+        ::memmove(strData, assignData, dataLen);
+        strData[dataLen] = '\0';
+        len = dataLen;
+        return;
+    }
 
-        if (len < SMALL_STR_MAX)
-        {
-            ::memcpy(newData, shortStr, len);
-        }
-        else
-        {
-            ::memcpy(newData, strData, len);
-            delete[] strData;
-        }
+    char* oldData = strData;
 
-        ::memcpy(newData + len, cstr, cstrLen+1);
+    reserved = dataLen+1;
+    strData = new char[reserved];
+    ::memcpy(strData, assignData, dataLen);
+    strData[dataLen] = '\0';
+    len = dataLen;
 
-        reserved = newReserved;
-        strData = newData;
+    if (oldData != shortStr)
+    {
+        delete[] oldData;
+    }
+}
+
+void String::steal(String& str)
+{
+    if (str.strData == str.shortStr)
+    {
+        strData = shortStr;
+        reserved = SMALL_STR_LEN;
+        ::memcpy(shortStr, str.shortStr, str.len+1);
     }
+    else
+    {
+        strData = str.strData;
+        reserved = str.reserved;
+    }
+
+    len = str.len;
 
-    len += cstrLen;
+    str.strData = str.shortStr;
+    str.reserved = SMALL_STR_LEN;
+    str.len = 0;
+    str.shortStr[0] = '\0';
 }
 
 const char* String::c_str() const
@@ -421,14 +316,7 @@ const char* String::c_str() const
 
 const char* String::data() const
 {
-    if (len < SMALL_STR_MAX)
-    {
-        return shortStr;
-    }
-    else
-    {
-        return strData;
-    }
+    return strData;
 }
 
 uint32 String::hash() const
@@ -438,14 +326,7 @@ uint32 String::hash() const
 
 const char String::charAt(size_t pos) const
 {
-    if (len < SMALL_STR_MAX)
-    {
-        return shortStr[pos];
-    }
-    else
-    {
-        return strData[pos];
-    }
+    return strData[pos];
 }
 
 const utf32 String::codePointAt(size_t pos) const
@@ -548,18 +429,19 @@ bool String::endsWith(const StringRef& strRef) const
 
 void String::reserve(size_t size)
 {
-    // Don't bother with small sizes and do nothing if already reserved
+    // Don't bother with small sizes and do nothing if already reserved.
+    // reserved includes the terminator.
     if (size < SMALL_STR_MAX ||
-        size <= reserved)
+        size < reserved)
     {
         return;
     }
 
     char* newBuffer = new char[size+1];
+    ::memcpy(newBuffer, strData, len+1);
 
-    if (len > 0)
+    if (strData != shortStr)
     {
-        ::memcpy(newBuffer, strData, len+1);
         delete[] strData;
     }
 
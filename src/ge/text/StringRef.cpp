@@ -114,12 +114,12 @@ int32 StringRef::engCompareIgnoreCase(const StringRef& strRef) const
     {
         char a = strData[i];
 
-        if (a >= 'a' || a <= 'z')
+        if (a >= 'a' && a <= 'z')
             a -= 'a' - 'A';
 
         char b = strRef.strData[i];
 
-        if (b >= 'a' || b <= 'z')
+        if (b >= 'a' && b <= 'z')
             b -= 'a' - 'A';
 
         if (a != b)
@@ -149,12 +149,12 @@ bool StringRef::engEqualsIgnoreCase(const StringRef& strRef) const
     {
         char a = strData[i];
 
-        if (a >= 'a' || a <= 'z')
+        if (a >= 'a' && a <= 'z')
             a -= 'a' - 'A';
 
         char b = strRef.strData[i];
 
-        if (b >= 'a' || b <= 'z')
+        if (b >= 'a' && b <= 'z')
             b -= 'a' - 'A';
 
         if (a != b)
@@ -175,11 +175,11 @@ ssize_t StringRef::indexOf(const StringRef& strRef, size_t startIndex) const
 
     size_t strRefLen = strRef.length();
 
-    // Deal with zero length strings by always reporting a match at index
-    // zero. Nothing is always present.
+    // Deal with zero length strings by always reporting a match at the
+    // start index. Nothing is always present.
     if (strRefLen == 0)
     {
-        return 0;
+        return startIndex;
     }
 
     size_t searchLen = len - startIndex;
@@ -190,21 +190,15 @@ ssize_t StringRef::indexOf(const StringRef& strRef, size_t startIndex) const
         return -1;
     }
 
+    const char* strRefData = strRef.strData;
+
     // For short search areas, brute force. It's not worth building a table
     // to speed things up.
     if (searchLen < 256)
     {
-        for (size_t i = startIndex; i < len - strRefLen + 1; i++)
+        for (size_t i = startIndex; i <= len - strRefLen; i++)
         {
-            bool match = true;
-
-            for (size_t j = 0; match && j < strRefLen; j++)
-            {
-                if (strData[i] != strRef.strData[j])
-                    match = false;
-            }
-
-            if (match)
+            if (::memcmp(strData + i, strRefData, strRefLen) == 0)
                 return i;
         }
 
@@ -217,10 +211,10 @@ ssize_t StringRef::indexOf(const StringRef& strRef, size_t startIndex) const
     // allocation. In a multi-threaded application, this may run faster due
     // to avoiding locking in malloc.
 
-    const char* strRefData = strRef.strData;
     size_t endIndex = strRefLen - 1;
 
-    // Create an array of "skip" offsets when searching the string
+    // Create an array of "skip" offsets when searching the string. The
+    // last character is left out, so a match of it alone still moves on.
     size_t badCharSkip[256];
 
     for (uint32 i = 0; i < 256; i++)
@@ -228,23 +222,20 @@ ssize_t StringRef::indexOf(const StringRef& strRef, size_t startIndex) const
         badCharSkip[i] = strRefLen;
     }
 
-    for (uint32 i = 0; i < strRefLen; i++)
+    for (size_t i = 0; i < endIndex; i++)
     {
-        badCharSkip[(unsigned)strRefData[i]] = endIndex - i;
+        badCharSkip[(uint8)strRefData[i]] = endIndex - i;
     }
 
-    const char* searchStart = strData + startIndex;
+    const char* searchPtr = strData + startIndex;
     const char* searchEnd = strData + len - strRefLen;
-    const char* searchPtr = searchStart + startIndex;
 
     while (searchPtr <= searchEnd)
     {
-        for (size_t scan = endIndex;
-             strData[scan] == strRef.strData[scan];
-             scan--)
+        if (searchPtr[endIndex] == strRefData[endIndex] &&
+            ::memcmp(searchPtr, strRefData, endIndex) == 0)
         {
-            if (scan == 0) // If complete match
-                return searchPtr - searchStart;
+            return searchPtr - strData;
         }
 
         searchPtr += badCharSkip[(uint8)searchPtr[endIndex]];
@@ -263,54 +254,26 @@ ssize_t StringRef::lastIndexOf(const StringRef& strRef, size_t endIndex) const
 {
     assert(endIndex >= 0 && endIndex <= len);
 
-    // TODO: Fix this implementation and add a brute force version up front
-
     size_t strRefLen = strRef.length();
 
-    // Deal with zero length strings by always reporting a match at index
-    // zero. Nothing is always present.
+    // Deal with zero length strings by always reporting a match at the
+    // end index. Nothing is always present.
     if (strRefLen == 0)
     {
-        return 0;
+        return endIndex;
     }
 
     // Return -1 for overlong strings as there can be no match.
-    if (endIndex - strRefLen < 0)
+    if (strRefLen > endIndex)
     {
         return -1;
     }
 
-    // Like indexOf, using the BoyerMooreHorspool algorithm, but reversed.
-    // This also changes how the 'skip' indexes are generated.
-
-    const char* strRefData = strRef.strData;
-    size_t strRefLast = strRefLen - 1;
-
-    // Create an array of "skip" offsets when searching the string
-    size_t skip[255];
-
-    for (uint32 i = 0; i < 255; i++)
-    {
-        skip[i] = strRefLen;
-    }
-
-    for (uint32 i = 0; i < strRefLen; i++)
+    // Brute force, from the last match ending by endIndex back to the start
+    for (size_t i = endIndex - strRefLen + 1; i > 0; i--)
     {
-        skip[(unsigned)strRefData[i]] = strRefLast - (strRefLast - i);
-    }
-
-    // Do the reverse search
-    const char* searchStart = strData;
-    const char* searchPtr = searchStart + endIndex - strRefLen;
-
-    while (searchPtr >= searchStart)
-    {
-        if (::memcmp(searchPtr, strRefData, strRefLen) == 0)
-        {
-            return searchPtr - searchStart;
-        }
-
-        searchPtr -= skip[(uint8)searchPtr[0]];
+        if (::memcmp(strData + i - 1, strRef.strData, strRefLen) == 0)
+            return i - 1;
     }
 
     // No match found
@@ -24,7 +24,7 @@ public:
 
         do
         {
-            work = m_parent->getNextWorkItem(!m_minThread);
+            work = m_parent->getNextWorkItem(m_minThread);
 
             if (work != NULL)
             {
@@ -121,6 +121,7 @@ bool ThreadPool::execute(Runnable* runnable, bool autoDelete)
         newWorkData->runnable = runnable;
         newWorkData->autoDelete = autoDelete;
         m_workQueue.addBack(newWorkData);
+        ret = true;
 
         if (m_idleThreads == 0 &&
             m_runningThreads < m_maxThreads)
@@ -146,7 +147,7 @@ uint32 ThreadPool::threadCount()
     return m_runningThreads;
 }
 
-size_t ThreadPool::queueSize()
+uint32 ThreadPool::queueSize()
 {
     Locker<Condition> locker(m_cond);
     return (uint32)m_workQueue.size();
@@ -21,7 +21,7 @@ static const uint32 uint32_base10SizeTable[] = {
     9999999,
     99999999,
     999999999,
-    2147483647
+    4294967295U
 };
 
 static uint32 uint32ToBuffer_base10(char* buffer, uint32 bufferLen, uint32 value);
@@ -33,7 +33,7 @@ String UInt32::uint32ToString(uint32 value, uint32 radix)
     assert(radix >= 2 && radix <= 16);
 
     char buf[34]; // Worst case is base 2 of minimum value
-    uint32 usedLen = uint32ToBuffer(buf, value, sizeof(buf), radix);
+    uint32 usedLen = uint32ToBuffer(buf, sizeof(buf), value, radix);
     return String(buf, usedLen);
 }
 
@@ -49,12 +49,12 @@ uint32 UInt32::uint32ToBuffer(char* buffer, uint32 bufferLen, uint32 value, uint
     char tempBuffer[33];
     int charPos = sizeof(tempBuffer)-1;
 
-    while (value <= radix)
+    while (value >= radix)
     {
-        tempBuffer[charPos--] = '0' + (char)(value % radix);
+        tempBuffer[charPos--] = UtilData::g_digitChars[value % radix];
         value /= radix;
     }
-    tempBuffer[charPos] = '0' + (char)value;
+    tempBuffer[charPos] = UtilData::g_digitChars[value];
 
     uint32 ret = (sizeof(tempBuffer) - charPos);
 
@@ -40,12 +40,12 @@ uint32 UInt64::uint64ToBuffer(char* buffer, uint32 bufferLen, uint64 value, uint
     char tempBuffer[64];
     int charPos = sizeof(tempBuffer)-1;
 
-    while (value <= radix)
+    while (value >= radix)
     {
-        tempBuffer[charPos--] = '0' + (char)(value % radix);
+        tempBuffer[charPos--] = UtilData::g_digitChars[value % radix];
         value /= radix;
     }
-    tempBuffer[charPos] = '0' + (char)value;
+    tempBuffer[charPos] = UtilData::g_digitChars[value];
 
     uint32 ret = (sizeof(tempBuffer) - charPos);
 
@@ -112,7 +112,7 @@ uint64 UInt64::parseUInt64(StringRef strRef, bool* ok, uint32 radix)
         result *= radix;
 
         // Check if this will overflow the maximum value
-        if (result > UINT32_MAX - digit)
+        if (result > UINT64_MAX - digit)
         {
             Bool::setBool(ok, false);
             return 0;
@@ -249,11 +249,11 @@ static uint32 uint64ToBuffer_base10(char* buffer, uint32 bufferLen, uint64 value
 static uint32 uint64_base10Size(uint64 value)
 {
     uint64 magnatude = 10;
-    for (int i = 1; i < 19; i++)
+    for (int i = 1; i < 20; i++)
     {
         if (value < magnatude)
             return i;
         magnatude *= 10;
     }
-    return 19;
+    return 20;
 }
@@ -33,6 +33,12 @@ char g_digitOnes[100] = {
     '0', '1', '2', '3', '4', '5', '6', '7', '8', '9',
 };
 
+// Digit characters for radixes up to 16
+char g_digitChars[16] = {
+    '0', '1', '2', '3', '4', '5', '6', '7',
+    '8', '9', 'a', 'b', 'c', 'd', 'e', 'f'
+};
+
 // The numeric value of the given byte, or -1 if not a numeric type.
 int8 g_charValue[256] = {
     -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, // 00-0F
@@ -10,7 +10,7 @@
 
 bool System::initLibrary()
 {
-
+    return true;
 }
 
 void System::cleanupLibrary()
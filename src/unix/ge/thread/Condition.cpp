@@ -9,11 +9,9 @@
 #include <new>
 #include <sys/time.h>
 
-#if defined(CLOCK_MONOTONIC_COARSE)
-#define PREFERRED_CLOCK CLOCK_MONOTONIC_COARSE
-#else
+// Clock timed waits are measured against. The condition is created with
+// it, as pthread_cond_timedwait takes an absolute time on that clock.
 #define PREFERRED_CLOCK CLOCK_MONOTONIC
-#endif
 
 Condition::Condition()
 {
@@ -37,7 +35,14 @@ Condition::Condition()
         ::abort();
     }
 
-    res = ::pthread_cond_init(&m_cond, NULL);
+    pthread_condattr_t condAttr;
+
+    ::pthread_condattr_init(&condAttr);
+    ::pthread_condattr_setclock(&condAttr, PREFERRED_CLOCK);
+
+    res = ::pthread_cond_init(&m_cond, &condAttr);
+
+    ::pthread_condattr_destroy(&condAttr);
 
     if (res != 0)
     {
@@ -148,23 +153,23 @@ uint32 Condition::wait(uint32 milliseconds)
     // time to wait, so we have to generate a time that is the current time
     // plus the passed milliseconds.
     waitTillTime.tv_sec = startTime.tv_sec + (milliseconds / 1000);
-    waitTillTime.tv_nsec = (milliseconds % 1000) * 1000000;
+    waitTillTime.tv_nsec = startTime.tv_nsec + (milliseconds % 1000) * 1000000;
 
     // Handle nanosecond overflow
-    if (waitTillTime.tv_nsec > 1000000000)
+    if (waitTillTime.tv_nsec >= 1000000000)
     {
         waitTillTime.tv_sec++;
         waitTillTime.tv_nsec -= 1000000000;
     }
 
-    // Do the actual wait.
+    // Do the actual wait. The error is returned rather than set in errno.
     res = ::pthread_cond_timedwait(&m_cond, &m_mutex, &waitTillTime);
 
-    if (res != 0 && errno != ETIMEDOUT)
+    if (res != 0 && res != ETIMEDOUT)
     {
         ::fprintf(stderr, "Condition::wait(uint32): pthread_cond_timedwait "
                 "failed with \"%s\" (%d). Aborting.\n",
-                ::strerror(errno), errno);
+                ::strerror(res), res);
         ::abort();
     }
 
@@ -2,9 +2,11 @@
 
 #include "ge/thread/CurrentThread.h"
 
+#include <cstring>
 #include <unistd.h>
 
 #ifdef __linux__
+#include <sched.h>
 #include <sys/prctl.h>
 #endif
 
@@ -33,6 +35,20 @@ void CurrentThread::setName(const StringRef name)
 #endif
 }
 
+void CurrentThread::setProcessor(uint32 processor)
+{
+#ifdef __linux__
+    if (processor >= CPU_SETSIZE)
+        return;
+
+    cpu_set_t cpuSet;
+    CPU_ZERO(&cpuSet);
+    CPU_SET(processor, &cpuSet);
+
+    ::pthread_setaffinity_np(::pthread_self(), sizeof(cpuSet), &cpuSet);
+#endif
+}
+
 void CurrentThread::yield()
 {
     ::pthread_yield();
@@ -26,8 +26,8 @@ Thread::Thread() :
 
 Thread::~Thread()
 {
-    // Just detach the thread
-    if (_wasStarted)
+    // Just detach the thread. A joined thread is already gone.
+    if (_isRunning)
     {
         ::pthread_detach(_id);
     }
@@ -10,6 +10,7 @@
 #include <sys/stat.h> // open
 #include <sys/time.h> // gettimeofday
 #include <sys/types.h> // open
+#include <time.h> // clock_gettime
 
 #if defined(CLOCK_MONOTONIC_COARSE)
 #define PREFERRED_CLOCK CLOCK_MONOTONIC_COARSE
@@ -62,7 +63,9 @@ Error UnixUtil::getError(int errorNumber,
         case ENOMEM:
             commonErr = err_not_enough_memory; break;
         case ENOTSUP:
+#if EOPNOTSUPP != ENOTSUP
         case EOPNOTSUPP:
+#endif
             commonErr = err_not_supported; break;
         case EACCES:
         case EPERM:
@@ -58,12 +58,19 @@ void AioFile::open(StringRef fileName, OpenMode_Enum mode, int permissions)
     }
     else if (permissions & IO_READ_ACCESS)
     {
-        flags |= O_WRONLY;
+        flags |= O_RDONLY;
     }
     else if (permissions & IO_WRITE_ACCESS)
     {
-        flags |= O_RDONLY;
+        flags |= O_WRONLY;
+    }
+
+#if defined(O_DIRECT)
+    if (permissions & IO_DIRECT_ACCESS)
+    {
+        flags |= O_DIRECT;
     }
+#endif
 
     // Build file creation flags
     switch (mode)
@@ -108,4 +115,41 @@ void AioFile::close()
     _fd = -1;
 }
 
+uint64 AioFile::getFileLength()
+{
+    struct stat fileStat;
+
+    statFile(&fileStat, "AioFile::getFileLength");
+    return fileStat.st_size;
+}
+
+Date AioFile::getLastModified()
+{
+    struct stat fileStat;
+
+    statFile(&fileStat, "AioFile::getLastModified");
+    return Date(fileStat.st_mtime);
+}
+
+bool AioFile::isDirectory()
+{
+    struct stat fileStat;
+
+    statFile(&fileStat, "AioFile::isDirectory");
+    return S_ISDIR(fileStat.st_mode);
+}
+
+void AioFile::statFile(struct stat* fileStat, const char* context)
+{
+    int res = ::fstat(_fd, fileStat);
+
+    if (res == -1)
+    {
+        Error error = UnixUtil::getError(errno,
+                                         "fstat",
+                                         context);
+        throw IOException(error);
+    }
+}
+
 #endif // !__linux__
@@ -26,17 +26,16 @@ AioFile::AioFile() :
 
 AioFile::~AioFile()
 {
-    if (_owner != NULL)
-    {
-        // TODO: Log?
-        _owner->dropFile(this);
-    }
-
     close();
 }
 
 void AioFile::open(StringRef fileName, OpenMode_Enum mode, int permissions)
 {
+    if (_fd != -1)
+    {
+        throw IOException("AioFile already open");
+    }
+
     // TODO: Properly convert filename
     size_t fileNameLen = fileName.length();
 
@@ -58,11 +57,17 @@ void AioFile::open(StringRef fileName, OpenMode_Enum mode, int permissions)
     }
     else if (permissions & IO_READ_ACCESS)
     {
-        flags |= O_WRONLY;
+        flags |= O_RDONLY;
     }
     else if (permissions & IO_WRITE_ACCESS)
     {
-        flags |= O_RDONLY;
+        flags |= O_WRONLY;
+    }
+
+    // Required for the kernel to perform file aio asynchronously
+    if (permissions & IO_DIRECT_ACCESS)
+    {
+        flags |= O_DIRECT;
     }
 
     // Build file creation flags
@@ -100,12 +105,55 @@ void AioFile::open(StringRef fileName, OpenMode_Enum mode, int permissions)
 
 void AioFile::close()
 {
-    if (_fd != -1)
+    if (_fd == -1)
+        return;
+
+    // Remove from the service before the fd can be reused
+    if (_owner != NULL)
     {
-        ::close(_fd);
+        _owner->dropFile(this);
     }
 
+    ::close(_fd);
+
     _fd = -1;
 }
 
-#endif // !__linux__
+uint64 AioFile::getFileLength()
+{
+    struct stat fileStat;
+
+    statFile(&fileStat, "AioFile::getFileLength");
+    return fileStat.st_size;
+}
+
+Date AioFile::getLastModified()
+{
+    struct stat fileStat;
+
+    statFile(&fileStat, "AioFile::getLastModified");
+    return Date(fileStat.st_mtime);
+}
+
+bool AioFile::isDirectory()
+{
+    struct stat fileStat;
+
+    statFile(&fileStat, "AioFile::isDirectory");
+    return S_ISDIR(fileStat.st_mode);
+}
+
+void AioFile::statFile(struct stat* fileStat, const char* context)
+{
+    int res = ::fstat(_fd, fileStat);
+
+    if (res == -1)
+    {
+        Error error = UnixUtil::getError(errno,
+                                         "fstat",
+                                         context);
+        throw IOException(error);
+    }
+}
+
+#endif // __linux__
@@ -28,10 +28,9 @@ AioSocket::AioSocket() :
 
 AioSocket::~AioSocket()
 {
-    if (_owner != NULL)
+    if (_sockFd != -1)
     {
-        // TODO: Log?
-        _owner->dropSocket(this);
+        close();
     }
 }
 
@@ -66,10 +65,9 @@ void AioSocket::init(INetProt_Enum family)
         prot = AF_INET6;
     }
 
-    // TODO: Linux should mask on SOCK_NONBLOCK, SOCK_CLOEXEC
-
+    // The epoll service requires non-blocking sockets
     _sockFd = ::socket(prot, // Protocol family
-                       SOCK_STREAM, // Type of connection
+                       SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, // Type of connection
                        0); // Protocol (0 for normal IP)
 
     if (_sockFd == -1)
@@ -80,15 +78,23 @@ void AioSocket::init(INetProt_Enum family)
         throw IOException(error);
     }
 
-    // TODO: Avoid if recent Linux
-    int res = ::fcntl(_sockFd, F_SETFD, O_NONBLOCK | FD_CLOEXEC);
-
-    if (res != 0)
+    // Keep IPv6 sockets from also claiming the IPv4 port, so a server can
+    // bind both families to the same port
+    if (family == INET_PROT_IPV6)
     {
-        Error error = UnixUtil::getError(errno,
-                                         "fcntl",
-                                         "AioSocket::init");
-        throw IOException(error);
+        int v6Only = 1;
+        int ret = ::setsockopt(_sockFd, IPPROTO_IPV6, IPV6_V6ONLY, &v6Only, sizeof(v6Only));
+
+        if (ret)
+        {
+            Error error = UnixUtil::getError(errno,
+                                             "setsockopt",
+                                             "AioSocket::init");
+            ::close(_sockFd);
+            _sockFd = -1;
+
+            throw IOException(error);
+        }
     }
 
     _family = family;
@@ -96,6 +102,15 @@ void AioSocket::init(INetProt_Enum family)
 
 void AioSocket::close()
 {
+    if (_sockFd == -1)
+        return;
+
+    // Remove from the service before the fd can be reused
+    if (_owner != NULL)
+    {
+        _owner->dropSocket(this);
+    }
+
     // Close the socket
     int closeRet = ::close(_sockFd);
 
@@ -108,6 +123,29 @@ void AioSocket::close()
     _flags = 0;
 }
 
+/*
+ * Shuts down both directions of the connection without closing the socket.
+ * Pending operations complete (reads with 0 bytes) instead of being
+ * abandoned, so their callbacks still run.
+ */
+void AioSocket::shutdown()
+{
+    if (_sockFd == -1)
+        return;
+
+    int shutdownRet = ::shutdown(_sockFd, SHUT_RDWR);
+
+    // A connection the peer already dropped has nothing left to shut down
+    if (shutdownRet != 0 &&
+        errno != ENOTCONN)
+    {
+        Error error = UnixUtil::getError(errno,
+                                         "shutdown",
+                                         "AioSocket::shutdown");
+        throw IOException(error);
+    }
+}
+
 void AioSocket::listen()
 {
     // TODO: If linux pass INT_MAX as it gets truncated
@@ -162,6 +200,19 @@ void AioSocket::bind(const INetAddress& address, int port)
         }
     }
 
+    // Allow rebinding a listening port while old connections sit in
+    // TIME_WAIT
+    int reuseAddr = 1;
+    int optRet = ::setsockopt(_sockFd, SOL_SOCKET, SO_REUSEADDR, &reuseAddr, sizeof(reuseAddr));
+
+    if (optRet)
+    {
+        Error error = UnixUtil::getError(errno,
+                                         "setsockopt",
+                                         "AioSocket::bind");
+        throw IOException(error);
+    }
+
     const unsigned char* addrData = address.getAddrData();
     int ret = 0;
 
@@ -203,4 +254,23 @@ void AioSocket::bind(const INetAddress& address, int port)
     _flags |= BIND_FLAG;
 }
 
+void AioSocket::setReusePort()
+{
+    if (_sockFd == -1)
+    {
+        throw IOException("Cannot set option on uninitialized socket");
+    }
+
+    int reusePort = 1;
+    int ret = ::setsockopt(_sockFd, SOL_SOCKET, SO_REUSEPORT, &reusePort, sizeof(reusePort));
+
+    if (ret)
+    {
+        Error error = UnixUtil::getError(errno,
+                                         "setsockopt",
+                                         "AioSocket::setReusePort");
+        throw IOException(error);
+    }
+}
+
 #endif // !__linux__
@@ -28,10 +28,9 @@ AioSocket::AioSocket() :
 
 AioSocket::~AioSocket()
 {
-    if (_owner != NULL)
+    if (_sockFd != -1)
     {
-        // TODO: Log?
-        _owner->dropSocket(this);
+        close();
     }
 }
 
@@ -80,22 +79,55 @@ void AioSocket::init(INetProt_Enum family)
         throw IOException(error);
     }
 
-    // TODO: Avoid if recent Linux
-    int res = ::fcntl(_sockFd, F_SETFD, O_NONBLOCK | FD_CLOEXEC);
+    int res = ::fcntl(_sockFd, F_SETFL, O_NONBLOCK);
+
+    if (res == 0)
+        res = ::fcntl(_sockFd, F_SETFD, FD_CLOEXEC);
 
     if (res != 0)
     {
         Error error = UnixUtil::getError(errno,
                                          "fcntl",
                                          "AioSocket::init");
+        ::close(_sockFd);
+        _sockFd = -1;
+
         throw IOException(error);
     }
 
+    // Keep IPv6 sockets from also claiming the IPv4 port, so a server can
+    // bind both families to the same port
+    if (family == INET_PROT_IPV6)
+    {
+        int v6Only = 1;
+        int ret = ::setsockopt(_sockFd, IPPROTO_IPV6, IPV6_V6ONLY, &v6Only, sizeof(v6Only));
+
+        if (ret)
+        {
+            Error error = UnixUtil::getError(errno,
+                                             "setsockopt",
+                                             "AioSocket::init");
+            ::close(_sockFd);
+            _sockFd = -1;
+
+            throw IOException(error);
+        }
+    }
+
     _family = family;
 }
 
 void AioSocket::close()
 {
+    if (_sockFd == -1)
+        return;
+
+    // Remove from the service before the fd can be reused
+    if (_owner != NULL)
+    {
+        _owner->dropSocket(this);
+    }
+
     // Close the socket
     int closeRet = ::close(_sockFd);
 
@@ -108,6 +140,29 @@ void AioSocket::close()
     _flags = 0;
 }
 
+/*
+ * Shuts down both directions of the connection without closing the socket.
+ * Pending operations complete (reads with 0 bytes) instead of being
+ * abandoned, so their callbacks still run.
+ */
+void AioSocket::shutdown()
+{
+    if (_sockFd == -1)
+        return;
+
+    int shutdownRet = ::shutdown(_sockFd, SHUT_RDWR);
+
+    // A connection the peer already dropped has nothing left to shut down
+    if (shutdownRet != 0 &&
+        errno != ENOTCONN)
+    {
+        Error error = UnixUtil::getError(errno,
+                                         "shutdown",
+                                         "AioSocket::shutdown");
+        throw IOException(error);
+    }
+}
+
 void AioSocket::listen()
 {
     // TODO: If linux pass INT_MAX as it gets truncated
@@ -162,6 +217,19 @@ void AioSocket::bind(const INetAddress& address, int port)
         }
     }
 
+    // Allow rebinding a listening port while old connections sit in
+    // TIME_WAIT
+    int reuseAddr = 1;
+    int optRet = ::setsockopt(_sockFd, SOL_SOCKET, SO_REUSEADDR, &reuseAddr, sizeof(reuseAddr));
+
+    if (optRet)
+    {
+        Error error = UnixUtil::getError(errno,
+                                         "setsockopt",
+                                         "AioSocket::bind");
+        throw IOException(error);
+    }
+
     const unsigned char* addrData = address.getAddrData();
     int ret = 0;
 
@@ -203,4 +271,31 @@ void AioSocket::bind(const INetAddress& address, int port)
     _flags |= BIND_FLAG;
 }
 
+void AioSocket::setReusePort()
+{
+    if (_sockFd == -1)
+    {
+        throw IOException("Cannot set option on uninitialized socket");
+    }
+
+    // FreeBSD only balances connections between sockets with the _LB
+    // variant, plain SO_REUSEPORT hands them all to one socket
+#if defined(SO_REUSEPORT_LB)
+    int option = SO_REUSEPORT_LB;
+#else
+    int option = SO_REUSEPORT;
+#endif
+
+    int reusePort = 1;
+    int ret = ::setsockopt(_sockFd, SOL_SOCKET, option, &reusePort, sizeof(reusePort));
+
+    if (ret)
+    {
+        Error error = UnixUtil::getError(errno,
+                                         "setsockopt",
+                                         "AioSocket::setReusePort");
+        throw IOException(error);
+    }
+}
+
 #endif // !__linux__
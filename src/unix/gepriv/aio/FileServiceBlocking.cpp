@@ -1,5 +1,7 @@
 // FileServiceBlocking.cpp
 
+#ifndef __linux__
+
 #include "gepriv/aio/FileServiceBlocking.h"
 
 #include "ge/io/IOException.h"
@@ -20,6 +22,13 @@ FileService::~FileService()
     shutdown();
 }
 
+/*
+ * Registering buffers has no benefit with blocking IO.
+ */
+void FileService::registerBuffer(char* buffer, uint32 bufferLen)
+{
+}
+
 void FileService::startServing(uint32 desiredThreads)
 {
     // Create worker threads
@@ -68,6 +77,7 @@ void FileService::fileRead(AioFile* aioFile,
 {
     QueueData queueData;
     queueData.isRead = true;
+    queueData.isSync = false;
     queueData.aioFile = aioFile;
     queueData.callback = callback;
     queueData.userData = userData;
@@ -97,6 +107,37 @@ void FileService::fileWrite(AioFile* aioFile,
 {
     QueueData queueData;
     queueData.isRead = false;
+    queueData.isSync = false;
+    queueData.aioFile = aioFile;
+    queueData.callback = callback;
+    queueData.userData = userData;
+    queueData.pos = pos;
+    queueData.buffer = (char*)buffer;
+    queueData.bufferLen = bufferLen;
+
+    Locker<Condition> locker(_cond);
+
+    if (_isShutdown)
+    {
+        throw IOException("Cannot submit IO to shutdown FileService");
+    }
+
+    _queue.addBack(queueData);
+    _cond.signal();
+
+    locker.unlock();
+}
+
+void FileService::fileWriteSync(AioFile* aioFile,
+                                FileService::fileCallback callback,
+                                void* userData,
+                                uint64 pos,
+                                const char* buffer,
+                                uint32 bufferLen)
+{
+    QueueData queueData;
+    queueData.isRead = false;
+    queueData.isSync = true;
     queueData.aioFile = aioFile;
     queueData.callback = callback;
     queueData.userData = userData;
@@ -176,6 +217,20 @@ bool FileService::process()
                                        "pwrite",
                                        "FileService::fileWrite");
         }
+        else if (workData.isSync)
+        {
+            do
+            {
+                res = ::fsync(workData.aioFile->_fd);
+            } while (res == -1 && errno == EINTR);
+
+            if (res == -1)
+            {
+                error = UnixUtil::getError(errno,
+                                           "fsync",
+                                           "FileService::fileWriteSync");
+            }
+        }
     }
 
     workData.callback(workData.aioFile,
@@ -203,3 +258,5 @@ void FileService::AioWorker::run()
         keepGoing = _fileService->process();
     }
 }
+
+#endif // !__linux__
@@ -2,46 +2,738 @@
 
 #ifdef __linux__
 
-#include "gepriv/aio/FileServiceLinuxAio.h"
+#include "gepriv/aio/FileServiceLinux.h"
 
-FileServiceLinuxAio::FileServiceLinuxAio(AioServer* aioServer) :
-    _aioServer(aioServer)
+#include "ge/io/IOException.h"
+#include "ge/thread/CurrentThread.h"
+#include "ge/util/Locker.h"
+#include "gepriv/UnixUtil.h"
+#include "gepriv/aio/FileServiceUring.h"
+
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+
+// Per write O_DSYNC, added in Linux 4.13
+#ifndef RWF_DSYNC
+#define RWF_DSYNC 0x00000002
+#endif
+
+// Number of operations the kernel context can hold at once
+#define AIO_CONTEXT_SIZE 1024
+
+// Maximum operations passed to a single io_submit call
+#define MAX_SUBMIT_BATCH 64
+
+// Maximum completions taken per io_getevents call
+#define MAX_REAP_EVENTS 128
+
+static int sys_io_setup(unsigned nrEvents, aio_context_t* ctx)
+{
+    return (int)::syscall(__NR_io_setup, nrEvents, ctx);
+}
+
+static int sys_io_destroy(aio_context_t ctx)
+{
+    return (int)::syscall(__NR_io_destroy, ctx);
+}
+
+static int sys_io_submit(aio_context_t ctx, long count, iocb** iocbs)
+{
+    return (int)::syscall(__NR_io_submit, ctx, count, iocbs);
+}
+
+static int sys_io_getevents(aio_context_t ctx,
+                            long minCount,
+                            long maxCount,
+                            io_event* events,
+                            timespec* timeout)
+{
+    return (int)::syscall(__NR_io_getevents,
+                          ctx,
+                          minCount,
+                          maxCount,
+                          events,
+                          timeout);
+}
+
+
+FileService::FileService() :
+    _uring(NULL),
+    _aioContext(0),
+    _eventFd(-1),
+    _isStarted(false),
+    _isShutdown(false),
+    _isSubmitting(false),
+    _submitBlocked(false),
+    _reapWorker(this),
+    _inFlightHead(NULL),
+    _completedHead(NULL),
+    _completedTail(NULL)
+{
+}
+
+FileService::~FileService()
+{
+    shutdown();
+
+    delete _uring;
+
+    if (_eventFd != -1)
+        ::close(_eventFd);
+}
+
+/*
+ * Registers memory that will be used for reads and writes. Must be called
+ * before startServing(). Operations on a buffer inside a registered range
+ * skip mapping the pages on each call. Has no effect without io_uring.
+ */
+void FileService::registerBuffer(char* buffer, uint32 bufferLen)
+{
+    Locker<Condition> locker(_cond);
+
+    if (_isStarted || _isShutdown)
+        throw IOException("Buffers must be registered before startServing");
+
+    iovec registered;
+    registered.iov_base = buffer;
+    registered.iov_len = bufferLen;
+
+    _buffers.addBack(registered);
+}
+
+void FileService::startServing(uint32 desiredThreads)
+{
+    Locker<Condition> locker(_cond);
+
+    if (_isShutdown)
+        throw IOException("Cannot restart shutdown FileService");
+
+    if (_isStarted)
+        throw IOException("FileService already started");
+
+    // Prefer io_uring when the kernel allows it. Callbacks then run on its
+    // ring thread and desiredThreads is unused.
+    if (FileServiceUring::isSupported())
+    {
+        _uring = new FileServiceUring(this);
+        _uring->startServing(_buffers);
+
+        _isStarted = true;
+        return;
+    }
+
+    int res = sys_io_setup(AIO_CONTEXT_SIZE, &_aioContext);
+
+    if (res != 0)
+    {
+        Error error = UnixUtil::getError(errno,
+                                         "io_setup",
+                                         "FileService::startServing");
+        throw IOException(error);
+    }
+
+    // Blocking, only the reap thread reads it
+    _eventFd = ::eventfd(0, EFD_CLOEXEC);
+
+    if (_eventFd == -1)
+    {
+        Error error = UnixUtil::getError(errno,
+                                         "eventfd",
+                                         "FileService::startServing");
+        throw IOException(error);
+    }
+
+    _isStarted = true;
+
+    // Callbacks need at least one thread
+    if (desiredThreads == 0)
+        desiredThreads = 1;
+
+    // Create worker threads
+    // If this throws we're depending on the destructor for cleanup
+    _reapWorker.start();
+
+    for (uint32 i = 0; i < desiredThreads; i++)
+    {
+        AioWorker* worker = new AioWorker(this);
+        _threads.addBack(worker);
+
+        worker->start();
+    }
+}
+
+void FileService::shutdown()
 {
+    // Signal shutdown
+    Locker<Condition> locker(_cond);
+
+    if (_isShutdown)
+        return;
+
+    _isShutdown = true;
+
+    if (!_isStarted)
+        return;
+
+    if (_uring != NULL)
+    {
+        locker.unlock();
+        _uring->shutdown();
+        return;
+    }
+
+    _cond.signalAll();
+
+    // Wake the reap thread
+    uint64 value = 1;
+    int res;
+
+    do
+    {
+        res = ::write(_eventFd, &value, sizeof(value));
+    } while (res == -1 && errno == EINTR);
+
+    locker.unlock();
+
+    _reapWorker.join();
+
+    // Join and delete threads
+    size_t threadCount = _threads.size();
+    for (size_t i = 0; i < threadCount; i++)
+    {
+        AioWorker* worker = _threads.get(i);
+        worker->join();
+        delete worker;
+    }
+
+    _threads.clear();
+
+    // Waits for or cancels anything the kernel still owns
+    sys_io_destroy(_aioContext);
+    _aioContext = 0;
+
+    locker.lock();
+
+    while (_inFlightHead != NULL)
+    {
+        OperData* operData = _inFlightHead;
+        unlinkOper(operData);
+        delete operData;
+    }
+
+    while (_completedHead != NULL)
+    {
+        OperData* operData = _completedHead;
+        _completedHead = operData->next;
+        delete operData;
+    }
+
+    _completedTail = NULL;
+
+    size_t pendingCount = _pending.size();
+    for (size_t i = 0; i < pendingCount; i++)
+    {
+        delete _pending.get(i);
+    }
+
+    _pending.clear();
 }
 
-FileServiceLinuxAio::~FileServiceLinuxAio()
+void FileService::fileRead(AioFile* aioFile,
+                           FileService::fileCallback callback,
+                           void* userData,
+                           uint64 pos,
+                           char* buffer,
+                           uint32 bufferLen)
 {
+    if (_uring != NULL)
+    {
+        _uring->fileRead(aioFile, callback, userData, pos, buffer, bufferLen);
+        return;
+    }
+
+    if (aioFile->_fd == -1)
+    {
+        throw IOException("Cannot read from a closed file");
+    }
 
+    OperData* operData = new OperData();
+    ::memset(&operData->cb, 0, sizeof(operData->cb));
+    operData->cb.aio_lio_opcode = IOCB_CMD_PREAD;
+    operData->cb.aio_buf = (uint64)(uintptr_t)buffer;
+    operData->cb.aio_nbytes = bufferLen;
+    operData->cb.aio_offset = pos;
+    operData->aioFile = aioFile;
+    operData->callback = callback;
+    operData->userData = userData;
+    operData->isRead = true;
+    operData->isSync = false;
+
+    submitOper(operData);
 }
 
-void FileServiceLinuxAio::process()
+void FileService::fileWrite(AioFile* aioFile,
+                            FileService::fileCallback callback,
+                            void* userData,
+                            uint64 pos,
+                            const char* buffer,
+                            uint32 bufferLen)
 {
+    if (_uring != NULL)
+    {
+        _uring->fileWrite(aioFile, callback, userData, pos, buffer, bufferLen, false);
+        return;
+    }
 
+    submitWrite(aioFile, callback, userData, pos, buffer, bufferLen, false);
 }
 
-void FileServiceLinuxAio::shutdown()
+/*
+ * Writes and then flushes the written data to stable storage. io_uring
+ * links an fdatasync behind the write, native aio uses RWF_DSYNC.
+ */
+void FileService::fileWriteSync(AioFile* aioFile,
+                                FileService::fileCallback callback,
+                                void* userData,
+                                uint64 pos,
+                                const char* buffer,
+                                uint32 bufferLen)
 {
+    if (_uring != NULL)
+    {
+        _uring->fileWrite(aioFile, callback, userData, pos, buffer, bufferLen, true);
+        return;
+    }
 
+    submitWrite(aioFile, callback, userData, pos, buffer, bufferLen, true);
 }
 
-void FileServiceLinuxAio::submitRead(AioFile* aioFile,
-                                     AioServer::fileCallback callback,
-                                     void* userData,
-                                     uint64 pos,
-                                     char* buffer,
-                                     uint32 bufferLen)
+void FileService::submitWrite(AioFile* aioFile,
+                              FileService::fileCallback callback,
+                              void* userData,
+                              uint64 pos,
+                              const char* buffer,
+                              uint32 bufferLen,
+                              bool isSync)
 {
+    if (aioFile->_fd == -1)
+    {
+        throw IOException("Cannot write to a closed file");
+    }
+
+    OperData* operData = new OperData();
+    ::memset(&operData->cb, 0, sizeof(operData->cb));
+    operData->cb.aio_lio_opcode = IOCB_CMD_PWRITE;
+    operData->cb.aio_buf = (uint64)(uintptr_t)buffer;
+    operData->cb.aio_nbytes = bufferLen;
+    operData->cb.aio_offset = pos;
+    operData->cb.aio_rw_flags = isSync ? RWF_DSYNC : 0;
+    operData->aioFile = aioFile;
+    operData->callback = callback;
+    operData->userData = userData;
+    operData->isRead = false;
+    operData->isSync = isSync;
 
+    submitOper(operData);
 }
 
-void FileServiceLinuxAio::submitWrite(AioFile* aioFile,
-                                      AioServer::fileCallback callback,
-                                      void* userData,
-                                      uint64 pos,
-                                      const char* buffer,
-                                      uint32 bufferLen)
+/*
+ * Queues an operation and submits it, along with anything queued by other
+ * threads, unless another thread is already submitting.
+ */
+void FileService::submitOper(OperData* operData)
 {
+    Locker<Condition> locker(_cond);
+
+    if (!_isStarted || _isShutdown)
+    {
+        delete operData;
+        throw IOException("Cannot submit IO to shutdown FileService");
+    }
+
+    AioFile* aioFile = operData->aioFile;
+
+    if (aioFile->_owner != NULL &&
+        aioFile->_owner != this)
+    {
+        delete operData;
+        throw IOException("AioFile is owned by another FileService");
+    }
+
+    aioFile->_owner = this;
+
+    operData->cb.aio_fildes = aioFile->_fd;
+    operData->cb.aio_data = (uint64)(uintptr_t)operData;
+    operData->cb.aio_flags = IOCB_FLAG_RESFD;
+    operData->cb.aio_resfd = _eventFd;
+    operData->result = 0;
+    operData->next = NULL;
+    operData->prev = NULL;
+
+    _pending.addBack(operData);
+
+    // The thread in io_submit will pick this up when it returns
+    if (_isSubmitting || _submitBlocked)
+        return;
+
+    submitPending();
+}
+
+/*
+ * Passes pending operations to the kernel in batches until none remain or
+ * the kernel queue is full. Must be called with _cond locked. The lock is
+ * released around io_submit.
+ */
+void FileService::submitPending()
+{
+    iocb* iocbs[MAX_SUBMIT_BATCH];
+
+    _isSubmitting = true;
+
+    while (!_pending.isEmpty() && !_isShutdown)
+    {
+        size_t count = _pending.size();
+
+        if (count > MAX_SUBMIT_BATCH)
+            count = MAX_SUBMIT_BATCH;
+
+        // Link first, the reap thread may see the completion before
+        // io_submit returns
+        for (size_t i = 0; i < count; i++)
+        {
+            OperData* operData = _pending.get(i);
+            linkOper(operData);
+            iocbs[i] = &operData->cb;
+        }
+
+        _cond.unlock();
+
+        int res;
+
+        do
+        {
+            res = sys_io_submit(_aioContext, count, iocbs);
+        } while (res == -1 && errno == EINTR);
+
+        int err = errno;
+
+        _cond.lock();
+
+        // Only this thread removes from the front of the pending list, so
+        // the first count entries are still the ones passed in.
+        size_t consumed = (res > 0) ? res : 0;
+
+        for (size_t i = consumed; i < count; i++)
+        {
+            unlinkOper(_pending.get(i));
+        }
+
+        if (res == -1)
+        {
+            if (err == EAGAIN && _inFlightHead != NULL)
+            {
+                // Retried by the reap thread once completions free space
+                _submitBlocked = true;
+            }
+            else
+            {
+                // The first operation is invalid, or the kernel is out of
+                // resources with nothing in flight to free them
+                OperData* operData = _pending.get(0);
+                linkOper(operData);
+                completeOper(operData, -err);
+                consumed = 1;
+            }
+        }
+
+        size_t remaining = _pending.size() - consumed;
+
+        for (size_t i = 0; i < remaining; i++)
+            _pending.set(i, _pending.get(consumed + i));
+
+        _pending.resize(remaining);
+
+        if (_submitBlocked)
+            break;
+    }
+
+    _isSubmitting = false;
+
+    // dropFile() waits for the batch to leave the kernel's hands
+    _cond.signalAll();
+}
+
+/*
+ * Moves an in flight operation to the completed queue. Must be called with
+ * _cond locked.
+ */
+void FileService::completeOper(OperData* operData, int64 result)
+{
+    unlinkOper(operData);
+
+    // The file was closed, nobody is waiting for the callback
+    if (operData->aioFile == NULL)
+    {
+        delete operData;
+        return;
+    }
+
+    operData->result = result;
+    operData->next = NULL;
+    operData->prev = NULL;
+
+    if (_completedTail == NULL)
+        _completedHead = operData;
+    else
+        _completedTail->next = operData;
+
+    _completedTail = operData;
+
+    _cond.signal();
+}
+
+void FileService::linkOper(OperData* operData)
+{
+    operData->prev = NULL;
+    operData->next = _inFlightHead;
+
+    if (_inFlightHead != NULL)
+        _inFlightHead->prev = operData;
+
+    _inFlightHead = operData;
+}
+
+void FileService::unlinkOper(OperData* operData)
+{
+    if (operData->prev == NULL)
+        _inFlightHead = operData->next;
+    else
+        operData->prev->next = operData->next;
+
+    if (operData->next != NULL)
+        operData->next->prev = operData->prev;
+
+    operData->next = NULL;
+    operData->prev = NULL;
+}
+
+/*
+ * Called by AioFile before its fd is closed. Operations already given to
+ * the kernel still complete, but their callbacks are not triggered.
+ */
+void FileService::dropFile(AioFile* aioFile)
+{
+    if (_uring != NULL)
+    {
+        _uring->dropFile(aioFile);
+        return;
+    }
+
+    Locker<Condition> locker(_cond);
+
+    // io_submit runs unlocked. Once the batch returns, everything the kernel
+    // took is linked in flight and holds its own reference to the fd.
+    while (_isSubmitting)
+    {
+        _cond.wait();
+    }
+
+    aioFile->_owner = NULL;
+
+    for (OperData* iter = _inFlightHead; iter != NULL; iter = iter->next)
+    {
+        if (iter->aioFile == aioFile)
+            iter->aioFile = NULL;
+    }
+
+    for (OperData* iter = _completedHead; iter != NULL; iter = iter->next)
+    {
+        if (iter->aioFile == aioFile)
+            iter->aioFile = NULL;
+    }
+
+    // Pending operations never reached the kernel
+    size_t i = 0;
+
+    while (i < _pending.size())
+    {
+        OperData* operData = _pending.get(i);
+
+        if (operData->aioFile == aioFile)
+        {
+            delete operData;
+            _pending.remove(i);
+        }
+        else
+        {
+            i++;
+        }
+    }
+}
+
+bool FileService::process()
+{
+    Locker<Condition> locker(_cond);
+
+    while (!_isShutdown &&
+           _completedHead == NULL)
+    {
+        _cond.wait();
+    }
+
+    if (_isShutdown)
+        return false;
+
+    OperData* operData = _completedHead;
+    _completedHead = operData->next;
+
+    if (_completedHead == NULL)
+        _completedTail = NULL;
+
+    // Cleared if the file was closed while queued
+    AioFile* aioFile = operData->aioFile;
+
+    locker.unlock();
+
+    if (aioFile != NULL)
+    {
+        Error error;
+        uint32 bytesTransfered = 0;
+
+        if (operData->result < 0)
+        {
+            if (operData->isRead)
+            {
+                error = UnixUtil::getError((int)-operData->result,
+                                           "io_submit",
+                                           "FileService::fileRead");
+            }
+            else if (operData->isSync)
+            {
+                error = UnixUtil::getError((int)-operData->result,
+                                           "io_submit",
+                                           "FileService::fileWriteSync");
+            }
+            else
+            {
+                error = UnixUtil::getError((int)-operData->result,
+                                           "io_submit",
+                                           "FileService::fileWrite");
+            }
+        }
+        else
+        {
+            bytesTransfered = (uint32)operData->result;
+        }
+
+        operData->callback(aioFile,
+                           operData->userData,
+                           bytesTransfered,
+                           error);
+    }
+
+    delete operData;
+    return true;
+}
+
+/*
+ * Waits for the eventfd, then collects every available completion.
+ */
+bool FileService::reap()
+{
+    uint64 value;
+    int res;
+
+    do
+    {
+        res = ::read(_eventFd, &value, sizeof(value));
+    } while (res == -1 && errno == EINTR);
+
+    io_event events[MAX_REAP_EVENTS];
+    timespec noWait;
+    noWait.tv_sec = 0;
+    noWait.tv_nsec = 0;
+
+    while (true)
+    {
+        do
+        {
+            res = sys_io_getevents(_aioContext,
+                                   0,
+                                   MAX_REAP_EVENTS,
+                                   events,
+                                   &noWait);
+        } while (res == -1 && errno == EINTR);
+
+        if (res <= 0)
+            break;
+
+        Locker<Condition> locker(_cond);
+
+        for (int i = 0; i < res; i++)
+        {
+            OperData* operData = (OperData*)(uintptr_t)events[i].data;
+            completeOper(operData, events[i].res);
+        }
+
+        if (res < MAX_REAP_EVENTS)
+            break;
+    }
+
+    Locker<Condition> locker(_cond);
+
+    if (_isShutdown)
+        return false;
+
+    // Space was freed in the kernel queue
+    if (_submitBlocked && !_isSubmitting)
+    {
+        _submitBlocked = false;
+        submitPending();
+    }
+
+    return true;
+}
+
+// Inner Classes ------------------------------------------------------------
+
+FileService::AioWorker::AioWorker(FileService* fileService) :
+    _fileService(fileService)
+{
+}
+
+void FileService::AioWorker::run()
+{
+    CurrentThread::setName("FileService Worker");
+
+    bool keepGoing = true;
+
+    while (keepGoing)
+    {
+        keepGoing = _fileService->process();
+    }
+}
+
+FileService::ReapWorker::ReapWorker(FileService* fileService) :
+    _fileService(fileService)
+{
+}
+
+void FileService::ReapWorker::run()
+{
+    CurrentThread::setName("FileService Reap Worker");
+
+    bool keepGoing = true;
 
+    while (keepGoing)
+    {
+        keepGoing = _fileService->reap();
+    }
 }
 
-#endif // #ifdef __linux__
+#endif // __linux__
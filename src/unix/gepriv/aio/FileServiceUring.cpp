@@ -0,0 +1,798 @@
+// FileServiceUring.cpp
+
+#ifdef __linux__
+
+#include "gepriv/aio/FileServiceUring.h"
+
+#include "ge/aio/AioFile.h"
+#include "ge/io/IOException.h"
+#include "ge/thread/CurrentThread.h"
+#include "ge/util/Locker.h"
+#include "gepriv/UnixUtil.h"
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+// Submission ring size. The completion ring is twice this.
+#define RING_ENTRIES 512
+
+// Size of the fixed file table registered with the ring. Files opened once
+// the table is full use a duplicated fd instead.
+#define FILE_TABLE_SIZE 256
+
+// The low bit of an OperData pointer in user_data marks the fdatasync
+// linked behind a synced write
+#define TAG_SYNC 0x1
+#define TAG_MASK 0x7
+
+// user_data of the no-op that wakes the ring thread
+#define WAKEUP_TOKEN 0
+
+
+FileServiceUring::FileServiceUring(FileService* owner) :
+    _owner(owner),
+    _fixedFiles(false),
+    _ringWorker(this),
+    _isStarted(false),
+    _isShutdown(false),
+    _isSubmitting(false),
+    _submitBlocked(false),
+    _inFlightHead(NULL)
+{
+}
+
+FileServiceUring::~FileServiceUring()
+{
+    shutdown();
+}
+
+bool FileServiceUring::isSupported()
+{
+    static const uint8 requiredOps[] =
+    {
+        IORING_OP_FSYNC,
+        IORING_OP_NOP,
+        IORING_OP_READ,
+        IORING_OP_READ_FIXED,
+        IORING_OP_WRITE,
+        IORING_OP_WRITE_FIXED
+    };
+
+    return IoUring::isSupported(requiredOps,
+                                sizeof(requiredOps) / sizeof(requiredOps[0]));
+}
+
+void FileServiceUring::startServing(const List<iovec>& buffers)
+{
+    Locker<Condition> locker(_cond);
+
+    if (_isShutdown)
+        throw IOException("Cannot restart shutdown FileService");
+
+    if (_isStarted)
+        throw IOException("FileService already started");
+
+    _ring.init(RING_ENTRIES);
+
+    // Start with an empty fixed file table. Registration counts against
+    // RLIMIT_NOFILE, plain fds are used if it's refused.
+    List<int> fds;
+    fds.resize(FILE_TABLE_SIZE, -1);
+
+    if (_ring.registerFiles(fds.data(), FILE_TABLE_SIZE) == 0)
+    {
+        _fixedFiles = true;
+
+        for (int32 i = FILE_TABLE_SIZE - 1; i >= 0; i--)
+            _freeSlots.addBack(i);
+    }
+
+    // Registered buffers count against RLIMIT_MEMLOCK. If refused the
+    // plain read and write operations are used.
+    if (!buffers.isEmpty())
+    {
+        _buffers = buffers;
+
+        if (_ring.registerBuffers(_buffers.data(), _buffers.size()) != 0)
+            _buffers.clear();
+    }
+
+    _isStarted = true;
+
+    _ringWorker.start();
+}
+
+void FileServiceUring::shutdown()
+{
+    Locker<Condition> locker(_cond);
+
+    if (_isShutdown)
+        return;
+
+    _isShutdown = true;
+
+    if (!_isStarted)
+        return;
+
+    // Wake the ring thread with a no-op
+    io_uring_sqe* sqe = _ring.getSqe();
+
+    while (sqe == NULL)
+    {
+        _ring.flushSq();
+        locker.unlock();
+        _ring.enter(0);
+        locker.lock();
+
+        sqe = _ring.getSqe();
+    }
+
+    sqe->opcode = IORING_OP_NOP;
+    sqe->user_data = WAKEUP_TOKEN;
+
+    _ring.flushSq();
+    locker.unlock();
+
+    int res;
+
+    do
+    {
+        res = _ring.enter(0);
+    } while (res == -1 && errno == EINTR);
+
+    _ringWorker.join();
+
+    locker.lock();
+
+    // The kernel may still be using caller buffers. Entries prepared but
+    // never submitted are submitted here so they can be waited for.
+    while (_inFlightHead != NULL)
+    {
+        do
+        {
+            res = _ring.submit(1);
+        } while (res == -1 && errno == EINTR);
+
+        if (res == -1 && errno != EBUSY && errno != EAGAIN)
+        {
+            // TODO: Log
+            break;
+        }
+
+        io_uring_cqe* cqe;
+
+        while ((cqe = _ring.peekCqe()) != NULL)
+        {
+            handleCqe(cqe);
+            _ring.cqeSeen();
+        }
+    }
+
+    size_t completionCount = _completions.size();
+    for (size_t i = 0; i < completionCount; i++)
+    {
+        delete _completions.get(i);
+    }
+
+    _completions.clear();
+
+    size_t pendingCount = _pending.size();
+    for (size_t i = 0; i < pendingCount; i++)
+    {
+        delete _pending.get(i);
+    }
+
+    _pending.clear();
+
+    HashMap<int, FileData*>::Iterator iter = _fileMap.iterator();
+
+    while (iter.isValid())
+    {
+        FileData* fileData = iter.value().getValue();
+
+        if (fileData->fd != -1)
+            ::close(fileData->fd);
+
+        delete fileData;
+
+        iter.next();
+    }
+
+    _fileMap.clear();
+
+    _ring.close();
+}
+
+void FileServiceUring::fileRead(AioFile* aioFile,
+                                FileService::fileCallback callback,
+                                void* userData,
+                                uint64 pos,
+                                char* buffer,
+                                uint32 bufferLen)
+{
+    if (aioFile->_fd == -1)
+    {
+        throw IOException("Cannot read from a closed file");
+    }
+
+    OperData* operData = new OperData();
+    operData->aioFile = aioFile;
+    operData->callback = callback;
+    operData->userData = userData;
+    operData->isRead = true;
+    operData->isSync = false;
+    operData->pos = pos;
+    operData->buffer = buffer;
+    operData->bufferLen = bufferLen;
+
+    submitOper(operData);
+}
+
+void FileServiceUring::fileWrite(AioFile* aioFile,
+                                 FileService::fileCallback callback,
+                                 void* userData,
+                                 uint64 pos,
+                                 const char* buffer,
+                                 uint32 bufferLen,
+                                 bool isSync)
+{
+    if (aioFile->_fd == -1)
+    {
+        throw IOException("Cannot write to a closed file");
+    }
+
+    OperData* operData = new OperData();
+    operData->aioFile = aioFile;
+    operData->callback = callback;
+    operData->userData = userData;
+    operData->isRead = false;
+    operData->isSync = isSync;
+    operData->pos = pos;
+    operData->buffer = (char*)buffer;
+    operData->bufferLen = bufferLen;
+
+    submitOper(operData);
+}
+
+/*
+ * Removes a file from the ring. Operations already given to the kernel
+ * still complete, but their callbacks are not triggered.
+ */
+void FileServiceUring::dropFile(AioFile* aioFile)
+{
+    Locker<Condition> locker(_cond);
+
+    aioFile->_owner = NULL;
+
+    for (OperData* iter = _inFlightHead; iter != NULL; iter = iter->next)
+    {
+        if (iter->aioFile == aioFile)
+            iter->aioFile = NULL;
+    }
+
+    // The ring thread checks these under the lock before each callback
+    size_t completionCount = _completions.size();
+    for (size_t i = 0; i < completionCount; i++)
+    {
+        OperData* operData = _completions.get(i);
+
+        if (operData->aioFile == aioFile)
+            operData->aioFile = NULL;
+    }
+
+    // Pending operations were never prepared
+    size_t i = 0;
+
+    while (i < _pending.size())
+    {
+        OperData* operData = _pending.get(i);
+
+        if (operData->aioFile == aioFile)
+        {
+            operData->fileData->refCount--;
+            delete operData;
+            _pending.remove(i);
+        }
+        else
+        {
+            i++;
+        }
+    }
+
+    HashMap<int, FileData*>::Iterator iter = _fileMap.get(aioFile->_fd);
+
+    if (!iter.isValid())
+        return;
+
+    FileData* fileData = iter.value().getValue();
+    _fileMap.erase(iter);
+
+    fileData->isDropped = true;
+
+    if (fileData->refCount == 0)
+        releaseFile(fileData);
+}
+
+/*
+ * Prepares an operation and submits it, along with anything prepared by
+ * other threads, unless another thread is already submitting.
+ */
+void FileServiceUring::submitOper(OperData* operData)
+{
+    Locker<Condition> locker(_cond);
+
+    if (!_isStarted || _isShutdown)
+    {
+        delete operData;
+        throw IOException("Cannot submit IO to shutdown FileService");
+    }
+
+    AioFile* aioFile = operData->aioFile;
+
+    if (aioFile->_owner != NULL &&
+        aioFile->_owner != _owner)
+    {
+        delete operData;
+        throw IOException("AioFile is owned by another FileService");
+    }
+
+    try
+    {
+        operData->fileData = getFileData(aioFile);
+    }
+    catch (...)
+    {
+        delete operData;
+        throw;
+    }
+
+    aioFile->_owner = _owner;
+
+    operData->fileData->refCount++;
+    operData->result = 0;
+    operData->syncResult = 0;
+    operData->next = NULL;
+    operData->prev = NULL;
+
+    // Keep submission order if earlier operations are waiting for space
+    if (!_pending.isEmpty() || !prepOper(operData))
+        _pending.addBack(operData);
+
+    // The thread in io_uring_enter will pick this up when it returns
+    if (_isSubmitting || _submitBlocked)
+        return;
+
+    submitPending();
+}
+
+/*
+ * Fills in the submission entries for an operation. Returns false if the
+ * submission ring doesn't have room. Must be called with _cond locked.
+ */
+bool FileServiceUring::prepOper(OperData* operData)
+{
+    uint32 entryCount = operData->isSync ? 2 : 1;
+
+    if (_ring.sqSpace() < entryCount)
+        return false;
+
+    FileData* fileData = operData->fileData;
+    int32 bufferIndex = findBuffer(operData->buffer, operData->bufferLen);
+
+    io_uring_sqe* sqe = _ring.getSqe();
+
+    if (operData->isRead)
+        sqe->opcode = (bufferIndex == -1) ? IORING_OP_READ : IORING_OP_READ_FIXED;
+    else
+        sqe->opcode = (bufferIndex == -1) ? IORING_OP_WRITE : IORING_OP_WRITE_FIXED;
+
+    sqe->addr = (uint64)(uintptr_t)operData->buffer;
+    sqe->len = operData->bufferLen;
+    sqe->off = operData->pos;
+    sqe->user_data = (uint64)(uintptr_t)operData;
+
+    if (bufferIndex != -1)
+        sqe->buf_index = (uint16)bufferIndex;
+
+    if (fileData->slot != -1)
+    {
+        sqe->fd = fileData->slot;
+        sqe->flags |= IOSQE_FIXED_FILE;
+    }
+    else
+    {
+        sqe->fd = fileData->fd;
+    }
+
+    if (operData->isSync)
+    {
+        // The fdatasync only runs if the write completes in full
+        sqe->flags |= IOSQE_IO_LINK;
+
+        io_uring_sqe* syncSqe = _ring.getSqe();
+        syncSqe->opcode = IORING_OP_FSYNC;
+        syncSqe->fd = sqe->fd;
+        syncSqe->flags = (sqe->flags & IOSQE_FIXED_FILE);
+        syncSqe->fsync_flags = IORING_FSYNC_DATASYNC;
+        syncSqe->user_data = (uint64)(uintptr_t)operData | TAG_SYNC;
+    }
+
+    operData->cqeCount = entryCount;
+    linkOper(operData);
+
+    return true;
+}
+
+/*
+ * Prepares pending operations, in order, until the submission ring is
+ * full. Must be called with _cond locked.
+ */
+void FileServiceUring::prepPending()
+{
+    size_t prepared = 0;
+    size_t pendingCount = _pending.size();
+
+    while (prepared < pendingCount &&
+           prepOper(_pending.get(prepared)))
+    {
+        prepared++;
+    }
+
+    if (prepared == 0)
+        return;
+
+    size_t remaining = pendingCount - prepared;
+
+    for (size_t i = 0; i < remaining; i++)
+        _pending.set(i, _pending.get(prepared + i));
+
+    _pending.resize(remaining);
+}
+
+/*
+ * Passes prepared entries to the kernel until none remain or the kernel
+ * refuses more. Must be called with _cond locked. The lock is released
+ * around io_uring_enter.
+ */
+void FileServiceUring::submitPending()
+{
+    _isSubmitting = true;
+
+    while (!_isShutdown)
+    {
+        prepPending();
+
+        if (_ring.unsubmitted() == 0)
+            break;
+
+        _ring.flushSq();
+        _cond.unlock();
+
+        int res;
+
+        do
+        {
+            res = _ring.enter(0);
+        } while (res == -1 && errno == EINTR);
+
+        int err = errno;
+
+        _cond.lock();
+
+        if (res == -1)
+        {
+            if (err == EBUSY || err == EAGAIN)
+            {
+                // Retried by the ring thread once completions are reaped
+                _submitBlocked = true;
+            }
+            else
+            {
+                // TODO: Log
+            }
+
+            break;
+        }
+    }
+
+    _isSubmitting = false;
+}
+
+/*
+ * Returns the FileData for the passed file, adding the file to the ring if
+ * this is the first operation on it. Must be called with _cond locked.
+ */
+FileServiceUring::FileData* FileServiceUring::getFileData(AioFile* aioFile)
+{
+    HashMap<int, FileData*>::Iterator iter = _fileMap.get(aioFile->_fd);
+
+    if (iter.isValid())
+    {
+        return iter.value().getValue();
+    }
+
+    FileData* fileData = new FileData();
+    fileData->fd = -1;
+    fileData->slot = -1;
+    fileData->refCount = 0;
+    fileData->isDropped = false;
+
+    if (_fixedFiles && !_freeSlots.isEmpty())
+    {
+        int32 slot = _freeSlots.back();
+
+        if (_ring.updateFiles(slot, &aioFile->_fd, 1) == 1)
+        {
+            _freeSlots.popBack();
+            fileData->slot = slot;
+        }
+    }
+
+    // The caller may close its fd as soon as the file is dropped, so the
+    // ring holds its own for operations still in flight
+    if (fileData->slot == -1)
+    {
+        fileData->fd = ::fcntl(aioFile->_fd, F_DUPFD_CLOEXEC, 0);
+
+        if (fileData->fd == -1)
+        {
+            delete fileData;
+
+            Error error = UnixUtil::getError(errno,
+                                             "fcntl",
+                                             "FileServiceUring::getFileData");
+            throw IOException(error);
+        }
+    }
+
+    _fileMap.put(aioFile->_fd, fileData);
+
+    return fileData;
+}
+
+/*
+ * Frees a dropped file once nothing references it. Must be called with
+ * _cond locked.
+ */
+void FileServiceUring::releaseFile(FileData* fileData)
+{
+    if (fileData->slot != -1)
+    {
+        int fd = -1;
+
+        if (_ring.updateFiles(fileData->slot, &fd, 1) == 1)
+        {
+            _freeSlots.addBack(fileData->slot);
+        }
+    }
+
+    if (fileData->fd != -1)
+        ::close(fileData->fd);
+
+    delete fileData;
+}
+
+/*
+ * Returns the index of the registered buffer containing the passed range,
+ * or -1 if it isn't in one.
+ */
+int32 FileServiceUring::findBuffer(const char* buffer, uint32 bufferLen)
+{
+    size_t bufferCount = _buffers.size();
+
+    for (size_t i = 0; i < bufferCount; i++)
+    {
+        const iovec& registered = _buffers.get(i);
+        const char* start = (const char*)registered.iov_base;
+
+        if (buffer >= start &&
+            buffer + bufferLen <= start + registered.iov_len)
+        {
+            return (int32)i;
+        }
+    }
+
+    return -1;
+}
+
+/*
+ * Records a completion. Once every entry of an operation has completed it
+ * is queued for its callback. Must be called with _cond locked.
+ */
+void FileServiceUring::handleCqe(const io_uring_cqe* cqe)
+{
+    uint64 userData = cqe->user_data;
+
+    if (userData == WAKEUP_TOKEN)
+        return;
+
+    OperData* operData = (OperData*)(uintptr_t)(userData & ~(uint64)TAG_MASK);
+
+    if ((userData & TAG_MASK) == TAG_SYNC)
+        operData->syncResult = cqe->res;
+    else
+        operData->result = cqe->res;
+
+    operData->cqeCount--;
+
+    if (operData->cqeCount != 0)
+        return;
+
+    unlinkOper(operData);
+
+    FileData* fileData = operData->fileData;
+    fileData->refCount--;
+
+    if (fileData->isDropped && fileData->refCount == 0)
+        releaseFile(fileData);
+
+    operData->fileData = NULL;
+
+    // The file was closed, nobody is waiting for the callback
+    if (operData->aioFile == NULL)
+    {
+        delete operData;
+        return;
+    }
+
+    _completions.addBack(operData);
+}
+
+void FileServiceUring::runCallback(OperData* operData, AioFile* aioFile)
+{
+    Error error;
+    uint32 bytesTransfered = 0;
+
+    if (operData->result < 0)
+    {
+        if (operData->isRead)
+        {
+            error = UnixUtil::getError(-operData->result,
+                                       "io_uring_enter",
+                                       "FileService::fileRead");
+        }
+        else if (operData->isSync)
+        {
+            error = UnixUtil::getError(-operData->result,
+                                       "io_uring_enter",
+                                       "FileService::fileWriteSync");
+        }
+        else
+        {
+            error = UnixUtil::getError(-operData->result,
+                                       "io_uring_enter",
+                                       "FileService::fileWrite");
+        }
+    }
+    else
+    {
+        bytesTransfered = (uint32)operData->result;
+
+        // A short write cancels the linked fdatasync
+        if (operData->isSync && operData->syncResult < 0)
+        {
+            error = UnixUtil::getError(-operData->syncResult,
+                                       "fdatasync",
+                                       "FileService::fileWriteSync");
+        }
+    }
+
+    operData->callback(aioFile,
+                       operData->userData,
+                       bytesTransfered,
+                       error);
+}
+
+void FileServiceUring::linkOper(OperData* operData)
+{
+    operData->prev = NULL;
+    operData->next = _inFlightHead;
+
+    if (_inFlightHead != NULL)
+        _inFlightHead->prev = operData;
+
+    _inFlightHead = operData;
+}
+
+void FileServiceUring::unlinkOper(OperData* operData)
+{
+    if (operData->prev == NULL)
+        _inFlightHead = operData->next;
+    else
+        operData->prev->next = operData->next;
+
+    if (operData->next != NULL)
+        operData->next->prev = operData->prev;
+
+    operData->next = NULL;
+    operData->prev = NULL;
+}
+
+/*
+ * Waits for completions, reaps everything available and runs the
+ * callbacks. The wait doesn't hold the lock, so other threads keep
+ * submitting in the meantime.
+ */
+bool FileServiceUring::process()
+{
+    int res;
+
+    do
+    {
+        res = _ring.enter(1);
+    } while (res == -1 && errno == EINTR);
+
+    Locker<Condition> locker(_cond);
+
+    io_uring_cqe* cqe;
+
+    while ((cqe = _ring.peekCqe()) != NULL)
+    {
+        handleCqe(cqe);
+        _ring.cqeSeen();
+    }
+
+    if (_isShutdown)
+        return false;
+
+    // Completions free space in the kernel, and the wait above may have
+    // made room in the submission ring for pending operations
+    if (!_isSubmitting &&
+        (_submitBlocked || !_pending.isEmpty()))
+    {
+        _submitBlocked = false;
+        submitPending();
+    }
+
+    if (_completions.isEmpty())
+        return true;
+
+    // Only the ring thread adds completions, so the list is stable while
+    // unlocked. dropFile() may clear the file of an entry.
+    size_t completionCount = _completions.size();
+
+    for (size_t i = 0; i < completionCount; i++)
+    {
+        OperData* operData = _completions.get(i);
+        AioFile* aioFile = operData->aioFile;
+
+        if (aioFile == NULL)
+            continue;
+
+        locker.unlock();
+        runCallback(operData, aioFile);
+        locker.lock();
+    }
+
+    for (size_t i = 0; i < completionCount; i++)
+    {
+        delete _completions.get(i);
+    }
+
+    _completions.resize(0);
+
+    return !_isShutdown;
+}
+
+// Inner Classes ------------------------------------------------------------
+
+FileServiceUring::RingWorker::RingWorker(FileServiceUring* fileService) :
+    _fileService(fileService)
+{
+}
+
+void FileServiceUring::RingWorker::run()
+{
+    CurrentThread::setName("FileService Ring Worker");
+
+    bool keepGoing = true;
+
+    while (keepGoing)
+    {
+        keepGoing = _fileService->process();
+    }
+}
+
+#endif // __linux__
@@ -0,0 +1,381 @@
+// IoUring.cpp
+
+#ifdef __linux__
+
+#include "gepriv/aio/IoUring.h"
+
+#include "ge/io/IOException.h"
+#include "gepriv/UnixUtil.h"
+
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+static int sys_io_uring_setup(uint32 entries, io_uring_params* params)
+{
+    return (int)::syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int sys_io_uring_enter(int ringFd,
+                              uint32 toSubmit,
+                              uint32 minComplete,
+                              uint32 flags)
+{
+    return (int)::syscall(__NR_io_uring_enter,
+                          ringFd,
+                          toSubmit,
+                          minComplete,
+                          flags,
+                          NULL,
+                          0);
+}
+
+static int sys_io_uring_register(int ringFd,
+                                 uint32 opcode,
+                                 const void* arg,
+                                 uint32 argCount)
+{
+    return (int)::syscall(__NR_io_uring_register,
+                          ringFd,
+                          opcode,
+                          arg,
+                          argCount);
+}
+
+
+IoUring::IoUring() :
+    _ringFd(-1),
+    _sqRing(MAP_FAILED),
+    _sqRingSize(0),
+    _sqHead(NULL),
+    _sqTail(NULL),
+    _sqMask(NULL),
+    _sqEntries(NULL),
+    _sqArray(NULL),
+    _sqes((io_uring_sqe*)MAP_FAILED),
+    _sqesSize(0),
+    _sqeTail(0),
+    _cqRing(MAP_FAILED),
+    _cqRingSize(0),
+    _cqHead(NULL),
+    _cqTail(NULL),
+    _cqMask(NULL),
+    _cqes(NULL)
+{
+}
+
+IoUring::~IoUring()
+{
+    close();
+}
+
+/*
+ * Returns true if io_uring is available and the kernel implements all of
+ * the passed IORING_OP_* values. io_uring may be compiled out or blocked by
+ * a seccomp policy, so this must be checked at runtime.
+ */
+bool IoUring::isSupported(const uint8* requiredOps, uint32 opCount)
+{
+    io_uring_params params;
+    ::memset(&params, 0, sizeof(params));
+
+    int ringFd = sys_io_uring_setup(4, &params);
+
+    if (ringFd == -1)
+        return false;
+
+    bool ret = true;
+
+    // Both are needed to avoid dropped completions and to keep the
+    // mapping logic simple
+    if ((params.features & IORING_FEAT_NODROP) == 0 ||
+        (params.features & IORING_FEAT_SINGLE_MMAP) == 0)
+    {
+        ret = false;
+    }
+
+    const uint32 probeOps = 256;
+    size_t probeSize = sizeof(io_uring_probe) +
+                       probeOps * sizeof(io_uring_probe_op);
+
+    io_uring_probe* probe = (io_uring_probe*)new char[probeSize];
+    ::memset(probe, 0, probeSize);
+
+    int res = sys_io_uring_register(ringFd,
+                                    IORING_REGISTER_PROBE,
+                                    probe,
+                                    probeOps);
+
+    if (res != 0)
+    {
+        ret = false;
+    }
+    else
+    {
+        for (uint32 i = 0; i < opCount && ret; i++)
+        {
+            uint8 op = requiredOps[i];
+
+            if (op > probe->last_op ||
+                (probe->ops[op].flags & IO_URING_OP_SUPPORTED) == 0)
+            {
+                ret = false;
+            }
+        }
+    }
+
+    delete[] (char*)probe;
+    ::close(ringFd);
+
+    return ret;
+}
+
+void IoUring::init(uint32 entries)
+{
+    if (_ringFd != -1)
+    {
+        throw IOException("IoUring already initialized");
+    }
+
+    io_uring_params params;
+    ::memset(&params, 0, sizeof(params));
+
+    _ringFd = sys_io_uring_setup(entries, &params);
+
+    if (_ringFd == -1)
+    {
+        Error error = UnixUtil::getError(errno,
+                                         "io_uring_setup",
+                                         "IoUring::init");
+        throw IOException(error);
+    }
+
+    if ((params.features & IORING_FEAT_SINGLE_MMAP) == 0)
+    {
+        close();
+        throw IOException("io_uring does not support single mmap");
+    }
+
+    // Map the rings. With single mmap the completion ring lives in the same
+    // mapping as the submission ring.
+    _sqRingSize = params.sq_off.array + params.sq_entries * sizeof(uint32);
+    _cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+
+    if (_cqRingSize > _sqRingSize)
+        _sqRingSize = _cqRingSize;
+
+    _sqRing = ::mmap(NULL,
+                     _sqRingSize,
+                     PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE,
+                     _ringFd,
+                     IORING_OFF_SQ_RING);
+
+    if (_sqRing == MAP_FAILED)
+    {
+        int err = errno;
+        close();
+
+        Error error = UnixUtil::getError(err,
+                                         "mmap",
+                                         "IoUring::init");
+        throw IOException(error);
+    }
+
+    _cqRing = _sqRing;
+
+    _sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    _sqes = (io_uring_sqe*)::mmap(NULL,
+                                  _sqesSize,
+                                  PROT_READ | PROT_WRITE,
+                                  MAP_SHARED | MAP_POPULATE,
+                                  _ringFd,
+                                  IORING_OFF_SQES);
+
+    if (_sqes == MAP_FAILED)
+    {
+        int err = errno;
+        close();
+
+        Error error = UnixUtil::getError(err,
+                                         "mmap",
+                                         "IoUring::init");
+        throw IOException(error);
+    }
+
+    char* sqBase = (char*)_sqRing;
+    _sqHead = (uint32*)(sqBase + params.sq_off.head);
+    _sqTail = (uint32*)(sqBase + params.sq_off.tail);
+    _sqMask = (uint32*)(sqBase + params.sq_off.ring_mask);
+    _sqEntries = (uint32*)(sqBase + params.sq_off.ring_entries);
+    _sqArray = (uint32*)(sqBase + params.sq_off.array);
+
+    char* cqBase = (char*)_cqRing;
+    _cqHead = (uint32*)(cqBase + params.cq_off.head);
+    _cqTail = (uint32*)(cqBase + params.cq_off.tail);
+    _cqMask = (uint32*)(cqBase + params.cq_off.ring_mask);
+    _cqes = (io_uring_cqe*)(cqBase + params.cq_off.cqes);
+
+    _sqeTail = *_sqTail;
+}
+
+void IoUring::close()
+{
+    if (_sqes != MAP_FAILED)
+    {
+        ::munmap(_sqes, _sqesSize);
+        _sqes = (io_uring_sqe*)MAP_FAILED;
+    }
+
+    if (_sqRing != MAP_FAILED)
+    {
+        ::munmap(_sqRing, _sqRingSize);
+        _sqRing = MAP_FAILED;
+        _cqRing = MAP_FAILED;
+    }
+
+    if (_ringFd != -1)
+    {
+        ::close(_ringFd);
+        _ringFd = -1;
+    }
+}
+
+bool IoUring::isOpen() const
+{
+    return (_ringFd != -1);
+}
+
+/*
+ * Returns a zeroed submission entry, or NULL if the submission ring is
+ * full. The entry is passed to the kernel on the next call to submit().
+ */
+io_uring_sqe* IoUring::getSqe()
+{
+    uint32 head = __atomic_load_n(_sqHead, __ATOMIC_ACQUIRE);
+
+    if (_sqeTail - head >= *_sqEntries)
+        return NULL;
+
+    uint32 index = _sqeTail & *_sqMask;
+    io_uring_sqe* sqe = &_sqes[index];
+
+    ::memset(sqe, 0, sizeof(io_uring_sqe));
+    _sqArray[index] = index;
+    _sqeTail++;
+
+    return sqe;
+}
+
+uint32 IoUring::sqSpace() const
+{
+    uint32 head = __atomic_load_n(_sqHead, __ATOMIC_ACQUIRE);
+    return *_sqEntries - (_sqeTail - head);
+}
+
+/*
+ * Returns the number of entries returned by getSqe() that the kernel has
+ * not consumed yet.
+ */
+uint32 IoUring::unsubmitted() const
+{
+    uint32 head = __atomic_load_n(_sqHead, __ATOMIC_ACQUIRE);
+    return _sqeTail - head;
+}
+
+/*
+ * Publishes all entries returned by getSqe() and makes a single
+ * io_uring_enter call, optionally waiting for completions. Returns the
+ * number of entries consumed, or -1 with errno set on failure.
+ */
+int IoUring::submit(uint32 waitCount)
+{
+    flushSq();
+    return enter(waitCount);
+}
+
+/*
+ * Makes the entries returned by getSqe() visible to the kernel without
+ * entering it. Must be serialized with getSqe().
+ */
+void IoUring::flushSq()
+{
+    __atomic_store_n(_sqTail, _sqeTail, __ATOMIC_RELEASE);
+}
+
+/*
+ * Passes every published entry the kernel has not consumed yet and
+ * optionally waits for completions. Only touches the shared ring indexes,
+ * so it may be called without serializing against getSqe(). Returns the
+ * number of entries consumed, or -1 with errno set on failure.
+ */
+int IoUring::enter(uint32 waitCount)
+{
+    uint32 tail = __atomic_load_n(_sqTail, __ATOMIC_ACQUIRE);
+    uint32 head = __atomic_load_n(_sqHead, __ATOMIC_ACQUIRE);
+    uint32 toSubmit = tail - head;
+
+    if (toSubmit == 0 && waitCount == 0)
+        return 0;
+
+    uint32 flags = 0;
+
+    if (waitCount != 0)
+        flags |= IORING_ENTER_GETEVENTS;
+
+    return sys_io_uring_enter(_ringFd, toSubmit, waitCount, flags);
+}
+
+/*
+ * Returns the next completion or NULL if none are available. cqeSeen()
+ * must be called once the entry has been handled.
+ */
+io_uring_cqe* IoUring::peekCqe()
+{
+    uint32 head = *_cqHead;
+    uint32 tail = __atomic_load_n(_cqTail, __ATOMIC_ACQUIRE);
+
+    if (head == tail)
+        return NULL;
+
+    return &_cqes[head & *_cqMask];
+}
+
+void IoUring::cqeSeen()
+{
+    __atomic_store_n(_cqHead, *_cqHead + 1, __ATOMIC_RELEASE);
+}
+
+int IoUring::registerFiles(const int* fds, uint32 count)
+{
+    return sys_io_uring_register(_ringFd,
+                                 IORING_REGISTER_FILES,
+                                 fds,
+                                 count);
+}
+
+int IoUring::updateFiles(uint32 offset, const int* fds, uint32 count)
+{
+    io_uring_files_update update;
+    ::memset(&update, 0, sizeof(update));
+
+    update.offset = offset;
+    update.fds = (uint64)(uintptr_t)fds;
+
+    return sys_io_uring_register(_ringFd,
+                                 IORING_REGISTER_FILES_UPDATE,
+                                 &update,
+                                 count);
+}
+
+int IoUring::registerBuffers(const iovec* iovecs, uint32 count)
+{
+    return sys_io_uring_register(_ringFd,
+                                 IORING_REGISTER_BUFFERS,
+                                 iovecs,
+                                 count);
+}
+
+#endif // __linux__
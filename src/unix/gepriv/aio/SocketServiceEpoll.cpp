@@ -2,88 +2,1589 @@
 
 #ifdef __linux__
 
-#include <gepriv/aio/SocketServiceEpoll.h>
+#include "gepriv/aio/SocketServiceEpoll.h"
+#include "gepriv/aio/SocketServiceUring.h"
 
-SocketServiceEpoll::SocketServiceEpoll(AioServer* aioServer) :
-    _aioServer(aioServer)
+#include "ge/SystemException.h"
+#include "ge/aio/AioFile.h"
+#include "ge/io/IOException.h"
+#include "ge/thread/CurrentThread.h"
+#include "ge/util/Locker.h"
+#include "gepriv/UnixUtil.h"
+
+#include <climits>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#define FLAG_ACCEPT 0x1
+#define FLAG_CONNECT 0x2
+#define FLAG_READ 0x4
+#define FLAG_WRITE 0x8
+#define FLAG_SENDFILE 0x10
+#define FLAG_WAIT_READ 0x20
+
+// Maximum number of events handled per call to epoll_wait
+#define MAX_EPOLL_EVENTS 256
+
+// Maximum number of buffers gathered into a single sendmsg() call
+#define MAX_WRITE_IOVECS 64
+
+// Largest amount Linux will transfer in a single sendfile() call
+#define MAX_SENDFILE_LEN 0x7ffff000
+
+// Events every socket is registered for
+#define SOCKET_EPOLL_EVENTS (EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET)
+
+// Maximum number of queued operations a poll thread runs between calls to
+// epoll_wait() with inline completion
+#define INLINE_QUEUE_BATCH 256
+
+
+SocketService::SocketService() :
+    _uring(NULL),
+    _reactorCount(1),
+    _processor(-1),
+    _inlineCompletion(false),
+    _isStarted(false),
+    _isShutdown(false)
+{
+}
+
+SocketService::~SocketService()
+{
+    shutdown();
+
+    delete _uring;
+
+    for (size_t i = 0; i < _reactors.size(); i++)
+        delete _reactors.get(i);
+}
+
+void SocketService::startServing(uint32 desiredThreads)
+{
+    Locker<Mutex> locker(_lock);
+
+    if (_isShutdown)
+        throw IOException("Cannot restart shutdown SocketService");
+
+    if (_isStarted)
+        throw IOException("SocketService already started");
+
+    // Prefer io_uring when the kernel allows it
+    if (SocketServiceUring::isSupported())
+    {
+        _uring = new SocketServiceUring(this);
+        _uring->startServing(desiredThreads, _processor, _inlineCompletion);
+
+        _isStarted = true;
+        return;
+    }
+
+    // Create the reactors with their epoll instances
+    // If this throws we're depending on the destructor for cleanup
+    for (uint32 i = 0; i < _reactorCount; i++)
+    {
+        Reactor* reactor = new Reactor(this);
+        _reactors.addBack(reactor);
+
+        reactor->epollFd = ::epoll_create1(EPOLL_CLOEXEC);
+
+        if (reactor->epollFd == -1)
+        {
+            Error error = UnixUtil::getError(errno,
+                                             "epoll_create1",
+                                             "SocketService::startServing");
+            throw IOException(error);
+        }
+
+        // Create the eventfd used to wake the poll thread. It's the only fd
+        // registered level-triggered and is identified by a NULL data
+        // pointer.
+        reactor->wakeupFd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+        if (reactor->wakeupFd == -1)
+        {
+            Error error = UnixUtil::getError(errno,
+                                             "eventfd",
+                                             "SocketService::startServing");
+            throw IOException(error);
+        }
+
+        epoll_event event;
+        event.events = EPOLLIN;
+        event.data.ptr = NULL;
+
+        int ctlRes = ::epoll_ctl(reactor->epollFd,
+                                 EPOLL_CTL_ADD,
+                                 reactor->wakeupFd,
+                                 &event);
+
+        if (ctlRes != 0)
+        {
+            Error error = UnixUtil::getError(errno,
+                                             "epoll_ctl",
+                                             "SocketService::startServing");
+            throw IOException(error);
+        }
+
+        // Split the workers between the reactors. They're all created
+        // before any socket can be queued to one.
+        uint32 workerCount = 0;
+
+        // Inline completion performs every operation on the poll threads
+        if (!_inlineCompletion)
+        {
+            workerCount = desiredThreads / _reactorCount;
+
+            if (i < desiredThreads % _reactorCount)
+                workerCount++;
+
+            // Every reactor needs a worker to perform its operations
+            if (workerCount == 0)
+                workerCount = 1;
+        }
+
+        for (uint32 j = 0; j < workerCount; j++)
+            reactor->workers.addBack(new AioWorker(reactor));
+    }
+
+    _isStarted = true;
+    _isServing.set(1);
+
+    // Start the threads
+    for (uint32 i = 0; i < _reactorCount; i++)
+    {
+        Reactor* reactor = _reactors.get(i);
+        reactor->start();
+
+        for (size_t j = 0; j < reactor->workers.size(); j++)
+            reactor->workers.get(j)->start();
+    }
+}
+
+void SocketService::startServing(uint32 desiredThreads,
+                                 uint32 processor)
+{
+    // Read by the threads once they start
+    _processor = (int32)processor;
+
+    startServing(desiredThreads);
+}
+
+void SocketService::setReactorCount(uint32 reactorCount)
+{
+    Locker<Mutex> locker(_lock);
+
+    if (_isStarted)
+        throw IOException("Cannot change the reactors of a started SocketService");
+
+    if (reactorCount == 0)
+        throw SystemException("SocketService needs at least one reactor");
+
+    _reactorCount = reactorCount;
+}
+
+void SocketService::setInlineCompletion(bool inlineCompletion)
+{
+    Locker<Mutex> locker(_lock);
+
+    if (_isStarted)
+        throw IOException("Cannot change the completion mode of a started SocketService");
+
+    _inlineCompletion = inlineCompletion;
+}
+
+void SocketService::shutdown()
+{
+    // Signal shutdown
+    Locker<Mutex> locker(_lock);
+
+    if (_isShutdown)
+        return;
+
+    _isShutdown = true;
+    _isServing.set(0);
+
+    if (!_isStarted)
+        return;
+
+    if (_uring != NULL)
+    {
+        locker.unlock();
+        _uring->shutdown();
+        return;
+    }
+
+    locker.unlock();
+
+    size_t reactorCount = _reactors.size();
+
+    // Wake every thread
+    for (size_t i = 0; i < reactorCount; i++)
+    {
+        Reactor* reactor = _reactors.get(i);
+
+        reactor->cond.lock();
+        reactor->isShutdown = true;
+        reactor->cond.signalAll();
+        reactor->cond.unlock();
+
+        wakeup(reactor);
+    }
+
+    // Join threads. The workers are deleted with their reactor.
+    for (size_t i = 0; i < reactorCount; i++)
+    {
+        Reactor* reactor = _reactors.get(i);
+        reactor->join();
+
+        for (size_t j = 0; j < reactor->workers.size(); j++)
+            reactor->workers.get(j)->join();
+    }
+
+    // No other thread can touch the socket data now. Release it and detach
+    // any sockets still referring to this service.
+    for (size_t i = 0; i < reactorCount; i++)
+    {
+        Reactor* reactor = _reactors.get(i);
+        Locker<Condition> reactorLocker(reactor->cond);
+
+        HashMap<int, SockData*>::Iterator iter = reactor->dataMap.iterator();
+
+        while (iter.isValid())
+        {
+            SockData* sockData = iter.value().getValue();
+            sockData->aioSocket->_owner = NULL;
+            delete sockData;
+
+            iter.next();
+        }
+
+        reactor->dataMap.clear();
+
+        size_t droppedCount = reactor->droppedList.size();
+        for (size_t j = 0; j < droppedCount; j++)
+        {
+            delete reactor->droppedList.get(j);
+        }
+
+        reactor->droppedList.clear();
+
+        reactor->readyQueueHead = NULL;
+        reactor->readyQueueTail = NULL;
+    }
+}
+
+void SocketService::socketAccept(AioSocket* listenSocket,
+                                 AioSocket* acceptSocket,
+                                 SocketService::acceptCallback callback,
+                                 void* userData)
+{
+    if (_uring != NULL)
+    {
+        _uring->socketAccept(listenSocket, acceptSocket, callback, userData);
+        return;
+    }
+
+    if (listenSocket->_sockFd == -1)
+    {
+        throw IOException("Can't accept with uninitialized socket");
+    }
+
+    if (acceptSocket->_sockFd != -1)
+    {
+        throw IOException("Can't accept into an initialized socket");
+    }
+
+    Reactor* reactor = getReactor(listenSocket);
+    Locker<Condition> locker(reactor->cond);
+
+    if (reactor->isShutdown)
+        throw IOException("SocketService not running");
+
+    SockData* sockData = getSockData(reactor, listenSocket, "SocketService::socketAccept");
+
+    if (sockData->readOper != 0)
+    {
+        throw IOException("Cannot accept on socket performing another operation");
+    }
+
+    sockData->readOper = FLAG_ACCEPT;
+    sockData->readCallback = (void*)callback;
+    sockData->acceptSocket = acceptSocket;
+    sockData->readUserData = userData;
+
+    // Let a worker try immediately if epoll has not reported EAGAIN
+    if (sockData->readReady)
+        enqueData(&sockData->readQueueEntry);
+}
+
+void SocketService::socketConnect(AioSocket* aioSocket,
+                                  SocketService::connectCallback callback,
+                                  void* userData,
+                                  const INetAddress& address,
+                                  int32 port)
+{
+    if (_uring != NULL)
+    {
+        _uring->socketConnect(aioSocket, callback, userData, address, port);
+        return;
+    }
+
+    if (aioSocket->_sockFd == -1)
+    {
+        throw IOException("Can't connect with uninitialized socket");
+    }
+
+    Reactor* reactor = getReactor(aioSocket);
+    Locker<Condition> locker(reactor->cond);
+
+    if (reactor->isShutdown)
+        throw IOException("SocketService not running");
+
+    SockData* sockData = getSockData(reactor, aioSocket, "SocketService::socketConnect");
+
+    if (sockData->writeOper != 0 ||
+        sockData->readOper != 0)
+    {
+        throw IOException("Cannot connect on socket performing another operation");
+    }
+
+    sockData->writeOper = FLAG_CONNECT;
+    sockData->writeCallback = (void*)callback;
+    sockData->writeUserData = userData;
+    sockData->connectAddress = address;
+    sockData->connectPort = port;
+    sockData->connectStarted = false;
+
+    // The connect call itself is made by a worker
+    enqueData(&sockData->writeQueueEntry);
+}
+
+void SocketService::socketRead(AioSocket* aioSocket,
+                               SocketService::socketCallback callback,
+                               void* userData,
+                               char* buffer,
+                               uint32 bufferLen)
+{
+    if (_uring != NULL)
+    {
+        _uring->socketRead(aioSocket, callback, userData, buffer, bufferLen);
+        return;
+    }
+
+    if (aioSocket->_sockFd == -1)
+    {
+        throw IOException("Can't read from uninitialized socket");
+    }
+
+    Reactor* reactor = getReactor(aioSocket);
+    Locker<Condition> locker(reactor->cond);
+
+    if (reactor->isShutdown)
+        throw IOException("SocketService not running");
+
+    SockData* sockData = getSockData(reactor, aioSocket, "SocketService::socketRead");
+
+    if (sockData->readOper != 0)
+    {
+        throw IOException("Cannot read from socket with read operation already in progress");
+    }
+
+    sockData->readOper = FLAG_READ;
+    sockData->readCallback = (void*)callback;
+    sockData->readUserData = userData;
+    sockData->readBuffer = buffer;
+    sockData->readBufferPos = 0;
+    sockData->readBufferLen = bufferLen;
+
+    if (sockData->readReady)
+        enqueData(&sockData->readQueueEntry);
+}
+
+void SocketService::socketWaitReadable(AioSocket* aioSocket,
+                                       SocketService::socketCallback callback,
+                                       void* userData)
+{
+    if (_uring != NULL)
+    {
+        _uring->socketWaitReadable(aioSocket, callback, userData);
+        return;
+    }
+
+    if (aioSocket->_sockFd == -1)
+    {
+        throw IOException("Can't read from uninitialized socket");
+    }
+
+    Reactor* reactor = getReactor(aioSocket);
+    Locker<Condition> locker(reactor->cond);
+
+    if (reactor->isShutdown)
+        throw IOException("SocketService not running");
+
+    SockData* sockData = getSockData(reactor, aioSocket, "SocketService::socketWaitReadable");
+
+    if (sockData->readOper != 0)
+    {
+        throw IOException("Cannot read from socket with read operation already in progress");
+    }
+
+    sockData->readOper = FLAG_WAIT_READ;
+    sockData->readCallback = (void*)callback;
+    sockData->readUserData = userData;
+    sockData->readBuffer = NULL;
+    sockData->readBufferPos = 0;
+    sockData->readBufferLen = 0;
+
+    if (sockData->readReady)
+        enqueData(&sockData->readQueueEntry);
+}
+
+void SocketService::socketWrite(AioSocket* aioSocket,
+                                SocketService::socketCallback callback,
+                                void* userData,
+                                const char* buffer,
+                                uint32 bufferLen)
+{
+    WriteBuffer writeBuffer;
+
+    writeBuffer.data = buffer;
+    writeBuffer.dataLen = bufferLen;
+
+    socketWriteV(aioSocket, callback, userData, &writeBuffer, 1);
+}
+
+void SocketService::socketWriteV(AioSocket* aioSocket,
+                                 SocketService::socketCallback callback,
+                                 void* userData,
+                                 const WriteBuffer* buffers,
+                                 uint32 bufferCount)
+{
+    if (_uring != NULL)
+    {
+        _uring->socketWriteV(aioSocket, callback, userData, buffers, bufferCount);
+        return;
+    }
+
+    if (aioSocket->_sockFd == -1)
+    {
+        throw IOException("Can't write to uninitialized socket");
+    }
+
+    Reactor* reactor = getReactor(aioSocket);
+    Locker<Condition> locker(reactor->cond);
+
+    if (reactor->isShutdown)
+        throw IOException("SocketService not running");
+
+    SockData* sockData = getSockData(reactor, aioSocket, "SocketService::socketWrite");
+
+    if (sockData->writeOper != 0)
+    {
+        throw IOException("Cannot write to socket with write operation already in progress");
+    }
+
+    sockData->writeOper = FLAG_WRITE;
+    sockData->writeCallback = (void*)callback;
+    sockData->writeUserData = userData;
+
+    setWriteBuffers(sockData, buffers, bufferCount);
+
+    if (sockData->writeReady)
+        enqueData(&sockData->writeQueueEntry);
+}
+
+void SocketService::socketSendFile(AioSocket* aioSocket,
+                                   SocketService::socketCallback callback,
+                                   void* userData,
+                                   AioFile* aioFile,
+                                   uint64 pos,
+                                   uint32 writeLen)
+{
+    if (_uring != NULL)
+    {
+        _uring->socketSendFile(aioSocket, callback, userData, aioFile, pos, writeLen);
+        return;
+    }
+
+    if (aioSocket->_sockFd == -1)
+    {
+        throw IOException("Can't write to uninitialized socket");
+    }
+
+    if (aioFile->_fd == -1)
+    {
+        throw IOException("Cannot send a closed file");
+    }
+
+    Reactor* reactor = getReactor(aioSocket);
+    Locker<Condition> locker(reactor->cond);
+
+    if (reactor->isShutdown)
+        throw IOException("SocketService not running");
+
+    SockData* sockData = getSockData(reactor, aioSocket, "SocketService::socketSendFile");
+
+    if (sockData->writeOper != 0)
+    {
+        throw IOException("Cannot write to socket with write operation already in progress");
+    }
+
+    sockData->writeOper = FLAG_SENDFILE;
+    sockData->writeCallback = (void*)callback;
+    sockData->writeUserData = userData;
+    sockData->writeBufferPos = 0;
+    sockData->writeBufferLen = writeLen;
+    sockData->sendFileFd = aioFile->_fd;
+    sockData->sendFileOffset = pos;
+    sockData->sendFileEnd = pos + writeLen;
+
+    if (sockData->writeReady)
+        enqueData(&sockData->writeQueueEntry);
+}
+
+void SocketService::emptyWakeFd(Reactor* reactor)
+{
+    uint64 value;
+    int res;
+
+    do
+    {
+        res = ::read(reactor->wakeupFd, &value, sizeof(value));
+    } while (res == -1 && errno == EINTR);
+}
+
+void SocketService::wakeup(Reactor* reactor)
+{
+    uint64 value = 1;
+    int res;
+
+    do
+    {
+        res = ::write(reactor->wakeupFd, &value, sizeof(value));
+    } while (res == -1 && errno == EINTR);
+}
+
+/*
+ * Returns the reactor serving a socket. Sockets are spread between the
+ * reactors by fd, so a socket stays with one reactor until it's closed.
+ */
+SocketService::Reactor* SocketService::getReactor(AioSocket* aioSocket)
+{
+    // Once serving, the reactors are kept until the service is destroyed
+    if (_isServing.get() == 0)
+        throw IOException("SocketService not running");
+
+    return _reactors.get((uint32)aioSocket->_sockFd % _reactors.size());
+}
+
+/*
+ * Returns the SockData for the passed socket, registering the socket with
+ * the reactor's epoll instance if this is the first operation on it. Must
+ * be called with the reactor's cond locked.
+ */
+SocketService::SockData* SocketService::getSockData(Reactor* reactor,
+                                                    AioSocket* aioSocket,
+                                                    const char* context)
+{
+    HashMap<int, SockData*>::Iterator iter = reactor->dataMap.get(aioSocket->_sockFd);
+
+    if (iter.isValid())
+    {
+        return iter.value().getValue();
+    }
+
+    if (aioSocket->_owner != NULL &&
+        aioSocket->_owner != this)
+    {
+        throw IOException("AioSocket is owned by another SocketService");
+    }
+
+    SockData* sockData = new SockData();
+    sockData->aioSocket = aioSocket;
+    sockData->fd = aioSocket->_sockFd;
+    sockData->reactor = reactor;
+
+    // Register for both directions once. Edge triggering means an idle
+    // socket never shows up in epoll_wait results again until its state
+    // changes.
+    epoll_event event;
+    event.events = SOCKET_EPOLL_EVENTS;
+    event.data.ptr = sockData;
+
+    int ctlRes = ::epoll_ctl(reactor->epollFd, EPOLL_CTL_ADD, sockData->fd, &event);
+
+    if (ctlRes != 0)
+    {
+        delete sockData;
+
+        Error error = UnixUtil::getError(errno,
+                                         "epoll_ctl",
+                                         context);
+        throw IOException(error);
+    }
+
+    reactor->dataMap.put(sockData->fd, sockData);
+    aioSocket->_owner = this;
+
+    return sockData;
+}
+
+/*
+ * Removes a socket from the service. Called by AioSocket before its fd is
+ * closed. Pending operations are abandoned without their callbacks being
+ * triggered.
+ */
+void SocketService::dropSocket(AioSocket* aioSocket)
+{
+    if (_uring != NULL)
+    {
+        _uring->dropSocket(aioSocket);
+        return;
+    }
+
+    aioSocket->_owner = NULL;
+
+    // Only a started service can own a socket
+    if (_reactors.isEmpty())
+        return;
+
+    Reactor* reactor = _reactors.get((uint32)aioSocket->_sockFd % _reactors.size());
+    Locker<Condition> locker(reactor->cond);
+
+    HashMap<int, SockData*>::Iterator iter = reactor->dataMap.get(aioSocket->_sockFd);
+
+    if (!iter.isValid())
+        return;
+
+    SockData* sockData = iter.value().getValue();
+    reactor->dataMap.erase(iter);
+
+    // Deregister before the fd can be closed and reused
+    epoll_event event;
+    ::epoll_ctl(reactor->epollFd, EPOLL_CTL_DEL, sockData->fd, &event);
+
+    dequeData(&sockData->readQueueEntry);
+    dequeData(&sockData->writeQueueEntry);
+
+    sockData->readOper = 0;
+    sockData->writeOper = 0;
+    sockData->isDropped = true;
+
+    // The poll thread may hold a pointer from its last epoll_wait, so it's
+    // responsible for the final delete.
+    reactor->droppedList.addBack(sockData);
+}
+
+/*
+ * Frees dropped socket data that can no longer be referenced by a worker or
+ * an epoll event. Must be called by the reactor's poll thread with its cond
+ * locked, before calling epoll_wait.
+ */
+void SocketService::freeDropped(Reactor* reactor)
 {
+    List<SockData*>& droppedList = reactor->droppedList;
+    size_t i = 0;
+
+    while (i < droppedList.size())
+    {
+        SockData* sockData = droppedList.get(i);
+
+        if (sockData->readActive ||
+            sockData->writeActive)
+        {
+            i++;
+            continue;
+        }
+
+        delete sockData;
+
+        // Swap remove
+        droppedList.set(i, droppedList.back());
+        droppedList.popBack();
+    }
+}
+
+bool SocketService::doAccept(SockData* sockData, Error* error)
+{
+    sockaddr_storage address;
+    socklen_t addrSize;
+    int ret;
+    int err;
+
+    while (true)
+    {
+        addrSize = sizeof(address);
+
+        do
+        {
+            ret = ::accept4(sockData->fd,
+                            (sockaddr*)&address,
+                            &addrSize,
+                            SOCK_NONBLOCK | SOCK_CLOEXEC);
+        } while (ret == -1 && errno == EINTR);
+
+        if (ret != -1)
+            break;
+
+        err = errno;
+
+        // Connections reset before being accepted are not the caller's
+        // problem, just try for the next one.
+        if (err == ECONNABORTED)
+            continue;
+
+        if (err == EAGAIN ||
+            err == EWOULDBLOCK)
+        {
+            return false;
+        }
+
+        (*error) = UnixUtil::getError(err,
+                                      "accept4",
+                                      "SocketService::socketAccept");
+        return true;
+    }
+
+    // Accept succeeded
+    AioSocket* acceptSocket = sockData->acceptSocket;
+    acceptSocket->_sockFd = ret;
+    acceptSocket->_family = sockData->aioSocket->_family;
+
+    if (address.ss_family == AF_INET)
+    {
+        sockaddr_in* ipv4Address = (sockaddr_in*)&address;
+        acceptSocket->_remoteAddress = INetAddress::fromBytes(INET_PROT_IPV4,
+            (unsigned char*)&ipv4Address->sin_addr);
+        acceptSocket->_remotePort = ntohs(ipv4Address->sin_port);
+    }
+    else if (address.ss_family == AF_INET6)
+    {
+        sockaddr_in6* ipv6Address = (sockaddr_in6*)&address;
+        acceptSocket->_remoteAddress = INetAddress::fromBytes(INET_PROT_IPV6,
+            (unsigned char*)&ipv6Address->sin6_addr);
+        acceptSocket->_remotePort = ntohs(ipv6Address->sin6_port);
+    }
+
+    // More connections may be waiting and no new edge will report them
+    sockData->readReady = true;
+    return true;
+}
+
+bool SocketService::doConnect(SockData* sockData, Error* error)
+{
+    int res;
+    int err;
+
+    if (sockData->connectStarted)
+    {
+        // The connect is in progress. Check if it finished.
+        int errVal = 0;
+        socklen_t optLen = sizeof(errVal);
+
+        res = ::getsockopt(sockData->fd, SOL_SOCKET, SO_ERROR, &errVal, &optLen);
+
+        if (res == -1)
+            errVal = errno;
+
+        if (errVal != 0)
+        {
+            (*error) = UnixUtil::getError(errVal,
+                                          "connect",
+                                          "SocketService::socketConnect");
+            return true;
+        }
+
+        // No error could also mean the connect hasn't finished. A connected
+        // socket will have a peer.
+        sockaddr_storage peerAddress;
+        socklen_t peerLen = sizeof(peerAddress);
+
+        res = ::getpeername(sockData->fd, (sockaddr*)&peerAddress, &peerLen);
+
+        if (res == -1)
+        {
+            err = errno;
+
+            if (err == ENOTCONN)
+                return false;
+
+            (*error) = UnixUtil::getError(err,
+                                          "getpeername",
+                                          "SocketService::socketConnect");
+            return true;
+        }
+
+        // The edge that reported the connect is consumed, but a new socket
+        // has room to send.
+        sockData->writeReady = true;
+        return true;
+    }
+
+    sockaddr_in ipv4SockAddr;
+    sockaddr_in6 ipv6SockAddr;
+
+    const sockaddr* sockAddrPtr;
+    socklen_t sockAddrLen;
+
+    const unsigned char* addrData = sockData->connectAddress.getAddrData();
+    int port = sockData->connectPort;
+
+    // Fill in the address information and prep the connect parameters
+    if (sockData->aioSocket->_family == INET_PROT_IPV4)
+    {
+        ::memset(&ipv4SockAddr, 0, sizeof(ipv4SockAddr));
+
+        ipv4SockAddr.sin_family = AF_INET;
+        ::memcpy(&ipv4SockAddr.sin_addr, addrData, 4);
+        ipv4SockAddr.sin_port = htons(port);
+
+        sockAddrPtr = (const sockaddr*)&ipv4SockAddr;
+        sockAddrLen = sizeof(ipv4SockAddr);
+    }
+    else
+    {
+        ::memset(&ipv6SockAddr, 0, sizeof(ipv6SockAddr));
+
+        ipv6SockAddr.sin6_family = AF_INET6;
+        ::memcpy(&ipv6SockAddr.sin6_addr, addrData, 16);
+        ipv6SockAddr.sin6_port = htons(port);
+
+        sockAddrPtr = (const sockaddr*)&ipv6SockAddr;
+        sockAddrLen = sizeof(ipv6SockAddr);
+    }
+
+    // A non-blocking connect interrupted by a signal keeps going in the
+    // background, so EINTR is treated like EINPROGRESS.
+    res = ::connect(sockData->fd, sockAddrPtr, sockAddrLen);
+
+    if (res == 0)
+    {
+        sockData->writeReady = true;
+        return true;
+    }
+
+    err = errno;
+
+    if (err == EINPROGRESS ||
+        err == EINTR)
+    {
+        sockData->connectStarted = true;
+        return false;
+    }
+
+    (*error) = UnixUtil::getError(err,
+                                  "connect",
+                                  "SocketService::socketConnect");
+    return true;
+}
+
+bool SocketService::doRecv(SockData* sockData, Error* error)
+{
+    ssize_t res;
+    int err;
+    size_t recvLen;
+
+    recvLen = sockData->readBufferLen;
+
+    // Prevent overflow to negative
+    if (recvLen > INT_MAX)
+        recvLen = INT_MAX;
+
+    do
+    {
+        res = ::recv(sockData->fd,
+                     sockData->readBuffer,
+                     recvLen,
+                     0);
+    }
+    while (res == -1 && errno == EINTR);
+
+    if (res != -1)
+    {
+        sockData->readBufferPos = res;
+
+        // A full buffer means there may be more data that no new edge
+        // will report.
+        if ((size_t)res == recvLen && res != 0)
+            sockData->readReady = true;
+
+        return true;
+    }
+
+    err = errno;
+
+    if (err == EAGAIN ||
+        err == EWOULDBLOCK)
+    {
+        return false;
+    }
+
+    (*error) = UnixUtil::getError(err,
+                                  "recv",
+                                  "SocketService::socketRead");
+    return true;
+}
+
+/*
+ * Peeks at a single byte to find if data or the end of the stream has
+ * arrived, leaving it for the read that follows.
+ */
+bool SocketService::doWaitRead(SockData* sockData, Error* error)
+{
+    ssize_t res;
+    int err;
+    char peekByte;
+
+    do
+    {
+        res = ::recv(sockData->fd,
+                     &peekByte,
+                     1,
+                     MSG_PEEK);
+    }
+    while (res == -1 && errno == EINTR);
+
+    if (res != -1)
+    {
+        // The data is still there, and no new edge will report it
+        sockData->readReady = true;
+        return true;
+    }
+
+    err = errno;
+
+    if (err == EAGAIN ||
+        err == EWOULDBLOCK)
+    {
+        return false;
+    }
+
+    (*error) = UnixUtil::getError(err,
+                                  "recv",
+                                  "SocketService::socketWaitReadable");
+    return true;
+}
+
+/*
+ * Sets the buffers of a write operation. A single buffer is copied into the
+ * SockData so callers may pass a temporary.
+ */
+void SocketService::setWriteBuffers(SockData* sockData,
+                                    const WriteBuffer* buffers,
+                                    uint32 bufferCount)
+{
+    if (bufferCount == 1)
+    {
+        sockData->writeSingle = buffers[0];
+        buffers = &sockData->writeSingle;
+    }
+
+    sockData->writeBuffers = buffers;
+    sockData->writeBufferCount = bufferCount;
+    sockData->writeBufferIndex = 0;
+    sockData->writeBufferOffset = 0;
+    sockData->writeBufferPos = 0;
+    sockData->writeBufferLen = 0;
+
+    for (uint32 i = 0; i < bufferCount; i++)
+        sockData->writeBufferLen += buffers[i].dataLen;
+}
+
+bool SocketService::doSend(SockData* sockData, Error* error)
+{
+    iovec iov[MAX_WRITE_IOVECS];
+    msghdr msg;
+    ssize_t res;
+    int err;
+
+    ::memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+
+    // Keep sending until everything is written or the socket buffer fills
+    while (sockData->writeBufferPos < sockData->writeBufferLen)
+    {
+        // Gather as many of the remaining buffers as fit in one call
+        uint32 index = sockData->writeBufferIndex;
+        uint32 offset = sockData->writeBufferOffset;
+        uint32 iovCount = 0;
+
+        while (index < sockData->writeBufferCount &&
+               iovCount < MAX_WRITE_IOVECS)
+        {
+            const WriteBuffer& buffer = sockData->writeBuffers[index];
+
+            if (buffer.dataLen > offset)
+            {
+                iov[iovCount].iov_base = (void*)(buffer.data + offset);
+                iov[iovCount].iov_len = buffer.dataLen - offset;
+                iovCount++;
+            }
+
+            offset = 0;
+            index++;
+        }
+
+        msg.msg_iovlen = iovCount;
+
+        do
+        {
+            res = ::sendmsg(sockData->fd, &msg, MSG_NOSIGNAL);
+        }
+        while (res == -1 && errno == EINTR);
+
+        if (res == -1)
+        {
+            err = errno;
+
+            if (err == EAGAIN ||
+                err == EWOULDBLOCK)
+            {
+                return false;
+            }
+
+            (*error) = UnixUtil::getError(err,
+                                          "sendmsg",
+                                          "SocketService::socketWrite");
+            return true;
+        }
+
+        sockData->writeBufferPos += res;
+
+        // Skip past the buffers that were sent
+        uint32 sent = (uint32)res;
+
+        while (sent != 0)
+        {
+            const WriteBuffer& buffer =
+                sockData->writeBuffers[sockData->writeBufferIndex];
+            uint32 remaining = buffer.dataLen - sockData->writeBufferOffset;
+
+            if (sent < remaining)
+            {
+                sockData->writeBufferOffset += sent;
+                break;
+            }
+
+            sent -= remaining;
+            sockData->writeBufferIndex++;
+            sockData->writeBufferOffset = 0;
+        }
+    }
+
+    // The socket buffer still has room
+    sockData->writeReady = true;
+    return true;
 }
 
-SocketServiceEpoll::~SocketServiceEpoll()
+bool SocketService::doSendfile(SockData* sockData, Error* error)
 {
+    ssize_t res;
+    int err;
+    size_t sendLen;
+
+    while (sockData->sendFileOffset < sockData->sendFileEnd)
+    {
+        off_t offset = (off_t)sockData->sendFileOffset;
+        sendLen = (size_t)(sockData->sendFileEnd - sockData->sendFileOffset);
+
+        if (sendLen > MAX_SENDFILE_LEN)
+            sendLen = MAX_SENDFILE_LEN;
+
+        do
+        {
+            res = ::sendfile(sockData->fd,
+                             sockData->sendFileFd,
+                             &offset,
+                             sendLen);
+        }
+        while (res == -1 && errno == EINTR);
+
+        if (res == -1)
+        {
+            err = errno;
+
+            if (err == EAGAIN ||
+                err == EWOULDBLOCK)
+            {
+                return false;
+            }
+
+            (*error) = UnixUtil::getError(err,
+                                          "sendfile",
+                                          "SocketService::socketSendFile");
+            return true;
+        }
+
+        // Hit the end of the file early
+        if (res == 0)
+        {
+            (*error) = UnixUtil::getError(EIO,
+                                          "sendfile",
+                                          "SocketService::socketSendFile");
+            return true;
+        }
+
+        sockData->sendFileOffset += res;
+        sockData->writeBufferPos += res;
+    }
 
+    sockData->writeReady = true;
+    return true;
 }
 
-void SocketServiceEpoll::process()
+bool SocketService::process(AioWorker* worker)
 {
+    Reactor* reactor = worker->reactor;
 
+    reactor->cond.lock();
+
+    while (!reactor->isShutdown &&
+           reactor->readyQueueHead == NULL)
+    {
+        reactor->cond.wait();
+    }
+
+    if (reactor->isShutdown)
+    {
+        reactor->cond.unlock();
+        return false;
+    }
+
+    performOper(reactor->readyQueueHead);
+    return true;
 }
 
-void SocketServiceEpoll::shutdown()
+/*
+ * Performs a queued operation and runs its callback once complete. Must be
+ * called with the reactor's cond locked, which is released on return.
+ */
+void SocketService::performOper(QueueEntry* queueEntry)
 {
+    Reactor* reactor = queueEntry->data->reactor;
+
+    dequeData(queueEntry);
+
+    SockData* sockData = queueEntry->data;
+    bool isRead = queueEntry->isRead;
+    uint32 oper;
+
+    // Take the side. Readiness is consumed here, so an edge arriving while
+    // the system call runs will be noticed afterwards.
+    if (isRead)
+    {
+        oper = sockData->readOper;
+        sockData->readActive = true;
+        sockData->readReady = false;
+    }
+    else
+    {
+        oper = sockData->writeOper;
+        sockData->writeActive = true;
+        sockData->writeReady = false;
+    }
+
+    reactor->cond.unlock();
+
+    Error error;
+    bool operComplete = false;
+
+    switch (oper)
+    {
+        case FLAG_ACCEPT:
+            operComplete = doAccept(sockData, &error);
+            break;
+        case FLAG_READ:
+            operComplete = doRecv(sockData, &error);
+            break;
+        case FLAG_WAIT_READ:
+            operComplete = doWaitRead(sockData, &error);
+            break;
+        case FLAG_CONNECT:
+            operComplete = doConnect(sockData, &error);
+            break;
+        case FLAG_WRITE:
+            operComplete = doSend(sockData, &error);
+            break;
+        case FLAG_SENDFILE:
+            operComplete = doSendfile(sockData, &error);
+            break;
+    }
+
+    reactor->cond.lock();
+
+    // Copy what the callback needs, as the SockData may be reused as soon
+    // as the operation is cleared.
+    AioSocket* aioSocket = sockData->aioSocket;
+    AioSocket* acceptSocket = sockData->acceptSocket;
+    void* callback;
+    void* userData;
+    uint32 bytesTransfered;
 
+    if (isRead)
+    {
+        sockData->readActive = false;
+        callback = sockData->readCallback;
+        userData = sockData->readUserData;
+        bytesTransfered = sockData->readBufferPos;
+    }
+    else
+    {
+        sockData->writeActive = false;
+        callback = sockData->writeCallback;
+        userData = sockData->writeUserData;
+        bytesTransfered = sockData->writeBufferPos;
+    }
+
+    // A closed socket's operations are abandoned
+    if (sockData->isDropped)
+    {
+        reactor->cond.unlock();
+        return;
+    }
+
+    if (!operComplete)
+    {
+        // Wait for the next edge unless one arrived during the call
+        if (isRead && sockData->readReady)
+            enqueData(&sockData->readQueueEntry);
+        else if (!isRead && sockData->writeReady)
+            enqueData(&sockData->writeQueueEntry);
+
+        reactor->cond.unlock();
+        return;
+    }
+
+    if (isRead)
+        sockData->readOper = 0;
+    else
+        sockData->writeOper = 0;
+
+    reactor->cond.unlock();
+
+    switch (oper)
+    {
+        case FLAG_ACCEPT:
+            ((SocketService::acceptCallback)callback)(aioSocket,
+                                                      acceptSocket,
+                                                      userData,
+                                                      error);
+            break;
+        case FLAG_CONNECT:
+            ((SocketService::connectCallback)callback)(aioSocket,
+                                                       userData,
+                                                       error);
+            break;
+        case FLAG_READ:
+        case FLAG_WAIT_READ:
+        case FLAG_WRITE:
+        case FLAG_SENDFILE:
+            ((SocketService::socketCallback)callback)(aioSocket,
+                                                      userData,
+                                                      bytesTransfered,
+                                                      error);
+            break;
+    }
 }
 
-void SocketServiceEpoll::submitClose(AioSocket* aioSocket,
-                                     AioServer::connectCallback callback,
-                                     void* userData)
+bool SocketService::poll(Reactor* reactor)
 {
+    epoll_event events[MAX_EPOLL_EVENTS];
+
+    Locker<Condition> locker(reactor->cond);
+
+    if (reactor->isShutdown)
+        return false;
+
+    freeDropped(reactor);
+
+    // With inline completion, operations left queued are run as soon as
+    // the events ready now are collected
+    int timeout = -1;
 
+    if (_inlineCompletion)
+    {
+        if (reactor->readyQueueHead != NULL)
+            timeout = 0;
+        else
+            reactor->isPolling = true;
+    }
+
+    locker.unlock();
+
+    int pollRet;
+
+    do
+    {
+        pollRet = ::epoll_wait(reactor->epollFd, events, MAX_EPOLL_EVENTS, timeout);
+    }
+    while (pollRet == -1 && errno == EINTR);
+
+    if (pollRet == -1)
+    {
+        // Not much we can do if epoll failed
+        // TODO: Log
+        return false;
+    }
+
+    locker.lock();
+
+    reactor->isPolling = false;
+
+    if (reactor->isShutdown)
+        return false;
+
+    // Only sockets with activity are returned, so this loop is bounded by
+    // the number of ready sockets.
+    for (int i = 0; i < pollRet; i++)
+    {
+        epoll_event& event = events[i];
+
+        // NULL data indicates the wakeup fd
+        if (event.data.ptr == NULL)
+        {
+            emptyWakeFd(reactor);
+            continue;
+        }
+
+        SockData* sockData = (SockData*)event.data.ptr;
+
+        if (sockData->isDropped)
+            continue;
+
+        // Errors and hangups are reported through the next system call on
+        // either side.
+        if (event.events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+        {
+            sockData->readReady = true;
+
+            if (sockData->readOper != 0 &&
+                !sockData->readActive)
+            {
+                enqueData(&sockData->readQueueEntry);
+            }
+        }
+
+        if (event.events & (EPOLLOUT | EPOLLHUP | EPOLLERR))
+        {
+            sockData->writeReady = true;
+
+            if (sockData->writeOper != 0 &&
+                !sockData->writeActive)
+            {
+                enqueData(&sockData->writeQueueEntry);
+            }
+        }
+    }
+
+    locker.unlock();
+
+    if (_inlineCompletion)
+        runQueued(reactor);
+
+    return true;
 }
 
-void SocketServiceEpoll::submitAccept(AioSocket* listenSocket,
-                                      AioSocket* acceptSocket,
-                                      AioServer::acceptCallback callback,
-                                      void* userData)
+/*
+ * Performs the operations queued to a reactor on its poll thread, up to
+ * INLINE_QUEUE_BATCH of them so sockets with new events aren't held up for
+ * long. Used with inline completion.
+ */
+void SocketService::runQueued(Reactor* reactor)
 {
+    for (uint32 i = 0; i < INLINE_QUEUE_BATCH; i++)
+    {
+        reactor->cond.lock();
+
+        if (reactor->isShutdown ||
+            reactor->readyQueueHead == NULL)
+        {
+            reactor->cond.unlock();
+            return;
+        }
 
+        performOper(reactor->readyQueueHead);
+    }
 }
 
-void SocketServiceEpoll::submitConnect(AioSocket* aioSocket,
-                                       AioServer::connectCallback callback,
-                                       void* userData,
-                                       const INetAddress& address,
-                                       int32 port)
+/*
+ * Adds an entry to the ready queue of its socket's reactor if not already
+ * queued and wakes a worker, or the poll thread with inline completion.
+ * Must be called with the reactor's cond locked.
+ */
+void SocketService::enqueData(QueueEntry* queueEntry)
 {
+    if (queueEntry->isQueued)
+        return;
+
+    Reactor* reactor = queueEntry->data->reactor;
+
+    queueEntry->isQueued = true;
+    queueEntry->next = NULL;
+    queueEntry->prev = reactor->readyQueueTail;
 
+    if (reactor->readyQueueTail == NULL)
+    {
+        reactor->readyQueueHead = queueEntry;
+    }
+    else
+    {
+        reactor->readyQueueTail->next = queueEntry;
+    }
+
+    reactor->readyQueueTail = queueEntry;
+
+    if (!_inlineCompletion)
+    {
+        reactor->cond.signal();
+    }
+    else if (reactor->isPolling)
+    {
+        // Only the first entry queued while epoll_wait blocks needs this
+        reactor->isPolling = false;
+        wakeup(reactor);
+    }
 }
 
-void SocketServiceEpoll::submitConnect(AioSocket* aioSocket,
-                                       AioServer::connectCallback callback,
-                                       void* userData,
-                                       const INetAddress& address,
-                                       int32 port,
-                                       int32 timeout)
+/*
+ * Removes an entry from the ready queue if queued. Must be called with the
+ * reactor's cond locked.
+ */
+void SocketService::dequeData(QueueEntry* queueEntry)
 {
+    if (!queueEntry->isQueued)
+        return;
+
+    Reactor* reactor = queueEntry->data->reactor;
 
+    if (queueEntry->prev == NULL)
+        reactor->readyQueueHead = queueEntry->next;
+    else
+        queueEntry->prev->next = queueEntry->next;
+
+    if (queueEntry->next == NULL)
+        reactor->readyQueueTail = queueEntry->prev;
+    else
+        queueEntry->next->prev = queueEntry->prev;
+
+    queueEntry->isQueued = false;
+    queueEntry->next = NULL;
+    queueEntry->prev = NULL;
 }
 
-void SocketServiceEpoll::socketRead(AioSocket* aioSocket,
-                                    AioServer::socketCallback callback,
-                                    void* userData,
-                                    char* buffer,
-                                    uint32 bufferLen)
+// Inner Classes ------------------------------------------------------------
+
+SocketService::AioWorker::AioWorker(Reactor* reactor) :
+    reactor(reactor)
 {
+}
+
+void SocketService::AioWorker::run()
+{
+    SocketService* socketService = reactor->socketService;
+
+    CurrentThread::setName("SocketService Worker");
+
+    if (socketService->_processor != -1)
+        CurrentThread::setProcessor((uint32)socketService->_processor);
 
+    bool keepGoing = true;
+
+    while (keepGoing)
+    {
+        keepGoing = socketService->process(this);
+    }
 }
 
-void SocketServiceEpoll::socketWrite(AioSocket* aioSocket,
-                                     AioServer::socketCallback callback,
-                                     void* userData,
-                                     const char* buffer,
-                                     uint32 bufferLen)
+SocketService::Reactor::Reactor(SocketService* socketService) :
+    socketService(socketService),
+    epollFd(-1),
+    wakeupFd(-1),
+    isShutdown(false),
+    isPolling(false),
+    readyQueueHead(NULL),
+    readyQueueTail(NULL)
 {
+}
+
+SocketService::Reactor::~Reactor()
+{
+    for (size_t i = 0; i < workers.size(); i++)
+        delete workers.get(i);
+
+    if (epollFd != -1)
+        ::close(epollFd);
 
+    if (wakeupFd != -1)
+        ::close(wakeupFd);
 }
 
-void SocketServiceEpoll::socketSendFile(AioSocket* aioSocket,
-                                        AioServer::socketCallback callback,
-                                        void* userData,
-                                        AioFile* aioFile,
-                                        uint64 pos,
-                                        uint32 writeLen)
+void SocketService::Reactor::run()
 {
+    CurrentThread::setName("SocketService Poll Worker");
 
+    if (socketService->_processor != -1)
+        CurrentThread::setProcessor((uint32)socketService->_processor);
+
+    bool keepGoing = true;
+
+    while (keepGoing)
+    {
+        keepGoing = socketService->poll(this);
+    }
+}
+
+SocketService::SockData::SockData() :
+    aioSocket(NULL),
+    fd(-1),
+    reactor(NULL),
+    readReady(false),
+    writeReady(false),
+    readActive(false),
+    writeActive(false),
+    isDropped(false),
+    readOper(0),
+    acceptSocket(NULL),
+    readCallback(NULL),
+    readUserData(NULL),
+    readBuffer(NULL),
+    readBufferPos(0),
+    readBufferLen(0),
+    writeOper(0),
+    writeCallback(NULL),
+    writeUserData(NULL),
+    writeBuffers(NULL),
+    writeBufferCount(0),
+    writeBufferIndex(0),
+    writeBufferOffset(0),
+    writeBufferPos(0),
+    writeBufferLen(0),
+    connectPort(0),
+    connectStarted(false),
+    sendFileFd(-1),
+    sendFileOffset(0),
+    sendFileEnd(0)
+{
+    readQueueEntry.isRead = true;
+    readQueueEntry.isQueued = false;
+    readQueueEntry.data = this;
+    readQueueEntry.prev = NULL;
+    readQueueEntry.next = NULL;
+    writeQueueEntry.isRead = false;
+    writeQueueEntry.isQueued = false;
+    writeQueueEntry.data = this;
+    writeQueueEntry.prev = NULL;
+    writeQueueEntry.next = NULL;
 }
 
-#endif // #ifdef __linux__
+#endif // __linux__
@@ -1,7 +1,11 @@
 // SocketServicePoll.cpp
 
+#ifndef __linux__
+
 #include "gepriv/aio/SocketServicePoll.h"
 
+#include "ge/aio/AioFile.h"
+#include "ge/SystemException.h"
 #include "ge/io/IOException.h"
 #include "ge/thread/CurrentThread.h"
 #include "ge/util/Locker.h"
@@ -9,99 +13,264 @@
 
 #include <climits>
 #include <cerrno>
+#include <cstring>
 #include <fcntl.h>
 #include <unistd.h>
 #include <netinet/in.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 
 #define FLAG_ACCEPT 0x1
 #define FLAG_CONNECT 0x2
 #define FLAG_READ 0x4
 #define FLAG_WRITE 0x8
 #define FLAG_SENDFILE 0x10
+#define FLAG_WAIT_READ 0x20
 
 #define SEND_FILE_BUF_LEN 2048
 
+// Maximum number of buffers gathered into a single sendmsg() call
+#define MAX_WRITE_IOVECS 64
+
+// Maximum number of queued operations a poll thread runs between calls to
+// poll() with inline completion
+#define INLINE_QUEUE_BATCH 256
+
 
 SocketService::SocketService() :
-    _isShutdown(false),
-    _pollWorker(this)
+    _reactorCount(1),
+    _processor(-1),
+    _inlineCompletion(false),
+    _isStarted(false),
+    _isShutdown(false)
 {
+    for (uint32 i = 0; i < SOCKET_TABLE_MAX_CHUNKS; i++)
+        _slotChunks[i] = NULL;
 }
 
 SocketService::~SocketService()
 {
-    ::close(_wakeupPipe[0]);
-    ::close(_wakeupPipe[1]);
+    shutdown();
+
+    for (size_t i = 0; i < _reactors.size(); i++)
+        delete _reactors.get(i);
+
+    for (uint32 i = 0; i < SOCKET_TABLE_MAX_CHUNKS; i++)
+        delete[] _slotChunks[i];
 }
 
 void SocketService::startServing(uint32 desiredThreads)
 {
-    Locker<Condition> locker(_cond);
+    Locker<Mutex> locker(_lock);
 
     if (_isShutdown)
         throw IOException("Cannot restart shutdown SocketService");
 
-    // Create the wakeup pipe
-    int pipeRes = ::pipe(_wakeupPipe);
+    if (_isStarted)
+        throw IOException("SocketService already started");
 
-    if (pipeRes != 0)
+    // Create the reactors and their wakeup pipes
+    // If this throws we're depending on the destructor for cleanup
+    for (uint32 i = 0; i < _reactorCount; i++)
     {
-        Error error = UnixUtil::getError(errno,
-                                         "pipe",
-                                         "SocketService::AioServer");
-        throw IOException(error);
-    }
+        Reactor* reactor = new Reactor(this);
+        _reactors.addBack(reactor);
 
-    for (int i = 0; i < 2; i++)
-    {
-        int fcntlRes = ::fcntl(_wakeupPipe[i], F_SETFD, O_NONBLOCK | FD_CLOEXEC);
+        int pipeRes = ::pipe(reactor->wakeupPipe);
 
-        if (fcntlRes != 0)
+        if (pipeRes != 0)
         {
+            reactor->wakeupPipe[0] = -1;
+            reactor->wakeupPipe[1] = -1;
+
             Error error = UnixUtil::getError(errno,
-                                             "fcntl",
-                                             "SocketService::AioServer");
+                                             "pipe",
+                                             "SocketService::startServing");
             throw IOException(error);
         }
+
+        for (int j = 0; j < 2; j++)
+        {
+            int fcntlRes = ::fcntl(reactor->wakeupPipe[j], F_SETFL, O_NONBLOCK);
+
+            if (fcntlRes == 0)
+                fcntlRes = ::fcntl(reactor->wakeupPipe[j], F_SETFD, FD_CLOEXEC);
+
+            if (fcntlRes != 0)
+            {
+                Error error = UnixUtil::getError(errno,
+                                                 "fcntl",
+                                                 "SocketService::startServing");
+                throw IOException(error);
+            }
+        }
+
+        // The wakeup pipe is always the first entry polled
+        pollfd pollData;
+        pollData.fd = reactor->wakeupPipe[0];
+        pollData.events = POLLIN;
+        pollData.revents = 0;
+
+        reactor->pollFdList.addBack(pollData);
+        reactor->pollDataList.addBack(NULL);
+
+        // Split the workers between the reactors. They're all created
+        // before any socket can be queued to one.
+        uint32 workerCount = 0;
+
+        // Inline completion performs every operation on the poll threads
+        if (!_inlineCompletion)
+        {
+            workerCount = desiredThreads / _reactorCount;
+
+            if (i < desiredThreads % _reactorCount)
+                workerCount++;
+
+            // Every reactor needs a worker to perform its operations
+            if (workerCount == 0)
+                workerCount = 1;
+        }
+
+        for (uint32 j = 0; j < workerCount; j++)
+            reactor->workers.addBack(new AioWorker(reactor));
     }
 
-    // Create worker threads
-    // If this throws we're depending on the destructor for cleanup
-    for (uint32 i = 0; i < desiredThreads; i++)
+    _isStarted = true;
+    _isServing.set(1);
+
+    // Start the threads
+    for (uint32 i = 0; i < _reactorCount; i++)
     {
-        AioWorker* worker = new AioWorker(this);
-        _threads.addBack(worker);
+        Reactor* reactor = _reactors.get(i);
+        reactor->start();
 
-        worker->start();
+        for (size_t j = 0; j < reactor->workers.size(); j++)
+            reactor->workers.get(j)->start();
     }
 }
 
+void SocketService::startServing(uint32 desiredThreads,
+                                 uint32 processor)
+{
+    // Read by the threads once they start
+    _processor = (int32)processor;
+
+    startServing(desiredThreads);
+}
+
+void SocketService::setReactorCount(uint32 reactorCount)
+{
+    Locker<Mutex> locker(_lock);
+
+    if (_isStarted)
+        throw IOException("Cannot change the reactors of a started SocketService");
+
+    if (reactorCount == 0)
+        throw SystemException("SocketService needs at least one reactor");
+
+    _reactorCount = reactorCount;
+}
+
+void SocketService::setInlineCompletion(bool inlineCompletion)
+{
+    Locker<Mutex> locker(_lock);
+
+    if (_isStarted)
+        throw IOException("Cannot change the completion mode of a started SocketService");
+
+    _inlineCompletion = inlineCompletion;
+}
+
 void SocketService::shutdown()
 {
     // Signal shutdown
-    Locker<Condition> locker(_cond);
+    Locker<Mutex> locker(_lock);
+
+    if (_isShutdown)
+        return;
 
     _isShutdown = true;
+    _isServing.set(0);
 
-    if (_threads.isEmpty())
+    if (!_isStarted)
         return;
 
-    _cond.signalAll();
-
     locker.unlock();
 
-    // Join and delete threads
-    size_t threadCount = _threads.size();
-    for (size_t i = 0; i < threadCount; i++)
+    size_t reactorCount = _reactors.size();
+
+    // Wake every thread. Parked workers see _isServing cleared.
+    for (size_t i = 0; i < reactorCount; i++)
+    {
+        Reactor* reactor = _reactors.get(i);
+
+        for (size_t j = 0; j < reactor->workers.size(); j++)
+        {
+            AioWorker* worker = reactor->workers.get(j);
+            Locker<Condition> parkLocker(worker->parkCond);
+
+            worker->parkCond.signal();
+        }
+
+        wakeup(reactor);
+    }
+
+    // Join threads. The workers are deleted with their reactor, as a late
+    // submitter may still queue to one.
+    for (size_t i = 0; i < reactorCount; i++)
+    {
+        Reactor* reactor = _reactors.get(i);
+        reactor->join();
+
+        for (size_t j = 0; j < reactor->workers.size(); j++)
+            reactor->workers.get(j)->join();
+    }
+
+    // No other thread can touch the socket data now. Dropping the
+    // references held by the ready queues, the poll lists and the table
+    // frees it. Sockets still referring to this service are detached.
+    for (size_t i = 0; i < reactorCount; i++)
     {
-        AioWorker* worker = _threads.get(i);
-        worker->join();
-        delete worker;
+        Reactor* reactor = _reactors.get(i);
+
+        for (size_t j = 0; j < reactor->workers.size(); j++)
+            drainQueue(&reactor->workers.get(j)->readyQueue);
+
+        drainQueue(&reactor->inlineQueue);
+
+        for (size_t j = 0; j < reactor->pollDirtyList.size(); j++)
+            releaseData(reactor->pollDirtyList.get(j));
+
+        for (size_t j = 1; j < reactor->pollDataList.size(); j++)
+            releaseData(reactor->pollDataList.get(j));
+
+        reactor->pollDirtyList.clear();
+        reactor->pollFdList.clear();
+        reactor->pollDataList.clear();
     }
 
-    _threads.clear();
+    uint32 chunkCount = (uint32)_chunkCount.get();
+
+    for (uint32 i = 0; i < chunkCount; i++)
+    {
+        SocketSlot* chunk = _slotChunks[i];
+
+        if (chunk == NULL)
+            continue;
+
+        for (uint32 j = 0; j < SOCKET_TABLE_CHUNK_LEN; j++)
+        {
+            SockData* sockData = chunk[j].data;
+
+            if (sockData != NULL)
+            {
+                sockData->aioSocket->_owner = NULL;
+                chunk[j].data = NULL;
+                releaseData(sockData);
+            }
+        }
+    }
 }
 
 void SocketService::socketAccept(AioSocket* listenSocket,
@@ -109,80 +278,69 @@ void SocketService::socketAccept(AioSocket* listenSocket,
                                  SocketService::acceptCallback callback,
                                  void* userData)
 {
-    if (listenSocket->_sockFd != -1)
+    if (listenSocket->_sockFd == -1)
     {
         throw IOException("Can't accept with uninitialized socket");
     }
 
-    // TODO: check if acceptSocket is initialized wrong
-
-    acceptSocket->init(listenSocket->_family);
-
-    SockData newData;
-    
-
-    Locker<Condition> locker(_cond);
+    if (acceptSocket->_sockFd != -1)
+    {
+        throw IOException("Can't accept into an initialized socket");
+    }
 
-    // TODO: Should check socket state?
+    SocketSlot* slot = getSlot(listenSocket->_sockFd);
+    Locker<Mutex> locker(slot->lock);
 
-    HashMap<int, SockData>::Iterator iter = _dataMap.get(listenSocket->_sockFd);
+    SockData* sockData = getSockData(slot, listenSocket, "SocketService::socketAccept");
 
-    if (iter.isValid())
+    if (sockData->readOper != 0)
     {
         throw IOException("Cannot accept on socket performing another operation");
     }
 
-    // Create a SockData object
-    SockData sockData;
-    sockData.aioSocket = listenSocket;
-    sockData.readOper = FLAG_ACCEPT;
-    sockData.readCallback = (void*)callback;
-    sockData.acceptSocket = acceptSocket;
-    sockData.readUserData = userData;
+    sockData->readOper = FLAG_ACCEPT;
+    sockData->readCallback = (void*)callback;
+    sockData->acceptSocket = acceptSocket;
+    sockData->readUserData = userData;
 
-    // Try to accept
-    doAccept(&sockData);
-
-    // Add to the data map and wake the poller if didn't immediately complete 
-    if (!sockData.readComplete)
-    {
-        _dataMap.put(listenSocket->_sockFd, newData);
-        wakeup();
-    }
+    // Let a worker try immediately unless the last call reported EAGAIN
+    if (sockData->readReady)
+        enqueData(&sockData->readQueueEntry);
+    else
+        markPollDirty(sockData);
 }
 
 void SocketService::socketConnect(AioSocket* aioSocket,
-                                      SocketService::connectCallback callback,
-                                      void* userData,
-                                      const INetAddress& address,
-                                      int32 port)
+                                  SocketService::connectCallback callback,
+                                  void* userData,
+                                  const INetAddress& address,
+                                  int32 port)
 {
-    Locker<Condition> locker(_cond);
-
-    HashMap<int, SockData>::Iterator iter = _dataMap.get(aioSocket->_sockFd);
-
-    if (iter.isValid())
+    if (aioSocket->_sockFd == -1)
     {
-        throw IOException("Cannot connect on socket performing another operation");
+        throw IOException("Can't connect with uninitialized socket");
     }
 
-    SockData sockData;
-    sockData.aioSocket = aioSocket;
-    sockData.writeOper = FLAG_CONNECT;
-    sockData.writeCallback = (void*)callback;
-    sockData.writeUserData = userData;
-    sockData.connectAddress = address;
-    sockData.connectPort = port;
+    SocketSlot* slot = getSlot(aioSocket->_sockFd);
+    Locker<Mutex> locker(slot->lock);
 
-    // Try to connect
-    doConnect(&sockData);
+    SockData* sockData = getSockData(slot, aioSocket, "SocketService::socketConnect");
 
-    // Add to the data map and wake the poller if didn't immediately complete 
-    if (!sockData.writeComplete)
+    if (sockData->writeOper != 0 ||
+        sockData->readOper != 0)
     {
-        _dataMap.put(aioSocket->_sockFd, sockData);
-        wakeup();
+        throw IOException("Cannot connect on socket performing another operation");
     }
+
+    sockData->writeOper = FLAG_CONNECT;
+    sockData->writeCallback = (void*)callback;
+    sockData->writeUserData = userData;
+    sockData->connectAddress = address;
+    sockData->connectPort = port;
+    sockData->connectStarted = false;
+
+    // The connect call itself is made by a worker
+    enqueData(&sockData->writeQueueEntry);
 }
 
 void SocketService::socketRead(AioSocket* aioSocket,
@@ -191,44 +349,64 @@ void SocketService::socketRead(AioSocket* aioSocket,
                                char* buffer,
                                uint32 bufferLen)
 {
-    Locker<Condition> locker(_cond);
-
-    SockData newData;
-    SockData& sockData = newData;
+    if (aioSocket->_sockFd == -1)
+    {
+        throw IOException("Can't read from uninitialized socket");
+    }
 
-    // TODO: Should check socket state?
+    SocketSlot* slot = getSlot(aioSocket->_sockFd);
+    Locker<Mutex> locker(slot->lock);
 
-    HashMap<int, SockData>::Iterator iter = _dataMap.get(aioSocket->_sockFd);
+    SockData* sockData = getSockData(slot, aioSocket, "SocketService::socketRead");
 
-    if (iter.isValid())
+    if (sockData->readOper != 0)
     {
-        HashMap<int, SockData>::Entry entry = iter.value();
-        sockData = entry.getValue();
+        throw IOException("Cannot read from socket with read operation already in progress");
+    }
 
-        if (sockData.readOper != 0)
-        {
-            throw IOException("Cannot read from socket with read operation already in progress");
-        }
+    sockData->readOper = FLAG_READ;
+    sockData->readCallback = (void*)callback;
+    sockData->readUserData = userData;
+    sockData->readBuffer = buffer;
+    sockData->readBufferPos = 0;
+    sockData->readBufferLen = bufferLen;
+
+    if (sockData->readReady)
+        enqueData(&sockData->readQueueEntry);
+    else
+        markPollDirty(sockData);
+}
+
+void SocketService::socketWaitReadable(AioSocket* aioSocket,
+                                       SocketService::socketCallback callback,
+                                       void* userData)
+{
+    if (aioSocket->_sockFd == -1)
+    {
+        throw IOException("Can't read from uninitialized socket");
     }
 
-    sockData.aioSocket = aioSocket;
-    sockData.readOper = FLAG_READ;
-    sockData.readCallback = (void*)callback;
-    sockData.readUserData = userData;
-    sockData.readBuffer = buffer;
-    sockData.readBufferPos = 0;
-    sockData.readBufferLen = bufferLen;
+    SocketSlot* slot = getSlot(aioSocket->_sockFd);
+    Locker<Mutex> locker(slot->lock);
 
-    // Try to recv
-    doRecv(&sockData);
+    SockData* sockData = getSockData(slot, aioSocket, "SocketService::socketWaitReadable");
 
-    // Add to the data map and wake the poller if didn't immediately complete 
-    if (!sockData.readComplete &&
-        !iter.isValid())
+    if (sockData->readOper != 0)
     {
-        _dataMap.put(aioSocket->_sockFd, newData);
-        wakeup();
+        throw IOException("Cannot read from socket with read operation already in progress");
     }
+
+    sockData->readOper = FLAG_WAIT_READ;
+    sockData->readCallback = (void*)callback;
+    sockData->readUserData = userData;
+    sockData->readBuffer = NULL;
+    sockData->readBufferPos = 0;
+    sockData->readBufferLen = 0;
+
+    if (sockData->readReady)
+        enqueData(&sockData->readQueueEntry);
+    else
+        markPollDirty(sockData);
 }
 
 void SocketService::socketWrite(AioSocket* aioSocket,
@@ -237,44 +415,45 @@ void SocketService::socketWrite(AioSocket* aioSocket,
                                 const char* buffer,
                                 uint32 bufferLen)
 {
-    Locker<Condition> locker(_cond);
-
-    SockData newData;
-    SockData& sockData = newData;
+    WriteBuffer writeBuffer;
 
-    // TODO: Should check socket state?
+    writeBuffer.data = buffer;
+    writeBuffer.dataLen = bufferLen;
 
-    HashMap<int, SockData>::Iterator iter = _dataMap.get(aioSocket->_sockFd);
+    socketWriteV(aioSocket, callback, userData, &writeBuffer, 1);
+}
 
-    if (iter.isValid())
+void SocketService::socketWriteV(AioSocket* aioSocket,
+                                 SocketService::socketCallback callback,
+                                 void* userData,
+                                 const WriteBuffer* buffers,
+                                 uint32 bufferCount)
+{
+    if (aioSocket->_sockFd == -1)
     {
-        HashMap<int, SockData>::Entry entry = iter.value();
-        SockData& sockData = entry.getValue();
-
-        if (sockData.writeOper != 0)
-        {
-            throw IOException("Cannot write to socket with write operation already in progress");
-        }
+        throw IOException("Can't write to uninitialized socket");
     }
-    
-    sockData.aioSocket = aioSocket;
-    sockData.writeOper = FLAG_WRITE;
-    sockData.writeCallback = (void*)callback;
-    sockData.writeUserData = userData;
-    sockData.writeBuffer = (char*)buffer;
-    sockData.writeBufferPos = 0;
-    sockData.writeBufferLen = bufferLen;
 
-    // Try to recv
-    doSend(&sockData);
+    SocketSlot* slot = getSlot(aioSocket->_sockFd);
+    Locker<Mutex> locker(slot->lock);
+
+    SockData* sockData = getSockData(slot, aioSocket, "SocketService::socketWrite");
 
-    // Add to the data map and wake the poller if didn't immediately complete 
-    if (!sockData.writeComplete &&
-        !iter.isValid())
+    if (sockData->writeOper != 0)
     {
-        _dataMap.put(aioSocket->_sockFd, newData);
-        wakeup();
+        throw IOException("Cannot write to socket with write operation already in progress");
     }
+
+    sockData->writeOper = FLAG_WRITE;
+    sockData->writeCallback = (void*)callback;
+    sockData->writeUserData = userData;
+
+    setWriteBuffers(sockData, buffers, bufferCount);
+
+    if (sockData->writeReady)
+        enqueData(&sockData->writeQueueEntry);
+    else
+        markPollDirty(sockData);
 }
 
 void SocketService::socketSendFile(AioSocket* aioSocket,
@@ -284,626 +463,1341 @@ void SocketService::socketSendFile(AioSocket* aioSocket,
                                    uint64 pos,
                                    uint32 writeLen)
 {
-    Locker<Condition> locker(_cond);
-
-    // TODO: Check if file is open
-
-    HashMap<int, SockData>::Iterator iter = _dataMap.get(aioSocket->_sockFd);
-
-    if (iter.isValid())
+    if (aioSocket->_sockFd == -1)
     {
-        HashMap<int, SockData>::Entry entry = iter.value();
-        SockData& sockData = entry.getValue();
-
-        // TODO: Should check socket state?
-        if (sockData.writeOper != 0)
-        {
-            throw IOException("Cannot write to socket with write operation already in progress");
-        }
-
-        sockData.writeOper = FLAG_SENDFILE;
-        sockData.writeCallback = (void*)callback;
-        sockData.writeUserData = userData;
-
-        if (sockData.sendFileBuf == NULL)
-            sockData.sendFileBuf = new char[SEND_FILE_BUF_LEN];
-
-        sockData.sendFileBufFilled = 0;
-        sockData.sendFileBufIndex = 0;
-        sockData.sendFileOffset = pos;
-        sockData.sendFileEnd = pos + writeLen;
+        throw IOException("Can't write to uninitialized socket");
     }
-    else
+
+    if (aioFile->_fd == -1)
     {
-        SockData newData;
+        throw IOException("Cannot send a closed file");
+    }
 
-        newData.aioSocket = aioSocket;
-        newData.writeOper = FLAG_SENDFILE;
-        newData.writeCallback = (void*)callback;
-        newData.writeUserData = userData;
+    SocketSlot* slot = getSlot(aioSocket->_sockFd);
+    Locker<Mutex> locker(slot->lock);
 
-        newData.sendFileBuf = new char[SEND_FILE_BUF_LEN];
-        newData.sendFileBufFilled = 0;
-        newData.sendFileBufIndex = 0;
-        newData.sendFileOffset = pos;
-        newData.sendFileEnd = pos + writeLen;
+    SockData* sockData = getSockData(slot, aioSocket, "SocketService::socketSendFile");
 
-        _dataMap.put(aioSocket->_sockFd, newData);
+    if (sockData->writeOper != 0)
+    {
+        throw IOException("Cannot write to socket with write operation already in progress");
     }
 
-    locker.unlock();
-    wakeup();
+    if (sockData->sendFileBuf == NULL)
+        sockData->sendFileBuf = new char[SEND_FILE_BUF_LEN];
+
+    sockData->writeOper = FLAG_SENDFILE;
+    sockData->writeCallback = (void*)callback;
+    sockData->writeUserData = userData;
+    sockData->writeBufferPos = 0;
+    sockData->writeBufferLen = writeLen;
+    sockData->sendFileFd = aioFile->_fd;
+    sockData->sendFileBufFilled = 0;
+    sockData->sendFileBufIndex = 0;
+    sockData->sendFileOffset = pos;
+    sockData->sendFileEnd = pos + writeLen;
+
+    if (sockData->writeReady)
+        enqueData(&sockData->writeQueueEntry);
+    else
+        markPollDirty(sockData);
 }
 
-void SocketService::emptyWakePipe()
+void SocketService::emptyWakePipe(Reactor* reactor)
 {
     char buffer[255];
     int res;
 
     do
     {
-        res = ::read(_wakeupPipe[0], buffer, sizeof(buffer));
-    } while (res == -1 && errno == EINTR);
+        res = ::read(reactor->wakeupPipe[0], buffer, sizeof(buffer));
+    } while (res > 0 || (res == -1 && errno == EINTR));
 }
 
-void SocketService::wakeup()
+void SocketService::wakeup(Reactor* reactor)
 {
     char data[1] = {'1'};
     int res;
 
+    // A full pipe already guarantees a wakeup
     do
     {
-        res = ::write(_wakeupPipe[1], data, 1);
+        res = ::write(reactor->wakeupPipe[1], data, 1);
     } while (res == -1 && errno == EINTR);
 }
 
-void SocketService::doAccept(SockData* sockData)
+/*
+ * Returns the table slot of an fd, adding the chunk holding it if this is
+ * the first fd in its range.
+ */
+SocketService::SocketSlot* SocketService::getSlot(int fd)
 {
-    INetProt_Enum family;
-    sockaddr_in ipv4Address;
-    sockaddr_in6 ipv6Address;
-    sockaddr* addrPtr;
-    socklen_t addrSize;
-    socklen_t* retAddrSize;
-    int ret;
-    int err;
-
-    family = sockData->aioSocket->_family;
-    retAddrSize = &addrSize;
+    uint32 chunkIndex = (uint32)fd >> SOCKET_TABLE_CHUNK_BITS;
 
-    // Set up the address
-    if (family == INET_PROT_IPV4)
-    {
-        ::memset(&ipv4Address, 0, sizeof(ipv4Address));
-        addrPtr = (sockaddr*)&ipv4Address;
-        addrSize = sizeof(ipv4Address);
-    }
-    else
+    if (chunkIndex >= SOCKET_TABLE_MAX_CHUNKS)
     {
-        ::memset(&ipv6Address, 0, sizeof(ipv6Address));
-        addrPtr = (sockaddr*)&ipv6Address;
-        addrSize = sizeof(ipv6Address);
+        throw IOException("Socket descriptor too large for SocketService");
     }
 
-    // Accept
-    do
-    {
-        ret = ::accept(sockData->aioSocket->_sockFd, addrPtr, retAddrSize);
-    } while (ret == -1 && errno == EINTR);
+    SocketSlot* chunk = __atomic_load_n(&_slotChunks[chunkIndex], __ATOMIC_ACQUIRE);
 
-    if (ret != -1)
-    {
-        // Accept succeeded
-        sockData->acceptSocket->_sockFd = ret;
-        sockData->readComplete = true;
-    }
-    else
+    if (chunk == NULL)
     {
-        // Handle error
-        err = errno;
+        Locker<Mutex> locker(_tableLock);
+
+        chunk = _slotChunks[chunkIndex];
 
-        // If the error is that it would block, just keep going
-        if (err != EAGAIN || err != EWOULDBLOCK)
+        if (chunk == NULL)
         {
-            sockData->readError = UnixUtil::getError(errno,
-                "SocketService::accept",
-                "accept");
-            sockData->readComplete = true;
+            chunk = new SocketSlot[SOCKET_TABLE_CHUNK_LEN];
+            __atomic_store_n(&_slotChunks[chunkIndex], chunk, __ATOMIC_RELEASE);
+
+            // Tells the poll thread how far to scan
+            if (chunkIndex >= (uint32)_chunkCount.get())
+                _chunkCount.set((int32)chunkIndex + 1);
         }
     }
+
+    return &chunk[(uint32)fd & (SOCKET_TABLE_CHUNK_LEN - 1)];
 }
 
-void SocketService::doConnect(SockData* sockData)
+/*
+ * Returns the SockData of the passed socket, adding it to its slot if this
+ * is the first operation on it. Must be called with the slot locked.
+ */
+SocketService::SockData* SocketService::getSockData(SocketSlot* slot,
+                                                    AioSocket* aioSocket,
+                                                    const char* context)
 {
-    sockaddr_in ipv4SockAddr;
-    sockaddr_in6 ipv6SockAddr;
+    if (_isServing.get() == 0)
+        throw IOException("SocketService not running");
 
-    INetProt_Enum family;
-    const sockaddr* sockAddrPtr;
-    socklen_t sockAddrLen;
-
-    const unsigned char* addrData;
-    int port;
-    int res;
-    int err;
-
-    family = sockData->aioSocket->_family;
-    addrData = sockData->connectAddress.getAddrData();
-    port = sockData->connectPort;
+    if (slot->data != NULL)
+        return slot->data;
 
-    // Fill in the address information and prep the connect parameters
-    if (family == INET_PROT_IPV4)
+    if (aioSocket->_owner != NULL &&
+        aioSocket->_owner != this)
     {
-        ::memset(&ipv4SockAddr, 0, sizeof(ipv4SockAddr));
-
-        ipv4SockAddr.sin_family = AF_INET;
-        ::memcpy(&ipv4SockAddr.sin_addr, addrData, 4);
-        ipv4SockAddr.sin_port = htons(port);
-
-        sockAddrPtr = (const sockaddr*)&ipv4SockAddr;
-        sockAddrLen = sizeof(ipv4SockAddr);
+        throw IOException("AioSocket is owned by another SocketService");
     }
-    else
-    {
-        ::memset(&ipv6SockAddr, 0, sizeof(ipv6SockAddr));
-
-        ipv6SockAddr.sin6_family = AF_INET6;
-        ::memcpy(&ipv6SockAddr.sin6_addr, addrData, 16);
-        ipv6SockAddr.sin6_port = htons(port);
 
-        sockAddrPtr = (const sockaddr*)&ipv6SockAddr;
-        sockAddrLen = sizeof(ipv6SockAddr);
-    }
+    SockData* sockData = new SockData();
+    sockData->aioSocket = aioSocket;
+    sockData->fd = aioSocket->_sockFd;
 
-    // Do the call to connect
-    do
-    {
-        res = ::connect(sockData->aioSocket->_sockFd, sockAddrPtr, sockAddrLen);
-    }
-    while (res == -1 && errno == EINTR);
+    // Reactors take new sockets in turn
+    uint32 reactorIndex = (uint32)_nextReactor.inc() % (uint32)_reactors.size();
+    sockData->reactor = _reactors.get(reactorIndex);
 
-    if (res == 0)
-    {
-        // Success
-        sockData->writeComplete = true;
-    }
-    else
-    {
-        err = errno;
+    slot->data = sockData;
+    aioSocket->_owner = this;
 
-        if (err != EINPROGRESS)
-        {
-            sockData->writeError = UnixUtil::getError(err,
-                "SocketService::connect",
-                "connect");
-            sockData->writeComplete = true;
-        }
-    }
+    return sockData;
 }
 
-void SocketService::doRecv(SockData* sockData)
+/*
+ * Drops a reference to socket data, freeing it with the last one.
+ */
+void SocketService::releaseData(SockData* sockData)
 {
-    ssize_t res;
-    int err;
-    size_t recvLen;
+    if (sockData->refCount.dec() == 0)
+        delete sockData;
+}
 
-    recvLen = sockData->readBufferLen;
+/*
+ * Removes a socket from the service. Called by AioSocket before its fd is
+ * closed. Pending operations are abandoned without their callbacks being
+ * triggered.
+ */
+void SocketService::dropSocket(AioSocket* aioSocket)
+{
+    aioSocket->_owner = NULL;
 
-    // Prevent overflow to negative
-    if (recvLen > INT_MAX)
-        recvLen = INT_MAX;
+    SocketSlot* slot = getSlot(aioSocket->_sockFd);
+    Locker<Mutex> locker(slot->lock);
 
-    do
-    {
-        res = ::recv(sockData->aioSocket->_sockFd,
-                     sockData->readBuffer,
-                     recvLen,
-                     0);
-    }
-    while (res == -1 && errno == EINTR);
+    SockData* sockData = slot->data;
 
-    if (res != -1)
+    if (sockData == NULL ||
+        sockData->aioSocket != aioSocket)
     {
-        sockData->readBufferPos = res;
-        sockData->readComplete = true;
+        return;
     }
-    else
-    {
-        err = errno;
 
-        if (err != EAGAIN &&
-            err != EWOULDBLOCK)
-        {
-            sockData->readError = UnixUtil::getError(err,
-                "SocketService::submitRecv",
-                "recv");
-            sockData->readComplete = true;
-        }
-    }
-}
+    slot->data = NULL;
 
-void SocketService::doSend(SockData* sockData)
-{
-    ssize_t res;
-    int err;
-    size_t sendLen;
+    // Queued entries are left for the workers, who hold a reference while
+    // they find the socket dropped
+    sockData->readOper = 0;
+    sockData->writeOper = 0;
+    sockData->isDropped = true;
 
-    sendLen = sockData->writeBufferLen - sockData->writeBufferPos;
+    // Have the poll thread remove its entry. It must let go of the fd
+    // before it's closed, or the close may not take effect until poll()
+    // returns.
+    markPollDirty(sockData);
 
-    // Prevent overflow to negative
-    if (sendLen > INT_MAX)
-        sendLen = INT_MAX;
+    locker.unlock();
 
-    int flags = 0;
+    // Workers still running a side hold their own reference
+    releaseData(sockData);
+}
 
-#ifdef MSG_NOSIGNAL
-    flags = MSG_NOSIGNAL;
-#endif
+/*
+ * Returns the poll events a socket waits on. Must be called with the
+ * socket's slot locked.
+ */
+short SocketService::pollEvents(const SockData* sockData)
+{
+    short events = 0;
 
-    do
+    if (sockData->readOper != 0 &&
+        !sockData->readReady &&
+        !sockData->readActive &&
+        !__atomic_load_n(&sockData->readQueueEntry.isQueued, __ATOMIC_ACQUIRE))
     {
-        res = ::send(sockData->aioSocket->_sockFd,
-                     sockData->writeBuffer + sockData->writeBufferPos,
-                     sendLen,
-                     flags);
+        events |= POLLIN;
     }
-    while (res == -1 && errno == EINTR);
 
-    if (res != -1)
+    if (sockData->writeOper != 0 &&
+        !sockData->writeReady &&
+        !sockData->writeActive &&
+        !__atomic_load_n(&sockData->writeQueueEntry.isQueued, __ATOMIC_ACQUIRE))
     {
-        sockData->writeBufferPos += res;
-        sockData->writeComplete = true;
+        events |= POLLOUT;
     }
-    else
-    {
-        err = errno;
 
-        if (err != EAGAIN &&
-            err != EWOULDBLOCK)
-        {
-            sockData->writeError = UnixUtil::getError(err,
-                "SocketService::submitSend",
-                "send");
-            sockData->writeComplete = true;
-        }
-    }
+    return events;
 }
 
-void SocketService::doSendfile(SockData* sockData)
+/*
+ * Adds a socket to the dirty list, so the poll thread updates its entry
+ * before the next call to poll(). The list holds a reference to the data.
+ * Must be called with the socket's slot locked.
+ */
+void SocketService::markPollDirty(SockData* sockData)
 {
+    if (sockData->isPollDirty)
+        return;
 
-}
+    sockData->isPollDirty = true;
+    sockData->refCount.inc();
 
-void SocketService::dropSocket(AioSocket* aioSocket)
-{
+    Reactor* reactor = sockData->reactor;
+    Locker<Mutex> locker(reactor->pollLock);
+
+    reactor->pollDirtyList.addBack(sockData);
+
+    // Later changes are picked up with the first, which wakes the thread
+    bool isFirst = (reactor->pollDirtyList.size() == 1);
 
+    locker.unlock();
+
+    if (isFirst)
+        wakeup(reactor);
 }
 
-bool SocketService::process()
+/*
+ * Brings a reactor's poll list up to date with the sockets on its dirty
+ * list. Called by the reactor's poll thread.
+ */
+void SocketService::applyPollChanges(Reactor* reactor)
 {
-    while (true)
-    {
-        Locker<Condition> locker(_cond);
+    Locker<Mutex> pollLocker(reactor->pollLock);
 
-        while (!_isShutdown &&
-               _readyQueueHead == NULL)
-        {
-            _cond.wait();
-        }
+    if (reactor->pollDirtyList.isEmpty())
+        return;
 
-        if (_isShutdown)
-            return false;
+    reactor->pollChangeList.addBlockBack(reactor->pollDirtyList.data(),
+                                         reactor->pollDirtyList.size());
+    reactor->pollDirtyList.resize(0);
+
+    pollLocker.unlock();
+
+    size_t changeCount = reactor->pollChangeList.size();
+
+    for (size_t i = 0; i < changeCount; i++)
+    {
+        SockData* sockData = reactor->pollChangeList.get(i);
+        SocketSlot* slot = getSlot(sockData->fd);
+        Locker<Mutex> locker(slot->lock);
 
-        // Pop an entry from the queue
-        QueueEntry* queueEntry = _readyQueueHead;
-        _readyQueueHead = queueEntry->next;
+        sockData->isPollDirty = false;
 
-        if (_readyQueueHead == NULL)
+        if (sockData->isDropped)
         {
-            _readyQueueTail = NULL;
+            if (sockData->pollIndex != -1)
+                removePollEntry(reactor, (size_t)sockData->pollIndex);
+        }
+        else if (sockData->pollIndex != -1)
+        {
+            setPollEvents(sockData);
         }
         else
         {
-            _readyQueueHead->prev = NULL;
+            // Sockets get an entry the first time they wait, and keep it
+            // until they're dropped
+            short events = pollEvents(sockData);
+
+            if (events != 0)
+            {
+                pollfd pollData;
+                pollData.fd = sockData->fd;
+                pollData.events = events;
+                pollData.revents = 0;
+
+                sockData->pollIndex = (int32)reactor->pollFdList.size();
+                sockData->refCount.inc();
+
+                reactor->pollFdList.addBack(pollData);
+                reactor->pollDataList.addBack(sockData);
+            }
         }
 
         locker.unlock();
+        releaseData(sockData);
+    }
 
-        // Take action depending on the data
-        SockData* sockData = queueEntry->data;
-        bool isRead = queueEntry->isRead;
+    reactor->pollChangeList.resize(0);
+}
 
-        Error error;
-        bool operComplete = false;
+/*
+ * Updates the events of a socket's poll entry in place. A socket waiting
+ * on nothing gets a negative fd, which poll() skips. Called by the poll
+ * thread with the socket's slot locked.
+ */
+void SocketService::setPollEvents(SockData* sockData)
+{
+    pollfd& pollData = sockData->reactor->pollFdList.get((size_t)sockData->pollIndex);
+    short events = pollEvents(sockData);
 
-        if (isRead)
+    pollData.fd = (events != 0) ? sockData->fd : -1;
+    pollData.events = events;
+}
+
+/*
+ * Removes a poll entry by moving the last entry into its place, dropping
+ * the list's reference to the data. Called by the poll thread.
+ */
+void SocketService::removePollEntry(Reactor* reactor,
+                                    size_t index)
+{
+    SockData* sockData = reactor->pollDataList.get(index);
+    size_t lastIndex = reactor->pollFdList.size() - 1;
+
+    if (index != lastIndex)
+    {
+        SockData* lastData = reactor->pollDataList.get(lastIndex);
+
+        reactor->pollFdList.set(index, reactor->pollFdList.get(lastIndex));
+        reactor->pollDataList.set(index, lastData);
+        lastData->pollIndex = (int32)index;
+    }
+
+    reactor->pollFdList.popBack();
+    reactor->pollDataList.popBack();
+
+    sockData->pollIndex = -1;
+    releaseData(sockData);
+}
+
+bool SocketService::doAccept(SockData* sockData, Error* error)
+{
+    sockaddr_storage address;
+    socklen_t addrSize;
+    int ret;
+    int err;
+
+    while (true)
+    {
+        addrSize = sizeof(address);
+
+        do
         {
-            if (sockData->readOper == FLAG_ACCEPT)
-            {
-                doAccept(sockData);
-
-                if (sockData->readComplete)
-                {
-                    SocketService::acceptCallback callback = (SocketService::acceptCallback)sockData->readCallback;
-                    callback(sockData->aioSocket,
-                             sockData->acceptSocket,
-                             sockData->readUserData,
-                             error);
-                }
-            }
-            else if (sockData->readOper == FLAG_READ)
-            {
-                doRecv(sockData);
-
-                if (sockData->readComplete)
-                {
-                    SocketService::socketCallback callback = (SocketService::socketCallback)sockData->readCallback;
-                    callback(sockData->aioSocket,
-                             sockData->readUserData,
-                             sockData->readBufferPos,
-                             error);
-                }
-            }
-        }
-        else
+            ret = ::accept(sockData->fd,
+                           (sockaddr*)&address,
+                           &addrSize);
+        } while (ret == -1 && errno == EINTR);
+
+        if (ret != -1)
+            break;
+
+        err = errno;
+
+        // Connections reset before being accepted are not the caller's
+        // problem, just try for the next one.
+        if (err == ECONNABORTED)
+            continue;
+
+        if (err == EAGAIN ||
+            err == EWOULDBLOCK)
         {
-            if (sockData->writeOper == FLAG_CONNECT)
-            {
-                doAccept(sockData);
-
-                if (sockData->writeComplete)
-                {
-                    SocketService::acceptCallback callback = (SocketService::acceptCallback)sockData->readCallback;
-                    callback(sockData->aioSocket,
-                             sockData->acceptSocket,
-                             sockData->writeUserData,
-                             error);
-                }
-            }
-            else if (sockData->writeOper == FLAG_WRITE)
-            {
-                doSend(sockData);
-
-                if (sockData->writeComplete)
-                {
-                    SocketService::connectCallback callback = (SocketService::connectCallback)sockData->readCallback;
-                    callback(sockData->aioSocket,
-                             sockData->writeUserData,
-                             error);
-                }
-            }
-            else if (sockData->writeOper == FLAG_SENDFILE)
-            {
-                doSendfile(sockData);
-
-                if (sockData->writeComplete)
-                {
-                    // TODO
-                    /*
-                    SocketService::socketCallback callback = (SocketService::socketCallback)sockData->readCallback;
-                    callback(sockData->aioSocket,
-                             sockData->writeUserData,
-                             sockData->readBufferPos,
-                             error);
-                    */
-                }
-            }
+            return false;
         }
+
+        (*error) = UnixUtil::getError(err,
+                                      "accept",
+                                      "SocketService::socketAccept");
+        return true;
+    }
+
+    // There's no portable accept4(), so the flags are set separately
+    if (::fcntl(ret, F_SETFL, O_NONBLOCK) != 0 ||
+        ::fcntl(ret, F_SETFD, FD_CLOEXEC) != 0)
+    {
+        (*error) = UnixUtil::getError(errno,
+                                      "fcntl",
+                                      "SocketService::socketAccept");
+        ::close(ret);
+
+        // More connections may be waiting
+        sockData->readReady = true;
+        return true;
     }
 
+    // Accept succeeded
+    AioSocket* acceptSocket = sockData->acceptSocket;
+    acceptSocket->_sockFd = ret;
+    acceptSocket->_family = sockData->aioSocket->_family;
+
+    if (address.ss_family == AF_INET)
+    {
+        sockaddr_in* ipv4Address = (sockaddr_in*)&address;
+        acceptSocket->_remoteAddress = INetAddress::fromBytes(INET_PROT_IPV4,
+            (unsigned char*)&ipv4Address->sin_addr);
+        acceptSocket->_remotePort = ntohs(ipv4Address->sin_port);
+    }
+    else if (address.ss_family == AF_INET6)
+    {
+        sockaddr_in6* ipv6Address = (sockaddr_in6*)&address;
+        acceptSocket->_remoteAddress = INetAddress::fromBytes(INET_PROT_IPV6,
+            (unsigned char*)&ipv6Address->sin6_addr);
+        acceptSocket->_remotePort = ntohs(ipv6Address->sin6_port);
+    }
+
+    // More connections may be waiting
+    sockData->readReady = true;
     return true;
 }
 
-bool SocketService::poll()
+bool SocketService::doConnect(SockData* sockData, Error* error)
 {
-    Locker<Condition> mainLocker(_cond);
-
-    if (_isShutdown)
-        return false;
+    int res;
+    int err;
 
-    // Fill in the pollfd data
-    _pollFdList.clear();
+    if (sockData->connectStarted)
+    {
+        // The connect is in progress. Check if it finished.
+        int errVal = 0;
+        socklen_t optLen = sizeof(errVal);
 
-    size_t pollIndex = 0;
-    HashMap<int, SockData>::ConstIterator mapIter = _dataMap.iterator();
+        res = ::getsockopt(sockData->fd, SOL_SOCKET, SO_ERROR, &errVal, &optLen);
 
-    while (mapIter.isValid())
-    {
-        HashMap<int, SockData>::Entry entry = mapIter.value();
-        int fd = entry.getKey();
-        SockData& sockData = entry.getValue();
+        if (res == -1)
+            errVal = errno;
 
-        pollfd pollData;
-        pollData.fd = fd;
-        pollData.events = 0;
-        pollData.revents = 0;
-        
-        if (sockData.readOper != 0 &&
-            !sockData.readComplete)
+        if (errVal != 0)
         {
-            pollData.events |= POLLIN;
+            (*error) = UnixUtil::getError(errVal,
+                                          "connect",
+                                          "SocketService::socketConnect");
+            return true;
         }
 
-        if (sockData.writeOper != 0 &&
-            !sockData.writeComplete)
+        // No error could also mean the connect hasn't finished. A connected
+        // socket will have a peer.
+        sockaddr_storage peerAddress;
+        socklen_t peerLen = sizeof(peerAddress);
+
+        res = ::getpeername(sockData->fd, (sockaddr*)&peerAddress, &peerLen);
+
+        if (res == -1)
         {
-            pollData.events |= POLLOUT;
+            err = errno;
+
+            if (err == ENOTCONN)
+                return false;
+
+            (*error) = UnixUtil::getError(err,
+                                          "getpeername",
+                                          "SocketService::socketConnect");
+            return true;
         }
 
-        _pollFdList.addBack(pollData);
+        // A new socket has room to send
+        sockData->writeReady = true;
+        return true;
+    }
+
+    sockaddr_in ipv4SockAddr;
+    sockaddr_in6 ipv6SockAddr;
+
+    const sockaddr* sockAddrPtr;
+    socklen_t sockAddrLen;
+
+    const unsigned char* addrData = sockData->connectAddress.getAddrData();
+    int port = sockData->connectPort;
 
-        pollIndex++;
+    // Fill in the address information and prep the connect parameters
+    if (sockData->aioSocket->_family == INET_PROT_IPV4)
+    {
+        ::memset(&ipv4SockAddr, 0, sizeof(ipv4SockAddr));
+
+        ipv4SockAddr.sin_family = AF_INET;
+        ::memcpy(&ipv4SockAddr.sin_addr, addrData, 4);
+        ipv4SockAddr.sin_port = htons(port);
+
+        sockAddrPtr = (const sockaddr*)&ipv4SockAddr;
+        sockAddrLen = sizeof(ipv4SockAddr);
+    }
+    else
+    {
+        ::memset(&ipv6SockAddr, 0, sizeof(ipv6SockAddr));
+
+        ipv6SockAddr.sin6_family = AF_INET6;
+        ::memcpy(&ipv6SockAddr.sin6_addr, addrData, 16);
+        ipv6SockAddr.sin6_port = htons(port);
+
+        sockAddrPtr = (const sockaddr*)&ipv6SockAddr;
+        sockAddrLen = sizeof(ipv6SockAddr);
     }
 
-    // Unlock the main condition and call poll
-    mainLocker.unlock();
+    // A non-blocking connect interrupted by a signal keeps going in the
+    // background, so EINTR is treated like EINPROGRESS.
+    res = ::connect(sockData->fd, sockAddrPtr, sockAddrLen);
 
-    int pollRet;
-    
-    do
+    if (res == 0)
     {
-        pollRet = ::poll(_pollFdList.data(), _pollFdList.size(), -1);
+        sockData->writeReady = true;
+        return true;
     }
-    while (pollRet == -1 && errno == EINTR);
 
-    if (pollRet == -1)
+    err = errno;
+
+    if (err == EINPROGRESS ||
+        err == EINTR)
     {
-        // Not much we can do if poll failed
-        // TODO: Log
-        // TODO: Shutdown?
+        sockData->connectStarted = true;
         return false;
     }
 
-    // If you close a FD passed to poll, prior to the poll returning, you
-    // can get errors relating to invalid FDs. To avoid this, a thread desiring
-    // to remove a FD can write to the wake pipe, indicate this thread should
-    // wait, do the removal and indicate it can stop waiting. This causes a
-    // bit of churn, but it's hard to avoid.
-    Locker<Condition> pauseLocker(_pauseCond);
+    (*error) = UnixUtil::getError(err,
+                                  "connect",
+                                  "SocketService::socketConnect");
+    return true;
+}
+
+bool SocketService::doRecv(SockData* sockData, Error* error)
+{
+    ssize_t res;
+    int err;
+    size_t recvLen;
+
+    recvLen = sockData->readBufferLen;
+
+    // Prevent overflow to negative
+    if (recvLen > INT_MAX)
+        recvLen = INT_MAX;
+
+    do
+    {
+        res = ::recv(sockData->fd,
+                     sockData->readBuffer,
+                     recvLen,
+                     0);
+    }
+    while (res == -1 && errno == EINTR);
 
-    if (_doPause)
+    if (res != -1)
     {
-        _isPaused = true;
+        sockData->readBufferPos = res;
 
-        while (_doPause)
-        {
-            _pauseCond.wait();
-        }
+        // A full buffer means there's likely more data to read without
+        // asking poll
+        if ((size_t)res == recvLen && res != 0)
+            sockData->readReady = true;
 
-        _isPaused = false;
-        _pauseCond.signal(); // TODO: Need?
         return true;
     }
 
-    pauseLocker.unlock();
+    err = errno;
+
+    if (err == EAGAIN ||
+        err == EWOULDBLOCK)
+    {
+        return false;
+    }
+
+    (*error) = UnixUtil::getError(err,
+                                  "recv",
+                                  "SocketService::socketRead");
+    return true;
+}
 
-    // Grab the main condition's lock again
-    mainLocker.lock();
+/*
+ * Peeks at a single byte to find if data or the end of the stream has
+ * arrived, leaving it for the read that follows.
+ */
+bool SocketService::doWaitRead(SockData* sockData, Error* error)
+{
+    ssize_t res;
+    int err;
+    char peekByte;
 
-    if (_isShutdown)
+    do
+    {
+        res = ::recv(sockData->fd,
+                     &peekByte,
+                     1,
+                     MSG_PEEK);
+    }
+    while (res == -1 && errno == EINTR);
+
+    if (res != -1)
+    {
+        // The data is still there for the read that follows
+        sockData->readReady = true;
+        return true;
+    }
+
+    err = errno;
+
+    if (err == EAGAIN ||
+        err == EWOULDBLOCK)
+    {
         return false;
+    }
 
-    // Now we walk through our happy set of results
-    for (int i = 0; i < pollRet; i++)
+    (*error) = UnixUtil::getError(err,
+                                  "recv",
+                                  "SocketService::socketWaitReadable");
+    return true;
+}
+
+/*
+ * Sets the buffers of a write operation. A single buffer is copied into the
+ * SockData so callers may pass a temporary.
+ */
+void SocketService::setWriteBuffers(SockData* sockData,
+                                    const WriteBuffer* buffers,
+                                    uint32 bufferCount)
+{
+    if (bufferCount == 1)
     {
-        pollfd& pollData = _pollFdList.get(i);
+        sockData->writeSingle = buffers[0];
+        buffers = &sockData->writeSingle;
+    }
 
-        // Ignore the wakeup pipe
-        if (pollData.fd == _wakeupPipe[0])
-            continue;
+    sockData->writeBuffers = buffers;
+    sockData->writeBufferCount = bufferCount;
+    sockData->writeBufferIndex = 0;
+    sockData->writeBufferOffset = 0;
+    sockData->writeBufferPos = 0;
+    sockData->writeBufferLen = 0;
 
-        HashMap<int, SockData>::ConstIterator iter = _dataMap.get(pollData.fd);
-        HashMap<int, SockData>::Entry entry = iter.value();
+    for (uint32 i = 0; i < bufferCount; i++)
+        sockData->writeBufferLen += buffers[i].dataLen;
+}
 
-        SockData& sockData = entry.getValue();
+bool SocketService::doSend(SockData* sockData, Error* error)
+{
+    iovec iov[MAX_WRITE_IOVECS];
+    msghdr msg;
+    ssize_t res;
+    int err;
 
-        bool queueRead = false;
-        bool queueWrite = false;
+    int flags = 0;
 
-        // Handle flags indicating a socket issues first
-        if ((pollData.revents | POLLERR) != 0)
-        {
-            // The socket itself is dead somehow
+#ifdef MSG_NOSIGNAL
+    flags = MSG_NOSIGNAL;
+#endif
+
+    ::memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
 
-            int errVal = -1;
-            socklen_t optLen = sizeof(errVal);
-            int optRet = ::getsockopt(pollData.fd, SOL_SOCKET, SO_ERROR, &errVal, &optLen);
+    // Keep sending until everything is written or the socket buffer fills
+    while (sockData->writeBufferPos < sockData->writeBufferLen)
+    {
+        // Gather as many of the remaining buffers as fit in one call
+        uint32 index = sockData->writeBufferIndex;
+        uint32 offset = sockData->writeBufferOffset;
+        uint32 iovCount = 0;
+
+        while (index < sockData->writeBufferCount &&
+               iovCount < MAX_WRITE_IOVECS)
+        {
+            const WriteBuffer& buffer = sockData->writeBuffers[index];
 
-            if (optRet == -1)
+            if (buffer.dataLen > offset)
             {
-                // TODO: Not much we can do but log
+                iov[iovCount].iov_base = (void*)(buffer.data + offset);
+                iov[iovCount].iov_len = buffer.dataLen - offset;
+                iovCount++;
             }
 
-            if (sockData.readOper != 0)
+            offset = 0;
+            index++;
+        }
+
+        msg.msg_iovlen = iovCount;
+
+        do
+        {
+            res = ::sendmsg(sockData->fd, &msg, flags);
+        }
+        while (res == -1 && errno == EINTR);
+
+        if (res == -1)
+        {
+            err = errno;
+
+            if (err == EAGAIN ||
+                err == EWOULDBLOCK)
             {
-                sockData.readError = UnixUtil::getError(errVal,
-                    "SocketService::?", // TODO: Mapping?
-                    "poll");
-                queueRead = true;
+                return false;
             }
 
-            if (sockData.writeOper != 0)
+            (*error) = UnixUtil::getError(err,
+                                          "sendmsg",
+                                          "SocketService::socketWrite");
+            return true;
+        }
+
+        sockData->writeBufferPos += res;
+
+        // Skip past the buffers that were sent
+        uint32 sent = (uint32)res;
+
+        while (sent != 0)
+        {
+            const WriteBuffer& buffer =
+                sockData->writeBuffers[sockData->writeBufferIndex];
+            uint32 remaining = buffer.dataLen - sockData->writeBufferOffset;
+
+            if (sent < remaining)
             {
-                sockData.writeError = UnixUtil::getError(errVal,
-                    "SocketService::?", // TODO: Mapping?
-                    "poll");
-                queueWrite = true;
+                sockData->writeBufferOffset += sent;
+                break;
             }
+
+            sent -= remaining;
+            sockData->writeBufferIndex++;
+            sockData->writeBufferOffset = 0;
         }
-        else if ((pollData.revents | POLLNVAL) != 0)
+    }
+
+    // The socket buffer still has room
+    sockData->writeReady = true;
+    return true;
+}
+
+/*
+ * There's no portable sendfile(), so it's emulated by reading blocks of the
+ * file into sendFileBuf and sending those.
+ */
+bool SocketService::doSendfile(SockData* sockData, Error* error)
+{
+    ssize_t res;
+    int err;
+
+    int flags = 0;
+
+#ifdef MSG_NOSIGNAL
+    flags = MSG_NOSIGNAL;
+#endif
+
+    while (true)
+    {
+        // Read the next block once the last has been sent
+        if (sockData->sendFileBufIndex == sockData->sendFileBufFilled)
         {
-            // The FD is somehow bad. This shouldn't be possible, but pass it on to both sides.
+            if (sockData->sendFileOffset == sockData->sendFileEnd)
+            {
+                sockData->writeReady = true;
+                return true;
+            }
 
-            if (sockData.readOper != 0)
+            size_t readLen = SEND_FILE_BUF_LEN;
+
+            if (sockData->sendFileEnd - sockData->sendFileOffset < readLen)
+                readLen = (size_t)(sockData->sendFileEnd - sockData->sendFileOffset);
+
+            do
             {
-                sockData.readError = UnixUtil::getError(EBADF,
-                    "SocketService::?", // TODO: Mapping?
-                    "poll");
-                queueRead = true;
+                res = ::pread(sockData->sendFileFd,
+                              sockData->sendFileBuf,
+                              readLen,
+                              (off_t)sockData->sendFileOffset);
             }
+            while (res == -1 && errno == EINTR);
 
-            if (sockData.writeOper != 0)
+            // Hitting the end of the file early is an error too
+            if (res <= 0)
             {
-                sockData.writeError = UnixUtil::getError(EBADF,
-                    "SocketService::?", // TODO: Mapping?
-                    "poll");
-                queueWrite = true;
+                (*error) = UnixUtil::getError((res == -1) ? errno : EIO,
+                                              "pread",
+                                              "SocketService::socketSendFile");
+                return true;
             }
+
+            sockData->sendFileBufFilled = (uint32)res;
+            sockData->sendFileBufIndex = 0;
+            sockData->sendFileOffset += res;
         }
-        else
+
+        do
         {
-            // Handle valid output cases
-            if ((pollData.revents | POLLHUP) != 0)
-            {
-                // This indicates the write side of the socket on our side is shutdown
+            res = ::send(sockData->fd,
+                         sockData->sendFileBuf + sockData->sendFileBufIndex,
+                         sockData->sendFileBufFilled - sockData->sendFileBufIndex,
+                         flags);
+        }
+        while (res == -1 && errno == EINTR);
 
-                sockData.writeError = UnixUtil::getError(EBADF,
-                    "SocketService::?", // TODO: Mapping?
-                    "poll");
-                queueWrite = true;
+        if (res == -1)
+        {
+            err = errno;
+
+            if (err == EAGAIN ||
+                err == EWOULDBLOCK)
+            {
+                return false;
             }
-            else if ((pollData.revents | POLLOUT) != 0)
+
+            (*error) = UnixUtil::getError(err,
+                                          "send",
+                                          "SocketService::socketSendFile");
+            return true;
+        }
+
+        sockData->sendFileBufIndex += (uint32)res;
+        sockData->writeBufferPos += (uint32)res;
+    }
+}
+
+bool SocketService::process(AioWorker* worker)
+{
+    if (_isServing.get() == 0)
+        return false;
+
+    QueueEntry* queueEntry = worker->readyQueue.pop();
+
+    while (queueEntry == NULL)
+    {
+        // Announce the worker is idle before looking at the queue one last
+        // time. A thread that queues an entry after that look sees the flag
+        // and wakes it.
+        __atomic_store_n(&worker->isIdle, 1, __ATOMIC_SEQ_CST);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+        queueEntry = worker->readyQueue.pop();
+
+        if (queueEntry != NULL)
+        {
+            __atomic_store_n(&worker->isIdle, 0, __ATOMIC_RELAXED);
+            break;
+        }
+
+        Locker<Condition> parkLocker(worker->parkCond);
+
+        while (!worker->wakePending &&
+               _isServing.get() != 0)
+        {
+            worker->parkCond.wait();
+        }
+
+        worker->wakePending = false;
+
+        parkLocker.unlock();
+
+        if (_isServing.get() == 0)
+            return false;
+
+        queueEntry = worker->readyQueue.pop();
+    }
+
+    // The queue's reference passes to this worker
+    SockData* sockData = queueEntry->data;
+    bool isRead = queueEntry->isRead;
+
+    __atomic_store_n(&queueEntry->isQueued, false, __ATOMIC_RELEASE);
+
+    performOper(sockData, isRead);
+    return true;
+}
+
+/*
+ * Performs the operation pending on one side of a socket, then runs its
+ * callback if it completed. The caller passes in a reference to the data,
+ * which is released.
+ */
+void SocketService::performOper(SockData* sockData,
+                                bool isRead)
+{
+    // Only the socket's own slot is locked from here on
+    SocketSlot* slot = getSlot(sockData->fd);
+    Locker<Mutex> locker(slot->lock);
+
+    uint32 oper;
+
+    // The socket may have been dropped or another worker may have taken
+    // the side since the entry was queued
+    if (isRead)
+    {
+        oper = sockData->readOper;
+
+        if (sockData->readActive)
+            oper = 0;
+    }
+    else
+    {
+        oper = sockData->writeOper;
+
+        if (sockData->writeActive)
+            oper = 0;
+    }
+
+    if (oper == 0 ||
+        sockData->isDropped)
+    {
+        locker.unlock();
+        releaseData(sockData);
+        return;
+    }
+
+    // Take the side. Readiness is consumed here, so poll results arriving
+    // while the system call runs are noticed afterwards.
+    if (isRead)
+    {
+        sockData->readActive = true;
+        sockData->readReady = false;
+    }
+    else
+    {
+        sockData->writeActive = true;
+        sockData->writeReady = false;
+    }
+
+    locker.unlock();
+
+    Error error;
+    bool operComplete = false;
+
+    switch (oper)
+    {
+        case FLAG_ACCEPT:
+            operComplete = doAccept(sockData, &error);
+            break;
+        case FLAG_READ:
+            operComplete = doRecv(sockData, &error);
+            break;
+        case FLAG_WAIT_READ:
+            operComplete = doWaitRead(sockData, &error);
+            break;
+        case FLAG_CONNECT:
+            operComplete = doConnect(sockData, &error);
+            break;
+        case FLAG_WRITE:
+            operComplete = doSend(sockData, &error);
+            break;
+        case FLAG_SENDFILE:
+            operComplete = doSendfile(sockData, &error);
+            break;
+    }
+
+    locker.lock();
+
+    // Copy what the callback needs, as the SockData may be reused as soon
+    // as the operation is cleared.
+    AioSocket* aioSocket = sockData->aioSocket;
+    AioSocket* acceptSocket = sockData->acceptSocket;
+    void* callback;
+    void* userData;
+    uint32 bytesTransfered;
+
+    if (isRead)
+    {
+        sockData->readActive = false;
+        callback = sockData->readCallback;
+        userData = sockData->readUserData;
+        bytesTransfered = sockData->readBufferPos;
+    }
+    else
+    {
+        sockData->writeActive = false;
+        callback = sockData->writeCallback;
+        userData = sockData->writeUserData;
+        bytesTransfered = sockData->writeBufferPos;
+    }
+
+    // A closed socket's operations are abandoned
+    if (sockData->isDropped)
+    {
+        locker.unlock();
+        releaseData(sockData);
+        return;
+    }
+
+    if (!operComplete)
+    {
+        // Try again if poll reported readiness during the call, otherwise
+        // have the poll thread add the side to its set
+        if ((isRead && sockData->readReady) ||
+            (!isRead && sockData->writeReady))
+        {
+            enqueData(isRead ? &sockData->readQueueEntry :
+                               &sockData->writeQueueEntry);
+        }
+        else
+        {
+            markPollDirty(sockData);
+        }
+
+        locker.unlock();
+        releaseData(sockData);
+        return;
+    }
+
+    if (isRead)
+        sockData->readOper = 0;
+    else
+        sockData->writeOper = 0;
+
+    locker.unlock();
+    releaseData(sockData);
+
+    switch (oper)
+    {
+        case FLAG_ACCEPT:
+            ((SocketService::acceptCallback)callback)(aioSocket,
+                                                      acceptSocket,
+                                                      userData,
+                                                      error);
+            break;
+        case FLAG_CONNECT:
+            ((SocketService::connectCallback)callback)(aioSocket,
+                                                       userData,
+                                                       error);
+            break;
+        case FLAG_READ:
+        case FLAG_WAIT_READ:
+        case FLAG_WRITE:
+        case FLAG_SENDFILE:
+            ((SocketService::socketCallback)callback)(aioSocket,
+                                                      userData,
+                                                      bytesTransfered,
+                                                      error);
+            break;
+    }
+}
+
+/*
+ * Performs the operations queued on a reactor with inline completion. At
+ * most INLINE_QUEUE_BATCH are run between calls to poll(), so sockets
+ * waiting on poll aren't held up by a busy queue. Called by the reactor's
+ * poll thread.
+ */
+void SocketService::runQueued(Reactor* reactor)
+{
+    for (uint32 i = 0; i < INLINE_QUEUE_BATCH; i++)
+    {
+        QueueEntry* queueEntry = reactor->inlineQueue.pop();
+
+        if (queueEntry == NULL)
+            break;
+
+        // The queue's reference passes to performOper()
+        SockData* sockData = queueEntry->data;
+        bool isRead = queueEntry->isRead;
+
+        __atomic_store_n(&queueEntry->isQueued, false, __ATOMIC_RELEASE);
+
+        performOper(sockData, isRead);
+    }
+}
+
+bool SocketService::poll(Reactor* reactor)
+{
+    if (_isServing.get() == 0)
+        return false;
+
+    applyPollChanges(reactor);
+
+    List<pollfd>& pollFdList = reactor->pollFdList;
+    int pollTimeout = -1;
+    int pollRet;
+
+    if (_inlineCompletion)
+    {
+        // Queued operations run once poll() has looked for events, so it
+        // mustn't wait if there are any. The flag is set before looking, so
+        // an entry queued after the look wakes poll().
+        __atomic_store_n(&reactor->isPolling, 1, __ATOMIC_SEQ_CST);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+        if (!reactor->inlineQueue.isEmpty())
+            pollTimeout = 0;
+    }
+
+    do
+    {
+        pollRet = ::poll(pollFdList.data(), pollFdList.size(), pollTimeout);
+    }
+    while (pollRet == -1 && errno == EINTR);
+
+    if (_inlineCompletion)
+        __atomic_store_n(&reactor->isPolling, 0, __ATOMIC_RELAXED);
+
+    if (pollRet == -1)
+    {
+        // Not much we can do if poll failed
+        // TODO: Log
+        return false;
+    }
+
+    if (_isServing.get() == 0)
+        return false;
+
+    if (pollFdList.get(0).revents != 0)
+    {
+        emptyWakePipe(reactor);
+        pollRet--;
+    }
+
+    // pollRet counts the entries with results, which may be anywhere in
+    // the list
+    size_t pollCount = pollFdList.size();
+
+    for (size_t i = 1; i < pollCount && pollRet > 0; i++)
+    {
+        const pollfd& result = pollFdList.get(i);
+
+        if (result.revents == 0)
+            continue;
+
+        pollRet--;
+
+        SockData* sockData = reactor->pollDataList.get(i);
+        SocketSlot* slot = getSlot(sockData->fd);
+        Locker<Mutex> locker(slot->lock);
+
+        // The entry of a dropped socket is removed with the next changes
+        if (sockData->isDropped)
+            continue;
+
+        bool runRead = false;
+        bool runWrite = false;
+
+        // Errors and hangups are reported through the next system call on
+        // either side.
+        if (result.revents & (POLLIN | POLLHUP | POLLERR | POLLNVAL))
+        {
+            sockData->readReady = true;
+
+            if (sockData->readOper != 0 &&
+                !sockData->readActive)
             {
-                queueWrite = true;
+                if (_inlineCompletion)
+                    runRead = true;
+                else
+                    enqueData(&sockData->readQueueEntry);
             }
-            
-            // Handle valid input cases
-            if ((pollData.revents | POLLIN) != 0)
+        }
+
+        if (result.revents & (POLLOUT | POLLHUP | POLLERR | POLLNVAL))
+        {
+            sockData->writeReady = true;
+
+            if (sockData->writeOper != 0 &&
+                !sockData->writeActive)
             {
-                queueRead = true;
+                if (_inlineCompletion)
+                    runWrite = true;
+                else
+                    enqueData(&sockData->writeQueueEntry);
             }
         }
 
-        if (queueRead)
-            enqueData(&sockData.readQueueEntry);
+        // The sides that are ready stop waiting
+        setPollEvents(sockData);
+
+        if (!runRead && !runWrite)
+            continue;
+
+        // Each side run holds its own reference, as a callback may drop
+        // the socket
+        if (runRead)
+            sockData->refCount.inc();
+
+        if (runWrite)
+            sockData->refCount.inc();
+
+        locker.unlock();
+
+        if (runRead)
+            performOper(sockData, true);
 
-        if (queueWrite)
-            enqueData(&sockData.writeQueueEntry);
+        if (runWrite)
+            performOper(sockData, false);
     }
 
+    if (_inlineCompletion)
+        runQueued(reactor);
+
     return true;
 }
 
+/*
+ * Adds an entry to a ready queue of its reactor if not already queued and
+ * wakes the thread taking from it if idle. The queue holds a reference to
+ * the entry's data. Must be called with the data's slot locked.
+ */
 void SocketService::enqueData(QueueEntry* queueEntry)
 {
-    if (_readyQueueHead == NULL)
+    if (__atomic_load_n(&queueEntry->isQueued, __ATOMIC_ACQUIRE))
+        return;
+
+    SockData* sockData = queueEntry->data;
+    Reactor* reactor = sockData->reactor;
+
+    sockData->refCount.inc();
+    __atomic_store_n(&queueEntry->isQueued, true, __ATOMIC_RELAXED);
+
+    if (_inlineCompletion)
     {
-        queueEntry->prev = NULL;
-        _readyQueueHead = queueEntry;
-        _readyQueueTail = queueEntry;
+        reactor->inlineQueue.push(queueEntry);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+        if (__atomic_load_n(&reactor->isPolling, __ATOMIC_RELAXED) != 0 &&
+            __atomic_exchange_n(&reactor->isPolling, 0, __ATOMIC_SEQ_CST) != 0)
+        {
+            wakeup(reactor);
+        }
+
+        return;
     }
-    else
+
+    // Entries go to the workers in turn, but an idle worker is preferred
+    // over one that may be busy with a long callback
+    List<AioWorker*>& workers = reactor->workers;
+    size_t workerCount = workers.size();
+    size_t first = (uint32)reactor->nextWorker.inc() % workerCount;
+    AioWorker* worker = workers.get(first);
+
+    for (size_t i = 0; i < workerCount; i++)
     {
-        _readyQueueTail->next = queueEntry;
+        AioWorker* candidate = workers.get((first + i) % workerCount);
+
+        if (__atomic_load_n(&candidate->isIdle, __ATOMIC_RELAXED) != 0)
+        {
+            worker = candidate;
+            break;
+        }
     }
 
-    queueEntry->next = NULL;
+    worker->readyQueue.push(queueEntry);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(&worker->isIdle, __ATOMIC_RELAXED) != 0 &&
+        __atomic_exchange_n(&worker->isIdle, 0, __ATOMIC_SEQ_CST) != 0)
+    {
+        Locker<Condition> parkLocker(worker->parkCond);
+
+        worker->wakePending = true;
+        worker->parkCond.signal();
+    }
+}
+
+/*
+ * Empties a ready queue, dropping its references. Only called once the
+ * threads have stopped.
+ */
+void SocketService::drainQueue(ReadyQueue* readyQueue)
+{
+    QueueEntry* queueEntry = readyQueue->pop();
+
+    while (queueEntry != NULL)
+    {
+        SockData* sockData = queueEntry->data;
+
+        __atomic_store_n(&queueEntry->isQueued, false, __ATOMIC_RELAXED);
+        releaseData(sockData);
+
+        queueEntry = readyQueue->pop();
+    }
 }
 
 // Inner Classes ------------------------------------------------------------
 
-SocketService::AioWorker::AioWorker(SocketService* socketService) :
-    _socketService(socketService)
+SocketService::ReadyQueue::ReadyQueue() :
+    _head(&_stub),
+    _tail(&_stub)
+{
+    _stub.isRead = false;
+    _stub.isQueued = false;
+    _stub.data = NULL;
+    _stub.next = NULL;
+}
+
+void SocketService::ReadyQueue::push(QueueEntry* queueEntry)
+{
+    queueEntry->next = NULL;
+
+    // The entry is reachable once the previous last entry links to it
+    QueueEntry* prev = __atomic_exchange_n(&_head, queueEntry, __ATOMIC_ACQ_REL);
+    __atomic_store_n(&prev->next, queueEntry, __ATOMIC_RELEASE);
+}
+
+SocketService::QueueEntry* SocketService::ReadyQueue::pop()
+{
+    QueueEntry* tail = _tail;
+    QueueEntry* next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+
+    if (tail == &_stub)
+    {
+        if (next == NULL)
+            return NULL;
+
+        _tail = next;
+        tail = next;
+        next = __atomic_load_n(&next->next, __ATOMIC_ACQUIRE);
+    }
+
+    if (next != NULL)
+    {
+        _tail = next;
+        return tail;
+    }
+
+    // An entry being added hasn't been linked yet
+    if (tail != __atomic_load_n(&_head, __ATOMIC_ACQUIRE))
+        return NULL;
+
+    // tail is the last entry. The stub takes its place, so it can be
+    // taken without leaving the queue without entries.
+    push(&_stub);
+
+    next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+
+    if (next != NULL)
+    {
+        _tail = next;
+        return tail;
+    }
+
+    return NULL;
+}
+
+bool SocketService::ReadyQueue::isEmpty() const
+{
+    return _tail == &_stub &&
+           __atomic_load_n(&_head, __ATOMIC_ACQUIRE) == &_stub;
+}
+
+SocketService::AioWorker::AioWorker(Reactor* reactor) :
+    reactor(reactor),
+    isIdle(0),
+    wakePending(false)
 {
 }
 
@@ -911,34 +1805,66 @@ void SocketService::AioWorker::run()
 {
     CurrentThread::setName("SocketService Worker");
 
+    SocketService* socketService = reactor->socketService;
+
+    if (socketService->_processor != -1)
+        CurrentThread::setProcessor((uint32)socketService->_processor);
+
     bool keepGoing = true;
 
     while (keepGoing)
     {
-        keepGoing = _socketService->process();
+        keepGoing = socketService->process(this);
     }
 }
 
-SocketService::PollWorker::PollWorker(SocketService* socketService) :
-    _socketService(socketService)
+SocketService::Reactor::Reactor(SocketService* socketService) :
+    socketService(socketService),
+    isPolling(0)
+{
+    wakeupPipe[0] = -1;
+    wakeupPipe[1] = -1;
+}
+
+SocketService::Reactor::~Reactor()
 {
+    for (size_t i = 0; i < workers.size(); i++)
+        delete workers.get(i);
+
+    if (wakeupPipe[0] != -1)
+        ::close(wakeupPipe[0]);
 
+    if (wakeupPipe[1] != -1)
+        ::close(wakeupPipe[1]);
 }
 
-void SocketService::PollWorker::run()
+void SocketService::Reactor::run()
 {
-    CurrentThread::setName("FileService Poll Worker");
+    CurrentThread::setName("SocketService Poll Worker");
+
+    if (socketService->_processor != -1)
+        CurrentThread::setProcessor((uint32)socketService->_processor);
 
     bool keepGoing = true;
 
     while (keepGoing)
     {
-        keepGoing = _socketService->poll();
+        keepGoing = socketService->poll(this);
     }
 }
 
 SocketService::SockData::SockData() :
     aioSocket(NULL),
+    fd(-1),
+    reactor(NULL),
+    refCount(1),
+    readReady(true),
+    writeReady(true),
+    readActive(false),
+    writeActive(false),
+    isDropped(false),
+    isPollDirty(false),
+    pollIndex(-1),
     readOper(0),
     acceptSocket(NULL),
     readCallback(NULL),
@@ -946,15 +1872,17 @@ SocketService::SockData::SockData() :
     readBuffer(NULL),
     readBufferPos(0),
     readBufferLen(0),
-    readComplete(false),
     writeOper(0),
     writeCallback(NULL),
     writeUserData(NULL),
-    writeBuffer(NULL),
+    writeBuffers(NULL),
+    writeBufferCount(0),
+    writeBufferIndex(0),
+    writeBufferOffset(0),
     writeBufferPos(0),
     writeBufferLen(0),
-    writeComplete(false),
     connectPort(0),
+    connectStarted(false),
     sendFileFd(-1),
     sendFileBuf(NULL),
     sendFileBufFilled(0),
@@ -963,12 +1891,12 @@ SocketService::SockData::SockData() :
     sendFileEnd(0)
 {
     readQueueEntry.isRead = true;
+    readQueueEntry.isQueued = false;
     readQueueEntry.data = this;
-    readQueueEntry.prev = NULL;
     readQueueEntry.next = NULL;
     writeQueueEntry.isRead = false;
+    writeQueueEntry.isQueued = false;
     writeQueueEntry.data = this;
-    writeQueueEntry.prev = NULL;
     writeQueueEntry.next = NULL;
 }
 
@@ -976,3 +1904,10 @@ SocketService::SockData::~SockData()
 {
     delete[] sendFileBuf;
 }
+
+SocketService::SocketSlot::SocketSlot() :
+    data(NULL)
+{
+}
+
+#endif // !__linux__
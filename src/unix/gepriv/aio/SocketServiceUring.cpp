@@ -0,0 +1,1545 @@
+// SocketServiceUring.cpp
+
+#ifdef __linux__
+
+#include "gepriv/aio/SocketServiceUring.h"
+
+#include "ge/aio/AioFile.h"
+#include "ge/io/IOException.h"
+#include "ge/thread/CurrentThread.h"
+#include "ge/util/Locker.h"
+#include "gepriv/UnixUtil.h"
+
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#define FLAG_ACCEPT 0x1
+#define FLAG_CONNECT 0x2
+#define FLAG_READ 0x4
+#define FLAG_WRITE 0x8
+#define FLAG_SENDFILE 0x10
+#define FLAG_WAIT_READ 0x20
+
+// Submission ring size. The completion ring is twice this.
+#define RING_ENTRIES 1024
+
+// Largest amount Linux will transfer in a single sendfile() call
+#define MAX_SENDFILE_LEN 0x7ffff000
+
+// The low bits of a SockData pointer in user_data select the operation
+#define TAG_READ 0x0
+#define TAG_WRITE 0x1
+#define TAG_ACCEPT 0x2
+#define TAG_CANCEL 0x3
+#define TAG_CANCEL_ACCEPT 0x4
+#define TAG_MASK 0x7
+
+// user_data of the read that wakes the ring thread
+#define WAKEUP_TOKEN 0
+
+
+SocketServiceUring::SocketServiceUring(SocketService* owner) :
+    _owner(owner),
+    _wakeupFd(-1),
+    _wakeupValue(0),
+    _isWaiting(false),
+    _wakeArmed(false),
+    _wakePending(false),
+    _multishotAccept(true),
+    _ringWorker(this),
+    _processor(-1),
+    _inlineCompletion(false),
+    _isStarted(false),
+    _isShutdown(false),
+    _workHead(0),
+    _isWorkShutdown(false)
+{
+}
+
+SocketServiceUring::~SocketServiceUring()
+{
+    shutdown();
+
+    if (_wakeupFd != -1)
+        ::close(_wakeupFd);
+}
+
+bool SocketServiceUring::isSupported()
+{
+    static const uint8 requiredOps[] =
+    {
+        IORING_OP_ACCEPT,
+        IORING_OP_ASYNC_CANCEL,
+        IORING_OP_CONNECT,
+        IORING_OP_POLL_ADD,
+        IORING_OP_READ,
+        IORING_OP_RECV,
+        IORING_OP_SEND,
+        IORING_OP_SENDMSG
+    };
+
+    return IoUring::isSupported(requiredOps,
+                                sizeof(requiredOps) / sizeof(requiredOps[0]));
+}
+
+void SocketServiceUring::startServing(uint32 workerCount,
+                                      int32 processor,
+                                      bool inlineCompletion)
+{
+    Locker<Condition> locker(_cond);
+
+    if (_isShutdown)
+        throw IOException("Cannot restart shutdown SocketService");
+
+    if (_isStarted)
+        throw IOException("SocketService already started");
+
+    _processor = processor;
+    _inlineCompletion = inlineCompletion;
+
+    _ring.init(RING_ENTRIES);
+
+    _wakeupFd = ::eventfd(0, EFD_CLOEXEC);
+
+    if (_wakeupFd == -1)
+    {
+        Error error = UnixUtil::getError(errno,
+                                         "eventfd",
+                                         "SocketServiceUring::startServing");
+        throw IOException(error);
+    }
+
+    armWakeup();
+
+    _isStarted = true;
+
+    // Every completion needs a worker to run its callback, unless the ring
+    // thread runs them all
+    if (inlineCompletion)
+        workerCount = 0;
+    else if (workerCount == 0)
+        workerCount = 1;
+
+    // If this throws we're depending on the destructor for cleanup
+    for (uint32 i = 0; i < workerCount; i++)
+    {
+        AioWorker* worker = new AioWorker(this);
+        _workers.addBack(worker);
+
+        worker->start();
+    }
+
+    _ringWorker.start();
+}
+
+void SocketServiceUring::shutdown()
+{
+    Locker<Condition> locker(_cond);
+
+    if (_isShutdown)
+        return;
+
+    _isShutdown = true;
+
+    if (!_isStarted)
+        return;
+
+    uint64 value = 1;
+    int res;
+
+    do
+    {
+        res = ::write(_wakeupFd, &value, sizeof(value));
+    } while (res == -1 && errno == EINTR);
+
+    locker.unlock();
+
+    _ringWorker.join();
+
+    // Completions not yet run are abandoned
+    Locker<Condition> workLocker(_workCond);
+
+    _isWorkShutdown = true;
+    _workCond.signalAll();
+
+    workLocker.unlock();
+
+    for (size_t i = 0; i < _workers.size(); i++)
+    {
+        AioWorker* worker = _workers.get(i);
+        worker->join();
+        delete worker;
+    }
+
+    _workers.clear();
+    _workList.clear();
+    _workHead = 0;
+
+    // Closing the ring cancels anything still in flight
+    _ring.close();
+
+    locker.lock();
+
+    HashMap<int, SockData*>::Iterator iter = _dataMap.iterator();
+
+    while (iter.isValid())
+    {
+        SockData* sockData = iter.value().getValue();
+        sockData->aioSocket->_owner = NULL;
+
+        for (size_t i = 0; i < sockData->acceptBacklog.size(); i++)
+            ::close(sockData->acceptBacklog.get(i));
+
+        delete sockData;
+
+        iter.next();
+    }
+
+    _dataMap.clear();
+
+    size_t droppedCount = _droppedList.size();
+    for (size_t i = 0; i < droppedCount; i++)
+    {
+        delete _droppedList.get(i);
+    }
+
+    _droppedList.clear();
+    _submitList.clear();
+}
+
+void SocketServiceUring::socketAccept(AioSocket* listenSocket,
+                                      AioSocket* acceptSocket,
+                                      SocketService::acceptCallback callback,
+                                      void* userData)
+{
+    if (listenSocket->_sockFd == -1)
+    {
+        throw IOException("Can't accept with uninitialized socket");
+    }
+
+    if (acceptSocket->_sockFd != -1)
+    {
+        throw IOException("Can't accept into an initialized socket");
+    }
+
+    Locker<Condition> locker(_cond);
+
+    checkRunning();
+
+    SockData* sockData = getSockData(listenSocket, "SocketService::socketAccept");
+
+    if (sockData->readOper != 0)
+    {
+        throw IOException("Cannot accept on socket performing another operation");
+    }
+
+    sockData->readOper = FLAG_ACCEPT;
+    sockData->readCallback = (void*)callback;
+    sockData->acceptSocket = acceptSocket;
+    sockData->readUserData = userData;
+
+    queueOper(sockData, TAG_READ);
+}
+
+void SocketServiceUring::socketConnect(AioSocket* aioSocket,
+                                       SocketService::connectCallback callback,
+                                       void* userData,
+                                       const INetAddress& address,
+                                       int32 port)
+{
+    if (aioSocket->_sockFd == -1)
+    {
+        throw IOException("Can't connect with uninitialized socket");
+    }
+
+    Locker<Condition> locker(_cond);
+
+    checkRunning();
+
+    SockData* sockData = getSockData(aioSocket, "SocketService::socketConnect");
+
+    if (sockData->writeOper != 0 ||
+        sockData->readOper != 0)
+    {
+        throw IOException("Cannot connect on socket performing another operation");
+    }
+
+    const unsigned char* addrData = address.getAddrData();
+
+    // The address must stay valid until the kernel has consumed the entry
+    ::memset(&sockData->connectAddress, 0, sizeof(sockData->connectAddress));
+
+    if (aioSocket->_family == INET_PROT_IPV4)
+    {
+        sockaddr_in* ipv4SockAddr = (sockaddr_in*)&sockData->connectAddress;
+
+        ipv4SockAddr->sin_family = AF_INET;
+        ::memcpy(&ipv4SockAddr->sin_addr, addrData, 4);
+        ipv4SockAddr->sin_port = htons(port);
+
+        sockData->connectAddressLen = sizeof(sockaddr_in);
+    }
+    else
+    {
+        sockaddr_in6* ipv6SockAddr = (sockaddr_in6*)&sockData->connectAddress;
+
+        ipv6SockAddr->sin6_family = AF_INET6;
+        ::memcpy(&ipv6SockAddr->sin6_addr, addrData, 16);
+        ipv6SockAddr->sin6_port = htons(port);
+
+        sockData->connectAddressLen = sizeof(sockaddr_in6);
+    }
+
+    sockData->writeOper = FLAG_CONNECT;
+    sockData->writeCallback = (void*)callback;
+    sockData->writeUserData = userData;
+    sockData->writePolling = false;
+
+    queueOper(sockData, TAG_WRITE);
+}
+
+void SocketServiceUring::socketRead(AioSocket* aioSocket,
+                                    SocketService::socketCallback callback,
+                                    void* userData,
+                                    char* buffer,
+                                    uint32 bufferLen)
+{
+    if (aioSocket->_sockFd == -1)
+    {
+        throw IOException("Can't read from uninitialized socket");
+    }
+
+    Locker<Condition> locker(_cond);
+
+    checkRunning();
+
+    SockData* sockData = getSockData(aioSocket, "SocketService::socketRead");
+
+    if (sockData->readOper != 0)
+    {
+        throw IOException("Cannot read from socket with read operation already in progress");
+    }
+
+    sockData->readOper = FLAG_READ;
+    sockData->readCallback = (void*)callback;
+    sockData->readUserData = userData;
+    sockData->readBuffer = buffer;
+    sockData->readBufferLen = bufferLen;
+    sockData->readPolling = false;
+
+    queueOper(sockData, TAG_READ);
+}
+
+void SocketServiceUring::socketWaitReadable(AioSocket* aioSocket,
+                                            SocketService::socketCallback callback,
+                                            void* userData)
+{
+    if (aioSocket->_sockFd == -1)
+    {
+        throw IOException("Can't read from uninitialized socket");
+    }
+
+    Locker<Condition> locker(_cond);
+
+    checkRunning();
+
+    SockData* sockData = getSockData(aioSocket, "SocketService::socketWaitReadable");
+
+    if (sockData->readOper != 0)
+    {
+        throw IOException("Cannot read from socket with read operation already in progress");
+    }
+
+    // Only a poll is submitted, there's no buffer for the kernel to fill
+    sockData->readOper = FLAG_WAIT_READ;
+    sockData->readCallback = (void*)callback;
+    sockData->readUserData = userData;
+    sockData->readBuffer = NULL;
+    sockData->readBufferLen = 0;
+    sockData->readPolling = true;
+
+    queueOper(sockData, TAG_READ);
+}
+
+void SocketServiceUring::socketWrite(AioSocket* aioSocket,
+                                     SocketService::socketCallback callback,
+                                     void* userData,
+                                     const char* buffer,
+                                     uint32 bufferLen)
+{
+    SocketService::WriteBuffer writeBuffer;
+
+    writeBuffer.data = buffer;
+    writeBuffer.dataLen = bufferLen;
+
+    socketWriteV(aioSocket, callback, userData, &writeBuffer, 1);
+}
+
+void SocketServiceUring::socketWriteV(AioSocket* aioSocket,
+                                      SocketService::socketCallback callback,
+                                      void* userData,
+                                      const SocketService::WriteBuffer* buffers,
+                                      uint32 bufferCount)
+{
+    if (aioSocket->_sockFd == -1)
+    {
+        throw IOException("Can't write to uninitialized socket");
+    }
+
+    Locker<Condition> locker(_cond);
+
+    checkRunning();
+
+    SockData* sockData = getSockData(aioSocket, "SocketService::socketWrite");
+
+    if (sockData->writeOper != 0)
+    {
+        throw IOException("Cannot write to socket with write operation already in progress");
+    }
+
+    // A single buffer is copied so callers may pass a temporary
+    if (bufferCount == 1)
+    {
+        sockData->writeSingle = buffers[0];
+        buffers = &sockData->writeSingle;
+    }
+
+    sockData->writeOper = FLAG_WRITE;
+    sockData->writeCallback = (void*)callback;
+    sockData->writeUserData = userData;
+    sockData->writeBuffers = buffers;
+    sockData->writeBufferCount = bufferCount;
+    sockData->writeBufferIndex = 0;
+    sockData->writeBufferOffset = 0;
+    sockData->writeBufferPos = 0;
+    sockData->writeBufferLen = 0;
+    sockData->writePolling = false;
+
+    for (uint32 i = 0; i < bufferCount; i++)
+        sockData->writeBufferLen += buffers[i].dataLen;
+
+    queueOper(sockData, TAG_WRITE);
+}
+
+void SocketServiceUring::socketSendFile(AioSocket* aioSocket,
+                                        SocketService::socketCallback callback,
+                                        void* userData,
+                                        AioFile* aioFile,
+                                        uint64 pos,
+                                        uint32 writeLen)
+{
+    if (aioSocket->_sockFd == -1)
+    {
+        throw IOException("Can't write to uninitialized socket");
+    }
+
+    if (aioFile->_fd == -1)
+    {
+        throw IOException("Cannot send a closed file");
+    }
+
+    Locker<Condition> locker(_cond);
+
+    checkRunning();
+
+    SockData* sockData = getSockData(aioSocket, "SocketService::socketSendFile");
+
+    if (sockData->writeOper != 0)
+    {
+        throw IOException("Cannot write to socket with write operation already in progress");
+    }
+
+    // Sent by sendfile() once a poll reports the socket writable
+    sockData->writeOper = FLAG_SENDFILE;
+    sockData->writeCallback = (void*)callback;
+    sockData->writeUserData = userData;
+    sockData->writeBufferPos = 0;
+    sockData->writeBufferLen = writeLen;
+    sockData->writePolling = true;
+    sockData->sendFileFd = aioFile->_fd;
+    sockData->sendFileOffset = pos;
+    sockData->sendFileEnd = pos + writeLen;
+
+    queueOper(sockData, TAG_WRITE);
+}
+
+/*
+ * Removes a socket from the service. Called by AioSocket before its fd is
+ * closed. Pending operations are cancelled without their callbacks being
+ * triggered.
+ */
+void SocketServiceUring::dropSocket(AioSocket* aioSocket)
+{
+    Locker<Condition> locker(_cond);
+
+    aioSocket->_owner = NULL;
+
+    HashMap<int, SockData*>::Iterator iter = _dataMap.get(aioSocket->_sockFd);
+
+    if (!iter.isValid())
+        return;
+
+    SockData* sockData = iter.value().getValue();
+    _dataMap.erase(iter);
+
+    sockData->isDropped = true;
+    sockData->readOper = 0;
+    sockData->writeOper = 0;
+
+    for (size_t i = 0; i < sockData->acceptBacklog.size(); i++)
+        ::close(sockData->acceptBacklog.get(i));
+
+    sockData->acceptBacklog.clear();
+
+    // The kernel holds its own reference to the file, so anything in flight
+    // must be cancelled explicitly.
+    if (sockData->inFlight != 0 && _isStarted && !_isShutdown)
+        queueOper(sockData, TAG_CANCEL);
+
+    _droppedList.addBack(sockData);
+}
+
+/*
+ * Returns the SockData for the passed socket, creating it if this is the
+ * first operation on it. Must be called with _cond locked.
+ */
+SocketServiceUring::SockData* SocketServiceUring::getSockData(AioSocket* aioSocket,
+                                                              const char* context)
+{
+    HashMap<int, SockData*>::Iterator iter = _dataMap.get(aioSocket->_sockFd);
+
+    if (iter.isValid())
+    {
+        return iter.value().getValue();
+    }
+
+    if (aioSocket->_owner != NULL &&
+        aioSocket->_owner != _owner)
+    {
+        throw IOException(String(context) + ": AioSocket is owned by another SocketService");
+    }
+
+    SockData* sockData = new SockData();
+    sockData->aioSocket = aioSocket;
+    sockData->fd = aioSocket->_sockFd;
+
+    _dataMap.put(sockData->fd, sockData);
+    aioSocket->_owner = _owner;
+
+    return sockData;
+}
+
+void SocketServiceUring::checkRunning()
+{
+    if (!_isStarted || _isShutdown)
+        throw IOException("SocketService not running");
+}
+
+/*
+ * Adds an operation to the submit list and wakes the ring thread if it is
+ * waiting for completions. Must be called with _cond locked.
+ */
+void SocketServiceUring::queueOper(SockData* sockData, uint32 tag)
+{
+    if (tag == TAG_READ)
+    {
+        if (sockData->readQueued)
+            return;
+
+        sockData->readQueued = true;
+    }
+    else if (tag == TAG_WRITE)
+    {
+        if (sockData->writeQueued)
+            return;
+
+        sockData->writeQueued = true;
+    }
+
+    sockData->queuedCount++;
+    _submitList.addBack((uint64)(uintptr_t)sockData | tag);
+
+    if (_isWaiting && !_wakePending)
+    {
+        _wakePending = true;
+
+        uint64 value = 1;
+        int res;
+
+        do
+        {
+            res = ::write(_wakeupFd, &value, sizeof(value));
+        } while (res == -1 && errno == EINTR);
+    }
+}
+
+/*
+ * Fills in submission entries for a queued operation. Returns false if the
+ * submission ring is full. Must be called by the ring thread with _cond
+ * locked.
+ */
+bool SocketServiceUring::prepOper(uint64 token)
+{
+    SockData* sockData = (SockData*)(uintptr_t)(token & ~(uint64)TAG_MASK);
+    uint32 tag = (uint32)(token & TAG_MASK);
+
+    if (tag == TAG_CANCEL)
+    {
+        // Cancel each outstanding entry, matched by user_data
+        uint64 targets[3];
+        uint32 targetCount = 0;
+
+        if (sockData->readSubmitted)
+            targets[targetCount++] = (uint64)(uintptr_t)sockData | TAG_READ;
+
+        if (sockData->writeSubmitted)
+            targets[targetCount++] = (uint64)(uintptr_t)sockData | TAG_WRITE;
+
+        if (sockData->acceptArmed)
+            targets[targetCount++] = (uint64)(uintptr_t)sockData | TAG_ACCEPT;
+
+        if (_ring.sqSpace() < targetCount)
+            return false;
+
+        for (uint32 i = 0; i < targetCount; i++)
+        {
+            io_uring_sqe* sqe = _ring.getSqe();
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->fd = -1;
+            sqe->addr = targets[i];
+            sqe->user_data = token;
+            sockData->inFlight++;
+        }
+
+        sockData->queuedCount--;
+        return true;
+    }
+
+    if (tag == TAG_CANCEL_ACCEPT)
+    {
+        // The accept may have ended by itself since the cancel was queued
+        if (sockData->acceptArmed)
+        {
+            io_uring_sqe* sqe = _ring.getSqe();
+
+            if (sqe == NULL)
+                return false;
+
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->fd = -1;
+            sqe->addr = (uint64)(uintptr_t)sockData | TAG_ACCEPT;
+            sqe->user_data = token;
+            sockData->inFlight++;
+        }
+
+        sockData->queuedCount--;
+        return true;
+    }
+
+    bool isRead = (tag == TAG_READ);
+
+    if (sockData->isDropped ||
+        (isRead && sockData->readOper == 0) ||
+        (isRead && sockData->readOper != FLAG_ACCEPT && sockData->readSubmitted) ||
+        (!isRead && (sockData->writeOper == 0 || sockData->writeSubmitted)))
+    {
+        // Nothing left to submit
+        if (isRead)
+            sockData->readQueued = false;
+        else
+            sockData->writeQueued = false;
+
+        sockData->queuedCount--;
+        return true;
+    }
+
+    if (isRead &&
+        sockData->readOper == FLAG_ACCEPT &&
+        !sockData->acceptBacklog.isEmpty())
+    {
+        // A multishot accept already has a connection waiting
+        int acceptFd = sockData->acceptBacklog.get(0);
+        sockData->acceptBacklog.remove(0);
+
+        sockData->readQueued = false;
+        sockData->queuedCount--;
+
+        acceptConnection(sockData, acceptFd, 0);
+        return true;
+    }
+
+    if (isRead &&
+        sockData->readOper == FLAG_ACCEPT &&
+        sockData->acceptArmed)
+    {
+        // The armed multishot accept will complete it
+        sockData->readQueued = false;
+        sockData->queuedCount--;
+        return true;
+    }
+
+    io_uring_sqe* sqe = _ring.getSqe();
+
+    if (sqe == NULL)
+        return false;
+
+    sqe->fd = sockData->fd;
+    sqe->user_data = token;
+
+    if (isRead && sockData->readOper == FLAG_ACCEPT)
+    {
+        // Stays armed across completions when multishot is available
+        sqe->opcode = IORING_OP_ACCEPT;
+        sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+        sqe->user_data = (uint64)(uintptr_t)sockData | TAG_ACCEPT;
+
+        if (_multishotAccept)
+            sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+
+        sockData->readQueued = false;
+        sockData->acceptArmed = true;
+        sockData->acceptCancelling = false;
+    }
+    else if (isRead)
+    {
+        if (sockData->readPolling)
+        {
+            sqe->opcode = IORING_OP_POLL_ADD;
+            sqe->poll32_events = POLLIN;
+        }
+        else
+        {
+            sqe->opcode = IORING_OP_RECV;
+            sqe->addr = (uint64)(uintptr_t)sockData->readBuffer;
+            sqe->len = sockData->readBufferLen;
+        }
+
+        sockData->readQueued = false;
+        sockData->readSubmitted = true;
+    }
+    else
+    {
+        if (sockData->writePolling)
+        {
+            sqe->opcode = IORING_OP_POLL_ADD;
+            sqe->poll32_events = POLLOUT;
+        }
+        else if (sockData->writeOper == FLAG_CONNECT)
+        {
+            sqe->opcode = IORING_OP_CONNECT;
+            sqe->addr = (uint64)(uintptr_t)&sockData->connectAddress;
+            sqe->off = sockData->connectAddressLen;
+        }
+        else
+        {
+            prepSend(sockData, sqe);
+        }
+
+        sockData->writeQueued = false;
+        sockData->writeSubmitted = true;
+    }
+
+    sockData->inFlight++;
+    sockData->queuedCount--;
+
+    return true;
+}
+
+/*
+ * Handles one completion entry. Must be called by the ring thread with
+ * _cond locked.
+ */
+void SocketServiceUring::handleCqe(const io_uring_cqe* cqe)
+{
+    if (cqe->user_data == WAKEUP_TOKEN)
+    {
+        _wakeArmed = false;
+        _wakePending = false;
+
+        if (!_isShutdown)
+            armWakeup();
+
+        return;
+    }
+
+    SockData* sockData = (SockData*)(uintptr_t)(cqe->user_data & ~(uint64)TAG_MASK);
+    uint32 tag = (uint32)(cqe->user_data & TAG_MASK);
+
+    bool hasMore = ((cqe->flags & IORING_CQE_F_MORE) != 0);
+
+    if (!hasMore)
+        sockData->inFlight--;
+
+    if (tag == TAG_CANCEL ||
+        tag == TAG_CANCEL_ACCEPT)
+    {
+        return;
+    }
+
+    if (tag == TAG_ACCEPT)
+    {
+        if (!hasMore)
+        {
+            sockData->acceptArmed = false;
+            sockData->acceptCancelling = false;
+        }
+
+        // Accepted connections must not leak once the socket is gone
+        if (sockData->isDropped)
+        {
+            if (cqe->res >= 0)
+                ::close(cqe->res);
+
+            return;
+        }
+
+        completeAccept(sockData, cqe->res);
+    }
+    else if (tag == TAG_READ)
+    {
+        sockData->readSubmitted = false;
+
+        if (sockData->isDropped)
+            return;
+
+        completeRead(sockData, cqe->res);
+    }
+    else
+    {
+        sockData->writeSubmitted = false;
+
+        if (sockData->isDropped)
+            return;
+
+        completeWrite(sockData, cqe->res);
+    }
+}
+
+void SocketServiceUring::completeAccept(SockData* sockData, int32 res)
+{
+    if (res == -EINVAL && _multishotAccept)
+    {
+        // Kernel predates multishot accept
+        _multishotAccept = false;
+    }
+    else if (res >= 0)
+    {
+        if (sockData->readOper == FLAG_ACCEPT &&
+            sockData->acceptBacklog.isEmpty())
+        {
+            acceptConnection(sockData, res, 0);
+        }
+        else
+        {
+            // Connections the kernel completes before the cancel lands are
+            // still kept. Only those already reaped can arrive that late.
+            sockData->acceptBacklog.addBack(res);
+        }
+
+        // Stop accepting until the backlog is taken
+        if (sockData->acceptBacklog.size() >= MAX_ACCEPT_BACKLOG &&
+            sockData->acceptArmed &&
+            !sockData->acceptCancelling)
+        {
+            sockData->acceptCancelling = true;
+            queueOper(sockData, TAG_CANCEL_ACCEPT);
+        }
+    }
+    else if (res != -ECONNABORTED &&
+             res != -ECANCELED &&
+             res != -EINTR &&
+             res != -EAGAIN &&
+             sockData->readOper == FLAG_ACCEPT)
+    {
+        acceptConnection(sockData, -1, res);
+    }
+
+    // Rearm if the accept terminated with an operation still pending
+    if (sockData->readOper == FLAG_ACCEPT &&
+        !sockData->acceptArmed)
+    {
+        queueOper(sockData, TAG_READ);
+    }
+}
+
+void SocketServiceUring::completeRead(SockData* sockData, int32 res)
+{
+    if (sockData->readOper == FLAG_WAIT_READ)
+    {
+        // Hangups and socket errors count as readable, the read that
+        // follows reports them
+        if (res < 0 && res != -EINTR)
+            addCompletion(sockData, true, 0, -res, "poll");
+        else if (res < 0)
+            queueOper(sockData, TAG_READ);
+        else
+            addCompletion(sockData, true, 0, 0, NULL);
+
+        return;
+    }
+
+    if (sockData->readOper != FLAG_READ)
+        return;
+
+    if (sockData->readPolling)
+    {
+        // Readable (or failed), retry the recv
+        sockData->readPolling = false;
+        queueOper(sockData, TAG_READ);
+        return;
+    }
+
+    if (res == -EAGAIN ||
+        res == -EINTR)
+    {
+        // Older kernels don't poll for non-blocking sockets
+        sockData->readPolling = true;
+        queueOper(sockData, TAG_READ);
+        return;
+    }
+
+    if (res < 0)
+    {
+        addCompletion(sockData, true, 0, -res, "recv");
+        return;
+    }
+
+    addCompletion(sockData, true, res, 0, NULL);
+}
+
+void SocketServiceUring::completeWrite(SockData* sockData, int32 res)
+{
+    uint32 oper = sockData->writeOper;
+
+    if (oper == 0)
+        return;
+
+    if (sockData->writePolling)
+    {
+        sockData->writePolling = false;
+
+        if (oper == FLAG_SENDFILE)
+        {
+            int err = 0;
+
+            if (doSendfile(sockData, &err))
+            {
+                if (err != 0)
+                    addCompletion(sockData, false, 0, err, "sendfile");
+                else
+                    addCompletion(sockData, false, sockData->writeBufferPos, 0, NULL);
+            }
+            else
+            {
+                sockData->writePolling = true;
+                queueOper(sockData, TAG_WRITE);
+            }
+
+            return;
+        }
+
+        if (oper == FLAG_CONNECT)
+        {
+            // A connect reported EINPROGRESS, check the result
+            int errVal = 0;
+            socklen_t optLen = sizeof(errVal);
+
+            int optRes = ::getsockopt(sockData->fd,
+                                      SOL_SOCKET,
+                                      SO_ERROR,
+                                      &errVal,
+                                      &optLen);
+
+            if (optRes == -1)
+                errVal = errno;
+
+            addCompletion(sockData, false, 0, errVal, "connect");
+            return;
+        }
+
+        queueOper(sockData, TAG_WRITE);
+        return;
+    }
+
+    if (oper == FLAG_CONNECT)
+    {
+        if (res == -EINPROGRESS ||
+            res == -EALREADY ||
+            res == -EINTR)
+        {
+            sockData->writePolling = true;
+            queueOper(sockData, TAG_WRITE);
+            return;
+        }
+
+        addCompletion(sockData, false, 0, -res, "connect");
+        return;
+    }
+
+    // FLAG_WRITE
+    if (res == -EAGAIN ||
+        res == -EINTR)
+    {
+        sockData->writePolling = true;
+        queueOper(sockData, TAG_WRITE);
+        return;
+    }
+
+    if (res < 0)
+    {
+        addCompletion(sockData, false, 0, -res, "send");
+        return;
+    }
+
+    advanceWrite(sockData, res);
+
+    if (sockData->writeBufferPos < sockData->writeBufferLen)
+    {
+        queueOper(sockData, TAG_WRITE);
+        return;
+    }
+
+    addCompletion(sockData, false, sockData->writeBufferLen, 0, NULL);
+}
+
+/*
+ * Fills in a send of the unsent data of a write. The remainder of a single
+ * buffer is sent with IORING_OP_SEND, otherwise the remaining buffers are
+ * gathered into an IORING_OP_SENDMSG.
+ */
+void SocketServiceUring::prepSend(SockData* sockData, io_uring_sqe* sqe)
+{
+    uint32 index = sockData->writeBufferIndex;
+    uint32 offset = sockData->writeBufferOffset;
+
+    if (index + 1 == sockData->writeBufferCount)
+    {
+        const SocketService::WriteBuffer& buffer = sockData->writeBuffers[index];
+
+        sqe->opcode = IORING_OP_SEND;
+        sqe->addr = (uint64)(uintptr_t)(buffer.data + offset);
+        sqe->len = buffer.dataLen - offset;
+        sqe->msg_flags = MSG_NOSIGNAL;
+        return;
+    }
+
+    uint32 iovCount = 0;
+
+    while (index < sockData->writeBufferCount &&
+           iovCount < MAX_SEND_IOVECS)
+    {
+        const SocketService::WriteBuffer& buffer = sockData->writeBuffers[index];
+
+        if (buffer.dataLen > offset)
+        {
+            sockData->writeIov[iovCount].iov_base = (void*)(buffer.data + offset);
+            sockData->writeIov[iovCount].iov_len = buffer.dataLen - offset;
+            iovCount++;
+        }
+
+        offset = 0;
+        index++;
+    }
+
+    ::memset(&sockData->writeMsg, 0, sizeof(sockData->writeMsg));
+    sockData->writeMsg.msg_iov = sockData->writeIov;
+    sockData->writeMsg.msg_iovlen = iovCount;
+
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->addr = (uint64)(uintptr_t)&sockData->writeMsg;
+    sqe->len = 1;
+    sqe->msg_flags = MSG_NOSIGNAL;
+}
+
+/*
+ * Moves the position of a write past sent bytes.
+ */
+void SocketServiceUring::advanceWrite(SockData* sockData, uint32 sent)
+{
+    sockData->writeBufferPos += sent;
+
+    while (sent != 0)
+    {
+        const SocketService::WriteBuffer& buffer =
+            sockData->writeBuffers[sockData->writeBufferIndex];
+        uint32 remaining = buffer.dataLen - sockData->writeBufferOffset;
+
+        if (sent < remaining)
+        {
+            sockData->writeBufferOffset += sent;
+            break;
+        }
+
+        sent -= remaining;
+        sockData->writeBufferIndex++;
+        sockData->writeBufferOffset = 0;
+    }
+}
+
+/*
+ * Completes a pending accept with the passed connection, or with the error
+ * in res if acceptFd is -1.
+ */
+void SocketServiceUring::acceptConnection(SockData* sockData, int acceptFd, int32 res)
+{
+    if (acceptFd == -1)
+    {
+        addCompletion(sockData, true, 0, -res, "accept4");
+        return;
+    }
+
+    AioSocket* acceptSocket = sockData->acceptSocket;
+    acceptSocket->_sockFd = acceptFd;
+    acceptSocket->_family = sockData->aioSocket->_family;
+
+    sockaddr_storage address;
+    socklen_t addrSize = sizeof(address);
+
+    if (::getpeername(acceptFd, (sockaddr*)&address, &addrSize) == 0)
+    {
+        if (address.ss_family == AF_INET)
+        {
+            sockaddr_in* ipv4Address = (sockaddr_in*)&address;
+            acceptSocket->_remoteAddress = INetAddress::fromBytes(INET_PROT_IPV4,
+                (unsigned char*)&ipv4Address->sin_addr);
+            acceptSocket->_remotePort = ntohs(ipv4Address->sin_port);
+        }
+        else if (address.ss_family == AF_INET6)
+        {
+            sockaddr_in6* ipv6Address = (sockaddr_in6*)&address;
+            acceptSocket->_remoteAddress = INetAddress::fromBytes(INET_PROT_IPV6,
+                (unsigned char*)&ipv6Address->sin6_addr);
+            acceptSocket->_remotePort = ntohs(ipv6Address->sin6_port);
+        }
+    }
+
+    addCompletion(sockData, true, 0, 0, NULL);
+}
+
+/*
+ * Clears the operation on the given side and records its callback to be run
+ * once _cond is released.
+ */
+void SocketServiceUring::addCompletion(SockData* sockData,
+                                       bool isRead,
+                                       uint32 bytesTransfered,
+                                       int err,
+                                       const char* systemCall)
+{
+    Completion completion;
+    completion.aioSocket = sockData->aioSocket;
+    completion.bytesTransfered = bytesTransfered;
+
+    if (isRead)
+    {
+        completion.oper = sockData->readOper;
+        completion.callback = sockData->readCallback;
+        completion.userData = sockData->readUserData;
+        completion.acceptSocket = sockData->acceptSocket;
+
+        sockData->readOper = 0;
+    }
+    else
+    {
+        completion.oper = sockData->writeOper;
+        completion.callback = sockData->writeCallback;
+        completion.userData = sockData->writeUserData;
+        completion.acceptSocket = NULL;
+
+        sockData->writeOper = 0;
+    }
+
+    if (err != 0)
+    {
+        const char* context = "SocketService::socketRead";
+
+        switch (completion.oper)
+        {
+            case FLAG_ACCEPT:
+                context = "SocketService::socketAccept";
+                break;
+            case FLAG_CONNECT:
+                context = "SocketService::socketConnect";
+                break;
+            case FLAG_WAIT_READ:
+                context = "SocketService::socketWaitReadable";
+                break;
+            case FLAG_WRITE:
+                context = "SocketService::socketWrite";
+                break;
+            case FLAG_SENDFILE:
+                context = "SocketService::socketSendFile";
+                break;
+        }
+
+        completion.error = UnixUtil::getError(err,
+                                              systemCall,
+                                              context);
+    }
+
+    _completions.addBack(completion);
+}
+
+/*
+ * Sends as much of the file as the socket will take. Returns true once the
+ * operation is complete, with err set on failure.
+ */
+bool SocketServiceUring::doSendfile(SockData* sockData, int* err)
+{
+    ssize_t res;
+    size_t sendLen;
+
+    while (sockData->sendFileOffset < sockData->sendFileEnd)
+    {
+        off_t offset = (off_t)sockData->sendFileOffset;
+        sendLen = (size_t)(sockData->sendFileEnd - sockData->sendFileOffset);
+
+        if (sendLen > MAX_SENDFILE_LEN)
+            sendLen = MAX_SENDFILE_LEN;
+
+        do
+        {
+            res = ::sendfile(sockData->fd,
+                             sockData->sendFileFd,
+                             &offset,
+                             sendLen);
+        }
+        while (res == -1 && errno == EINTR);
+
+        if (res == -1)
+        {
+            if (errno == EAGAIN ||
+                errno == EWOULDBLOCK)
+            {
+                return false;
+            }
+
+            *err = errno;
+            return true;
+        }
+
+        // Hit the end of the file early
+        if (res == 0)
+        {
+            *err = EIO;
+            return true;
+        }
+
+        sockData->sendFileOffset += res;
+        sockData->writeBufferPos += res;
+    }
+
+    return true;
+}
+
+/*
+ * Frees dropped socket data once the kernel and the submit list no longer
+ * reference it. Must be called by the ring thread with _cond locked.
+ */
+void SocketServiceUring::freeDropped()
+{
+    size_t i = 0;
+
+    while (i < _droppedList.size())
+    {
+        SockData* sockData = _droppedList.get(i);
+
+        if (sockData->inFlight != 0 ||
+            sockData->queuedCount != 0)
+        {
+            i++;
+            continue;
+        }
+
+        delete sockData;
+
+        // Swap remove
+        _droppedList.set(i, _droppedList.back());
+        _droppedList.popBack();
+    }
+}
+
+/*
+ * Queues a read on the wakeup eventfd. Other threads write to it to
+ * interrupt the ring thread when it is waiting for completions.
+ */
+void SocketServiceUring::armWakeup()
+{
+    io_uring_sqe* sqe = _ring.getSqe();
+
+    // Retried by process() if the ring is full
+    if (sqe == NULL)
+        return;
+
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = _wakeupFd;
+    sqe->addr = (uint64)(uintptr_t)&_wakeupValue;
+    sqe->len = sizeof(_wakeupValue);
+    sqe->user_data = WAKEUP_TOKEN;
+
+    _wakeArmed = true;
+}
+
+bool SocketServiceUring::process()
+{
+    Locker<Condition> locker(_cond);
+
+    if (_isShutdown)
+        return false;
+
+    // Turn everything queued since the last iteration into submission
+    // entries
+    size_t submitCount = _submitList.size();
+    size_t prepared = 0;
+
+    while (prepared < submitCount &&
+           prepOper(_submitList.get(prepared)))
+    {
+        prepared++;
+    }
+
+    // prepOper() may queue more, so only remove what was consumed
+    size_t remaining = _submitList.size() - prepared;
+
+    for (size_t i = 0; i < remaining; i++)
+        _submitList.set(i, _submitList.get(prepared + i));
+
+    _submitList.resize(remaining);
+
+    freeDropped();
+
+    if (!_wakeArmed)
+        armWakeup();
+
+    // Submit while locked so a socket can't be dropped and its fd reused
+    // between preparing an entry and the kernel resolving the fd.
+    int res;
+
+    if (_ring.unsubmitted() != 0)
+    {
+        do
+        {
+            res = _ring.submit(0);
+        } while (res == -1 && errno == EINTR);
+
+        if (res == -1 && errno != EBUSY && errno != EAGAIN)
+        {
+            // TODO: Log
+            return false;
+        }
+    }
+
+    // Completions produced while preparing (accept backlog) don't need
+    // a wait
+    bool shouldWait = (_completions.isEmpty() &&
+                       _ring.peekCqe() == NULL &&
+                       _submitList.isEmpty() &&
+                       _wakeArmed);
+
+    if (shouldWait)
+    {
+        _isWaiting = true;
+        locker.unlock();
+
+        do
+        {
+            res = _ring.submit(1);
+        } while (res == -1 && errno == EINTR);
+
+        locker.lock();
+        _isWaiting = false;
+
+        if (_isShutdown)
+            return false;
+    }
+
+    // Reap everything available
+    io_uring_cqe* cqe;
+
+    while ((cqe = _ring.peekCqe()) != NULL)
+    {
+        handleCqe(cqe);
+        _ring.cqeSeen();
+    }
+
+    if (_completions.isEmpty())
+        return true;
+
+    // Only the ring thread adds completions, so the list is stable while
+    // unlocked
+    locker.unlock();
+
+    size_t completionCount = _completions.size();
+
+    if (_inlineCompletion)
+    {
+        for (size_t i = 0; i < completionCount; i++)
+            runCompletion(_completions.get(i));
+
+        _completions.resize(0);
+        return true;
+    }
+
+    Locker<Condition> workLocker(_workCond);
+
+    for (size_t i = 0; i < completionCount; i++)
+        _workList.addBack(_completions.get(i));
+
+    if (completionCount == 1)
+        _workCond.signal();
+    else
+        _workCond.signalAll();
+
+    workLocker.unlock();
+
+    _completions.resize(0);
+
+    return true;
+}
+
+void SocketServiceUring::runCompletion(const Completion& completion)
+{
+    switch (completion.oper)
+    {
+        case FLAG_ACCEPT:
+            ((SocketService::acceptCallback)completion.callback)(completion.aioSocket,
+                                                                 completion.acceptSocket,
+                                                                 completion.userData,
+                                                                 completion.error);
+            break;
+        case FLAG_CONNECT:
+            ((SocketService::connectCallback)completion.callback)(completion.aioSocket,
+                                                                  completion.userData,
+                                                                  completion.error);
+            break;
+        case FLAG_READ:
+        case FLAG_WAIT_READ:
+        case FLAG_WRITE:
+        case FLAG_SENDFILE:
+            ((SocketService::socketCallback)completion.callback)(completion.aioSocket,
+                                                                 completion.userData,
+                                                                 completion.bytesTransfered,
+                                                                 completion.error);
+            break;
+    }
+}
+
+/*
+ * Runs the callback of one completion handed over by the ring thread.
+ * Called by the workers.
+ */
+bool SocketServiceUring::work()
+{
+    Locker<Condition> workLocker(_workCond);
+
+    while (!_isWorkShutdown &&
+           _workHead == _workList.size())
+    {
+        _workCond.wait();
+    }
+
+    if (_isWorkShutdown)
+        return false;
+
+    Completion completion = _workList.get(_workHead);
+    _workHead++;
+
+    // Reuse the list once every entry is taken
+    if (_workHead == _workList.size())
+    {
+        _workList.resize(0);
+        _workHead = 0;
+    }
+
+    workLocker.unlock();
+
+    runCompletion(completion);
+    return true;
+}
+
+// Inner Classes ------------------------------------------------------------
+
+SocketServiceUring::AioWorker::AioWorker(SocketServiceUring* socketService) :
+    _socketService(socketService)
+{
+}
+
+void SocketServiceUring::AioWorker::run()
+{
+    CurrentThread::setName("SocketService Worker");
+
+    if (_socketService->_processor != -1)
+        CurrentThread::setProcessor((uint32)_socketService->_processor);
+
+    bool keepGoing = true;
+
+    while (keepGoing)
+    {
+        keepGoing = _socketService->work();
+    }
+}
+
+SocketServiceUring::RingWorker::RingWorker(SocketServiceUring* socketService) :
+    _socketService(socketService)
+{
+}
+
+void SocketServiceUring::RingWorker::run()
+{
+    CurrentThread::setName("SocketService Ring Worker");
+
+    if (_socketService->_processor != -1)
+        CurrentThread::setProcessor((uint32)_socketService->_processor);
+
+    bool keepGoing = true;
+
+    while (keepGoing)
+    {
+        keepGoing = _socketService->process();
+    }
+}
+
+SocketServiceUring::SockData::SockData() :
+    aioSocket(NULL),
+    fd(-1),
+    inFlight(0),
+    queuedCount(0),
+    isDropped(false),
+    readOper(0),
+    readQueued(false),
+    readSubmitted(false),
+    readPolling(false),
+    acceptSocket(NULL),
+    readCallback(NULL),
+    readUserData(NULL),
+    readBuffer(NULL),
+    readBufferLen(0),
+    acceptArmed(false),
+    acceptCancelling(false),
+    writeOper(0),
+    writeQueued(false),
+    writeSubmitted(false),
+    writePolling(false),
+    writeCallback(NULL),
+    writeUserData(NULL),
+    writeBuffers(NULL),
+    writeBufferCount(0),
+    writeBufferIndex(0),
+    writeBufferOffset(0),
+    writeBufferPos(0),
+    writeBufferLen(0),
+    connectAddressLen(0),
+    sendFileFd(-1),
+    sendFileOffset(0),
+    sendFileEnd(0)
+{
+}
+
+#endif // __linux__
@@ -124,3 +124,58 @@ void AioFile::close()
 
     _handle = INVALID_HANDLE_VALUE;
 }
+
+uint64 AioFile::getFileLength()
+{
+    LARGE_INTEGER fileSize;
+
+    BOOL bret = ::GetFileSizeEx(_handle, &fileSize);
+
+    if (!bret)
+    {
+        Error error =  WinUtil::getError(::GetLastError(),
+                "GetFileSizeEx",
+                "AioFile::getFileLength");
+        throw IOException(error);
+    }
+
+    return fileSize.QuadPart;
+}
+
+Date AioFile::getLastModified()
+{
+    FILETIME writeTime;
+
+    BOOL bret = ::GetFileTime(_handle, NULL, NULL, &writeTime);
+
+    if (!bret)
+    {
+        Error error =  WinUtil::getError(::GetLastError(),
+                "GetFileTime",
+                "AioFile::getLastModified");
+        throw IOException(error);
+    }
+
+    // FILETIME counts 100ns intervals since 1601
+    uint64 fileTime = ((uint64)writeTime.dwHighDateTime << 32) |
+                      writeTime.dwLowDateTime;
+
+    return Date((time_t)((fileTime / 10000000) - 11644473600ULL));
+}
+
+bool AioFile::isDirectory()
+{
+    BY_HANDLE_FILE_INFORMATION fileInfo;
+
+    BOOL bret = ::GetFileInformationByHandle(_handle, &fileInfo);
+
+    if (!bret)
+    {
+        Error error =  WinUtil::getError(::GetLastError(),
+                "GetFileInformationByHandle",
+                "AioFile::isDirectory");
+        throw IOException(error);
+    }
+
+    return (fileInfo.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+}
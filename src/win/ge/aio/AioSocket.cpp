@@ -104,6 +104,24 @@ void AioSocket::close()
     _flags = 0;
 }
 
+/*
+ * Shuts down both directions of the connection without closing the socket.
+ * Pending operations complete (reads with 0 bytes) instead of being
+ * abandoned, so their callbacks still run.
+ */
+void AioSocket::shutdown()
+{
+    if (_winSocket == INVALID_SOCKET)
+        return;
+
+    int shutdownRet = ::shutdown(_winSocket, SD_BOTH);
+
+    if (shutdownRet != 0)
+    {
+        // TODO: Log
+    }
+}
+
 void AioSocket::listen()
 {
     listen(SOMAXCONN);
@@ -196,3 +214,10 @@ void AioSocket::bind(const INetAddress& address, int port)
 
     _flags |= BIND_FLAG;
 }
+
+void AioSocket::setReusePort()
+{
+    // Windows has no option to balance connections between sockets. Its
+    // SO_REUSEADDR lets a second socket take over the port instead.
+    throw IOException("Port sharing not supported");
+}
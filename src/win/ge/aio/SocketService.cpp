@@ -98,6 +98,10 @@ struct OVERLAPPED_EX
     void*             callback;
     void*             userData;
 
+    // Gathered send only fields
+    WSABUF*           wsaBufs;
+    uint32            wsaBufCount;
+
     // Accept only fields
     AioSocket*        acceptedSocket;
     char              addressBuffer[ACCEPTEX_ADDRESS_SIZE * 2];
@@ -105,6 +109,11 @@ struct OVERLAPPED_EX
     // Connect only fields
     INetAddress       address;
     uint32            port;
+
+    ~OVERLAPPED_EX()
+    {
+        delete[] wsaBufs;
+    }
 };
 
 /*
@@ -231,7 +240,8 @@ Error handleConnectSuccess(OVERLAPPED_EX* overlappedEx,
 SocketService::SocketService() :
     _completionPort(NULL),
     _state(STATE_NONE),
-    _pending(0)
+    _pending(0),
+    _processor(-1)
 {
 }
 
@@ -275,6 +285,29 @@ void SocketService::startServing(uint32 desiredThreads)
     }
 }
 
+void SocketService::startServing(uint32 desiredThreads,
+                                 uint32 processor)
+{
+    // Read by the threads once they start
+    _processor = (int32)processor;
+
+    startServing(desiredThreads);
+}
+
+void SocketService::setReactorCount(uint32 reactorCount)
+{
+    // The completion port already hands the events of every socket to all
+    // the workers
+    if (reactorCount == 0)
+        throw SystemException("SocketService needs at least one reactor");
+}
+
+void SocketService::setInlineCompletion(bool inlineCompletion)
+{
+    // Completions are already performed by the threads that take them
+    // from the completion port, without another hand off
+}
+
 void SocketService::shutdown()
 {
     LONG oldState = ::InterlockedExchange(&_state, STATE_SHUTDOWN);
@@ -618,6 +651,14 @@ void SocketService::socketRead(AioSocket* aioSocket,
     }
 }
 
+void SocketService::socketWaitReadable(AioSocket* aioSocket,
+                                       socketCallback callback,
+                                       void* userData)
+{
+    // A zero byte WSARecv completes once data arrives, without taking any
+    socketRead(aioSocket, callback, userData, NULL, 0);
+}
+
 void SocketService::socketWrite(AioSocket* aioSocket,
                                 socketCallback callback,
                                 void* userData,
@@ -683,6 +724,79 @@ void SocketService::socketWrite(AioSocket* aioSocket,
     }
 }
 
+void SocketService::socketWriteV(AioSocket* aioSocket,
+                                 socketCallback callback,
+                                 void* userData,
+                                 const WriteBuffer* buffers,
+                                 uint32 bufferCount)
+{
+    int err = 0;
+
+    if (aioSocket->_winSocket == INVALID_SOCKET)
+    {
+        throw IOException("Cannot write to an unconnected socket");
+    }
+
+    if (_state != STATE_STARTED)
+    {
+        throw IOException("AioServer not running");
+    }
+
+    // Associate the socket and file with this server if have not
+    // already done so
+    if (aioSocket->_owner == NULL)
+    {
+        Error err = addSocket(aioSocket, "socketWriteV");
+
+        if (err.isSet())
+            throw IOException(err);
+    }
+    else if (aioSocket->_owner != this)
+    {
+        throw IOException("Called SocketService::socketWriteV call with "
+            "AioSocket owned by another AioServer");
+    }
+
+    // Create an OVERLAPPED_EX with data for WSASend
+    OVERLAPPED_EX* overlappedEx = new OVERLAPPED_EX();
+
+    overlappedEx->overlapped.hEvent = ::CreateEventW(NULL, FALSE, FALSE, NULL);
+    overlappedEx->opCode = OP_SEND;
+    overlappedEx->callback = callback;
+    overlappedEx->aioSocket = aioSocket;
+    overlappedEx->userData = userData;
+
+    // Copied, so the caller's array need not outlive the call
+    overlappedEx->wsaBufs = new WSABUF[bufferCount];
+    overlappedEx->wsaBufCount = bufferCount;
+
+    for (uint32 i = 0; i < bufferCount; i++)
+    {
+        overlappedEx->wsaBufs[i].buf = (char*)buffers[i].data;
+        overlappedEx->wsaBufs[i].len = buffers[i].dataLen;
+    }
+
+    ::InterlockedIncrement(&_pending);
+
+    // Add to the completion queue
+    BOOL res = ::PostQueuedCompletionStatus(_completionPort,
+        0,
+        COMPLETION_KEY_SERVER,
+        &overlappedEx->overlapped);
+
+    if (!res)
+    {
+        delete overlappedEx;
+        ::InterlockedDecrement(&_pending);
+
+        Error err = WinUtil::getError(::WSAGetLastError(),
+            "PostQueuedCompletionStatus",
+            "SocketService::socketWriteV");
+
+        throw IOException(err);
+    }
+}
+
 void SocketService::socketSendFile(AioSocket* aioSocket,
                                    socketCallback callback,
                                    void* userData,
@@ -1105,8 +1219,10 @@ bool SocketService::process()
                 wsabuf.len = overlappedEx->bufferSize;
 
                 iRet = ::WSASend(overlappedEx->aioSocket->_winSocket, // Socket handle
-                                 &wsabuf, // Buffers
-                                 1, // Buffer count
+                                 overlappedEx->wsaBufs != NULL ?
+                                     overlappedEx->wsaBufs : &wsabuf, // Buffers
+                                 overlappedEx->wsaBufs != NULL ?
+                                     overlappedEx->wsaBufCount : 1, // Buffer count
                                  &bytesTransfered, // Bytes sent
                                  0, // Flags
                                  &overlappedEx->overlapped, // Pointer to OVERLAPPED
@@ -1266,6 +1382,9 @@ void SocketService::AioWorker::run()
 {
     CurrentThread::setName("SocketService Worker");
 
+    if (_socketService->_processor != -1)
+        CurrentThread::setProcessor((uint32)_socketService->_processor);
+
     bool keepGoing = true;
 
     while (keepGoing)
@@ -48,4 +48,12 @@ void setName(const StringRef name)
    }
 }
 
+void setProcessor(uint32 processor)
+{
+    if (processor >= sizeof(DWORD_PTR) * 8)
+        return;
+
+    ::SetThreadAffinityMask(::GetCurrentThread(), (DWORD_PTR)1 << processor);
+}
+
 } // End namespace CurrentThread
\ No newline at end of file
@@ -22,6 +22,7 @@ bool x86info_hasSSE4_1;
 bool x86info_hasSSE4_2;
 bool x86info_hasSSE4a;
 bool x86info_hasAVX;
+bool x86info_hasAVX2;
 bool x86info_hasAES;
 
 
@@ -77,6 +78,19 @@ void initializeX86Info()
     }
 #endif
 
+    // AVX2 is reported in the structured extended feature flags. It needs
+    // the same OS support for YMM registers as AVX.
+    x86info_hasAVX2 = false;
+
+#if (_MSC_VER >= 1700)
+    if (x86info_hasAVX && nIds >= 7)
+    {
+        int extInfo[4] = {-1};
+        ::__cpuidex(extInfo, 7, 0);
+        x86info_hasAVX2 = (extInfo[1] & (1 << 5)) || false;
+    }
+#endif
+
     nFeatureInfo = cpuInfo[3];
 
     // Running the CPUID instruction with 0x80000000 in EAX gets the highest
@@ -0,0 +1,32 @@
+// Test.cpp
+
+#include "Test.h"
+
+#include <ge/io/Console.h>
+#include <ge/text/String.h>
+
+static uint32 failureCount = 0;
+
+void Test::check(bool        passed,
+                 const char* expr,
+                 const char* file,
+                 int32       line)
+{
+    if (passed)
+        return;
+
+    failureCount++;
+
+    String msg(file);
+    msg.appendChar(':');
+    msg.appendInt32(line);
+    msg.append(": check failed: ");
+    msg.append(expr);
+
+    Console::errln(msg);
+}
+
+uint32 Test::getFailureCount()
+{
+    return failureCount;
+}
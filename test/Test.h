@@ -0,0 +1,44 @@
+// Test.h
+
+#ifndef TEST_H
+#define TEST_H
+
+#include <ge/common.h>
+
+/*
+ * Checks used by the library's tests. A failed check is reported on the
+ * console and counted, and the test carries on with its next check.
+ */
+namespace Test
+{
+    /*! \brief Records the result of a check. Use TEST_CHECK() instead.
+     *
+     * \param passed   Result of the check
+     * \param expr     Text of the checked expression
+     * \param file     Source file of the check
+     * \param line     Source line of the check
+     */
+    void check(bool        passed,
+               const char* expr,
+               const char* file,
+               int32       line);
+
+    /*! \brief Gives the number of checks failed so far.
+     *
+     * \return Number of failed checks
+     */
+    uint32 getFailureCount();
+
+    void testString();
+    void testStringRef();
+    void testShortList();
+    void testUInt();
+    void testHttpUtil();
+    void testHttpScan();
+    void testHttpRouter();
+    void testHttpForm();
+};
+
+#define TEST_CHECK(expr) Test::check((expr), #expr, __FILE__, __LINE__)
+
+#endif // TEST_H
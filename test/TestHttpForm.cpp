@@ -0,0 +1,89 @@
+// TestHttpForm.cpp
+
+#include "Test.h"
+
+#include <ge/http/HttpForm.h>
+#include <ge/http/HttpUtil.h>
+#include <ge/text/String.h>
+
+#include <cstring>
+
+void Test::testHttpForm()
+{
+    HttpForm form;
+
+    // Fields without escapes refer to the parsed text
+    StringRef plain("a=1&b=two&flag&&c=x=y&=empty");
+
+    TEST_CHECK(form.parse(plain));
+    TEST_CHECK(form.size() == 5);
+    TEST_CHECK(form.get("a") == "1");
+    TEST_CHECK(form.get("b") == "two");
+    TEST_CHECK(form.has("flag") && form.get("flag") == "");
+    TEST_CHECK(form.get("c") == "x=y");
+    TEST_CHECK(form.getName(4) == "" && form.getValue(4) == "empty");
+    TEST_CHECK(!form.has("d") && form.get("d") == "");
+    TEST_CHECK(form.getValue(1).data() == plain.data() + 6);
+
+    TEST_CHECK(form.parse(""));
+    TEST_CHECK(form.size() == 0);
+
+    // '+' is a space, and escapes are unescaped after the text is split
+    TEST_CHECK(form.parse("q=x+y&amp=%26&eq%3D=%3d&pct=100%25&hex=%4a%4B"));
+    TEST_CHECK(form.size() == 5);
+    TEST_CHECK(form.get("q") == "x y");
+    TEST_CHECK(form.get("amp") == "&");
+    TEST_CHECK(form.get("eq=") == "=");
+    TEST_CHECK(form.get("pct") == "100%");
+    TEST_CHECK(form.get("hex") == "JK");
+
+    TEST_CHECK(form.parse("euro=%E2%82%AC&nul=a%00b"));
+    TEST_CHECK(form.get("euro") == "\xe2\x82\xac");
+    TEST_CHECK(form.get("nul") == StringRef("a\0b", 3));
+
+    // Long fields mixing plain and escaped text, so the vectorized scan
+    // finds escapes past the first field and block
+    TEST_CHECK(form.parse("first=abcdefghijklmnopqrstuvwxyz0123456789"
+                          "&second=abcdefghijklmnopqrstuvwxyz+0123456789"
+                          "&third=abcdefghijklmnopqrstuvwxyz0123456789"
+                          "&fourth=%61bcdefghijklmnopqrstuvwxyz0123456789%21"));
+    TEST_CHECK(form.size() == 4);
+    TEST_CHECK(form.get("first") == "abcdefghijklmnopqrstuvwxyz0123456789");
+    TEST_CHECK(form.get("second") == "abcdefghijklmnopqrstuvwxyz 0123456789");
+    TEST_CHECK(form.get("third") == "abcdefghijklmnopqrstuvwxyz0123456789");
+    TEST_CHECK(form.get("fourth") == "abcdefghijklmnopqrstuvwxyz0123456789!");
+
+    // Invalid escapes fail the parse and leave no fields
+    TEST_CHECK(!form.parse("a=%"));
+    TEST_CHECK(form.size() == 0);
+    TEST_CHECK(!form.parse("a=%4"));
+    TEST_CHECK(!form.parse("a=%4&b=1"));
+    TEST_CHECK(!form.parse("a=1&b=%zz"));
+    TEST_CHECK(!form.parse("a=%g1"));
+    TEST_CHECK(!form.parse("%=1"));
+
+    char inPlace[] = "name=J%C3%B6rg+M&id=7";
+    TEST_CHECK(form.parseInPlace(inPlace, ::strlen(inPlace)));
+    TEST_CHECK(form.size() == 2);
+    TEST_CHECK(form.get("name") == "J\xc3\xb6rg M");
+    TEST_CHECK(form.get("id") == "7");
+    TEST_CHECK(form.getValue(0).data() == inPlace + 5);
+
+    char text[] = "a+b%20c%7e";
+    size_t len = ::strlen(text);
+    TEST_CHECK(HttpUtil::unescapeUrlInPlace(text, &len));
+    TEST_CHECK(StringRef(text, len) == "a b c~");
+
+    String unescaped;
+    TEST_CHECK(HttpUtil::unescapeUrl("%48%69+there", unescaped));
+    TEST_CHECK(unescaped == "Hi there");
+    TEST_CHECK(!HttpUtil::unescapeUrl("bad%2", unescaped));
+
+    // Escaping round trips
+    String escaped = HttpUtil::escapeUrl("a b&c=d/\xe2\x82\xac");
+    TEST_CHECK(escaped == "a+b%26c%3Dd%2F%E2%82%AC");
+
+    String roundTrip;
+    TEST_CHECK(HttpUtil::unescapeUrl(escaped, roundTrip));
+    TEST_CHECK(roundTrip == "a b&c=d/\xe2\x82\xac");
+}
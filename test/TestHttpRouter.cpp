@@ -0,0 +1,126 @@
+// TestHttpRouter.cpp
+
+#include "Test.h"
+
+#include <ge/SystemException.h>
+#include <ge/http/HttpRouter.h>
+
+// Handlers only told apart by their address
+static void rootHandler(HttpServer&, HttpSession&) {}
+static void usersHandler(HttpServer&, HttpSession&) {}
+static void userHandler(HttpServer&, HttpSession&) {}
+static void meHandler(HttpServer&, HttpSession&) {}
+static void postHandler(HttpServer&, HttpSession&) {}
+static void filesHandler(HttpServer&, HttpSession&) {}
+static void staticHandler(HttpServer&, HttpSession&) {}
+static void userFileHandler(HttpServer&, HttpSession&) {}
+
+/*
+ * Returns if the passed path is routed to the passed handler.
+ */
+static
+bool routesTo(const HttpRouter& router,
+              const StringRef& path,
+              HttpRouter::httpHandler_func handler,
+              StringRef* paramValues)
+{
+    const HttpRouter::Route* route = router.findRoute(path, paramValues);
+
+    return route != NULL && route->handler == handler;
+}
+
+/*
+ * Returns if adding the passed pattern is refused.
+ */
+static
+bool addFails(HttpRouter& router,
+              const StringRef& pattern)
+{
+    try
+    {
+        router.addRoute(pattern, rootHandler, HTTP_DISPATCH_POOL);
+    }
+    catch (const SystemException&)
+    {
+        return true;
+    }
+
+    return false;
+}
+
+void Test::testHttpRouter()
+{
+    HttpRouter router;
+
+    router.addRoute("/", rootHandler, HTTP_DISPATCH_POOL);
+    router.addRoute("/users", usersHandler, HTTP_DISPATCH_INLINE);
+    router.addRoute("/users/:id", userHandler, HTTP_DISPATCH_POOL);
+    router.addRoute("/users/me", meHandler, HTTP_DISPATCH_POOL);
+    router.addRoute("/users/:user/posts/:post", postHandler, HTTP_DISPATCH_POOL);
+    router.addRoute("/users/:user/*file", userFileHandler, HTTP_DISPATCH_POOL);
+    router.addRoute("/files/*path", filesHandler, HTTP_DISPATCH_POOL);
+    router.addRoute("/files/static/logo.png", staticHandler, HTTP_DISPATCH_POOL);
+
+    StringRef params[HTTP_MAX_ROUTE_PARAMS];
+
+    TEST_CHECK(routesTo(router, "/", rootHandler, params));
+    TEST_CHECK(routesTo(router, "/users", usersHandler, params));
+    TEST_CHECK(router.findRoute("/users", params)->dispatch ==
+               HTTP_DISPATCH_INLINE);
+
+    // Parameters capture a single segment
+    TEST_CHECK(routesTo(router, "/users/42", userHandler, params));
+    TEST_CHECK(params[0] == "42");
+
+    const HttpRouter::Route* route = router.findRoute("/users/ann/posts/7",
+                                                      params);
+    TEST_CHECK(route != NULL && route->handler == postHandler);
+    TEST_CHECK(params[0] == "ann" && params[1] == "7");
+    TEST_CHECK(route != NULL &&
+               route->paramNames.size() == 2 &&
+               route->paramNames.get(0) == "user" &&
+               route->paramNames.get(1) == "post");
+
+    // Static text is preferred over a parameter
+    TEST_CHECK(routesTo(router, "/users/me", meHandler, params));
+
+    // Backing off from static text to a parameter
+    TEST_CHECK(routesTo(router, "/users/me/posts/1", postHandler, params));
+    TEST_CHECK(params[0] == "me" && params[1] == "1");
+    TEST_CHECK(routesTo(router, "/users/mew", userHandler, params));
+    TEST_CHECK(params[0] == "mew");
+
+    // And from a parameter to a wildcard
+    TEST_CHECK(routesTo(router, "/users/ann/posts", userFileHandler, params));
+    TEST_CHECK(params[0] == "ann" && params[1] == "posts");
+    TEST_CHECK(routesTo(router, "/users/ann/a/b", userFileHandler, params));
+    TEST_CHECK(params[0] == "ann" && params[1] == "a/b");
+
+    // Wildcards take the rest of the path
+    TEST_CHECK(routesTo(router, "/files/static/logo.png", staticHandler, params));
+    TEST_CHECK(routesTo(router, "/files/static/logo.gif", filesHandler, params));
+    TEST_CHECK(params[0] == "static/logo.gif");
+    TEST_CHECK(routesTo(router, "/files/", filesHandler, params));
+    TEST_CHECK(params[0] == "");
+
+    // Paths matching no pattern
+    TEST_CHECK(router.findRoute("", params) == NULL);
+    TEST_CHECK(router.findRoute("/user", params) == NULL);
+    TEST_CHECK(router.findRoute("/users/", params) == NULL);
+    TEST_CHECK(router.findRoute("/users//posts/1", params) == NULL);
+    TEST_CHECK(router.findRoute("/files", params) == NULL);
+    TEST_CHECK(router.findRoute("/other", params) == NULL);
+
+    TEST_CHECK(addFails(router, ""));
+    TEST_CHECK(addFails(router, "users"));
+    TEST_CHECK(addFails(router, "/users"));
+    TEST_CHECK(addFails(router, "/users/:name"));
+    TEST_CHECK(addFails(router, "/files/*other"));
+    TEST_CHECK(addFails(router, "/a/:"));
+    TEST_CHECK(addFails(router, "/a/*rest/b"));
+    TEST_CHECK(addFails(router, "/:a/:b/:c/:d/:e/:f/:g/:h/:i"));
+
+    // A failed add leaves the routes as they were
+    TEST_CHECK(routesTo(router, "/users/42", userHandler, params));
+    TEST_CHECK(router.findRoute("/a/1", params) == NULL);
+}
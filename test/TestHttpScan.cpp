@@ -0,0 +1,190 @@
+// TestHttpScan.cpp
+
+#include "Test.h"
+
+#include <ge/http/HttpScan.h>
+
+#if defined(CHIPSET_X86)
+
+#include <gepriv/X86Info.h>
+
+#if defined(SUPPORTS_SSE2)
+const char* scanLine_partial_sse2(const char* iter,
+                                  const char* end,
+                                  const char** colon);
+const char* scanEscape_partial_sse2(const char* iter,
+                                    const char* end);
+#endif
+
+#if defined(SUPPORTS_AVX2)
+const char* scanLine_partial_avx2(const char* iter,
+                                  const char* end,
+                                  const char** colon);
+const char* scanEscape_partial_avx2(const char* iter,
+                                    const char* end);
+#endif
+
+#endif // CHIPSET_X86
+
+// Function scanning part of a line, as the vectorized versions do
+typedef const char* (*scanLinePartial_func)(const char* iter,
+                                            const char* end,
+                                            const char** colon);
+
+// Function scanning part of URL encoded text
+typedef const char* (*scanEscapePartial_func)(const char* iter,
+                                              const char* end);
+
+// Bytes the test data is made of, weighted towards plain text
+static const char scanChars[] = "abcdefgh:%+\r\t\n\x01\x1f\x7f\x80\xff ";
+
+static uint32 randState = 1;
+
+static
+uint32 nextRand()
+{
+    randState = randState * 1103515245 + 12345;
+    return randState >> 16;
+}
+
+/*
+ * Scans a line a byte at a time, without HttpScan::isLineStop(), to give
+ * the results the other versions should match.
+ */
+static
+const char* referenceScanLine(const char* iter,
+                              const char* end,
+                              const char** colon)
+{
+    for (; iter < end; iter++)
+    {
+        uint8 c = (uint8)(*iter);
+
+        if ((c < 0x20 && c != '\r' && c != '\t') || c >= 0x80)
+            break;
+
+        if (c == ':' && (*colon) == NULL)
+            (*colon) = iter;
+    }
+
+    return iter;
+}
+
+static
+const char* referenceScanEscape(const char* iter,
+                                const char* end)
+{
+    while (iter < end && (*iter) != '%' && (*iter) != '+')
+        iter++;
+
+    return iter;
+}
+
+/*
+ * Compares each version of the scans with the reference on the passed
+ * data. The vectorized versions leave the tail shorter than a block to the
+ * scalar loop, which the reference also stands in for here.
+ */
+static
+void checkScans(const char* str,
+                const char* end)
+{
+    scanLinePartial_func linePartials[2];
+    scanEscapePartial_func escapePartials[2];
+    ptrdiff_t blockSizes[2];
+    uint32 partialCount = 0;
+
+#if defined(SUPPORTS_SSE2)
+    if (X86Info::hasSSE2())
+    {
+        linePartials[partialCount] = scanLine_partial_sse2;
+        escapePartials[partialCount] = scanEscape_partial_sse2;
+        blockSizes[partialCount] = 16;
+        partialCount++;
+    }
+#endif
+#if defined(SUPPORTS_AVX2)
+    if (X86Info::hasAVX2())
+    {
+        linePartials[partialCount] = scanLine_partial_avx2;
+        escapePartials[partialCount] = scanEscape_partial_avx2;
+        blockSizes[partialCount] = 32;
+        partialCount++;
+    }
+#endif
+
+    const char* expectColon = NULL;
+    const char* expectStop = referenceScanLine(str, end, &expectColon);
+    const char* expectEscape = referenceScanEscape(str, end);
+
+    const char* colon;
+    TEST_CHECK(HttpScan::scanLine(str, end, &colon) == expectStop);
+    TEST_CHECK(colon == expectColon);
+    TEST_CHECK(HttpScan::scanEscape(str, end) == expectEscape);
+
+    for (uint32 i = 0; i < partialCount; i++)
+    {
+        colon = NULL;
+        const char* iter = linePartials[i](str, end, &colon);
+
+        // A version stops at the end of the line, or short of it only
+        // where less than a block is left
+        TEST_CHECK(iter == expectStop ||
+                   (iter >= str && iter < expectStop &&
+                    end - iter < blockSizes[i]));
+        TEST_CHECK(colon == NULL || colon < iter);
+        TEST_CHECK(referenceScanLine(iter, end, &colon) == expectStop);
+        TEST_CHECK(colon == expectColon);
+
+        iter = escapePartials[i](str, end);
+
+        TEST_CHECK(iter == expectEscape ||
+                   (iter >= str && iter < expectEscape &&
+                    end - iter < blockSizes[i]));
+        TEST_CHECK(referenceScanEscape(iter, end) == expectEscape);
+    }
+}
+
+void Test::testHttpScan()
+{
+    char buffer[160];
+
+    // Each byte at each position, in plain text of every length
+    for (size_t len = 0; len <= 80; len++)
+    {
+        for (size_t i = 0; i < len; i++)
+            buffer[i] = 'x';
+
+        checkScans(buffer, buffer + len);
+
+        for (size_t pos = 0; pos < len; pos++)
+        {
+            for (size_t c = 0; c < sizeof(scanChars) - 1; c++)
+            {
+                buffer[pos] = scanChars[c];
+                checkScans(buffer, buffer + len);
+            }
+
+            buffer[pos] = 'x';
+        }
+    }
+
+    // Random text at every alignment
+    for (uint32 trial = 0; trial < 20000; trial++)
+    {
+        size_t offset = nextRand() % 32;
+        size_t len = nextRand() % (sizeof(buffer) - offset);
+        uint32 plainOdds = nextRand() % 64 + 1;
+
+        for (size_t i = 0; i < len; i++)
+        {
+            if (nextRand() % plainOdds != 0)
+                buffer[offset + i] = 'a' + (char)(nextRand() % 26);
+            else
+                buffer[offset + i] = scanChars[nextRand() %
+                                               (sizeof(scanChars) - 1)];
+        }
+
+        checkScans(buffer + offset, buffer + offset + len);
+    }
+}
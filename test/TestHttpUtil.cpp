@@ -0,0 +1,94 @@
+// TestHttpUtil.cpp
+
+#include "Test.h"
+
+#include <ge/http/HttpUtil.h>
+
+void Test::testHttpUtil()
+{
+    uint32 chunkLen;
+
+    TEST_CHECK(HttpUtil::parseChunkSize("1a", &chunkLen) && chunkLen == 26);
+    TEST_CHECK(HttpUtil::parseChunkSize("1A", &chunkLen) && chunkLen == 26);
+    TEST_CHECK(HttpUtil::parseChunkSize("0", &chunkLen) && chunkLen == 0);
+    TEST_CHECK(HttpUtil::parseChunkSize("000010", &chunkLen) &&
+               chunkLen == 16);
+    TEST_CHECK(HttpUtil::parseChunkSize("ffffffff", &chunkLen) &&
+               chunkLen == 0xffffffff);
+
+    // Extensions and whitespace after the size are ignored
+    TEST_CHECK(HttpUtil::parseChunkSize("10;name=value", &chunkLen) &&
+               chunkLen == 16);
+    TEST_CHECK(HttpUtil::parseChunkSize("5 ; ext", &chunkLen) &&
+               chunkLen == 5);
+    TEST_CHECK(HttpUtil::parseChunkSize("0;last", &chunkLen) &&
+               chunkLen == 0);
+
+    TEST_CHECK(!HttpUtil::parseChunkSize("", &chunkLen));
+    TEST_CHECK(!HttpUtil::parseChunkSize(";ext", &chunkLen));
+    TEST_CHECK(!HttpUtil::parseChunkSize(" 5", &chunkLen));
+    TEST_CHECK(!HttpUtil::parseChunkSize("g", &chunkLen));
+    TEST_CHECK(!HttpUtil::parseChunkSize("-1", &chunkLen));
+    TEST_CHECK(!HttpUtil::parseChunkSize("0x10", &chunkLen));
+    TEST_CHECK(!HttpUtil::parseChunkSize("100000000", &chunkLen));
+
+    uint64 start;
+    uint64 end;
+
+    TEST_CHECK(HttpUtil::parseRange("bytes=0-499", 1000, &start, &end) ==
+               HTTP_RANGE_SATISFIABLE && start == 0 && end == 499);
+    TEST_CHECK(HttpUtil::parseRange("bytes=500-999", 1000, &start, &end) ==
+               HTTP_RANGE_SATISFIABLE && start == 500 && end == 999);
+    TEST_CHECK(HttpUtil::parseRange("Bytes=10-10", 1000, &start, &end) ==
+               HTTP_RANGE_SATISFIABLE && start == 10 && end == 10);
+
+    // Open ranges run to the end of the file, and ends past it are clamped
+    TEST_CHECK(HttpUtil::parseRange("bytes=900-", 1000, &start, &end) ==
+               HTTP_RANGE_SATISFIABLE && start == 900 && end == 999);
+    TEST_CHECK(HttpUtil::parseRange("bytes=900-5000", 1000, &start, &end) ==
+               HTTP_RANGE_SATISFIABLE && start == 900 && end == 999);
+
+    // Suffix ranges count back from the end of the file
+    TEST_CHECK(HttpUtil::parseRange("bytes=-100", 1000, &start, &end) ==
+               HTTP_RANGE_SATISFIABLE && start == 900 && end == 999);
+    TEST_CHECK(HttpUtil::parseRange("bytes=-5000", 1000, &start, &end) ==
+               HTTP_RANGE_SATISFIABLE && start == 0 && end == 999);
+    TEST_CHECK(HttpUtil::parseRange("bytes=-0", 1000, &start, &end) ==
+               HTTP_RANGE_UNSATISFIABLE);
+    TEST_CHECK(HttpUtil::parseRange("bytes=-10", 0, &start, &end) ==
+               HTTP_RANGE_UNSATISFIABLE);
+
+    TEST_CHECK(HttpUtil::parseRange("bytes=1000-", 1000, &start, &end) ==
+               HTTP_RANGE_UNSATISFIABLE);
+    TEST_CHECK(HttpUtil::parseRange("bytes=2000-3000", 1000, &start, &end) ==
+               HTTP_RANGE_UNSATISFIABLE);
+    TEST_CHECK(HttpUtil::parseRange("bytes=0-", 0, &start, &end) ==
+               HTTP_RANGE_UNSATISFIABLE);
+
+    // Files past 4 GiB
+    TEST_CHECK(HttpUtil::parseRange("bytes=5000000000-",
+                                    6000000000ULL,
+                                    &start,
+                                    &end) == HTTP_RANGE_SATISFIABLE &&
+               start == 5000000000ULL && end == 5999999999ULL);
+
+    // Anything else is ignored, and the whole file sent
+    TEST_CHECK(HttpUtil::parseRange("", 1000, &start, &end) ==
+               HTTP_RANGE_IGNORED);
+    TEST_CHECK(HttpUtil::parseRange("bytes=", 1000, &start, &end) ==
+               HTTP_RANGE_IGNORED);
+    TEST_CHECK(HttpUtil::parseRange("bytes=-", 1000, &start, &end) ==
+               HTTP_RANGE_IGNORED);
+    TEST_CHECK(HttpUtil::parseRange("items=0-10", 1000, &start, &end) ==
+               HTTP_RANGE_IGNORED);
+    TEST_CHECK(HttpUtil::parseRange("bytes=0-10,20-30", 1000, &start, &end) ==
+               HTTP_RANGE_IGNORED);
+    TEST_CHECK(HttpUtil::parseRange("bytes=10-5", 1000, &start, &end) ==
+               HTTP_RANGE_IGNORED);
+    TEST_CHECK(HttpUtil::parseRange("bytes=a-10", 1000, &start, &end) ==
+               HTTP_RANGE_IGNORED);
+    TEST_CHECK(HttpUtil::parseRange("bytes=0-1x", 1000, &start, &end) ==
+               HTTP_RANGE_IGNORED);
+    TEST_CHECK(HttpUtil::parseRange("bytes=10", 1000, &start, &end) ==
+               HTTP_RANGE_IGNORED);
+}
@@ -0,0 +1,85 @@
+// TestShortList.cpp
+
+#include "Test.h"
+
+#include <ge/data/ShortList.h>
+#include <ge/text/StringRef.h>
+
+static int32 liveCount = 0;
+
+/*
+ * Element counting its live copies, to find elements destroyed twice or
+ * not at all.
+ */
+class Counted
+{
+public:
+    Counted(int32 value) : value(value) { liveCount++; }
+    Counted(const Counted& other) : value(other.value) { liveCount++; }
+    ~Counted() { liveCount--; }
+
+    int32 value;
+};
+
+void Test::testShortList()
+{
+    // Destroying a list whose elements fit in the short block
+    {
+        ShortList<Counted, 4> list;
+
+        list.addBack(Counted(1));
+        list.addBack(Counted(2));
+        TEST_CHECK(liveCount == 2);
+    }
+
+    TEST_CHECK(liveCount == 0);
+
+    // And one that moved to the heap
+    {
+        ShortList<Counted, 4> list;
+
+        for (int32 i = 0; i < 10; i++)
+            list.addBack(Counted(i));
+
+        TEST_CHECK(list.size() == 10);
+        TEST_CHECK(list.get(0).value == 0 && list.get(9).value == 9);
+        TEST_CHECK(liveCount == 10);
+    }
+
+    TEST_CHECK(liveCount == 0);
+
+    {
+        ShortList<char, 8> list;
+
+        list.addBlockBack("abc", 3);
+        list.addBlockBack("defghijkl", 9);
+        TEST_CHECK(list.size() == 12);
+        TEST_CHECK(StringRef(list.data(), list.size()) == "abcdefghijkl");
+    }
+
+    // Copies hold the elements rather than the reserved space
+    {
+        ShortList<Counted, 4> list;
+
+        list.addBack(Counted(7));
+
+        ShortList<Counted, 4> copy(list);
+        TEST_CHECK(copy.size() == 1 && copy.get(0).value == 7);
+        TEST_CHECK(liveCount == 2);
+
+        for (int32 i = 0; i < 6; i++)
+            list.addBack(Counted(i));
+
+        ShortList<Counted, 4> heapCopy(list);
+        TEST_CHECK(heapCopy.size() == 7 && heapCopy.get(6).value == 5);
+
+        list.clear();
+        list.addBack(Counted(8));
+
+        ShortList<Counted, 4> shortCopy((const List<Counted>&)list);
+        TEST_CHECK(shortCopy.size() == 1 && shortCopy.get(0).value == 8);
+        TEST_CHECK(liveCount == 10);
+    }
+
+    TEST_CHECK(liveCount == 0);
+}
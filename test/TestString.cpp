@@ -0,0 +1,134 @@
+// TestString.cpp
+
+#include "Test.h"
+
+#include <ge/text/String.h>
+
+#include <cstring>
+#include <utility>
+
+/*
+ * Returns if the passed string holds the passed text, terminated.
+ */
+static
+bool holds(const String& str,
+           const char* text)
+{
+    size_t textLen = ::strlen(text);
+
+    return str.length() == textLen &&
+           ::memcmp(str.data(), text, textLen) == 0 &&
+           str.c_str()[textLen] == '\0';
+}
+
+void Test::testString()
+{
+    String empty;
+    TEST_CHECK(holds(empty, ""));
+
+    // Lengths around the end of the small buffer
+    for (size_t len = 0; len < 40; len++)
+    {
+        char text[40];
+
+        for (size_t i = 0; i < len; i++)
+            text[i] = 'a' + (char)(i % 26);
+
+        text[len] = '\0';
+
+        String str(text);
+        TEST_CHECK(holds(str, text));
+
+        String copy(str);
+        TEST_CHECK(holds(copy, text));
+        TEST_CHECK(len == 0 || copy.data() != str.data());
+
+        String assigned("x");
+        assigned = str;
+        TEST_CHECK(holds(assigned, text));
+
+        String moved(std::move(copy));
+        TEST_CHECK(holds(moved, text));
+
+        String moveAssigned("y");
+        moveAssigned = std::move(moved);
+        TEST_CHECK(holds(moveAssigned, text));
+
+        // Built up a byte at a time, crossing to the heap on the way
+        String built;
+
+        for (size_t i = 0; i < len; i++)
+            built.appendChar(text[i]);
+
+        TEST_CHECK(holds(built, text));
+        TEST_CHECK(built == str);
+    }
+
+    // A moved string stays usable
+    String source("a string too long for the small buffer");
+    String target(std::move(source));
+    TEST_CHECK(holds(target, "a string too long for the small buffer"));
+    source = "reused";
+    TEST_CHECK(holds(source, "reused"));
+
+    String shortSource("abc");
+    String shortTarget(std::move(shortSource));
+    TEST_CHECK(holds(shortTarget, "abc"));
+    shortSource = "def";
+    TEST_CHECK(holds(shortTarget, "abc") && holds(shortSource, "def"));
+
+    // Assigning heap text over short text and back
+    String str("short");
+    str = "now long enough to need the heap";
+    TEST_CHECK(holds(str, "now long enough to need the heap"));
+    str = "tiny";
+    TEST_CHECK(holds(str, "tiny"));
+
+    String& self = str;
+    str = self;
+    TEST_CHECK(holds(str, "tiny"));
+
+    str.append("+more text", 10);
+    str.append(StringRef("!"));
+    TEST_CHECK(holds(str, "tiny+more text!"));
+
+    String number("n=");
+    number.appendInt32(-42);
+    number.appendUInt64(18446744073709551615ULL);
+    TEST_CHECK(holds(number, "n=-4218446744073709551615"));
+
+    TEST_CHECK(holds(String("ab") + String("cd"), "abcd"));
+    TEST_CHECK(holds(String("ab") + "cdefghijklmnop", "abcdefghijklmnop"));
+    TEST_CHECK(holds('x' + String("y"), "xy"));
+
+    // Reserving keeps the text, and room for the reserved length
+    String reserved("keep");
+    reserved.reserve(100);
+    TEST_CHECK(holds(reserved, "keep"));
+
+    const char* reservedData = reserved.data();
+
+    for (size_t i = 4; i < 100; i++)
+        reserved.appendChar('.');
+
+    TEST_CHECK(reserved.length() == 100 && reserved.data() == reservedData);
+
+    for (size_t size = 0; size < 40; size++)
+    {
+        String exact;
+        exact.reserve(size);
+        reservedData = exact.data();
+
+        for (size_t i = 0; i < size; i++)
+            exact.appendChar('x');
+
+        TEST_CHECK(exact.length() == size && exact.data() == reservedData);
+    }
+
+    String withNul("a\0b", 3);
+    TEST_CHECK(withNul.length() == 3 && withNul.charAt(2) == 'b');
+
+    TEST_CHECK(String("abc") < String("abd"));
+    TEST_CHECK(String("abc") != "abcd");
+    TEST_CHECK(String("abcdefghij").substring(2, 5) == "cde");
+}
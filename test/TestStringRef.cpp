@@ -0,0 +1,121 @@
+// TestStringRef.cpp
+
+#include "Test.h"
+
+#include <ge/text/StringRef.h>
+
+#include <cstring>
+
+/*
+ * Finds text in a string a position at a time, to give the results
+ * indexOf() and lastIndexOf() should match.
+ */
+static
+ssize_t referenceIndexOf(const StringRef& str,
+                         const StringRef& text,
+                         size_t startIndex,
+                         size_t endIndex,
+                         bool last)
+{
+    ssize_t found = -1;
+
+    for (size_t i = startIndex; i + text.length() <= endIndex; i++)
+    {
+        if (::memcmp(str.data() + i, text.data(), text.length()) == 0)
+        {
+            found = (ssize_t)i;
+
+            if (!last)
+                break;
+        }
+    }
+
+    return found;
+}
+
+void Test::testStringRef()
+{
+    // Letters fold to the same case
+    TEST_CHECK(StringRef("Keep-Alive").engEqualsIgnoreCase("keep-alive"));
+    TEST_CHECK(StringRef("CHUNKED").engEqualsIgnoreCase("chunked"));
+    TEST_CHECK(!StringRef("chunked").engEqualsIgnoreCase("chunkes"));
+    TEST_CHECK(!StringRef("close").engEqualsIgnoreCase("closed"));
+    TEST_CHECK(StringRef("").engEqualsIgnoreCase(""));
+
+    // Bytes other than letters are compared as they are. '{' and '['
+    // are 0x20 apart like 'a' and 'A', as are '@' and '`', '0' and
+    // '\x10', and '^' and '~'.
+    TEST_CHECK(!StringRef("{").engEqualsIgnoreCase("["));
+    TEST_CHECK(!StringRef("@").engEqualsIgnoreCase("`"));
+    TEST_CHECK(!StringRef("0").engEqualsIgnoreCase("\x10"));
+    TEST_CHECK(!StringRef("~").engEqualsIgnoreCase("^"));
+    TEST_CHECK(!StringRef("\xe9").engEqualsIgnoreCase("\xc9"));
+    TEST_CHECK(StringRef("a1-{").engEqualsIgnoreCase("A1-{"));
+
+    TEST_CHECK(StringRef("Content-Length").engCompareIgnoreCase(
+        "content-length") == 0);
+    TEST_CHECK(StringRef("abc").engCompareIgnoreCase("ABD") < 0);
+    TEST_CHECK(StringRef("ABD").engCompareIgnoreCase("abc") > 0);
+    TEST_CHECK(StringRef("ab").engCompareIgnoreCase("ABC") < 0);
+    TEST_CHECK(StringRef("abc").engCompareIgnoreCase("AB") > 0);
+    TEST_CHECK(StringRef("{").engCompareIgnoreCase("[") > 0);
+    TEST_CHECK(StringRef("[").engCompareIgnoreCase("{") < 0);
+    TEST_CHECK(StringRef("`").engCompareIgnoreCase("@") > 0);
+
+    // Letters sort between '@' and '[' once folded
+    TEST_CHECK(StringRef("z").engCompareIgnoreCase("[") < 0);
+    TEST_CHECK(StringRef("a").engCompareIgnoreCase("@") > 0);
+
+    StringRef str("abcabcabd");
+    TEST_CHECK(str.indexOf("abd") == 6);
+    TEST_CHECK(str.indexOf("bc") == 1);
+    TEST_CHECK(str.indexOf("bc", 2) == 4);
+    TEST_CHECK(str.indexOf("x") == -1);
+    TEST_CHECK(str.indexOf("abcabcabdx") == -1);
+    TEST_CHECK(str.indexOf("") == 0 && str.indexOf("", 3) == 3);
+    TEST_CHECK(str.lastIndexOf("abc") == 3);
+    TEST_CHECK(str.lastIndexOf("abc", 5) == 0);
+    TEST_CHECK(str.lastIndexOf("ab") == 6);
+    TEST_CHECK(str.lastIndexOf("x") == -1);
+    TEST_CHECK(str.lastIndexOf("abcabcabdx") == -1);
+    TEST_CHECK(StringRef("aa").lastIndexOf("ab") == -1);
+
+    // Short searches, and long ones taking the skip table path, over text
+    // with many partial matches
+    static const char* needles[] = { "a", "ab", "aab", "ba", "abab",
+                                     "\xe9", "b\xe9" "a", "aaaaaaab" };
+    char text[600];
+    uint32 randState = 7;
+
+    for (uint32 trial = 0; trial < 300; trial++)
+    {
+        size_t textLen = (trial < 150) ? trial : 256 + trial;
+
+        for (size_t i = 0; i < textLen; i++)
+        {
+            randState = randState * 1103515245 + 12345;
+            uint32 pick = (randState >> 16) % 8;
+            text[i] = (pick < 5) ? 'a' : (pick < 7) ? 'b' : '\xe9';
+        }
+
+        StringRef hay(text, textLen);
+
+        for (size_t n = 0; n < sizeof(needles) / sizeof(needles[0]); n++)
+        {
+            StringRef needle(needles[n]);
+            size_t from = trial % 5;
+
+            if (from > textLen)
+                from = 0;
+
+            TEST_CHECK(hay.indexOf(needle) ==
+                       referenceIndexOf(hay, needle, 0, textLen, false));
+            TEST_CHECK(hay.indexOf(needle, from) ==
+                       referenceIndexOf(hay, needle, from, textLen, false));
+            TEST_CHECK(hay.lastIndexOf(needle) ==
+                       referenceIndexOf(hay, needle, 0, textLen, true));
+            TEST_CHECK(hay.lastIndexOf(needle, textLen - from) ==
+                       referenceIndexOf(hay, needle, 0, textLen - from, true));
+        }
+    }
+}
@@ -0,0 +1,64 @@
+// TestUInt.cpp
+
+#include "Test.h"
+
+#include <ge/util/UInt32.h>
+#include <ge/util/UInt64.h>
+
+void Test::testUInt()
+{
+    TEST_CHECK(UInt32::uint32ToString(0) == "0");
+    TEST_CHECK(UInt32::uint32ToString(1234567890) == "1234567890");
+    TEST_CHECK(UInt32::uint32ToString(UINT32_MAX) == "4294967295");
+    TEST_CHECK(UInt32::uint32ToString(0, 16) == "0");
+    TEST_CHECK(UInt32::uint32ToString(15, 16) == "f");
+    TEST_CHECK(UInt32::uint32ToString(16, 16) == "10");
+    TEST_CHECK(UInt32::uint32ToString(0x1a2b, 16) == "1a2b");
+    TEST_CHECK(UInt32::uint32ToString(UINT32_MAX, 16) == "ffffffff");
+    TEST_CHECK(UInt32::uint32ToString(5, 2) == "101");
+    TEST_CHECK(UInt32::uint32ToString(UINT32_MAX, 2) ==
+               "11111111111111111111111111111111");
+    TEST_CHECK(UInt32::uint32ToString(64, 8) == "100");
+
+    char buf[8];
+    TEST_CHECK(UInt32::uint32ToBuffer(buf, sizeof(buf), 0xbeef, 16) == 4);
+    TEST_CHECK(StringRef(buf, 4) == "beef");
+
+    // The length needed is returned when the buffer is too small
+    TEST_CHECK(UInt32::uint32ToBuffer(buf, 2, 0xbeef, 16) == 4);
+
+    TEST_CHECK(UInt64::uint64ToString(0) == "0");
+    TEST_CHECK(UInt64::uint64ToString(UINT64_MAX) ==
+               "18446744073709551615");
+    TEST_CHECK(UInt64::uint64ToString(0xff, 16) == "ff");
+    TEST_CHECK(UInt64::uint64ToString(0x123456789abcdefULL, 16) ==
+               "123456789abcdef");
+    TEST_CHECK(UInt64::uint64ToString(UINT64_MAX, 16) == "ffffffffffffffff");
+    TEST_CHECK(UInt64::uint64ToString(2, 2) == "10");
+    TEST_CHECK(UInt64::uint64ToString(UINT64_MAX, 2) ==
+               "1111111111111111111111111111111111111111111111111111111111111111");
+
+    bool ok;
+    TEST_CHECK(UInt64::parseUInt64("18446744073709551615", &ok) == UINT64_MAX &&
+               ok);
+    TEST_CHECK(UInt64::parseUInt64("4294967296", &ok) == 4294967296ULL && ok);
+    UInt64::parseUInt64("18446744073709551616", &ok);
+    TEST_CHECK(!ok);
+    TEST_CHECK(UInt32::parseUInt32("4294967295", &ok) == UINT32_MAX && ok);
+    UInt32::parseUInt32("4294967296", &ok);
+    TEST_CHECK(!ok);
+
+    // Conversions round trip through parsing
+    for (uint32 radix = 2; radix <= 16; radix++)
+    {
+        uint32 value32 = 0xdeadbeef;
+        TEST_CHECK(UInt32::parseUInt32(UInt32::uint32ToString(value32, radix),
+                                       &ok,
+                                       radix) == value32 && ok);
+
+        uint64 value64 = 0xfedcba9876543210ULL;
+        TEST_CHECK(UInt64::parseUInt64(UInt64::uint64ToString(value64, radix),
+                                       &ok,
+                                       radix) == value64 && ok);
+    }
+}
@@ -1,15 +1,36 @@
-
 #include <ge/System.h>
 #include <ge/io/Console.h>
+#include <ge/text/String.h>
+
+#include "test/Test.h"
 
 int main()
 {
     System::initLibrary();
 
-    Console::outln("Hello World");
+    Test::testString();
+    Test::testStringRef();
+    Test::testShortList();
+    Test::testUInt();
+    Test::testHttpUtil();
+    Test::testHttpScan();
+    Test::testHttpRouter();
+    Test::testHttpForm();
 
-    System::cleanupLibrary();
+    uint32 failureCount = Test::getFailureCount();
 
-    return 0;
-}
+    if (failureCount == 0)
+    {
+        Console::outln("All tests passed");
+    }
+    else
+    {
+        String msg;
+        msg.appendInt32((int32)failureCount);
+        msg.append(" checks failed");
+        Console::errln(msg);
+    }
 
+    System::cleanupLibrary();
+    return (failureCount == 0) ? 0 : 1;
+}